@@ -18,6 +18,7 @@
 
 // A mabain command-line client
 
+#include <algorithm>
 #include <assert.h>
 #include <ctype.h>
 #include <fstream>
@@ -25,11 +26,13 @@
 #include <readline/history.h>
 #include <readline/readline.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 
+#include "bulk_loader.h"
 #include "db.h"
 #include "dict.h"
 #include "error.h"
@@ -62,6 +65,7 @@ enum mbc_command {
     COMMAND_RECLAIM_RESOURCES = 17,
     COMMAND_PARSING_ERROR = 18,
     COMMAND_FIND_LOWER_BOUND = 19,
+    COMMAND_BULK_LOAD = 20,
 };
 
 volatile bool quit_mbc = false;
@@ -115,6 +119,7 @@ static void show_help()
     std::cout << "\tdecReaderCount\t\tdecrement reader count in shared memory header\n";
     std::cout << "\tprintHeader\t\tPrint shared memory header\n";
     std::cout << "\treclaimResources(max index gc size, max data gc size)\n\t\t\t\tReclaim deleted resources\n";
+    std::cout << "\tbulkLoad(\"file\"[, threads])\tload key<TAB>value lines sorted by key into an empty database\n";
 }
 
 static void trim_spaces(const char* cmd, std::string& cmd_trim)
@@ -345,6 +350,18 @@ static int parse_command(std::string& cmd,
         } else
             return COMMAND_UNKNOWN;
         break;
+    case 'b':
+        if (cmd.compare(0, 9, "bulkLoad(") == 0) {
+            if (cmd[cmd.length() - 1] != ')')
+                return COMMAND_PARSING_ERROR;
+            if (parse_args(cmd.substr(9, cmd.length() - 10), arg_list) < 0 || arg_list.size() > 2)
+                return COMMAND_PARSING_ERROR;
+            ExprParser expr(arg_list[0]);
+            if (expr.Evaluate(key) < 0)
+                return COMMAND_PARSING_ERROR;
+            return COMMAND_BULK_LOAD;
+        }
+        break;
     case 'h':
         if (cmd.compare("help") == 0)
             return COMMAND_HELP;
@@ -406,6 +423,110 @@ static void display_output(const std::string& key, const MBData& mbd, bool hex_o
     }
 }
 
+// Add the lines of in from offset up to byte end to loader. Each line is a
+// key and a value separated by the first tab.
+static int load_lines(std::ifstream& in, size_t& offset, size_t end, BulkLoader& loader,
+    int64_t& line_num)
+{
+    std::string line;
+    while (offset < end && getline(in, line)) {
+        line_num++;
+        offset += line.length() + 1;
+        size_t pos = line.find('\t');
+        if (pos == std::string::npos)
+            return MBError::INVALID_ARG;
+        int rval = loader.Add(line.data(), pos, line.data() + pos + 1, line.length() - pos - 1);
+        if (rval != MBError::SUCCESS)
+            return rval;
+    }
+    return MBError::SUCCESS;
+}
+
+// Start of the first line at or after offset
+static size_t line_start(std::ifstream& in, size_t offset, size_t size)
+{
+    if (offset == 0)
+        return 0;
+    std::string rest;
+    in.clear();
+    in.seekg(offset - 1);
+    getline(in, rest);
+    return std::min(offset + rest.length(), size);
+}
+
+// Lines of a sorted file whose keys start with byte c are in
+// [bounds[c], bounds[c + 1]).
+static void split_by_first_byte(std::ifstream& in, size_t size, std::vector<size_t>& bounds)
+{
+    bounds.assign(NUM_ALPHABET + 1, size);
+    bounds[0] = 0;
+    for (int c = 1; c < NUM_ALPHABET; c++) {
+        size_t lo = bounds[c - 1];
+        size_t hi = size;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            size_t start = line_start(in, mid, size);
+            in.clear();
+            in.seekg(start);
+            if (start >= size || static_cast<uint8_t>(in.get()) >= c)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        bounds[c] = line_start(in, lo, size);
+    }
+}
+
+// Keys must be unique and in byte order, e.g. the output of LC_ALL=C sort.
+// With more than one thread, the file is split by the first byte of the keys
+// and loaded with ParallelBulkLoader.
+static int bulk_load(DB* db, const std::string& path, int num_threads)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        std::cout << "cannot open file " << path << "\n";
+        return MBError::OPEN_FAILURE;
+    }
+
+    int rval;
+    int64_t count;
+    if (num_threads > 1) {
+        in.seekg(0, std::ios::end);
+        size_t size = in.tellg();
+        std::vector<size_t> bounds;
+        split_by_first_byte(in, size, bounds);
+
+        ParallelBulkLoader loader(*db, num_threads);
+        rval = loader.Load([&path, &bounds](int c, BulkLoader& partition) {
+            if (bounds[c] == bounds[c + 1])
+                return static_cast<int>(MBError::SUCCESS);
+            std::ifstream part(path, std::ios::binary);
+            if (!part.is_open())
+                return static_cast<int>(MBError::OPEN_FAILURE);
+            size_t offset = bounds[c];
+            int64_t line_num = 0;
+            part.seekg(offset);
+            return load_lines(part, offset, bounds[c + 1], partition, line_num);
+        });
+        count = loader.Count();
+    } else {
+        BulkLoader loader(*db);
+        size_t offset = 0;
+        int64_t line_num = 0;
+        rval = loader.Status();
+        if (rval == MBError::SUCCESS)
+            rval = load_lines(in, offset, SIZE_MAX, loader, line_num);
+        if (rval != MBError::SUCCESS && line_num > 0)
+            std::cout << path << ":" << line_num << ": ";
+        int finish_rval = loader.Finish();
+        if (rval == MBError::SUCCESS)
+            rval = finish_rval;
+        count = loader.Count();
+    }
+    std::cout << MBError::get_error_str(rval) << ", " << count << " entries loaded\n";
+    return rval;
+}
+
 static int RunCommand(int mode, DB* db, int cmd_id, const std::string& key,
     const std::string& value, std::vector<std::string>& arg_list)
 {
@@ -487,6 +608,12 @@ static int RunCommand(int mode, DB* db, int cmd_id, const std::string& key,
         db->CollectResource(arg_list.size() >= 1 ? stol(arg_list[0]) : 1,
             arg_list.size() >= 2 ? stol(arg_list[1]) : 1);
         break;
+    case COMMAND_BULK_LOAD:
+        if (!(mode & CONSTS::ACCESS_MODE_WRITER))
+            std::cout << "bulk load requires writer mode\n";
+        else
+            rval = bulk_load(db, key, arg_list.size() >= 2 ? stoi(arg_list[1]) : 1);
+        break;
     case COMMAND_PARSING_ERROR:
         std::cout << "invalid query\n";
         break;
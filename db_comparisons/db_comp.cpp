@@ -53,6 +53,8 @@ static bool use_jemalloc = false;
 // Prefix cache controls (MABAIN only)
 static long long pc_cap = -1; // capacity; -1 means default
 // Shared prefix cache controls (enable via -pcc)
+// Exact-match hash index for lookups (enable via -hi)
+static bool use_hash_index = false;
 
 // Buffer per-reader cache stats to avoid interleaved output
 static std::vector<std::string> g_reader_stats;
@@ -250,6 +252,10 @@ static void InitDB(bool writer_mode = true)
     if (pc_cap > 0) {
         mconf.options |= mabain::CONSTS::OPTION_PREFIX_CACHE;
     }
+    if (use_hash_index) {
+        mconf.options |= mabain::CONSTS::OPTION_HASH_INDEX;
+        mconf.hash_index_size = 2 * num_kv;
+    }
     db = new mabain::DB(mconf);
     // Ensure DB is open; subsequent phases depend on it
     assert(db->is_open());
@@ -596,6 +602,7 @@ static void* Reader(void* arg)
     std::string db_dir_tmp = std::string(db_dir) + "/mabain/";
     int ropts = mabain::CONSTS::ReaderOptions();
     if (pc_cap > 0) ropts |= mabain::CONSTS::OPTION_PREFIX_CACHE;
+    if (use_hash_index) ropts |= mabain::CONSTS::OPTION_HASH_INDEX;
     mabain::DB* db_r = new mabain::DB(db_dir_tmp.c_str(), ropts,
         (unsigned long long)(0.6666667 * memcap),
         (unsigned long long)(0.3333333 * memcap));
@@ -806,6 +813,8 @@ int main(int argc, char* argv[])
             if (++i >= argc)
                 abort();
             pc_cap = atoll(argv[i]);
+        } else if (strcmp(argv[i], "-hi") == 0) {
+            use_hash_index = true;
         } else {
             std::cerr << "invalid argument: " << argv[i] << "\n";
         }
@@ -827,6 +836,8 @@ int main(int argc, char* argv[])
     if (pc_cap > 0) {
         std::cout << "===== Prefix cache cap=" << pc_cap << "\n";
     }
+    if (use_hash_index)
+        std::cout << "===== Hash index on\n";
 #endif
 
     InitTestDir();
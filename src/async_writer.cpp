@@ -16,7 +16,11 @@
 
 // @author Changxue Deng <chadeng@cisco.com>
 
+#include <algorithm>
+#include <climits>
+#include <functional>
 #include <string.h>
+#include <string_view>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -27,6 +31,7 @@
 #include "logger.h"
 #include "mb_data.h"
 #include "mb_rc.h"
+#include "util/shm_mutex.h"
 
 namespace mabain {
 
@@ -38,17 +43,29 @@ AsyncWriter* AsyncWriter::CreateInstance(DB* db_ptr)
     return writer_instance;
 }
 
-AsyncWriter* AsyncWriter::GetInstance()
+AsyncWriter* AsyncWriter::GetInstance(const std::string& mbdir)
 {
-    return writer_instance;
+    // A process may write several DBs, e.g. the shards of a ShardedDB, but
+    // only the last async writer is registered here.
+    if (writer_instance != NULL && writer_instance->db->GetDBDir() == mbdir)
+        return writer_instance;
+    return NULL;
 }
 
 AsyncWriter::AsyncWriter(DB* db_ptr)
     : db(db_ptr)
     , tid(0)
     , stop_processing(false)
-    , queue(NULL)
+    , slaq(NULL)
     , header(NULL)
+    , lane(0)
+    , next_lane(0)
+    , spin_budget(MB_ASYNC_WRITER_SPIN_MIN)
+    , batch_overwrite(false)
+    , local_submitted(NULL)
+    , local_ticket(0)
+    , local_inflight(0)
+    , local_closed(false)
 {
     dict = NULL;
     if (!(db_ptr->GetDBOptions() & CONSTS::ACCESS_MODE_WRITER))
@@ -63,8 +80,21 @@ AsyncWriter::AsyncWriter(DB* db_ptr)
     header = dict->GetHeaderPtr();
     if (header == NULL)
         throw (int)MBError::NOT_INITIALIZED;
-    queue = dict->GetAsyncQueuePtr();
+    slaq = dict->GetAsyncQueuePtr();
     header->rc_flag.store(0, std::memory_order_release);
+    // The queue may have outlived the header or the other way around.
+    for (uint32_t i = 0; i < slaq->num_lanes; i++) {
+        header->async_applied_seq[i].store(slaq->lanes[i].head.load(std::memory_order_relaxed),
+            std::memory_order_release);
+    }
+    for (int i = 0; i < MB_ASYNC_SHM_MAX_LANES; i++) {
+        stalled_head[i] = UINT64_MAX;
+        stalled_since[i] = 0;
+    }
+    // Tickets of updates submitted in this process continue from the last
+    // writer.
+    local_ticket.store(header->async_applied_seq[MB_ASYNC_LOCAL_LANE].load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
 
     rc_backup_dir = NULL;
     // start the thread
@@ -77,21 +107,102 @@ AsyncWriter::AsyncWriter(DB* db_ptr)
 
 AsyncWriter::~AsyncWriter()
 {
+    if (writer_instance == this)
+        writer_instance = NULL;
+
+    LocalUpdate* update = local_submitted.exchange(NULL);
+    while (update != NULL) {
+        local_pending.push(update);
+        update = update->next;
+    }
+    if (!local_pending.empty()) {
+        Logger::Log(LOG_LEVEL_WARN, "dropping %zu updates submitted after the async writer stopped",
+            local_pending.size());
+    }
+    while (!local_pending.empty()) {
+        delete local_pending.top();
+        local_pending.pop();
+    }
 }
 
 int AsyncWriter::StopAsyncThread()
 {
+    // Refuse new local updates, then apply the ones already accepted so that
+    // their WaitApplied calls return.
+    local_closed.store(true);
     stop_processing = true;
     dict->SHMQ_Signal();
 
     if (tid != 0) {
         Logger::Log(LOG_LEVEL_DEBUG, "joining async writer thread");
         pthread_join(tid, NULL);
+        tid = 0;
+    }
+
+    while (local_inflight.load() != 0) {
+        writer_lock.lock();
+        int count = ApplyLocal(MB_ASYNC_WRITER_BATCH, false);
+        writer_lock.unlock();
+        if (count == 0)
+            usleep(1);
     }
 
     return MBError::SUCCESS;
 }
 
+// Collect a part of a value queued by Dict::shmqAddParts and add the value
+// when its last part arrives.
+int AsyncWriter::AddPart(const AsyncNode* node_ptr, bool rc_mode)
+{
+    AsyncPartHeader part_hdr;
+    int part_len = node_ptr->data_len - static_cast<int>(sizeof(part_hdr));
+    if (part_len < 0)
+        return MBError::INVALID_ARG;
+    memcpy(&part_hdr, node_ptr->data(), sizeof(part_hdr));
+    if (part_hdr.value_len > static_cast<uint32_t>(CONSTS::MAX_LARGE_DATA_SIZE)
+        || part_hdr.part_offset + part_len > part_hdr.value_len)
+        return MBError::INVALID_ARG;
+
+    // Drop transfers whose sender gave up.
+    time_t now = time(NULL);
+    for (auto it = partial_values.begin(); it != partial_values.end();) {
+        if (now - it->second.updated > MB_ASYNC_PART_TIMEOUT) {
+            Logger::Log(LOG_LEVEL_WARN, "dropping incomplete value of %zu bytes",
+                it->second.value.size());
+            it = partial_values.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    PartialValue& partial = partial_values[part_hdr.transfer_id];
+    if (partial.value.size() != part_hdr.value_len) {
+        partial.value.resize(part_hdr.value_len);
+        partial.received = 0;
+    }
+    memcpy(&partial.value[part_hdr.part_offset], node_ptr->data() + sizeof(part_hdr), part_len);
+    partial.received += part_len;
+    partial.updated = now;
+    if (partial.received < part_hdr.value_len)
+        return MBError::SUCCESS;
+
+    int rval;
+    MBData mbd;
+    if (rc_mode)
+        mbd.options = CONSTS::OPTION_RC_MODE;
+    mbd.buff = reinterpret_cast<uint8_t*>(&partial.value[0]);
+    mbd.data_len = part_hdr.value_len;
+    try {
+        rval = dict->Add((uint8_t*)node_ptr->key, node_ptr->key_len, mbd, node_ptr->overwrite);
+    } catch (int err) {
+        rval = err;
+        Logger::Log(LOG_LEVEL_ERROR, "dict->Add throws error %s", MBError::get_error_str(err));
+    }
+    mbd.buff = NULL;
+    partial_values.erase(part_hdr.transfer_id);
+    return rval;
+}
+
 // Run a given number of tasks if they are available.
 // This function should only be called by rc or pruner.
 int AsyncWriter::ProcessTask(int ntasks, bool rc_mode)
@@ -102,14 +213,14 @@ int AsyncWriter::ProcessTask(int ntasks, bool rc_mode)
     int count = 0;
 
     while (count < ntasks) {
-        node_ptr = &queue[header->writer_index % header->async_queue_size];
+        node_ptr = ReadyNode();
 
-        if (node_ptr->in_use.load(std::memory_order_consume)) {
+        if (node_ptr != NULL) {
             switch (node_ptr->type) {
             case MABAIN_ASYNC_TYPE_ADD:
                 if (rc_mode)
                     mbd.options = CONSTS::OPTION_RC_MODE;
-                mbd.buff = (uint8_t*)node_ptr->data;
+                mbd.buff = (uint8_t*)node_ptr->data();
                 mbd.data_len = node_ptr->data_len;
                 try {
                     rval = dict->Add((uint8_t*)node_ptr->key, node_ptr->key_len, mbd, node_ptr->overwrite);
@@ -119,6 +230,21 @@ int AsyncWriter::ProcessTask(int ntasks, bool rc_mode)
                         MBError::get_error_str(err));
                 }
                 break;
+            case MABAIN_ASYNC_TYPE_ADD_PART:
+                rval = AddPart(node_ptr, rc_mode);
+                break;
+            case MABAIN_ASYNC_TYPE_INCREMENT:
+            case MABAIN_ASYNC_TYPE_APPEND:
+            case MABAIN_ASYNC_TYPE_MERGE:
+                try {
+                    rval = dict->Update((uint8_t*)node_ptr->key, node_ptr->key_len, node_ptr->type,
+                        (uint8_t*)node_ptr->data(), node_ptr->data_len, rc_mode);
+                } catch (int err) {
+                    rval = err;
+                    Logger::Log(LOG_LEVEL_ERROR, "dict->Update throws error %s",
+                        MBError::get_error_str(err));
+                }
+                break;
             case MABAIN_ASYNC_TYPE_REMOVE:
                 // FIXME
                 // Removing entries during rc is currently not supported.
@@ -155,7 +281,7 @@ int AsyncWriter::ProcessTask(int ntasks, bool rc_mode)
                 if (rc_backup_dir != NULL)
                     free(rc_backup_dir);
                 rc_backup_dir = (char*)malloc(node_ptr->data_len + 1);
-                memcpy(rc_backup_dir, node_ptr->data, node_ptr->data_len);
+                memcpy(rc_backup_dir, node_ptr->data(), node_ptr->data_len);
                 rc_backup_dir[node_ptr->data_len] = '\0';
                 rval = MBError::SUCCESS;
                 break;
@@ -164,56 +290,399 @@ int AsyncWriter::ProcessTask(int ntasks, bool rc_mode)
                 break;
             }
 
-            header->writer_index++;
-            node_ptr->num_reader.store(0, std::memory_order_release);
-            node_ptr->type = MABAIN_ASYNC_TYPE_NONE;
-            node_ptr->in_use.store(false, std::memory_order_release);
+            if (rval != MBError::SUCCESS) {
+                Logger::Log(LOG_LEVEL_DEBUG, "failed to run update %d: %s",
+                    (int)node_ptr->type, MBError::get_error_str(rval));
+            }
+
+            ReleaseNode(node_ptr);
             mbd.Clear();
             count++;
         } else {
             // done processing
             count = ntasks;
         }
-
-        if (rval != MBError::SUCCESS) {
-            Logger::Log(LOG_LEVEL_DEBUG, "failed to run update %d: %s",
-                (int)node_ptr->type, MBError::get_error_str(rval));
-        }
     }
 
     if (stop_processing)
         return MBError::RC_SKIPPED;
+    ApplyLocal(ntasks, rc_mode);
     return MBError::SUCCESS;
 }
 
-uint32_t AsyncWriter::NextShmSlot(uint32_t windex, uint32_t qindex)
+// Return a record at the head of a lane if its reader has finished it, and
+// make that lane the current one. The lanes are visited round-robin so that
+// a busy lane does not hold back the others. Padding at the end of a ring is
+// a record of type MABAIN_ASYNC_TYPE_NONE.
+AsyncNode* AsyncWriter::ReadyNode()
 {
-    int cnt = 0;
-    while (windex != qindex) {
-        if (queue[windex % header->async_queue_size].in_use.load(std::memory_order_consume))
-            break;
-        if (++cnt > header->async_queue_size) {
-            windex = qindex;
+    uint32_t num_lanes = slaq->num_lanes;
+    for (uint32_t i = 0; i < num_lanes; i++) {
+        uint32_t l = (next_lane + i) % num_lanes;
+        AsyncNode* node_ptr = ReadyNode(l, slaq->lanes[l].head.load(std::memory_order_relaxed));
+        if (node_ptr != NULL) {
+            lane = l;
+            next_lane = (l + 1) % num_lanes;
+            return node_ptr;
+        }
+    }
+    return NULL;
+}
+
+AsyncNode* AsyncWriter::ReadyNode(uint32_t lane, uint64_t pos) const
+{
+    AsyncNode* node_ptr = slaq->node(lane, pos);
+    if (node_ptr->ready.load(std::memory_order_acquire) != pos + 1)
+        return NULL;
+    return node_ptr;
+}
+
+void AsyncWriter::ReleaseNode(const AsyncNode* node_ptr)
+{
+    // Padding is not counted in queue_index.
+    if (node_ptr->type != MABAIN_ASYNC_TYPE_NONE)
+        header->writer_index++;
+    uint32_t node_lane = (reinterpret_cast<const char*>(node_ptr) - slaq->ring) / slaq->ring_size;
+    ReleaseRing(node_lane, node_ptr->size);
+}
+
+// Free len bytes at the head of a lane for the readers. The bytes are cleared
+// so that record data is never taken for the header of a later record. The
+// records are done, so the new head is published as applied sequence.
+void AsyncWriter::ReleaseRing(uint32_t lane, uint64_t len)
+{
+    uint64_t head = slaq->lanes[lane].head.load(std::memory_order_relaxed);
+    char* ring = slaq->ring + lane * slaq->ring_size;
+    for (uint64_t pos = head; pos < head + len;) {
+        uint64_t offset = pos % slaq->ring_size;
+        uint64_t clear_len = std::min(head + len - pos, slaq->ring_size - offset);
+        memset(ring + offset, 0, clear_len);
+        pos += clear_len;
+    }
+    slaq->lanes[lane].head.store(head + len, std::memory_order_release);
+    PublishApplied(lane, head + len);
+}
+
+// Publish that a lane is processed up to seq and wake the handles waiting
+// for it.
+void AsyncWriter::PublishApplied(uint32_t lane, uint64_t seq)
+{
+    header->async_applied_seq[lane].store(seq, std::memory_order_release);
+    // Pairs with the increment of async_applied_waiters in
+    // Dict::SHMQ_WaitApplied: either the waiter sees the new sequence or the
+    // writer sees the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header->async_applied_waiters.load(std::memory_order_relaxed) != 0) {
+        header->async_applied_event.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+        ShmFutexWake(&header->async_applied_event, INT_MAX);
+#endif
+    }
+}
+
+// Reader process may have exited unexpectedly after reserving a record. Skip
+// the record once the head of its lane has not moved for
+// MB_ASYNC_SHM_LOCK_TMOUT seconds while records are queued. Only the lane of
+// that reader waits in the meantime.
+void AsyncWriter::SkipStalledNode()
+{
+    time_t now = time(NULL);
+    for (uint32_t l = 0; l < slaq->num_lanes; l++) {
+        uint64_t head = slaq->lanes[l].head.load(std::memory_order_relaxed);
+        uint64_t tail = slaq->lanes[l].tail.load(std::memory_order_acquire);
+        if (head == tail || head != stalled_head[l]) {
+            stalled_head[l] = head;
+            stalled_since[l] = now;
+            continue;
+        }
+        if (now - stalled_since[l] < MB_ASYNC_SHM_LOCK_TMOUT)
+            continue;
+
+        // The size is not known if the reader exited right after reserving
+        // the record. Drop everything queued in the lane then.
+        uint64_t len = slaq->node(l, head)->size;
+        if (len == 0 || len > tail - head)
+            len = tail - head;
+        Logger::Log(LOG_LEVEL_WARN, "skipping %llu bytes of async queue lane %u not completed by reader",
+            static_cast<unsigned long long>(len), l);
+        ReleaseRing(l, len);
+    }
+}
+
+// Wait for a ready record, or for updates submitted in this process, in
+// which case NULL may be returned. Readers often queue in bursts, so the
+// writer spins for a while before it parks on the futex word writer_parked
+// (the pipe where there is no futex). The spin budget doubles when spinning
+// finds work and halves when it does not.
+AsyncNode* AsyncWriter::WaitForNode(MBPipe& mbp)
+{
+    AsyncNode* node_ptr = ReadyNode();
+    if (node_ptr != NULL || LocalReady())
+        return node_ptr;
+
+    for (int i = 0; i < spin_budget; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        node_ptr = ReadyNode();
+        if (node_ptr != NULL || LocalReady()) {
+            spin_budget = std::min(spin_budget * 2, MB_ASYNC_WRITER_SPIN_MAX);
+            return node_ptr;
+        }
+    }
+    spin_budget = std::max(spin_budget / 2, MB_ASYNC_WRITER_SPIN_MIN);
+
+    slaq->writer_parked.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    node_ptr = ReadyNode();
+    if (node_ptr == NULL && !LocalReady() && !stop_processing) {
+#define __ASYNC_THREAD_SLEEP_TIME 1000
+#ifdef __linux__
+        // A reader clears the word before waking the writer, so a wakeup
+        // between the check above and the wait is not lost.
+        ShmFutexWait(&slaq->writer_parked, 1, __ASYNC_THREAD_SLEEP_TIME);
+#else
+        mbp.Wait(__ASYNC_THREAD_SLEEP_TIME);
+#endif
+        SkipStalledNode();
+    }
+    slaq->writer_parked.store(0, std::memory_order_relaxed);
+    return node_ptr;
+}
+
+// Apply the ready records at the head of the current lane, up to
+// MB_ASYNC_WRITER_BATCH of them, while the caller holds writer_lock. Adds
+// and removals of different keys go into one WriteBatch so that they share
+// the per-write work and walk the tree in key order. A record of a key
+// already in the batch, or of another kind, ends the batch. rc and backup
+// records are left for the caller. The records are released once all are
+// applied, so the queue is not idle before the DB has the updates.
+int AsyncWriter::ApplyBatch()
+{
+    uint32_t depth = header->queue_index.load(std::memory_order_relaxed) - header->writer_index;
+    ShmQueueMgr::AddToHistogram(slaq->depth_hist, depth);
+
+    uint64_t head = slaq->lanes[lane].head.load(std::memory_order_relaxed);
+    uint64_t pos = head;
+    uint32_t num_records = 0;
+    int count = 0;
+    AsyncNode* node_ptr;
+    while (count < MB_ASYNC_WRITER_BATCH && (node_ptr = ReadyNode(lane, pos)) != NULL) {
+        if (node_ptr->type == MABAIN_ASYNC_TYPE_RC || node_ptr->type == MABAIN_ASYNC_TYPE_BACKUP)
             break;
+
+        if (!BatchNode(node_ptr)) {
+            FlushBatch();
+            int rval = ApplyNode(node_ptr);
+            if (rval != MBError::SUCCESS) {
+                Logger::Log(LOG_LEVEL_DEBUG, "failed to run update %d: %s",
+                    (int)node_ptr->type, MBError::get_error_str(rval));
+            }
+        }
+        // Padding is not counted in queue_index.
+        if (node_ptr->type != MABAIN_ASYNC_TYPE_NONE)
+            num_records++;
+        pos += node_ptr->size;
+        count++;
+    }
+    FlushBatch();
+
+    header->writer_index += num_records;
+    ReleaseRing(lane, pos - head);
+    ShmQueueMgr::AddToHistogram(slaq->batch_hist, count);
+    return count;
+}
+
+// Copy an add or removal into the pending batch. Returns false if the record
+// has to be applied by itself.
+bool AsyncWriter::BatchNode(const AsyncNode* node_ptr)
+{
+    bool is_add = node_ptr->type == MABAIN_ASYNC_TYPE_ADD;
+    if (!is_add && node_ptr->type != MABAIN_ASYNC_TYPE_REMOVE)
+        return false;
+    if (is_add && batch.Size() > 0 && node_ptr->overwrite != batch_overwrite)
+        FlushBatch();
+
+    // The batch is applied in key order, which is the queue order only if no
+    // key comes twice. Keys are tracked by hash; a collision ends the batch
+    // early, which is harmless.
+    size_t hash = std::hash<std::string_view>()(std::string_view(node_ptr->key, node_ptr->key_len));
+    if (batch_keys.test(hash % batch_keys.size()))
+        FlushBatch();
+
+    int rval;
+    if (is_add)
+        rval = batch.Put(node_ptr->key, node_ptr->key_len, node_ptr->data(), node_ptr->data_len);
+    else
+        rval = batch.Remove(node_ptr->key, node_ptr->key_len);
+    if (rval != MBError::SUCCESS)
+        return false;
+    if (is_add)
+        batch_overwrite = node_ptr->overwrite;
+    batch_keys.set(hash % batch_keys.size());
+    return true;
+}
+
+void AsyncWriter::FlushBatch()
+{
+    if (batch.Size() == 0)
+        return;
+
+    int rval;
+    try {
+        rval = dict->Write(batch, batch_overwrite);
+    } catch (int err) {
+        rval = err;
+    }
+    if (rval != MBError::SUCCESS) {
+        Logger::Log(LOG_LEVEL_ERROR, "failed to write batch of %zu updates: %s",
+            batch.Size(), MBError::get_error_str(rval));
+    }
+    batch.Clear();
+    batch_keys.reset();
+    batch_overwrite = false;
+}
+
+// Apply a record that is not batched, while the caller holds writer_lock.
+int AsyncWriter::ApplyNode(const AsyncNode* node_ptr)
+{
+    int rval;
+    MBData mbd;
+    switch (node_ptr->type) {
+    case MABAIN_ASYNC_TYPE_ADD:
+        mbd.buff = (uint8_t*)node_ptr->data();
+        mbd.data_len = node_ptr->data_len;
+        try {
+            rval = dict->Add((uint8_t*)node_ptr->key, node_ptr->key_len, mbd,
+                node_ptr->overwrite);
+        } catch (int err) {
+            Logger::Log(LOG_LEVEL_ERROR, "dict->Add throws error %s",
+                MBError::get_error_str(err));
+            rval = err;
+        }
+        mbd.buff = NULL;
+        break;
+    case MABAIN_ASYNC_TYPE_ADD_PART:
+        rval = AddPart(node_ptr, false);
+        break;
+    case MABAIN_ASYNC_TYPE_REMOVE:
+        mbd.options |= CONSTS::OPTION_FIND_AND_STORE_PARENT;
+        try {
+            rval = dict->Remove((uint8_t*)node_ptr->key, node_ptr->key_len, mbd);
+        } catch (int err) {
+            Logger::Log(LOG_LEVEL_ERROR, "dict->Remmove throws error %s",
+                MBError::get_error_str(err));
+            rval = err;
+        }
+        break;
+    case MABAIN_ASYNC_TYPE_INCREMENT:
+    case MABAIN_ASYNC_TYPE_APPEND:
+    case MABAIN_ASYNC_TYPE_MERGE:
+        try {
+            rval = dict->Update((uint8_t*)node_ptr->key, node_ptr->key_len, node_ptr->type,
+                (uint8_t*)node_ptr->data(), node_ptr->data_len);
+        } catch (int err) {
+            Logger::Log(LOG_LEVEL_ERROR, "dict->Update throws error %s",
+                MBError::get_error_str(err));
+            rval = err;
+        }
+        break;
+    case MABAIN_ASYNC_TYPE_REMOVE_ALL:
+        try {
+            rval = dict->RemoveAll();
+        } catch (int err) {
+            Logger::Log(LOG_LEVEL_ERROR, "dict->RemoveAll throws error %s",
+                MBError::get_error_str(err));
+            rval = err;
         }
+        break;
+    case MABAIN_ASYNC_TYPE_NONE:
+        rval = MBError::SUCCESS;
+        break;
+    default:
+        rval = MBError::INVALID_ARG;
+        break;
+    }
+    return rval;
+}
 
-        windex++;
+// Whether an update submitted in this process can be applied
+bool AsyncWriter::LocalReady() const
+{
+    if (local_submitted.load(std::memory_order_relaxed) != NULL)
+        return true;
+    return !local_pending.empty()
+        && local_pending.top()->ticket == header->async_applied_seq[MB_ASYNC_LOCAL_LANE].load(std::memory_order_relaxed);
+}
+
+// Apply up to max_updates updates submitted in this process, in ticket
+// order, while the caller holds writer_lock. A submitter that has taken a
+// ticket but not pushed its update yet holds back the later tickets. In
+// rc_mode removals wait until rc is done, see ProcessTask.
+int AsyncWriter::ApplyLocal(int max_updates, bool rc_mode)
+{
+    LocalUpdate* update = local_submitted.exchange(NULL, std::memory_order_acquire);
+    while (update != NULL) {
+        local_pending.push(update);
+        update = update->next;
     }
 
-    return windex;
+    uint64_t next_ticket = header->async_applied_seq[MB_ASYNC_LOCAL_LANE].load(std::memory_order_relaxed);
+    int count = 0;
+    while (count < max_updates && !local_pending.empty()
+        && local_pending.top()->ticket == next_ticket) {
+        update = local_pending.top();
+        if (rc_mode && update->type == MABAIN_ASYNC_TYPE_REMOVE)
+            break;
+        local_pending.pop();
+
+        int rval;
+        MBData mbd;
+        try {
+            if (update->type == MABAIN_ASYNC_TYPE_ADD) {
+                if (rc_mode)
+                    mbd.options = CONSTS::OPTION_RC_MODE;
+                mbd.buff = reinterpret_cast<uint8_t*>(&update->value[0]);
+                mbd.data_len = update->value.size();
+                rval = dict->Add(reinterpret_cast<const uint8_t*>(update->key.data()),
+                    update->key.size(), mbd, update->overwrite);
+            } else {
+                mbd.options |= CONSTS::OPTION_FIND_AND_STORE_PARENT;
+                rval = dict->Remove(reinterpret_cast<const uint8_t*>(update->key.data()),
+                    update->key.size(), mbd);
+            }
+        } catch (int err) {
+            rval = err;
+        }
+        mbd.buff = NULL;
+        if (rval != MBError::SUCCESS) {
+            Logger::Log(LOG_LEVEL_DEBUG, "failed to run update %d: %s",
+                update->type, MBError::get_error_str(rval));
+        }
+        delete update;
+        next_ticket++;
+        count++;
+    }
+    if (count > 0) {
+        PublishApplied(MB_ASYNC_LOCAL_LANE, next_ticket);
+        local_inflight.fetch_sub(count);
+    }
+    return count;
 }
 
 void* AsyncWriter::async_writer_thread()
 {
     AsyncNode* node_ptr;
-    MBData mbd;
     int rval;
     int64_t min_index_size = 0;
     int64_t min_data_size = 0;
     int64_t max_dbsize = MAX_6B_OFFSET;
     int64_t max_dbcount = MAX_6B_OFFSET;
-    bool skip;
+#ifdef __linux__
+    MBPipe mbp;
+#else
     MBPipe mbp(db->GetDBDir(), CONSTS::ACCESS_MODE_WRITER);
+#endif
 
     Logger::Log(LOG_LEVEL_DEBUG, "async writer started");
     if (!(db->GetDBOptions() & CONSTS::OPTION_JEMALLOC)) {
@@ -222,111 +691,71 @@ void* AsyncWriter::async_writer_thread()
         rc.ExceptionRecovery();
         writer_lock.unlock();
     }
+    if (dict->HashIndexStale()) {
+        ResourceCollection rc(*db);
+        writer_lock.lock();
+        rc.RebuildHashIndex();
+        writer_lock.unlock();
+    }
+    if (dict->BloomFilterStale()) {
+        ResourceCollection rc(*db);
+        writer_lock.lock();
+        rc.RebuildBloomFilter();
+        writer_lock.unlock();
+    }
+    if (dict->SubtreeCountStale()) {
+        ResourceCollection rc(*db);
+        writer_lock.lock();
+        rc.RebuildSubtreeCounts();
+        writer_lock.unlock();
+    }
 
     while (!stop_processing) {
-        node_ptr = &queue[header->writer_index % header->async_queue_size];
-
-        skip = false;
-        while (!node_ptr->in_use.load(std::memory_order_consume)) {
-            if (stop_processing) {
-                skip = true;
-                break;
-            }
-
-#define __ASYNC_THREAD_SLEEP_TIME 1000
-            mbp.Wait(__ASYNC_THREAD_SLEEP_TIME);
-
-            auto windex = header->writer_index;
-            auto qindex = header->queue_index.load(std::memory_order_consume);
-            if (windex != qindex) {
-                // Reader process may have exited unexpectedly. Recover index.
-                skip = true;
-                header->writer_index = NextShmSlot(windex, qindex);
-                break;
-            }
+        node_ptr = WaitForNode(mbp);
+        if (LocalReady()) {
+            writer_lock.lock();
+            ApplyLocal(MB_ASYNC_WRITER_BATCH, false);
+            writer_lock.unlock();
         }
-
-        if (skip)
+        if (node_ptr == NULL)
             continue;
 
         // process the node
         switch (node_ptr->type) {
-        case MABAIN_ASYNC_TYPE_ADD:
-            mbd.buff = (uint8_t*)node_ptr->data;
-            mbd.data_len = node_ptr->data_len;
-            writer_lock.lock();
-            try {
-                rval = dict->Add((uint8_t*)node_ptr->key, node_ptr->key_len, mbd,
-                    node_ptr->overwrite);
-            } catch (int err) {
-                Logger::Log(LOG_LEVEL_ERROR, "dict->Add throws error %s",
-                    MBError::get_error_str(err));
-                rval = err;
-            }
-            writer_lock.unlock();
-            break;
-        case MABAIN_ASYNC_TYPE_REMOVE:
-            mbd.options |= CONSTS::OPTION_FIND_AND_STORE_PARENT;
-            writer_lock.lock();
-            try {
-                rval = dict->Remove((uint8_t*)node_ptr->key, node_ptr->key_len, mbd);
-            } catch (int err) {
-                Logger::Log(LOG_LEVEL_ERROR, "dict->Remmove throws error %s",
-                    MBError::get_error_str(err));
-                rval = err;
-            }
-            writer_lock.unlock();
-            mbd.options &= ~CONSTS::OPTION_FIND_AND_STORE_PARENT;
-            break;
-        case MABAIN_ASYNC_TYPE_REMOVE_ALL:
-            writer_lock.lock();
-            try {
-                rval = dict->RemoveAll();
-            } catch (int err) {
-                Logger::Log(LOG_LEVEL_ERROR, "dict->RemoveAll throws error %s",
-                    MBError::get_error_str(err));
-                rval = err;
-            }
-            writer_lock.unlock();
-            break;
         case MABAIN_ASYNC_TYPE_RC:
             rval = MBError::SUCCESS;
             header->rc_flag.store(1, std::memory_order_release);
             {
-                int64_t* data_ptr = reinterpret_cast<int64_t*>(node_ptr->data);
+                const int64_t* data_ptr = reinterpret_cast<const int64_t*>(node_ptr->data());
                 min_index_size = data_ptr[0];
                 min_data_size = data_ptr[1];
                 max_dbsize = data_ptr[2];
                 max_dbcount = data_ptr[3];
             }
             break;
-        case MABAIN_ASYNC_TYPE_NONE:
-            rval = MBError::SUCCESS;
-            break;
         case MABAIN_ASYNC_TYPE_BACKUP:
             try {
                 DBBackup mbbk(*db);
-                rval = mbbk.Backup((const char*)node_ptr->data);
+                rval = mbbk.Backup((const char*)node_ptr->data());
             } catch (int error) {
                 rval = error;
             }
             break;
         default:
-            rval = MBError::INVALID_ARG;
-            break;
+            writer_lock.lock();
+            ApplyBatch();
+            writer_lock.unlock();
+            // A stalled lane is also skipped while the other lanes keep
+            // the writer busy.
+            SkipStalledNode();
+            continue;
         }
 
-        header->writer_index++;
-        node_ptr->num_reader.store(0, std::memory_order_release);
-        node_ptr->type = MABAIN_ASYNC_TYPE_NONE;
-        node_ptr->in_use.store(false, std::memory_order_release);
-
         if (rval != MBError::SUCCESS) {
             Logger::Log(LOG_LEVEL_DEBUG, "failed to run update %d: %s",
                 (int)node_ptr->type, MBError::get_error_str(rval));
         }
-
-        mbd.Clear();
+        ReleaseNode(node_ptr);
 
         if (header->rc_flag.load(std::memory_order_consume) == 1) {
             rval = MBError::SUCCESS;
@@ -353,7 +782,12 @@ void* AsyncWriter::async_writer_thread()
         }
     }
 
-    mbd.buff = NULL;
+    // Apply what was submitted in this process before the writer stopped.
+    writer_lock.lock();
+    while (ApplyLocal(MB_ASYNC_WRITER_BATCH, false) > 0)
+        ;
+    writer_lock.unlock();
+
     Logger::Log(LOG_LEVEL_DEBUG, "async writer exiting");
     return NULL;
 }
@@ -384,4 +818,94 @@ int AsyncWriter::AddWithLock(const char* key, int len, MBData& mbdata, bool over
     return MBError::TRY_AGAIN;
 }
 
+int AsyncWriter::WriteWithLock(WriteBatch& batch, bool overwrite)
+{
+    if (header->rc_flag.load(std::memory_order_relaxed))
+        return MBError::TRY_AGAIN;
+
+    using Ms = std::chrono::milliseconds;
+    if (writer_lock.try_lock_for(Ms(1000))) {
+        int rval = dict->Write(batch, overwrite);
+        writer_lock.unlock();
+        return rval;
+    }
+
+    return MBError::TRY_AGAIN;
+}
+
+int AsyncWriter::UpdateWithLock(const char* key, int len, int type, const char* operand,
+    int operand_len)
+{
+    if (header->rc_flag.load(std::memory_order_relaxed))
+        return MBError::TRY_AGAIN;
+
+    using Ms = std::chrono::milliseconds;
+    if (writer_lock.try_lock_for(Ms(1000))) {
+        int rval;
+        try {
+            rval = dict->Update(reinterpret_cast<const uint8_t*>(key), len, type,
+                reinterpret_cast<const uint8_t*>(operand), operand_len);
+        } catch (int error) {
+            rval = error;
+        }
+        writer_lock.unlock();
+        return rval;
+    }
+
+    return MBError::TRY_AGAIN;
+}
+
+void AsyncWriter::SetMergeOperator(const DB::MergeOperator& merge)
+{
+    std::lock_guard<std::timed_mutex> lock(writer_lock);
+    dict->SetMergeOperator(merge);
+}
+
+// Submitters never wait for each other: a slot and a ticket are each a
+// fetch_add and the push a compare-and-swap on the top of the stack.
+int AsyncWriter::Submit(int type, std::string&& key, std::string&& value, bool overwrite,
+    uint64_t& seq)
+{
+    if (key.empty())
+        return MBError::INVALID_ARG;
+    if (key.size() > static_cast<size_t>(CONSTS::MAX_KEY_LENGHTH)
+        || value.size() > static_cast<size_t>(CONSTS::MAX_LARGE_DATA_SIZE))
+        return MBError::OUT_OF_BOUND;
+
+    // Reserve a slot and give it back if the list is full.
+    int retry_cnt = 0;
+    while (local_inflight.fetch_add(1) >= MB_ASYNC_LOCAL_MAX_PENDING) {
+        local_inflight.fetch_sub(1);
+        if (retry_cnt++ > MB_SHM_RETRY_TIMEOUT)
+            return MBError::TRY_AGAIN;
+        usleep(1);
+    }
+    // Checked after the reservation: StopAsyncThread sets local_closed before
+    // it waits for local_inflight to drop to zero, so an update accepted here
+    // is always applied.
+    if (local_closed.load()) {
+        local_inflight.fetch_sub(1);
+        return MBError::NOT_ALLOWED;
+    }
+
+    LocalUpdate* update = new LocalUpdate;
+    update->type = type;
+    update->overwrite = overwrite;
+    update->key = std::move(key);
+    update->value = std::move(value);
+    uint64_t ticket = local_ticket.fetch_add(1, std::memory_order_relaxed);
+    update->ticket = ticket;
+    update->next = local_submitted.load(std::memory_order_relaxed);
+    while (!local_submitted.compare_exchange_weak(update->next, update,
+        std::memory_order_release, std::memory_order_relaxed))
+        ;
+    seq = MB_ASYNC_SHM_SEQ(MB_ASYNC_LOCAL_LANE, ticket + 1);
+
+    // Pairs with the fence in WaitForNode as in Dict::SHMQ_PrepareSlot.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (slaq->writer_parked.load(std::memory_order_relaxed))
+        dict->SHMQ_Signal();
+    return MBError::SUCCESS;
+}
+
 }
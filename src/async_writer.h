@@ -19,18 +19,34 @@
 #ifndef __ASYNC_WRITER_H__
 #define __ASYNC_WRITER_H__
 
+#include <atomic>
+#include <bitset>
 #include <mutex>
 #include <pthread.h>
+#include <queue>
+#include <string>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
 
 #include "db.h"
 #include "dict.h"
 #include "drm_base.h"
 #include "error.h"
 #include "mb_backup.h"
+#include "mb_pipe.h"
 #include "shm_queue_mgr.h"
 
 namespace mabain {
 
+// Records applied by the writer thread per writer_lock acquisition
+#define MB_ASYNC_WRITER_BATCH 256
+#define MB_ASYNC_WRITER_SPIN_MIN 64
+#define MB_ASYNC_WRITER_SPIN_MAX 16384
+// Updates submitted in the writer process and not yet applied before Submit
+// waits for the writer thread
+#define MB_ASYNC_LOCAL_MAX_PENDING 65536
+
 class AsyncWriter {
 public:
     ~AsyncWriter();
@@ -38,9 +54,16 @@ public:
     int StopAsyncThread();
     int ProcessTask(int ntasks, bool rc_mode);
     int AddWithLock(const char* key, int len, MBData& mbdata, bool overwrite);
+    int WriteWithLock(WriteBatch& batch, bool overwrite);
+    int UpdateWithLock(const char* key, int len, int type, const char* operand, int operand_len);
+    // Hand an update of type MABAIN_ASYNC_TYPE_ADD or MABAIN_ASYNC_TYPE_REMOVE
+    // to the writer thread, taking over the buffers of key and value.
+    int Submit(int type, std::string&& key, std::string&& value, bool overwrite, uint64_t& seq);
+    void SetMergeOperator(const DB::MergeOperator& merge);
 
     static AsyncWriter* CreateInstance(DB* db_ptr);
-    static AsyncWriter* GetInstance();
+    // Return the instance of this process if it writes the DB in mbdir
+    static AsyncWriter* GetInstance(const std::string& mbdir);
 
 private:
     AsyncWriter(DB* db_ptr);
@@ -48,7 +71,20 @@ private:
     AsyncNode* AcquireSlot();
     int PrepareSlot(AsyncNode* node_ptr) const;
     void* async_writer_thread();
-    uint32_t NextShmSlot(uint32_t windex, uint32_t qindex);
+    AsyncNode* ReadyNode();
+    AsyncNode* ReadyNode(uint32_t lane, uint64_t pos) const;
+    void ReleaseNode(const AsyncNode* node_ptr);
+    void ReleaseRing(uint32_t lane, uint64_t len);
+    void SkipStalledNode();
+    AsyncNode* WaitForNode(MBPipe& mbp);
+    int ApplyBatch();
+    bool BatchNode(const AsyncNode* node_ptr);
+    void FlushBatch();
+    int ApplyNode(const AsyncNode* node_ptr);
+    int AddPart(const AsyncNode* node_ptr, bool rc_mode);
+    void PublishApplied(uint32_t lane, uint64_t seq);
+    bool LocalReady() const;
+    int ApplyLocal(int max_updates, bool rc_mode);
 
     // db pointer
     DB* db;
@@ -58,13 +94,61 @@ private:
     pthread_t tid;
     bool stop_processing;
 
-    AsyncNode* queue;
+    shm_lock_and_queue* slaq;
     IndexHeader* header;
+    // lane of the record last returned by ReadyNode and the lane to look at
+    // first next time
+    uint32_t lane;
+    uint32_t next_lane;
+    // head of each lane and the time since when the record there is not ready
+    uint64_t stalled_head[MB_ASYNC_SHM_MAX_LANES];
+    time_t stalled_since[MB_ASYNC_SHM_MAX_LANES];
+    // iterations to spin for a record before parking on the pipe
+    int spin_budget;
+
+    // adds and removals being batched by ApplyBatch, and the hashes of
+    // their keys
+    WriteBatch batch;
+    std::bitset<4096> batch_keys;
+    bool batch_overwrite;
 
     bool is_rc_running;
     char* rc_backup_dir;
 
     std::timed_mutex writer_lock;
+
+    // Values queued in parts, by transfer id
+    struct PartialValue {
+        std::string value;
+        uint32_t received;
+        time_t updated;
+    };
+    std::unordered_map<uint64_t, PartialValue> partial_values;
+
+    // Updates submitted in this process. Submitters take a ticket and push
+    // the update on a lock-free stack; the writer thread moves them from the
+    // stack to local_pending and applies them in ticket order.
+    struct LocalUpdate {
+        LocalUpdate* next;
+        uint64_t ticket;
+        int type;
+        bool overwrite;
+        std::string key;
+        std::string value;
+    };
+    struct LaterTicket {
+        bool operator()(const LocalUpdate* a, const LocalUpdate* b) const
+        {
+            return a->ticket > b->ticket;
+        }
+    };
+    std::atomic<LocalUpdate*> local_submitted;
+    std::atomic<uint64_t> local_ticket;
+    // updates submitted but not applied yet, counting submitters that are
+    // between reserving a slot and pushing; set once StopAsyncThread starts
+    std::atomic<uint64_t> local_inflight;
+    std::atomic<bool> local_closed;
+    std::priority_queue<LocalUpdate*, std::vector<LocalUpdate*>, LaterTicket> local_pending;
     static AsyncWriter* writer_instance;
 };
 
@@ -0,0 +1,159 @@
+/**
+ * Shared-memory blocked Bloom filter for ruling out absent keys using RollableFile.
+ */
+
+#include "bloom_filter.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "error.h"
+#include "logger.h"
+
+#ifdef MB_HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+#define BLOOM_FILTER_MAGIC 0x424C4F4DU // 'BLOM'
+#define BLOOM_FILTER_MIN_BLOCKS 1024ULL
+#define BLOOM_FILTER_MAX_BLOCKS (1ULL << 24)
+
+namespace mabain {
+
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static size_t round_blocks(size_t num_blocks)
+{
+    size_t n = BLOOM_FILTER_MIN_BLOCKS;
+    while (n < num_blocks && n < BLOOM_FILTER_MAX_BLOCKS)
+        n <<= 1;
+    return n;
+}
+
+// Bytes of the header block and all filter blocks, rounded up to whole MB
+static size_t file_size(size_t num_blocks)
+{
+    size_t bytes = (num_blocks + 1) * BloomFilter::BLOCK_SIZE;
+    return (bytes + (1ULL << 20) - 1) & ~((1ULL << 20) - 1);
+}
+
+// XXH3 when available, otherwise FNV-1a. Both are finalized so that the
+// block index (high half) and the probe bits spread independently.
+uint64_t BloomFilter::hash64(const uint8_t* data, int len)
+{
+#ifdef MB_HAVE_XXHASH
+    return mix64(XXH3_64bits(data, (size_t)len));
+#else
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < len; ++i) {
+        h ^= (uint64_t)data[i];
+        h *= 1099511628211ULL;
+    }
+    return mix64(h);
+#endif
+}
+
+size_t BloomFilter::BlocksForKeys(size_t num_keys)
+{
+    size_t bits = num_keys * BITS_PER_KEY;
+    return round_blocks((bits + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8));
+}
+
+BloomFilter::BloomFilter(const std::string& mbdir, size_t num_blocks, int options)
+    : path_(mbdir + "_bloom")
+    , file_(path_, file_size(round_blocks(num_blocks)), file_size(round_blocks(num_blocks)), options, 1)
+    , hdr_(nullptr)
+    , blocks_(nullptr)
+    , created_(false)
+{
+    num_blocks = round_blocks(num_blocks);
+    // Layout: [BFHeader, padded to one block][blocks]
+    size_t off = 0;
+    uint8_t* p = nullptr;
+    int rv = file_.Reserve(off, (int)((num_blocks + 1) * BLOCK_SIZE), p, true);
+    if (rv != MBError::SUCCESS || p == nullptr)
+        throw (int)(rv != MBError::SUCCESS ? rv : MBError::MMAP_FAILED);
+    hdr_ = reinterpret_cast<BFHeader*>(p);
+    blocks_ = reinterpret_cast<std::atomic<uint64_t>*>(p + BLOCK_SIZE);
+
+    bool valid = hdr_->magic == BLOOM_FILTER_MAGIC && hdr_->num_blocks == num_blocks
+        && hdr_->probes == PROBES;
+    if (options & CONSTS::ACCESS_MODE_WRITER) {
+        if (!valid)
+            initialize(num_blocks);
+    } else if (!valid) {
+        // Readers cannot initialize the filter; the writer has to create it first.
+        throw (int)MBError::NOT_INITIALIZED;
+    }
+}
+
+BloomFilter::~BloomFilter()
+{
+    // RollableFile owns mappings and flush
+}
+
+void BloomFilter::initialize(size_t num_blocks)
+{
+    hdr_->magic = 0;
+    hdr_->version = 1;
+    hdr_->probes = PROBES;
+    hdr_->num_blocks = num_blocks;
+    hdr_->mask = num_blocks - 1;
+    Clear();
+    hdr_->magic = BLOOM_FILTER_MAGIC;
+    created_ = true;
+}
+
+void BloomFilter::Clear()
+{
+    size_t words = hdr_->num_blocks * (BLOCK_SIZE / 8);
+    for (size_t i = 0; i < words; i++)
+        blocks_[i].store(0, std::memory_order_relaxed);
+}
+
+// Probe i sets bit (g >> 9i) & 511 of the block; seven probes use 63 bits.
+void BloomFilter::Add(const uint8_t* key, int len)
+{
+    uint64_t h = hash64(key, len);
+    std::atomic<uint64_t>* block = block_ptr(h);
+    uint64_t g = mix64(h);
+    for (int i = 0; i < PROBES; i++, g >>= 9) {
+        std::atomic<uint64_t>& word = block[(g >> 6) & 7];
+        // Single writer: no read-modify-write instruction is needed.
+        word.store(word.load(std::memory_order_relaxed) | (1ULL << (g & 63)),
+            std::memory_order_relaxed);
+    }
+}
+
+bool BloomFilter::MayContain(const uint8_t* key, int len) const
+{
+    uint64_t h = hash64(key, len);
+    const std::atomic<uint64_t>* block = block_ptr(h);
+    uint64_t g = mix64(h);
+    for (int i = 0; i < PROBES; i++, g >>= 9) {
+        uint64_t bit = 1ULL << (g & 63);
+        if (!(block[(g >> 6) & 7].load(std::memory_order_relaxed) & bit))
+            return false;
+    }
+    return true;
+}
+
+void BloomFilter::PrintStats(std::ostream& os) const
+{
+    size_t words = hdr_->num_blocks * (BLOCK_SIZE / 8);
+    size_t set = 0;
+    for (size_t i = 0; i < words; i++)
+        set += __builtin_popcountll(blocks_[i].load(std::memory_order_relaxed));
+    os << "Bloom filter: " << hdr_->num_blocks << " blocks, "
+       << (100.0 * set / (words * 64)) << "% bits set" << std::endl;
+}
+
+} // namespace mabain
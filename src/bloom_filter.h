@@ -0,0 +1,81 @@
+/**
+ * Shared-memory blocked Bloom filter for ruling out absent keys using RollableFile.
+ */
+
+#ifndef MABAIN_BLOOM_FILTER_H
+#define MABAIN_BLOOM_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "mabain_consts.h"
+#include "rollable_file.h"
+
+namespace mabain {
+
+// Every key maps to one 64-byte block and sets PROBES bits inside it, so a
+// lookup touches a single cache line. Keys cannot be removed; the writer
+// rebuilds the filter to drop them.
+class BloomFilter {
+public:
+    static const int BLOCK_SIZE = 64;
+    static const int BITS_PER_KEY = 12;
+    static const int PROBES = 7;
+    // Removed keys still pass the filter; the writer rebuilds it once they
+    // exceed 1/REBUILD_DIVISOR of the capacity.
+    static const int REBUILD_DIVISOR = 8;
+
+    // Create or open the filter under mbdir (file: mbdir+"_bloom").
+    // num_blocks: number of blocks, rounded up to a power of two.
+    // options: reader/writer flags from CONSTS.
+    // A writer keeps the bits of an existing filter with the same number of
+    // blocks and zeroes it otherwise. A reader throws NOT_INITIALIZED if the
+    // writer has not created the filter with num_blocks blocks.
+    BloomFilter(const std::string& mbdir, size_t num_blocks, int options);
+    ~BloomFilter();
+
+    // Writer only
+    void Add(const uint8_t* key, int len);
+    void Clear();
+    // False only if key was never added since the last Clear.
+    bool MayContain(const uint8_t* key, int len) const;
+
+    size_t NumBlocks() const { return hdr_->num_blocks; }
+    // Number of keys the filter is sized for
+    size_t Capacity() const { return NumBlocks() * BLOCK_SIZE * 8 / BITS_PER_KEY; }
+    // True if the writer zeroed the filter when opening it.
+    bool Created() const { return created_; }
+    // Number of blocks for a filter holding num_keys keys
+    static size_t BlocksForKeys(size_t num_keys);
+
+    void PrintStats(std::ostream& os) const;
+
+private:
+    struct BFHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t probes;
+        uint64_t num_blocks; // power of two
+        uint64_t mask; // num_blocks-1
+    };
+
+    static uint64_t hash64(const uint8_t* data, int len);
+    std::atomic<uint64_t>* block_ptr(uint64_t h) const
+    {
+        return blocks_ + (static_cast<size_t>(h >> 32) & hdr_->mask) * (BLOCK_SIZE / 8);
+    }
+    void initialize(size_t num_blocks);
+
+    std::string path_;
+    RollableFile file_;
+    BFHeader* hdr_;
+    std::atomic<uint64_t>* blocks_;
+    bool created_;
+};
+
+} // namespace mabain
+
+#endif // MABAIN_BLOOM_FILTER_H
@@ -0,0 +1,563 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <thread>
+
+#include "bulk_loader.h"
+#include "dict.h"
+#include "dict_mem.h"
+#include "error.h"
+#include "mabain_consts.h"
+
+namespace mabain {
+
+// Size of the file chunks cut by the workers of a parallel load
+#define BULK_CHUNK_SIZE (1024 * 1024)
+// Update numbers taken by a worker at a time
+#define BULK_UPDATE_BATCH 1024
+// Keys a worker holds before adding them to the hash index and Bloom filter
+#define BULK_INDEX_BATCH 4096
+
+// Part of the index or data file that a worker fills. If the chunk is not
+// mapped, its buffers are collected in buff and written when it is done.
+struct BulkChunk {
+    BulkChunk()
+        : offset(0)
+        , end(0)
+        , ptr(NULL)
+        , buff_offset(0)
+    {
+    }
+
+    size_t offset; // next free byte
+    size_t end;
+    uint8_t* ptr; // mapped address of offset, or NULL
+    size_t buff_offset;
+    std::vector<uint8_t> buff;
+};
+
+struct BulkWorker {
+    BulkWorker()
+        : n_states(0)
+        , n_edges(0)
+        , update(0)
+        , update_end(0)
+    {
+    }
+
+    // Index (0) and data (1) file
+    BulkChunk chunks[2];
+    int64_t n_states;
+    int64_t n_edges;
+    // Update numbers for the LRU buckets of values
+    int64_t update;
+    int64_t update_end;
+    // Keys and data offsets waiting for the hash index and Bloom filter
+    std::string index_keys;
+    std::vector<std::pair<int, size_t>> index_entries;
+};
+
+BulkLoader::BulkLoader(DB& db)
+    : dict(db.GetDictPtr())
+    , mm(NULL)
+    , parallel(NULL)
+    , worker(NULL)
+    , first_char(-1)
+    , status(MBError::SUCCESS)
+    , finished(false)
+    , count(0)
+    , path_size(0)
+{
+    if (!db.is_open())
+        status = MBError::NOT_INITIALIZED;
+    else if (dict == NULL || (db.GetDBOptions() & CONSTS::ASYNC_WRITER_MODE) || dict->Count() != 0)
+        status = MBError::NOT_ALLOWED;
+    if (status != MBError::SUCCESS) {
+        finished = true;
+        return;
+    }
+
+    mm = dict->GetMM();
+    // Readers ignore the hash index and subtree counts until Finish.
+    dict->BeginHashIndexUpdate();
+    dict->BeginSubtreeCountUpdate();
+    Push(0, false, 0);
+}
+
+BulkLoader::BulkLoader(ParallelBulkLoader& owner, BulkWorker& worker, int first_char)
+    : dict(owner.dict)
+    , mm(owner.mm)
+    , parallel(&owner)
+    , worker(&worker)
+    , first_char(first_char)
+    , status(MBError::SUCCESS)
+    , finished(false)
+    , count(0)
+    , path_size(0)
+{
+    Push(0, false, 0);
+}
+
+BulkLoader::~BulkLoader()
+{
+    Finish();
+}
+
+int BulkLoader::Add(const char* key, int len, const char* value, int value_len)
+{
+    if (status != MBError::SUCCESS)
+        return status;
+    if (finished)
+        return MBError::NOT_ALLOWED;
+    if (key == NULL || value == NULL)
+        return MBError::INVALID_ARG;
+    if (len <= 0 || len > CONSTS::MAX_KEY_LENGHTH || value_len <= 0 || value_len > CONSTS::MAX_DATA_SIZE)
+        return MBError::OUT_OF_BOUND;
+    if (first_char >= 0 && static_cast<uint8_t>(key[0]) != first_char)
+        return MBError::INVALID_ARG;
+
+    // The key must sort after the last one and shares lcp bytes with it.
+    int lcp = 0;
+    if (count > 0) {
+        int n = std::min(len, static_cast<int>(last_key.size()));
+        while (lcp < n && last_key[lcp] == key[lcp])
+            lcp++;
+        if (lcp == len || (lcp < n && static_cast<uint8_t>(key[lcp]) < static_cast<uint8_t>(last_key[lcp])))
+            return MBError::INVALID_ARG;
+    }
+
+    const uint8_t* key_ptr = reinterpret_cast<const uint8_t*>(key);
+    try {
+        Close(lcp);
+        if (parallel == NULL && dict->BloomFilterEnabled())
+            dict->AddBloomFilter(key_ptr, len);
+        size_t data_offset = WriteValue(reinterpret_cast<const uint8_t*>(value), value_len);
+        if (parallel == NULL) {
+            dict->PutHashIndex(key_ptr, len, data_offset);
+        } else if (dict->HashIndexEnabled() || dict->BloomFilterEnabled()) {
+            worker->index_keys.append(key, len);
+            worker->index_entries.push_back(std::make_pair(len, data_offset));
+            if (worker->index_entries.size() >= BULK_INDEX_BATCH)
+                parallel->FlushIndexes(*worker);
+        }
+        Push(len, true, data_offset);
+    } catch (int error) {
+        status = error;
+        return status;
+    }
+
+    last_key.assign(key, len);
+    count++;
+    return MBError::SUCCESS;
+}
+
+int BulkLoader::Add(const std::string& key, const std::string& value)
+{
+    return Add(key.data(), key.size(), value.data(), value.size());
+}
+
+int BulkLoader::Finish()
+{
+    if (finished)
+        return status;
+    finished = true;
+
+    if (status == MBError::SUCCESS) {
+        try {
+            Close(0);
+        } catch (int error) {
+            status = error;
+        }
+    }
+    // The parallel loader links the subtree and ends the updates.
+    if (parallel != NULL)
+        return status;
+
+    // Keys of a failed load may be in the index without being in the tree.
+    if (status != MBError::SUCCESS)
+        dict->ClearHashIndex();
+    dict->EndSubtreeCountUpdate();
+    dict->EndHashIndexUpdate();
+    return status;
+}
+
+// Write out the nodes on the path of the last key that are deeper than
+// depth. When the next key leaves an edge part way, the node it branches
+// from is created at depth and takes over the rest of the edge.
+void BulkLoader::Close(int depth)
+{
+    while (path[path_size - 1].depth > depth) {
+        PendingNode& child = path[path_size - 1];
+        PendingNode& parent = path[path_size - 2];
+        if (parent.depth >= depth) {
+            Link(child, parent, parent.depth);
+            path_size--;
+            continue;
+        }
+
+        PendingNode branch;
+        branch.depth = depth;
+        branch.match = false;
+        branch.data_offset = 0;
+        branch.count = 0;
+        Link(child, branch, depth);
+        std::swap(path[path_size - 1], branch);
+    }
+}
+
+// Write child, which ends at child.depth, and add its edge to parent. Edges
+// of the root are linked right away, or handed to the parallel loader.
+void BulkLoader::Link(const PendingNode& child, PendingNode& parent, int parent_depth)
+{
+    uint8_t edge[EDGE_SIZE];
+    const uint8_t* label = reinterpret_cast<const uint8_t*>(last_key.data()) + parent_depth;
+    int len = child.depth - parent_depth;
+    bool leaf = child.first_chars.empty();
+    size_t target = leaf ? child.data_offset : WriteNode(child);
+    size_t label_offset = 0;
+    if (len > LOCAL_EDGE_LEN)
+        label_offset = WriteLabel(label + 1, len - 1);
+    mm->InitBulkEdge(edge, label, len, leaf, target, label_offset);
+
+    if (parent_depth == 0) {
+        if (parallel != NULL) {
+            memcpy(&parallel->root_edges[label[0] * EDGE_SIZE], edge, EDGE_SIZE);
+            parallel->root_counts[label[0]] = child.count;
+            return;
+        }
+        int rval = mm->AddBulkRootEdge(edge, label[0], child.count);
+        if (rval != MBError::SUCCESS)
+            throw rval;
+        dict->GetHeaderPtr()->count += child.count;
+        return;
+    }
+    parent.first_chars.push_back(label[0]);
+    parent.edges.insert(parent.edges.end(), edge, edge + EDGE_SIZE);
+    parent.count += child.count;
+}
+
+void BulkLoader::Push(int depth, bool match, size_t data_offset)
+{
+    if (path_size == path.size())
+        path.emplace_back();
+    PendingNode& node = path[path_size++];
+    node.depth = depth;
+    node.match = match;
+    node.data_offset = data_offset;
+    node.count = match ? 1 : 0;
+    node.first_chars.clear();
+    node.edges.clear();
+}
+
+size_t BulkLoader::WriteNode(const PendingNode& node)
+{
+    int nt = static_cast<int>(node.first_chars.size());
+    if (parallel == NULL)
+        return mm->AddBulkNode(node.first_chars.data(), node.edges.data(), nt, node.match,
+            node.data_offset, node.count);
+
+    size_t offset;
+    uint8_t* ptr = parallel->Alloc(*worker, 0, mm->BulkNodeSize(nt), offset);
+    mm->FillBulkNode(ptr, node.first_chars.data(), node.edges.data(), nt, node.match,
+        node.data_offset, node.count);
+    worker->n_states++;
+    worker->n_edges += nt;
+    return offset;
+}
+
+size_t BulkLoader::WriteLabel(const uint8_t* label, int len)
+{
+    size_t offset;
+    if (parallel == NULL) {
+        mm->ReserveData(label, len, offset);
+        return offset;
+    }
+
+    uint8_t* ptr = parallel->Alloc(*worker, 0, mm->GetFreeList()->GetAlignmentSize(len), offset);
+    memcpy(ptr, label, len);
+    return offset;
+}
+
+// Values of a parallel load take their LRU bucket from update numbers that
+// workers take in batches, so buckets follow the load order only roughly.
+size_t BulkLoader::WriteValue(const uint8_t* value, int len)
+{
+    size_t offset;
+    IndexHeader* header = dict->GetHeaderPtr();
+    if (parallel == NULL) {
+        dict->ReserveData(value, len, offset);
+        header->num_update++;
+        return offset;
+    }
+
+    if (worker->update == worker->update_end) {
+        worker->update = parallel->next_update.fetch_add(BULK_UPDATE_BATCH, std::memory_order_relaxed);
+        worker->update_end = worker->update + BULK_UPDATE_BATCH;
+    }
+    uint16_t dsize[2];
+    dsize[0] = static_cast<uint16_t>(len);
+    dsize[1] = (worker->update++ / header->entry_per_bucket) % 0xFFFF;
+    int buf_size = dict->GetFreeList()->GetAlignmentSize(len + DATA_HDR_BYTE);
+    uint8_t* ptr = parallel->Alloc(*worker, 1, buf_size, offset);
+    memcpy(ptr, dsize, DATA_HDR_BYTE);
+    memcpy(ptr + DATA_HDR_BYTE, value, len);
+    return offset;
+}
+
+ParallelBulkLoader::ParallelBulkLoader(DB& db, int num_threads)
+    : dict(db.GetDictPtr())
+    , mm(NULL)
+    , status(MBError::SUCCESS)
+    , num_threads(num_threads)
+    , loaded(false)
+    , count(0)
+    , start_update(0)
+    , next_char(0)
+    , next_update(0)
+    , failed(false)
+    , root_edges(NUM_ALPHABET * EDGE_SIZE)
+    , root_counts(NUM_ALPHABET)
+{
+    if (this->num_threads <= 0)
+        this->num_threads = std::max(1u, std::thread::hardware_concurrency());
+    start_offset[0] = 0;
+    start_offset[1] = 0;
+
+    int options = db.GetDBOptions();
+    if (!db.is_open())
+        status = MBError::NOT_INITIALIZED;
+    else if (dict == NULL || (options & (CONSTS::ASYNC_WRITER_MODE | CONSTS::OPTION_JEMALLOC)) || dict->Count() != 0)
+        status = MBError::NOT_ALLOWED;
+    if (status == MBError::SUCCESS)
+        mm = dict->GetMM();
+}
+
+ParallelBulkLoader::~ParallelBulkLoader()
+{
+}
+
+int ParallelBulkLoader::Load(const Feed& feed)
+{
+    if (status != MBError::SUCCESS)
+        return status;
+    if (loaded)
+        return MBError::NOT_ALLOWED;
+    loaded = true;
+
+    IndexHeader* header = dict->GetHeaderPtr();
+    start_update = header->num_update;
+    next_update.store(start_update, std::memory_order_relaxed);
+    start_offset[0] = header->m_index_offset;
+    start_offset[1] = header->m_data_offset;
+    // Readers ignore the hash index and subtree counts until the end.
+    dict->BeginHashIndexUpdate();
+    dict->BeginSubtreeCountUpdate();
+
+    std::vector<std::unique_ptr<BulkWorker>> workers;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+        workers.emplace_back(new BulkWorker());
+        threads.emplace_back(&ParallelBulkLoader::Run, this, std::ref(*workers.back()), std::cref(feed));
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    Finish(workers);
+    dict->EndSubtreeCountUpdate();
+    dict->EndHashIndexUpdate();
+    return status;
+}
+
+void ParallelBulkLoader::Run(BulkWorker& worker, const Feed& feed)
+{
+    int c;
+    while (!failed.load(std::memory_order_relaxed) && (c = next_char.fetch_add(1)) < NUM_ALPHABET) {
+        BulkLoader loader(*this, worker, c);
+        int rval = feed(c, loader);
+        if (rval == MBError::SUCCESS)
+            rval = loader.Finish();
+        if (rval != MBError::SUCCESS) {
+            Fail(rval);
+            break;
+        }
+    }
+
+    try {
+        std::lock_guard<std::mutex> guard(lock);
+        FlushChunk(worker, 0);
+        FlushChunk(worker, 1);
+    } catch (int error) {
+        Fail(error);
+    }
+    FlushIndexes(worker);
+}
+
+void ParallelBulkLoader::Fail(int error)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (status == MBError::SUCCESS)
+        status = error;
+    failed.store(true, std::memory_order_relaxed);
+}
+
+// Chunks do not cross a block, as in Dict::ReserveBatchData, so that space
+// skipped at the end of a block is smaller than a buffer. Only mapped memory
+// is written through a pointer; the sliding window is not moved while other
+// workers may be writing into it.
+void ParallelBulkLoader::Claim(BulkWorker& worker, int file, int buf_size)
+{
+    BulkChunk& chunk = worker.chunks[file];
+    FlushChunk(worker, file);
+    if (chunk.offset < chunk.end)
+        gaps[file].push_back(std::make_pair(chunk.offset, chunk.end));
+
+    IndexHeader* header = dict->GetHeaderPtr();
+    DRMBase* drm = file == 0 ? static_cast<DRMBase*>(mm) : static_cast<DRMBase*>(dict);
+    size_t& end_offset = file == 0 ? header->m_index_offset : header->m_data_offset;
+    size_t block_size = file == 0 ? header->index_block_size : header->data_block_size;
+    size_t want = std::min(static_cast<size_t>(BULK_CHUNK_SIZE), block_size);
+    size_t room = block_size - end_offset % block_size;
+    if (room >= static_cast<size_t>(buf_size))
+        want = std::min(want, room);
+
+    size_t old_off = end_offset;
+    uint8_t* ptr;
+    int rval = drm->Reserve(end_offset, static_cast<int>(want), ptr, false);
+    if (rval != MBError::SUCCESS)
+        throw rval;
+    if (old_off < end_offset)
+        gaps[file].push_back(std::make_pair(old_off, end_offset));
+
+    chunk.offset = end_offset;
+    chunk.buff_offset = end_offset;
+    end_offset += want;
+    chunk.end = end_offset;
+    chunk.ptr = ptr;
+    chunk.buff.clear();
+}
+
+// Returns a zeroed buffer of buf_size bytes at offset in the worker's chunk
+uint8_t* ParallelBulkLoader::Alloc(BulkWorker& worker, int file, int buf_size, size_t& offset)
+{
+    BulkChunk& chunk = worker.chunks[file];
+    if (chunk.end - chunk.offset < static_cast<size_t>(buf_size)) {
+        std::lock_guard<std::mutex> guard(lock);
+        Claim(worker, file, buf_size);
+    }
+
+    offset = chunk.offset;
+    chunk.offset += buf_size;
+    if (chunk.ptr == NULL) {
+        chunk.buff.resize(chunk.buff.size() + buf_size);
+        return chunk.buff.data() + chunk.buff.size() - buf_size;
+    }
+    uint8_t* ptr = chunk.ptr;
+    chunk.ptr += buf_size;
+    memset(ptr, 0, buf_size);
+    return ptr;
+}
+
+// Called with lock held
+void ParallelBulkLoader::FlushChunk(BulkWorker& worker, int file)
+{
+    BulkChunk& chunk = worker.chunks[file];
+    if (chunk.buff.empty())
+        return;
+    DRMBase* drm = file == 0 ? static_cast<DRMBase*>(mm) : static_cast<DRMBase*>(dict);
+    drm->WriteData(chunk.buff.data(), chunk.buff.size(), chunk.buff_offset);
+    chunk.buff_offset += chunk.buff.size();
+    chunk.buff.clear();
+}
+
+void ParallelBulkLoader::FlushIndexes(BulkWorker& worker)
+{
+    if (worker.index_entries.empty())
+        return;
+
+    std::lock_guard<std::mutex> guard(index_lock);
+    const uint8_t* key = reinterpret_cast<const uint8_t*>(worker.index_keys.data());
+    for (const std::pair<int, size_t>& entry : worker.index_entries) {
+        if (dict->BloomFilterEnabled())
+            dict->AddBloomFilter(key, entry.first);
+        dict->PutHashIndex(key, entry.first, entry.second);
+        key += entry.first;
+    }
+    worker.index_keys.clear();
+    worker.index_entries.clear();
+}
+
+// Link the subtrees and account for the workers. The unused ends of chunks
+// go to the free lists in pieces of at most MAX_BUFFER_RESERVE_SIZE, except
+// at the end of a file where the file offset is moved back.
+void ParallelBulkLoader::Finish(const std::vector<std::unique_ptr<BulkWorker>>& workers)
+{
+    IndexHeader* header = dict->GetHeaderPtr();
+    if (status != MBError::SUCCESS) {
+        // Nothing is linked; give the file space back.
+        header->m_index_offset = start_offset[0];
+        header->m_data_offset = start_offset[1];
+        dict->ClearHashIndex();
+        return;
+    }
+
+    for (const std::unique_ptr<BulkWorker>& worker : workers) {
+        header->n_states += worker->n_states;
+        header->n_edges += worker->n_edges;
+        for (int file = 0; file < 2; file++) {
+            const BulkChunk& chunk = worker->chunks[file];
+            if (chunk.offset < chunk.end)
+                gaps[file].push_back(std::make_pair(chunk.offset, chunk.end));
+        }
+    }
+
+    for (int c = 0; c < NUM_ALPHABET; c++) {
+        if (root_counts[c] == 0)
+            continue;
+        int rval = mm->AddBulkRootEdge(&root_edges[c * EDGE_SIZE], static_cast<uint8_t>(c), root_counts[c]);
+        if (rval != MBError::SUCCESS) {
+            status = rval;
+            dict->ClearHashIndex();
+            break;
+        }
+        header->count += root_counts[c];
+        count += root_counts[c];
+    }
+    dict->AddBulkUpdates(count);
+
+    for (int file = 0; file < 2; file++) {
+        DRMBase* drm = file == 0 ? static_cast<DRMBase*>(mm) : static_cast<DRMBase*>(dict);
+        size_t& end_offset = file == 0 ? header->m_index_offset : header->m_data_offset;
+        int64_t& pending = file == 0 ? header->pending_index_buff_size : header->pending_data_buff_size;
+        std::vector<std::pair<size_t, size_t>>& file_gaps = gaps[file];
+        std::sort(file_gaps.begin(), file_gaps.end());
+        while (!file_gaps.empty() && file_gaps.back().second == end_offset) {
+            end_offset = file_gaps.back().first;
+            file_gaps.pop_back();
+        }
+        for (const std::pair<size_t, size_t>& gap : file_gaps) {
+            pending += gap.second - gap.first;
+            for (size_t off = gap.first; off < gap.second; off += MAX_BUFFER_RESERVE_SIZE) {
+                drm->GetFreeList()->ReleaseAlignmentBuffer(off,
+                    std::min(off + MAX_BUFFER_RESERVE_SIZE, gap.second));
+            }
+        }
+        file_gaps.clear();
+    }
+}
+
+}
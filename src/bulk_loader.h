@@ -0,0 +1,170 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BULK_LOADER_H__
+#define __BULK_LOADER_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "db.h"
+
+namespace mabain {
+
+class Dict;
+class DictMem;
+class ParallelBulkLoader;
+struct BulkWorker;
+
+// Builds the tree of an empty DB from keys given in increasing order.
+// Every node is written once, at its final size, after all of its children,
+// so index and data files grow sequentially without splits, node growth or
+// free-list traffic. A subtree is linked to the root once the input moves
+// past its first character; readers that open the DB during the load see
+// whole subtrees only. The files are the same as those built by Add.
+//
+// The DB handle must be a writer without async mode and hold no entries.
+// The prefix cache is not seeded. A load that stops early leaves the
+// subtrees linked so far; start again from an empty DB.
+class BulkLoader {
+public:
+    explicit BulkLoader(DB& db);
+    // Calls Finish if it has not been called
+    ~BulkLoader();
+
+    // Returns INVALID_ARG if key is not greater than the previous key and
+    // OUT_OF_BOUND for empty or oversized keys and values. Any other error
+    // stops the load and is returned by every later call.
+    int Add(const char* key, int len, const char* value, int value_len);
+    int Add(const std::string& key, const std::string& value);
+    // Link the last subtree and update the DB header.
+    int Finish();
+
+    int Status() const { return status; }
+    // Entries added so far
+    int64_t Count() const { return count; }
+
+private:
+    friend class ParallelBulkLoader;
+
+    // A node on the path of the last key; deeper nodes are still open to
+    // new edges.
+    struct PendingNode {
+        int depth; // length of the key prefix ending at the node
+        bool match;
+        size_t data_offset;
+        int64_t count;
+        std::vector<uint8_t> first_chars;
+        std::vector<uint8_t> edges;
+    };
+
+    // Loads the keys of one first byte for a ParallelBulkLoader
+    BulkLoader(ParallelBulkLoader& owner, BulkWorker& worker, int first_char);
+
+    void Close(int depth);
+    void Link(const PendingNode& child, PendingNode& parent, int parent_depth);
+    void Push(int depth, bool match, size_t data_offset);
+    size_t WriteNode(const PendingNode& node);
+    size_t WriteLabel(const uint8_t* label, int len);
+    size_t WriteValue(const uint8_t* value, int len);
+
+    Dict* dict;
+    DictMem* mm;
+    // Set for a partition of a parallel load
+    ParallelBulkLoader* parallel;
+    BulkWorker* worker;
+    int first_char;
+    int status;
+    bool finished;
+    int64_t count;
+    std::string last_key;
+    std::vector<PendingNode> path;
+    size_t path_size;
+};
+
+// Builds the tree of an empty DB on several threads. The root node has one
+// edge per first byte, so the keys split into 256 independent subtrees.
+// Worker threads take first bytes in turn and load each subtree as
+// BulkLoader does, into chunks of the index and data files that they cut
+// from the end of the files under a lock. Buffers are written into a chunk
+// without the lock, and offsets are final when written. The root edges are
+// linked once all workers are done, so readers see the whole tree at once;
+// a load that fails links nothing and gives back the file space it took.
+//
+// The same restrictions as for BulkLoader apply, and jemalloc mode is not
+// supported. Hash index and Bloom filter updates are applied in batches
+// under a lock; the rest of the load scales with the number of threads as
+// long as the feed does.
+class ParallelBulkLoader {
+public:
+    // Called once for every first byte c, on a worker thread. Adds the keys
+    // that start with c to loader in increasing order. Returning an error
+    // stops the load.
+    typedef std::function<int(int first_char, BulkLoader& loader)> Feed;
+
+    // num_threads <= 0 uses one thread per CPU.
+    ParallelBulkLoader(DB& db, int num_threads);
+    ~ParallelBulkLoader();
+
+    // Runs feed for the 256 first bytes and links the subtrees. Can only be
+    // called once.
+    int Load(const Feed& feed);
+    // Entries loaded
+    int64_t Count() const { return count; }
+
+private:
+    friend class BulkLoader;
+
+    void Run(BulkWorker& worker, const Feed& feed);
+    void Fail(int error);
+    // Cut a chunk for at least buf_size bytes from the end of the index
+    // (file 0) or data file (file 1). Called with lock held.
+    void Claim(BulkWorker& worker, int file, int buf_size);
+    uint8_t* Alloc(BulkWorker& worker, int file, int buf_size, size_t& offset);
+    void FlushChunk(BulkWorker& worker, int file);
+    void FlushIndexes(BulkWorker& worker);
+    void Finish(const std::vector<std::unique_ptr<BulkWorker>>& workers);
+
+    Dict* dict;
+    DictMem* mm;
+    int status;
+    int num_threads;
+    bool loaded;
+    int64_t count;
+    int64_t start_update;
+    size_t start_offset[2];
+
+    std::mutex lock;
+    // Space skipped between chunks, per file
+    std::vector<std::pair<size_t, size_t>> gaps[2];
+    std::mutex index_lock;
+    std::atomic<int> next_char;
+    std::atomic<int64_t> next_update;
+    std::atomic<bool> failed;
+
+    // Root edge and entry count of each first byte
+    std::vector<uint8_t> root_edges;
+    std::vector<int64_t> root_counts;
+};
+
+}
+
+#endif
@@ -16,6 +16,8 @@
 
 // @author Changxue Deng <chadeng@cisco.com>
 
+#include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
@@ -29,7 +31,10 @@
 
 #include "async_writer.h"
 #include "db.h"
+#include "detail/hot_key_cache.h"
+#include "detail/range_scanner.h"
 #include "detail/search_engine.h"
+#include "detail/subtree_counter.h"
 #include "dict.h"
 #include "drm_base.h"
 #include "error.h"
@@ -142,6 +147,9 @@ int DB::Close()
         async_writer = NULL;
     }
 
+    delete hot_key_cache;
+    hot_key_cache = NULL;
+
     if (dict != NULL) {
         UpdateNumHandlers(options, -1);
 
@@ -186,6 +194,30 @@ uint64_t DB::BeginReaderEpochGuard() const
         || !header->reader_epoch_tracking_active.load(MEMORY_ORDER_READER))
         return 0;
 
+    uint64_t slot_token = ClaimReaderEpochSlot(header);
+    if (slot_token != 0) {
+        reader_guard_fast_slot_count++;
+        return slot_token;
+    }
+
+    if (AcquireRebuildBarrierShared() != MBError::SUCCESS) {
+        Logger::Log(LOG_LEVEL_ERROR, "failed to acquire rebuild reader barrier fallback");
+        return 0;
+    }
+    header = dict->GetHeaderPtr();
+    if (header == NULL
+        || !header->reader_epoch_tracking_active.load(MEMORY_ORDER_READER)) {
+        ReleaseRebuildBarrierShared();
+        return 0;
+    }
+    reader_guard_barrier_fallback_count++;
+    return kRebuildBarrierGuardToken;
+}
+
+// Claim a free reader epoch slot and publish the current epoch in it.
+// Returns the slot index plus one, or 0 if no slot could be claimed.
+uint64_t DB::ClaimReaderEpochSlot(IndexHeader* header) const
+{
     const uint32_t slot_connect_id = identifier != 0 ? identifier : static_cast<uint32_t>(getpid());
     for (uint32_t i = 0; i < header->reader_epoch_slot_count; i++) {
         ReaderEpochSlot& slot = header->reader_epoch_slot[i];
@@ -199,27 +231,13 @@ uint64_t DB::BeginReaderEpochGuard() const
         for (uint32_t retry = 0; retry < kReaderEpochGuardMaxStabilizeRetries; retry++) {
             uint64_t epoch = header->reader_epoch.load(MEMORY_ORDER_READER);
             slot.epoch.store(epoch, MEMORY_ORDER_WRITER);
-            if (epoch == header->reader_epoch.load(MEMORY_ORDER_READER)) {
-                reader_guard_fast_slot_count++;
+            if (epoch == header->reader_epoch.load(MEMORY_ORDER_READER))
                 return i + 1;
-            }
         }
         slot.Clear();
         break;
     }
-
-    if (AcquireRebuildBarrierShared() != MBError::SUCCESS) {
-        Logger::Log(LOG_LEVEL_ERROR, "failed to acquire rebuild reader barrier fallback");
-        return 0;
-    }
-    header = dict->GetHeaderPtr();
-    if (header == NULL
-        || !header->reader_epoch_tracking_active.load(MEMORY_ORDER_READER)) {
-        ReleaseRebuildBarrierShared();
-        return 0;
-    }
-    reader_guard_barrier_fallback_count++;
-    return kRebuildBarrierGuardToken;
+    return 0;
 }
 
 void DB::EndReaderEpochGuard(uint64_t epoch) const
@@ -244,6 +262,15 @@ void DB::EndReaderEpochGuard(uint64_t epoch) const
         header->reader_epoch_slot[slot_index].Clear();
 }
 
+// Read after the view data, like the second load of a sequence lock.
+uint64_t DB::LoadValueSeq() const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (dict == NULL || dict->GetHeaderPtr() == NULL)
+        return 0;
+    return dict->GetHeaderPtr()->value_seq.load(std::memory_order_relaxed);
+}
+
 int DB::EnsureRebuildGuardFd() const
 {
     if (rebuild_guard_file)
@@ -293,6 +320,16 @@ uint64_t DB::GetReaderGuardBarrierFallbackCount() const
     return reader_guard_barrier_fallback_count;
 }
 
+uint64_t DB::GetBloomFilterSkipCount() const
+{
+    return dict != NULL ? dict->GetBloomFilterSkips() : 0;
+}
+
+uint64_t DB::GetBloomFilterFalsePositiveCount() const
+{
+    return dict != NULL ? dict->GetBloomFilterFalsePositives() : 0;
+}
+
 void DB::ReleaseRebuildBarrierExclusive() const
 {
     if (rebuild_guard_file != NULL)
@@ -312,6 +349,7 @@ DB::DB(const char* db_path,
     , reader_guard_fast_slot_count(0)
     , reader_guard_barrier_fallback_count(0)
     , writer_lock_fd(-1)
+    , hot_key_cache(NULL)
 {
     MBConfig config;
     memset(&config, 0, sizeof(config));
@@ -332,6 +370,7 @@ DB::DB(MBConfig& config)
     , reader_guard_fast_slot_count(0)
     , reader_guard_barrier_fallback_count(0)
     , writer_lock_fd(-1)
+    , hot_key_cache(NULL)
 {
     InitDB(config);
 }
@@ -366,6 +405,10 @@ int DB::ValidateConfig(MBConfig& config)
             }
         }
     }
+    if ((config.options & CONSTS::SYNC_GROUP_COMMIT) && (config.options & CONSTS::SYNC_ON_WRITE)) {
+        std::cout << "SYNC_ON_WRITE is ignored with SYNC_GROUP_COMMIT\n";
+        config.options &= ~CONSTS::SYNC_ON_WRITE;
+    }
     if (config.options & CONSTS::USE_SLIDING_WINDOW) {
         std::cout << "sliding window option is deprecated\n";
         config.options &= ~CONSTS::USE_SLIDING_WINDOW;
@@ -388,6 +431,8 @@ int DB::ValidateConfig(MBConfig& config)
         std::cerr << "async queue size exceeds maximum\n";
     if (config.queue_size == 0 || config.queue_size > MB_MAX_NUM_SHM_QUEUE_NODE)
         config.queue_size = MB_MAX_NUM_SHM_QUEUE_NODE;
+    if (config.queue_lanes == 0 || config.queue_lanes > MB_ASYNC_LOCAL_LANE)
+        config.queue_lanes = MB_NUM_SHM_QUEUE_LANES;
 #ifdef __APPLE__
     if (config.queue_dir == nullptr)
         config.queue_dir = config.mbdir;
@@ -558,6 +603,26 @@ void DB::PostDBUpdate(const MBConfig& config, bool init_header, bool update_head
                 }
             }
         }
+
+        // An index that does not match the tree is rebuilt before use; the
+        // async writer does it from its own thread.
+        if (status == MBError::SUCCESS && dict->HashIndexStale()
+            && !(config.options & CONSTS::ASYNC_WRITER_MODE)) {
+            ResourceCollection rc(*this);
+            rc.RebuildHashIndex();
+        }
+        // A filter that does not cover the tree is refilled before use.
+        if (status == MBError::SUCCESS && dict->BloomFilterStale()
+            && !(config.options & CONSTS::ASYNC_WRITER_MODE)) {
+            ResourceCollection rc(*this);
+            rc.RebuildBloomFilter();
+        }
+        // Counts left mid-update by a writer that did not exit cleanly
+        if (status == MBError::SUCCESS && dict->SubtreeCountStale()
+            && !(config.options & CONSTS::ASYNC_WRITER_MODE)) {
+            ResourceCollection rc(*this);
+            rc.RebuildSubtreeCounts();
+        }
     }
 }
 
@@ -806,7 +871,7 @@ void DB::InitDBEx(MBConfig& config)
             config.block_size_index, config.block_size_data,
             config.max_num_index_block, config.max_num_data_block,
             config.num_entry_per_bucket, config.queue_size,
-            config.queue_dir);
+            config.queue_dir, config.queue_lanes, config.connect_id);
     } catch (int error) {
         status = error;
         Logger::Log(LOG_LEVEL_ERROR, "database %s check failed: %s", mb_dir.c_str(),
@@ -819,7 +884,22 @@ void DB::InitDBEx(MBConfig& config)
     // Prefix cache: auto-enable only if DB was created with OPTION_PREFIX_CACHE
     // (embedded) or reader requested the option and cache can attach.
 
+    // A writer keeps the hash index of the last writer or rebuilds a stale one
+    // once the DB is ready; a reader without a writer-maintained index falls
+    // back to the tree.
+    if (config.options & CONSTS::OPTION_HASH_INDEX)
+        dict->OpenHashIndex(config.hash_index_size);
+    // Readers use the Bloom filter only while the writer keeps it complete.
+    if (config.options & CONSTS::OPTION_BLOOM_FILTER)
+        dict->OpenBloomFilter(config.bloom_filter_size);
+    if ((config.options & CONSTS::SYNC_GROUP_COMMIT) && (config.options & CONSTS::ACCESS_MODE_WRITER))
+        dict->StartGroupSync(config.sync_interval_ms, config.sync_bytes);
+
     PostDBUpdate(config, init_header, update_header);
+
+    if (status == MBError::SUCCESS && config.hot_key_cache_size > 0
+        && !(options & CONSTS::ASYNC_WRITER_MODE))
+        hot_key_cache = new detail::HotKeyCache(*dict, config.hot_key_cache_size);
 }
 
 int DB::Status() const
@@ -834,6 +914,7 @@ DB::DB(const DB& db)
     , reader_guard_fast_slot_count(0)
     , reader_guard_barrier_fallback_count(0)
     , writer_lock_fd(-1)
+    , hot_key_cache(NULL)
 {
     MBConfig db_config = db.dbConfig;
     db_config.mbdir = db.mb_dir.c_str();
@@ -908,9 +989,14 @@ int DB::Find(const char* key, int len, MBData& mdata) const
     if (options & CONSTS::ASYNC_WRITER_MODE)
         return MBError::NOT_ALLOWED;
 
+    int rval;
     uint64_t reader_epoch = BeginReaderEpochGuard();
-    detail::SearchEngine engine(*dict);
-    int rval = engine.find(reinterpret_cast<const uint8_t*>(key), len, mdata);
+    if (hot_key_cache != NULL) {
+        rval = hot_key_cache->find(reinterpret_cast<const uint8_t*>(key), len, mdata);
+    } else {
+        detail::SearchEngine engine(*dict);
+        rval = engine.find(reinterpret_cast<const uint8_t*>(key), len, mdata);
+    }
     EndReaderEpochGuard(reader_epoch);
     return rval;
 }
@@ -920,6 +1006,276 @@ int DB::Find(const std::string& key, MBData& mdata) const
     return Find(key.data(), key.size(), mdata);
 }
 
+int DB::FindView(const char* key, int len, MBDataView& view) const
+{
+    if (key == NULL)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    view.Release();
+    view.db = this;
+
+    int rval;
+    detail::SearchEngine engine(*dict);
+    IndexHeader* header = dict->GetHeaderPtr();
+    uint64_t pin = (header != NULL) ? ClaimReaderEpochSlot(header) : 0;
+    if (pin != 0) {
+        // Pairs with ResourceCollection::Prepare: either the collector sees
+        // this slot, or this reader sees the collection in progress.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (*reinterpret_cast<volatile size_t*>(&header->rc_m_data_off_pre) != 0) {
+            EndReaderEpochGuard(pin);
+            pin = 0;
+        }
+    }
+    uint64_t seq = 0;
+    if (pin != 0) {
+        // A value being rewritten in place is copied instead.
+        seq = header->value_seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            EndReaderEpochGuard(pin);
+            pin = 0;
+        }
+    }
+    if (pin != 0) {
+        MBData mbd(0, CONSTS::OPTION_DATA_VIEW);
+        rval = engine.find(reinterpret_cast<const uint8_t*>(key), len, mbd);
+        if (rval != MBError::SUCCESS) {
+            EndReaderEpochGuard(pin);
+            return rval;
+        }
+        // Large values are not contiguous and lose OPTION_DATA_VIEW.
+        const uint8_t* ptr = NULL;
+        if (mbd.options & CONSTS::OPTION_DATA_VIEW)
+            ptr = dict->GetShmPtr(mbd.data_offset + DATA_HDR_BYTE, mbd.data_len);
+        // The offset found may already have been released; copy in that case.
+        if (ptr != NULL && LoadValueSeq() == seq) {
+            view.data = ptr;
+            view.data_len = mbd.data_len;
+            view.data_offset = mbd.data_offset;
+            view.bucket_index = mbd.bucket_index;
+            view.pin = pin;
+            view.seq = seq;
+            return MBError::SUCCESS;
+        }
+        EndReaderEpochGuard(pin);
+    }
+
+    // The value is not mapped or stored in extents, no slot is free or rc is
+    // running; copy it.
+    if (view.copy == NULL)
+        view.copy = new MBData();
+    MBData& mbd = *view.copy;
+    mbd.options = 0;
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    rval = engine.find(reinterpret_cast<const uint8_t*>(key), len, mbd);
+    EndReaderEpochGuard(reader_epoch);
+    if (rval != MBError::SUCCESS)
+        return rval;
+    view.data = mbd.buff;
+    view.data_len = mbd.data_len;
+    view.data_offset = mbd.data_offset;
+    view.bucket_index = mbd.bucket_index;
+    return MBError::SUCCESS;
+}
+
+int DB::FindView(const std::string& key, MBDataView& view) const
+{
+    return FindView(key.data(), key.size(), view);
+}
+
+int DB::ReadValueRange(const char* key, int key_len, int64_t offset, int len, char* buf,
+    int& read_len) const
+{
+    read_len = 0;
+    if (key == NULL || buf == NULL || offset < 0 || len < 0)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    // The range is read into buf by the lookup itself.
+    MBData mbd(0, CONSTS::OPTION_READ_RANGE);
+    mbd.buff = reinterpret_cast<uint8_t*>(buf);
+    mbd.buff_len = len;
+    mbd.range_offset = offset;
+    detail::SearchEngine engine(*dict);
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    int rval = engine.find(reinterpret_cast<const uint8_t*>(key), key_len, mbd);
+    EndReaderEpochGuard(reader_epoch);
+    mbd.buff = NULL;
+    if (rval == MBError::SUCCESS)
+        read_len = mbd.data_len;
+    return rval;
+}
+
+int DB::ReadValueRange(const std::string& key, int64_t offset, int len, char* buf,
+    int& read_len) const
+{
+    return ReadValueRange(key.data(), key.size(), offset, len, buf, read_len);
+}
+
+int DB::MultiFind(const std::vector<std::string_view>& keys, std::vector<MBData>& out,
+    std::vector<int>* results) const
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    if (out.size() < keys.size()) {
+        // MBData owns its buffer; never let the vector copy existing elements.
+        out.clear();
+        out.resize(keys.size());
+    }
+    if (results != nullptr)
+        results->resize(keys.size());
+
+    const uint8_t* key_ptrs[detail::SearchEngine::MULTI_FIND_WINDOW];
+    int key_lens[detail::SearchEngine::MULTI_FIND_WINDOW];
+    int rvals[detail::SearchEngine::MULTI_FIND_WINDOW];
+
+    int rval = MBError::SUCCESS;
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    detail::SearchEngine engine(*dict);
+    for (size_t base = 0; base < keys.size(); base += detail::SearchEngine::MULTI_FIND_WINDOW) {
+        int n = static_cast<int>(std::min<size_t>(detail::SearchEngine::MULTI_FIND_WINDOW, keys.size() - base));
+        for (int i = 0; i < n; i++) {
+            key_ptrs[i] = reinterpret_cast<const uint8_t*>(keys[base + i].data());
+            key_lens[i] = static_cast<int>(keys[base + i].size());
+            out[base + i].match_len = 0;
+        }
+        engine.multiFind(key_ptrs, key_lens, n, &out[base], rvals);
+        if (results != nullptr) {
+            std::copy(rvals, rvals + n, results->begin() + base);
+        } else {
+            for (int i = 0; i < n && rval == MBError::SUCCESS; i++)
+                rval = rvals[i];
+        }
+    }
+    EndReaderEpochGuard(reader_epoch);
+    return rval;
+}
+
+int DB::MultiFind(const char* const* keys, const int* lens, int num_keys, MBData* out,
+    int* results) const
+{
+    if (keys == NULL || lens == NULL || out == NULL || num_keys < 0)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    for (int i = 0; i < num_keys; i++)
+        out[i].match_len = 0;
+
+    // Without results, collect the return codes a window at a time for the
+    // aggregate status.
+    int rval = MBError::SUCCESS;
+    int rvals[detail::SearchEngine::MULTI_FIND_WINDOW];
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    detail::SearchEngine engine(*dict);
+    if (results != NULL) {
+        engine.multiFind(reinterpret_cast<const uint8_t* const*>(keys), lens, num_keys, out, results);
+    } else {
+        for (int base = 0; base < num_keys; base += detail::SearchEngine::MULTI_FIND_WINDOW) {
+            int n = std::min(detail::SearchEngine::MULTI_FIND_WINDOW, num_keys - base);
+            engine.multiFind(reinterpret_cast<const uint8_t* const*>(keys + base), lens + base, n,
+                out + base, rvals);
+            for (int i = 0; i < n && rval == MBError::SUCCESS; i++)
+                rval = rvals[i];
+        }
+    }
+    EndReaderEpochGuard(reader_epoch);
+    return rval;
+}
+
+int DB::Scan(const char* start_key, int start_len, const char* end_key, int end_len,
+    int64_t limit, const ScanVisitor& visitor) const
+{
+    if ((start_key == NULL && start_len > 0) || (end_key == NULL && end_len > 0) || !visitor)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    detail::RangeScanner scanner(*dict);
+    int rval = scanner.scan(reinterpret_cast<const uint8_t*>(start_key), start_len,
+        reinterpret_cast<const uint8_t*>(end_key), (end_len > 0) ? end_len : -1, limit, visitor);
+    EndReaderEpochGuard(reader_epoch);
+    return rval;
+}
+
+int DB::Scan(const std::string& start_key, const std::string& end_key, int64_t limit,
+    const ScanVisitor& visitor) const
+{
+    return Scan(start_key.data(), start_key.size(), end_key.data(), end_key.size(), limit, visitor);
+}
+
+int DB::CountPrefix(const std::string& prefix, int64_t& count) const
+{
+    return CountPrefix(prefix.data(), prefix.size(), count);
+}
+
+int DB::CountPrefix(const char* prefix, int len, int64_t& count) const
+{
+    if ((prefix == NULL && len > 0) || len < 0)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    detail::SubtreeCounter counter(*dict);
+    int rval = counter.countPrefix(reinterpret_cast<const uint8_t*>(prefix), len, count);
+    EndReaderEpochGuard(reader_epoch);
+    return rval;
+}
+
+int DB::Rank(const std::string& key, int64_t& rank) const
+{
+    return Rank(key.data(), key.size(), rank);
+}
+
+int DB::Rank(const char* key, int len, int64_t& rank) const
+{
+    if ((key == NULL && len > 0) || len < 0)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    detail::SubtreeCounter counter(*dict);
+    int rval = counter.rank(reinterpret_cast<const uint8_t*>(key), len, rank);
+    EndReaderEpochGuard(reader_epoch);
+    return rval;
+}
+
+int DB::Select(int64_t n, MBData& data, std::string* key) const
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    data.options = 0;
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    detail::SubtreeCounter counter(*dict);
+    int rval = counter.select(n, data, key);
+    EndReaderEpochGuard(reader_epoch);
+    return rval;
+}
+
 int DB::FindLowerBound(const std::string& key, MBData& data, std::string* bound_key) const
 {
     return FindLowerBound(key.data(), key.size(), data, bound_key);
@@ -935,10 +1291,78 @@ int DB::FindLowerBound(const char* key, int len, MBData& data, std::string* boun
         return MBError::NOT_ALLOWED;
 
     data.options = 0;
+    data.match_len = 0;
     if (bound_key != nullptr)
         bound_key->reserve(CONSTS::MAX_KEY_LENGHTH);
+    uint64_t reader_epoch = BeginReaderEpochGuard();
     detail::SearchEngine engine(*dict);
-    return engine.lowerBound(reinterpret_cast<const uint8_t*>(key), len, data, bound_key);
+    int rval = engine.lowerBound(reinterpret_cast<const uint8_t*>(key), len, data, bound_key);
+    EndReaderEpochGuard(reader_epoch);
+    return rval;
+}
+
+int DB::FindUpperBound(const std::string& key, MBData& data, std::string* bound_key) const
+{
+    return FindUpperBound(key.data(), key.size(), data, bound_key);
+}
+
+int DB::FindUpperBound(const char* key, int len, MBData& data, std::string* bound_key) const
+{
+    return FindNeighbor(key, len, true, false, data, bound_key);
+}
+
+int DB::Next(const std::string& key, MBData& data, std::string* next_key) const
+{
+    return Next(key.data(), key.size(), data, next_key);
+}
+
+int DB::Next(const char* key, int len, MBData& data, std::string* next_key) const
+{
+    return FindNeighbor(key, len, false, false, data, next_key);
+}
+
+int DB::Prev(const std::string& key, MBData& data, std::string* prev_key) const
+{
+    return Prev(key.data(), key.size(), data, prev_key);
+}
+
+int DB::Prev(const char* key, int len, MBData& data, std::string* prev_key) const
+{
+    return FindNeighbor(key, len, false, true, data, prev_key);
+}
+
+// First entry after (or before, if reverse) key in key order
+int DB::FindNeighbor(const char* key, int len, bool inclusive, bool reverse, MBData& data,
+    std::string* neighbor_key) const
+{
+    if (key == NULL || len < 0)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+    // An empty key would make a reverse scanner start from the largest key.
+    if (reverse && len == 0)
+        return MBError::NOT_EXIST;
+
+    uint64_t reader_epoch = BeginReaderEpochGuard();
+    detail::RangeScanner scanner(*dict, reverse);
+    scanner.seek(reinterpret_cast<const uint8_t*>(key), len, inclusive);
+    int rval = scanner.next();
+    EndReaderEpochGuard(reader_epoch);
+    if (rval != MBError::SUCCESS)
+        return rval;
+
+    const MBData& value = scanner.value();
+    if (data.buff_len < value.data_len + 1 && data.Resize(value.data_len) != MBError::SUCCESS)
+        return MBError::NO_MEMORY;
+    memcpy(data.buff, value.buff, value.data_len);
+    data.data_len = value.data_len;
+    data.bucket_index = value.bucket_index;
+    data.data_offset = value.data_offset;
+    if (neighbor_key != nullptr)
+        neighbor_key->assign(scanner.key());
+    return MBError::SUCCESS;
 }
 
 // Find the longest prefix match
@@ -1005,7 +1429,7 @@ int DB::Add(const char* key, int len, MBData& mbdata, bool overwrite)
     if (async_writer == NULL && (options & CONSTS::ACCESS_MODE_WRITER)) {
         rval = dict->Add(reinterpret_cast<const uint8_t*>(key), len, mbdata, overwrite);
     } else {
-        AsyncWriter* awr = AsyncWriter::GetInstance();
+        AsyncWriter* awr = AsyncWriter::GetInstance(mb_dir);
         if (awr) {
             try {
                 rval = awr->AddWithLock(key, len, mbdata, overwrite);
@@ -1022,7 +1446,7 @@ int DB::Add(const char* key, int len, MBData& mbdata, bool overwrite)
         while (rval == MBError::TRY_AGAIN) {
             rval = dict->SHMQ_Add(reinterpret_cast<const char*>(key), len,
                 reinterpret_cast<const char*>(mbdata.buff), mbdata.data_len, overwrite);
-            if (!(mbdata.options & CONSTS::OPTION_SHMQ_RETRY)) {
+            if (rval != MBError::TRY_AGAIN || !(mbdata.options & CONSTS::OPTION_SHMQ_RETRY)) {
                 break;
             }
             if (retry_cnt++ > MB_SHM_RETRY_TIMEOUT) {
@@ -1047,6 +1471,43 @@ int DB::AddAsync(const char* key, int len, const char* data, int data_len, bool
     return rval;
 }
 
+int DB::AddAsync(const char* key, int len, const char* data, int data_len, bool overwrite,
+    uint64_t& seq)
+{
+    uint64_t last_seq = dict->SHMQ_LastSeq();
+    int rval = AddAsync(key, len, data, data_len, overwrite);
+    if (rval != MBError::SUCCESS)
+        return rval;
+
+    seq = dict->SHMQ_LastSeq();
+    // The async writer of this process added the entry right away; there is
+    // nothing to wait for.
+    if (seq == last_seq)
+        seq = 0;
+    return rval;
+}
+
+int DB::AddAsync(std::string key, std::string value, bool overwrite)
+{
+    uint64_t seq;
+    return AddAsync(std::move(key), std::move(value), overwrite, seq);
+}
+
+int DB::AddAsync(std::string key, std::string value, bool overwrite, uint64_t& seq)
+{
+    if (key.empty())
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    AsyncWriter* awr = NULL;
+    if (options & CONSTS::OPTION_ASYNC_HANDOFF)
+        awr = AsyncWriter::GetInstance(mb_dir);
+    if (awr != NULL)
+        return awr->Submit(MABAIN_ASYNC_TYPE_ADD, std::move(key), std::move(value), overwrite, seq);
+    return AddAsync(key.data(), key.size(), value.data(), value.size(), overwrite, seq);
+}
+
 int DB::Add(const char* key, int len, const char* data, int data_len, bool overwrite)
 {
     MBData mbdata;
@@ -1082,12 +1543,24 @@ int DB::Remove(const char* key, int len)
 }
 
 int DB::RemoveAsync(const char* key, int len)
+{
+    uint64_t seq;
+    return RemoveAsync(key, len, seq);
+}
+
+int DB::RemoveAsync(const char* key, int len, uint64_t& seq)
 {
     if (key == nullptr || len == 0)
         return MBError::INVALID_ARG;
     if (status != MBError::SUCCESS)
         return MBError::NOT_INITIALIZED;
 
+    AsyncWriter* awr = NULL;
+    if (options & CONSTS::OPTION_ASYNC_HANDOFF)
+        awr = AsyncWriter::GetInstance(mb_dir);
+    if (awr != NULL)
+        return awr->Submit(MABAIN_ASYNC_TYPE_REMOVE, std::string(key, len), std::string(), false, seq);
+
     int rval = MBError::SUCCESS;
     int retry_cnt = 0;
     do {
@@ -1097,6 +1570,8 @@ int DB::RemoveAsync(const char* key, int len)
         }
         usleep(1);
     } while (true);
+    if (rval == MBError::SUCCESS)
+        seq = dict->SHMQ_LastSeq();
     return rval;
 }
 
@@ -1105,6 +1580,145 @@ int DB::Remove(const std::string& key)
     return Remove(key.data(), key.size());
 }
 
+int DB::Write(WriteBatch& batch, bool overwrite)
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    if (async_writer == NULL && (options & CONSTS::ACCESS_MODE_WRITER))
+        return dict->Write(batch, overwrite);
+
+    int rval = MBError::TRY_AGAIN;
+    AsyncWriter* awr = AsyncWriter::GetInstance(mb_dir);
+    if (awr)
+        rval = awr->WriteWithLock(batch, overwrite);
+    if (rval != MBError::TRY_AGAIN)
+        return rval;
+
+    // The writer applies queued entries one at a time and does not report
+    // what it skipped.
+    batch.Sort();
+    batch.skipped = 0;
+    for (const WriteBatch::Entry& entry : batch.entries) {
+        const char* key = reinterpret_cast<const char*>(batch.Key(entry));
+        if (entry.value_len > 0) {
+            rval = AddAsync(key, entry.key_len, reinterpret_cast<const char*>(batch.Value(entry)),
+                entry.value_len, overwrite);
+        } else {
+            rval = RemoveAsync(key, entry.key_len);
+        }
+        if (rval != MBError::SUCCESS)
+            return rval;
+    }
+    return MBError::SUCCESS;
+}
+
+int DB::Update(const char* key, int len, int type, const char* operand, int operand_len)
+{
+    if (key == NULL || (operand == NULL && operand_len > 0))
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    if (async_writer == NULL && (options & CONSTS::ACCESS_MODE_WRITER)) {
+        try {
+            return dict->Update(reinterpret_cast<const uint8_t*>(key), len, type,
+                reinterpret_cast<const uint8_t*>(operand), operand_len);
+        } catch (int error) {
+            return error;
+        }
+    }
+
+    int rval = MBError::TRY_AGAIN;
+    AsyncWriter* awr = AsyncWriter::GetInstance(mb_dir);
+    if (awr)
+        rval = awr->UpdateWithLock(key, len, type, operand, operand_len);
+    if (rval != MBError::TRY_AGAIN)
+        return rval;
+    // The outcome of a queued compare-and-swap cannot be reported back.
+    if (type == MABAIN_UPDATE_TYPE_CAS)
+        return MBError::NOT_ALLOWED;
+
+    int retry_cnt = 0;
+    while (true) {
+        rval = dict->SHMQ_Update(key, len, type, operand, operand_len);
+        if (rval != MBError::TRY_AGAIN || retry_cnt++ > MB_SHM_RETRY_TIMEOUT)
+            break;
+        usleep(1);
+    }
+    return rval;
+}
+
+int DB::Increment(const char* key, int len, int64_t delta)
+{
+    return Update(key, len, MABAIN_ASYNC_TYPE_INCREMENT, reinterpret_cast<const char*>(&delta),
+        sizeof(delta));
+}
+
+int DB::Increment(const std::string& key, int64_t delta)
+{
+    return Increment(key.data(), key.size(), delta);
+}
+
+int DB::Append(const char* key, int len, const char* data, int data_len)
+{
+    return Update(key, len, MABAIN_ASYNC_TYPE_APPEND, data, data_len);
+}
+
+int DB::Append(const std::string& key, const std::string& data)
+{
+    return Append(key.data(), key.size(), data.data(), data.size());
+}
+
+int DB::CompareAndSwap(const char* key, int len, const char* expected, int expected_len,
+    const char* data, int data_len)
+{
+    if ((expected == NULL && expected_len > 0) || (data == NULL && data_len > 0))
+        return MBError::INVALID_ARG;
+    if (expected_len < 0 || data_len < 0 || expected_len > CONSTS::MAX_DATA_SIZE
+        || data_len > CONSTS::MAX_DATA_SIZE)
+        return MBError::OUT_OF_BOUND;
+
+    int32_t elen = expected_len;
+    std::string operand;
+    operand.reserve(sizeof(elen) + expected_len + data_len);
+    operand.append(reinterpret_cast<const char*>(&elen), sizeof(elen));
+    operand.append(expected, expected_len);
+    operand.append(data, data_len);
+    return Update(key, len, MABAIN_UPDATE_TYPE_CAS, operand.data(), operand.size());
+}
+
+int DB::CompareAndSwap(const std::string& key, const std::string& expected, const std::string& data)
+{
+    return CompareAndSwap(key.data(), key.size(), expected.data(), expected.size(), data.data(),
+        data.size());
+}
+
+int DB::Merge(const char* key, int len, const char* operand, int operand_len)
+{
+    return Update(key, len, MABAIN_ASYNC_TYPE_MERGE, operand, operand_len);
+}
+
+int DB::Merge(const std::string& key, const std::string& operand)
+{
+    return Merge(key.data(), key.size(), operand.data(), operand.size());
+}
+
+int DB::SetMergeOperator(const MergeOperator& merge)
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    if (!(options & CONSTS::ACCESS_MODE_WRITER))
+        return MBError::NOT_ALLOWED;
+
+    // The async writer thread reads the operator under its writer lock.
+    if (async_writer != NULL)
+        async_writer->SetMergeOperator(merge);
+    else
+        dict->SetMergeOperator(merge);
+    return MBError::SUCCESS;
+}
+
 int DB::RemoveAll()
 {
     if (status != MBError::SUCCESS)
@@ -1169,6 +1783,58 @@ void DB::Flush() const
     dict->Flush();
 }
 
+int DB::WriteSeq(uint64_t& seq) const
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    GroupSync* group_sync = dict->GetGroupSync();
+    if (group_sync == NULL)
+        return MBError::NOT_ALLOWED;
+
+    seq = group_sync->Mark();
+    return MBError::SUCCESS;
+}
+
+int DB::WaitDurable(uint64_t seq) const
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+    GroupSync* group_sync = dict->GetGroupSync();
+    if (group_sync == NULL)
+        return MBError::NOT_ALLOWED;
+
+    return group_sync->Wait(seq);
+}
+
+int DB::WaitApplied(uint64_t seq, int timeout_ms) const
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    return dict->SHMQ_WaitApplied(seq, timeout_ms);
+}
+
+DB::AppliedFuture::AppliedFuture(const DB& db, uint64_t seq)
+    : db_ref(db)
+    , seq(seq)
+{
+}
+
+uint64_t DB::AppliedFuture::Seq() const
+{
+    return seq;
+}
+
+bool DB::AppliedFuture::Ready() const
+{
+    return db_ref.WaitApplied(seq, 0) == MBError::SUCCESS;
+}
+
+int DB::AppliedFuture::Wait(int timeout_ms) const
+{
+    return db_ref.WaitApplied(seq, timeout_ms);
+}
+
 void DB::Purge() const
 {
     if (status != MBError::SUCCESS)
@@ -1239,6 +1905,8 @@ void DB::PrintStats(std::ostream& out_stream) const
         return;
 
     dict->PrintStats(out_stream);
+    if (hot_key_cache != NULL)
+        hot_key_cache->printStats(out_stream);
 }
 
 void DB::PrintHeader(std::ostream& out_stream) const
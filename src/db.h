@@ -19,19 +19,23 @@
 #ifndef __DB_H__
 #define __DB_H__
 
+#include <functional>
 #include <memory>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "error.h"
 #include "integer_4b_5b.h"
 #include "lock.h"
 #include "mb_data.h"
+#include "write_batch.h"
 
 namespace mabain {
 
 #define MB_MAX_NUM_SHM_QUEUE_NODE 8
+#define MB_NUM_SHM_QUEUE_LANES 8
 #define MB_SHM_RETRY_TIMEOUT 1000000 // 1 second
 
 class Dict;
@@ -41,6 +45,12 @@ class AsyncWriter;
 class ResourceCollection;
 class MmapFileIO;
 struct _DBTraverseNode;
+struct _IndexHeader;
+typedef struct _IndexHeader IndexHeader;
+namespace detail {
+    class HotKeyCache;
+    class RangeScanner;
+}
 
 typedef struct _MBConfig {
     const char* mbdir;
@@ -59,9 +69,44 @@ typedef struct _MBConfig {
     int num_entry_per_bucket;
     uint32_t queue_size;
     const char* queue_dir;
+    // Number of lanes of the async queue created by the writer, at most 15;
+    // zero selects the default (8). The lanes share the space of queue_size
+    // updates of the largest size, each holding at least one. A handle queues
+    // its updates in lane connect_id % queue_lanes (of its process if
+    // connect_id is zero); handles mapped to the same lane share it.
+    uint32_t queue_lanes;
 
     // Jemalloc configuration
     bool jemalloc_keep_db; // If true, don't call RemoveAll in jemalloc mode
+
+    // Number of entries in the per-handle hot key cache used by Find.
+    // Zero disables the cache. The cache is not shared across threads, so a
+    // handle with the cache enabled must not call Find concurrently.
+    uint32_t hot_key_cache_size;
+
+    // Number of buckets of the exact-match hash index created by a writer
+    // opened with OPTION_HASH_INDEX; zero selects the default (1M). Readers
+    // use the size chosen by the writer. Only keys of up to 24 bytes are
+    // indexed, since a hit is confirmed against the key bytes stored in the
+    // bucket; longer keys are always looked up in the tree.
+    uint32_t hash_index_size;
+
+    // Number of keys the negative-lookup Bloom filter created by a writer
+    // opened with OPTION_BLOOM_FILTER is sized for; zero selects the default
+    // (1M). More keys raise the false positive rate. Readers use the size
+    // chosen by the writer.
+    uint32_t bloom_filter_size;
+
+    // A writer opened with SYNC_GROUP_COMMIT writes its changes back every
+    // sync_interval_ms milliseconds, or as soon as sync_bytes bytes are
+    // pending; zero selects the defaults (10 ms, 4 MB).
+    uint32_t sync_interval_ms;
+    uint32_t sync_bytes;
+
+    // Seconds data rc started by the writer is put off for value views
+    // (DB::FindView) that are still pinned; zero selects the default (60).
+    // Views pinned for longer are no longer valid once data rc starts.
+    uint32_t view_rc_max_wait;
 } MBConfig;
 
 // Database handle class
@@ -70,6 +115,15 @@ class DB {
     friend class ResourceCollection;
 
 public:
+    // Scan visitor: key and value point into buffers reused by the scan and
+    // are only valid during the call. Return false to stop the scan.
+    typedef std::function<bool(const char* key, int key_len, const uint8_t* value, int value_len)> ScanVisitor;
+    // Merge operator run by the writer for Merge: value is NULL if the key is
+    // missing. Set result to the new value, or return false to keep the old one.
+    typedef std::function<bool(const uint8_t* value, int value_len, const uint8_t* operand,
+        int operand_len, std::string& result)>
+        MergeOperator;
+
     // DB iterator class as an inner class
     class iterator {
         friend class DBTraverseBase;
@@ -113,6 +167,57 @@ public:
         LockFree* lfree;
     };
 
+    // Ordered cursor over the DB entries; a reverse cursor visits keys in
+    // descending order. Each move continues from the current position
+    // instead of searching from the root again. key() and value() are valid
+    // until the cursor moves. Moves return SUCCESS when the cursor is on an
+    // entry, NOT_EXIST past the last entry, or TRY_AGAIN if updates from the
+    // writer keep racing the move. Entries added while resource collection
+    // runs are not visited until it completes.
+    class Cursor {
+    public:
+        explicit Cursor(const DB& db, bool reverse = false);
+        ~Cursor();
+        Cursor(const Cursor&) = delete;
+        Cursor& operator=(const Cursor&) = delete;
+
+        // Move to the smallest key, or the largest for a reverse cursor.
+        int SeekToFirst();
+        // Move to the first key >= key, or the last key <= key for a reverse
+        // cursor.
+        int Seek(const char* key, int len);
+        int Seek(const std::string& key);
+        // Move to the following entry in cursor order.
+        int Next();
+        bool Valid() const;
+        const std::string& key() const;
+        const MBData& value() const;
+
+    private:
+        int Move(bool seek, const uint8_t* key, int len);
+
+        const DB& db_ref;
+        std::unique_ptr<detail::RangeScanner> scanner;
+        int last_rval;
+    };
+
+    // Completion of an update queued with the seq overloads of AddAsync and
+    // RemoveAsync, in the manner of std::future. Ready tells whether the
+    // async writer has applied the update; Wait blocks until it has, for at
+    // most timeout_ms milliseconds unless timeout_ms is negative.
+    class AppliedFuture {
+    public:
+        AppliedFuture(const DB& db, uint64_t seq);
+
+        uint64_t Seq() const;
+        bool Ready() const;
+        int Wait(int timeout_ms = -1) const;
+
+    private:
+        const DB& db_ref;
+        uint64_t seq;
+    };
+
     // db_path: database directory
     // db_options: db access option (read/write)
     // memcap_index: maximum memory size in bytes for key index
@@ -132,18 +237,86 @@ public:
     int Add(const char* key, int len, MBData& data, bool overwrite = false);
     int Add(const std::string& key, const std::string& value, bool overwrite = false);
     int AddAsync(const char* key, int len, const char* data, int data_len, bool overwrite = false);
+    // Also return the sequence number of the update for WaitApplied
+    int AddAsync(const char* key, int len, const char* data, int data_len, bool overwrite,
+        uint64_t& seq);
+    // Queue an add taking over the buffers of key and value. Handles opened
+    // with CONSTS::OPTION_ASYNC_HANDOFF in the process of the async writer
+    // hand the update to the writer thread as it is, without a copy into the
+    // shared memory queue, to be applied in order with the other updates
+    // handed over this way. Otherwise it works like the overloads above.
+    int AddAsync(std::string key, std::string value, bool overwrite = false);
+    int AddAsync(std::string key, std::string value, bool overwrite, uint64_t& seq);
     // Check if a key exists in DB
     bool InDB(const char* key, int len, int& err);
     // Find an entry by exact match using a key
     int Find(const char* key, int len, MBData& mdata) const;
     int Find(const std::string& key, MBData& mdata) const;
+    // Find an entry by exact match without copying the value. On success,
+    // view.data points into the mapped data region and stays valid until the
+    // view is released or destroyed; it falls back to a private copy when the
+    // value is not mapped. Views must not outlive the DB handle, and pinned
+    // views hold off data defragmentation and the reuse of released buffers,
+    // so release them promptly.
+    int FindView(const char* key, int len, MBDataView& view) const;
+    int FindView(const std::string& key, MBDataView& view) const;
+    // Copy up to len bytes of the value of key, starting at byte offset of the
+    // value, into buf. read_len receives the number of bytes copied; it is less
+    // than len only at the end of the value. Only the requested part of a large
+    // value is read, so such values can be streamed piece by piece.
+    int ReadValueRange(const char* key, int key_len, int64_t offset, int len, char* buf,
+        int& read_len) const;
+    int ReadValueRange(const std::string& key, int64_t offset, int len, char* buf,
+        int& read_len) const;
+    // Find a batch of keys by exact match under a single reader guard. Keys are
+    // traversed in lockstep so that their index lookups overlap. out is resized
+    // to keys.size() if it is smaller; results[i] receives the Find return code
+    // for keys[i]. Returns SUCCESS unless the batch could not be run. results
+    // may be null; the return code is then SUCCESS only if every key was found
+    // and otherwise the first failing Find return code.
+    int MultiFind(const std::vector<std::string_view>& keys, std::vector<MBData>& out,
+        std::vector<int>* results = nullptr) const;
+    int MultiFind(const char* const* keys, const int* lens, int num_keys, MBData* out,
+        int* results) const;
     // Find the longest prefix match using a key
     int FindLongestPrefix(const char* key, int len, MBData& data) const;
     int FindLongestPrefix(const std::string& key, MBData& data) const;
-    // Find lower bound does not support reader/writer concurrency currently.
     // FindLowerBound returns that largest entry that is not greater than the given key.
+    // It may run concurrently with the writer and returns MBError::TRY_AGAIN if
+    // it keeps racing with updates on its path.
     int FindLowerBound(const char* key, int len, MBData& data, std::string* bound_key = nullptr) const;
     int FindLowerBound(const std::string& key, MBData& data, std::string* bound_key = nullptr) const;
+    // FindUpperBound returns the smallest entry that is not less than the given key.
+    int FindUpperBound(const char* key, int len, MBData& data, std::string* bound_key = nullptr) const;
+    int FindUpperBound(const std::string& key, MBData& data, std::string* bound_key = nullptr) const;
+    // Next and Prev return the entry right after or right before the given
+    // key, which does not need to be in the DB.
+    int Next(const char* key, int len, MBData& data, std::string* next_key = nullptr) const;
+    int Next(const std::string& key, MBData& data, std::string* next_key = nullptr) const;
+    int Prev(const char* key, int len, MBData& data, std::string* prev_key = nullptr) const;
+    int Prev(const std::string& key, MBData& data, std::string* prev_key = nullptr) const;
+    // Visit the entries with start_key <= key < end_key in ascending key order.
+    // An empty end_key means no upper bound and limit 0 means no limit. Every
+    // entry is consistent when visited; entries added or removed during the
+    // scan may or may not be seen. Entries added while resource collection
+    // runs are not visited until it completes. Returns SUCCESS when the range
+    // is exhausted, the limit is reached or the visitor stops the scan.
+    int Scan(const char* start_key, int start_len, const char* end_key, int end_len,
+        int64_t limit, const ScanVisitor& visitor) const;
+    int Scan(const std::string& start_key, const std::string& end_key, int64_t limit,
+        const ScanVisitor& visitor) const;
+    // Order statistics for DBs created with CONSTS::OPTION_SUBTREE_COUNT;
+    // other DBs return MBError::NOT_ALLOWED. Each call descends the tree once
+    // using the entry counts kept in the index nodes. CountPrefix counts the
+    // keys starting with prefix; Rank counts the keys less than key; Select
+    // finds the entry at 0-based position n in key order. They return
+    // MBError::TRY_AGAIN if the writer keeps updating the tree, and while
+    // resource collection runs.
+    int CountPrefix(const char* prefix, int len, int64_t& count) const;
+    int CountPrefix(const std::string& prefix, int64_t& count) const;
+    int Rank(const char* key, int len, int64_t& rank) const;
+    int Rank(const std::string& key, int64_t& rank) const;
+    int Select(int64_t n, MBData& data, std::string* key = nullptr) const;
     int ReadDataByOffset(size_t offset, MBData& data) const;
     int WriteDataByOffset(size_t offset, const char* data, int data_len) const;
     uint8_t* GetDataPtrByOffset(size_t offset) const;
@@ -151,7 +324,45 @@ public:
     // Remove an entry using a key
     int Remove(const char* key, int len);
     int RemoveAsync(const char* key, int len);
+    // With CONSTS::OPTION_ASYNC_HANDOFF, removals in the process of the async
+    // writer are handed to the writer thread like the string overloads of
+    // AddAsync.
+    int RemoveAsync(const char* key, int len, uint64_t& seq);
     int Remove(const std::string& key);
+    // Apply the puts and removals of batch in key order; for a repeated key
+    // only its last entry is applied. The writer takes its locks once for the
+    // whole batch, but readers may still see a batch partly applied. Puts of
+    // existing keys without overwrite and removals of missing keys are
+    // counted in batch.Skipped(); any other error stops the batch. Other
+    // handles pass the entries to the writer through the shared memory queue.
+    // Count() may be short by the current batch if the writer dies during it.
+    int Write(WriteBatch& batch, bool overwrite = false);
+    // Read-modify-write updates. The writer reads the value and writes the
+    // new one in a single step, so updates of the same key from several
+    // handles are not lost. Like AddAsync, other handles pass them to the
+    // writer through the shared memory queue, waiting while it is full, and
+    // only report whether they were queued; the writer logs the updates that
+    // fail.
+    // Add delta to the int64_t value of key, which starts at 0 if missing.
+    // Other value sizes fail with MBError::INVALID_SIZE.
+    int Increment(const char* key, int len, int64_t delta);
+    int Increment(const std::string& key, int64_t delta);
+    // Append data to the value of key; a missing key is added with data.
+    int Append(const char* key, int len, const char* data, int data_len);
+    int Append(const std::string& key, const std::string& data);
+    // Set the value of key to data if the value equals expected, or if the
+    // key is missing and expected is empty. Fails with MBError::COMPARE_FAILED
+    // otherwise. Handles outside the writer process get MBError::NOT_ALLOWED,
+    // since the result of a queued update is not reported back.
+    int CompareAndSwap(const char* key, int len, const char* expected, int expected_len,
+        const char* data, int data_len);
+    int CompareAndSwap(const std::string& key, const std::string& expected, const std::string& data);
+    // Combine the value of key with operand using the merge operator of the
+    // writer handle. Fails with MBError::NOT_ALLOWED if the writer has none.
+    int Merge(const char* key, int len, const char* operand, int operand_len);
+    int Merge(const std::string& key, const std::string& operand);
+    // Set the merge operator of a writer handle
+    int SetMergeOperator(const MergeOperator& merge);
     int RemoveAll();
     int RemoveAllSync();
     // DB Backup
@@ -160,6 +371,20 @@ public:
     // Close the DB handle
     int Close();
     void Flush() const;
+    // Group commit (writer opened with SYNC_GROUP_COMMIT): WriteSeq returns a
+    // sequence number covering the writes made so far, and WaitDurable blocks
+    // until the writes up to seq are on disk. Both fail with NOT_ALLOWED on
+    // other handles; WaitDurable returns WRITE_ERROR once a sync has failed.
+    int WriteSeq(uint64_t& seq) const;
+    int WaitDurable(uint64_t seq) const;
+    // Wait until the async writer has applied the queued updates up to the
+    // sequence number seq from AddAsync or RemoveAsync, so that the handle
+    // reads its own writes. Only the updates queued in the same lane as seq
+    // are waited for. A negative timeout_ms waits without limit;
+    // otherwise MBError::TIMEOUT is returned once timeout_ms milliseconds
+    // have passed. Updates of a reader that exited before completing them
+    // count as applied once the writer skips them.
+    int WaitApplied(uint64_t seq, int timeout_ms = -1) const;
     void Purge() const;
     static void ClearResources(const std::string& path);
 
@@ -193,7 +418,7 @@ public:
     static void LogDebug();
     static void CloseLogFile();
 
-    // Print database stats
+    // Print database stats, including hot key cache hits and misses
     void PrintStats(std::ostream& out_stream = std::cout) const;
     void PrintHeader(std::ostream& out_stream = std::cout) const;
     // current count of key-value pair
@@ -212,6 +437,10 @@ public:
     const std::string& GetDBDir() const;
     uint64_t GetReaderGuardFastSlotCount() const;
     uint64_t GetReaderGuardBarrierFallbackCount() const;
+    // Find calls of this handle answered by the Bloom filter, and Find calls
+    // the filter passed for keys that were not in the DB
+    uint64_t GetBloomFilterSkipCount() const;
+    uint64_t GetBloomFilterFalsePositiveCount() const;
 
     void GetDBConfig(MBConfig& config) const;
 
@@ -227,8 +456,16 @@ public:
     static bool PrefixCacheConfigured(int options) { return (options & CONSTS::OPTION_PREFIX_CACHE) != 0; }
 
 private:
+    friend class MBDataView;
+
+    int FindNeighbor(const char* key, int len, bool inclusive, bool reverse, MBData& data,
+        std::string* neighbor_key) const;
+    int Update(const char* key, int len, int type, const char* operand, int operand_len);
+
     uint64_t BeginReaderEpochGuard() const;
+    uint64_t ClaimReaderEpochSlot(IndexHeader* header) const;
     void EndReaderEpochGuard(uint64_t epoch) const;
+    uint64_t LoadValueSeq() const;
     int EnsureRebuildGuardFd() const;
     int AcquireRebuildBarrierShared() const;
     void ReleaseRebuildBarrierShared() const;
@@ -268,6 +505,9 @@ private:
     AsyncWriter* async_writer;
 
     int writer_lock_fd;
+
+    // per-handle hot key cache for Find; NULL if not configured
+    mutable detail::HotKeyCache* hot_key_cache;
 };
 
 }
@@ -0,0 +1,353 @@
+/**
+ * First-char table selection kernels (scalar, SSE2, AVX2) with runtime
+ * dispatch. Vector loads never read past the nt bytes of the table; the
+ * tail is copied into a padded stack buffer.
+ */
+
+#include "detail/first_char_select.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MB_FIRST_CHAR_X86 1
+#endif
+
+namespace mabain {
+namespace detail {
+
+    // Binary search on a sorted first-char array.
+    // Returns the first index i in [0, n] such that arr[i] >= key.
+    static inline int lower_bound_first_char(const uint8_t* arr, int n, uint8_t key)
+    {
+        int l = 0, r = n;
+        while (l < r) {
+            int m = l + ((r - l) >> 1);
+            if (arr[m] < key)
+                l = m + 1;
+            else
+                r = m;
+        }
+        return l;
+    }
+
+    static void select_scalar(const uint8_t* first_chars, int nt, uint8_t k, bool sorted,
+        int& match_idx, int& less_idx, int& max_idx)
+    {
+        match_idx = -1;
+        less_idx = -1;
+        max_idx = (nt > 0) ? (nt - 1) : -1;
+
+        if (nt <= 0)
+            return;
+
+        if (sorted && nt > FIRST_CHAR_SORTED_MIN) {
+            int lb = lower_bound_first_char(first_chars, nt, k);
+            if (lb < nt && first_chars[lb] == k)
+                match_idx = lb;
+            less_idx = lb - 1;
+            return;
+        }
+
+        int max_val = first_chars[0];
+        max_idx = 0;
+        for (int i = 0; i < nt; ++i) {
+            uint8_t c = first_chars[i];
+            if (c == k && match_idx < 0)
+                match_idx = i;
+            if (c < k && (less_idx < 0 || c > first_chars[less_idx]))
+                less_idx = i;
+            if (c > max_val) {
+                max_val = c;
+                max_idx = i;
+            }
+        }
+    }
+
+    static int match_scalar(const uint8_t* first_chars, int nt, uint8_t k)
+    {
+        for (int i = 0; i < nt; ++i) {
+            if (first_chars[i] == k)
+                return i;
+        }
+        return -1;
+    }
+
+#ifdef MB_FIRST_CHAR_X86
+
+    // 0xFF for the first 32 bytes, 0 for the rest: loading at (32 - rem)
+    // yields a vector whose first rem lanes are set.
+    alignas(64) static const uint8_t lane_mask_table[64] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+    };
+
+    ///////////////////////////////////////////////////////////////////////
+    // SSE2 (baseline on x86-64)
+    ///////////////////////////////////////////////////////////////////////
+
+    // Load 16 chars starting at i. Lanes past nt are padded with 0xFF, which
+    // is never below k; lanes marks the valid ones.
+    static inline void load_chunk_sse2(const uint8_t* first_chars, int nt, int i,
+        __m128i& c, __m128i& lanes, unsigned& valid)
+    {
+        int rem = nt - i;
+        if (rem >= 16) {
+            c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first_chars + i));
+            lanes = _mm_set1_epi8(-1);
+            valid = 0xFFFF;
+        } else {
+            alignas(16) uint8_t buf[16];
+            memset(buf, 0xFF, sizeof(buf));
+            memcpy(buf, first_chars + i, rem);
+            c = _mm_load_si128(reinterpret_cast<const __m128i*>(buf));
+            lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lane_mask_table + 32 - rem));
+            valid = (1U << rem) - 1;
+        }
+    }
+
+    static inline uint8_t hmax_epu8_sse2(__m128i v)
+    {
+        v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+        v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+        v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+        v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+        return static_cast<uint8_t>(_mm_cvtsi128_si32(v));
+    }
+
+    static int match_sse2(const uint8_t* first_chars, int nt, uint8_t k)
+    {
+        const __m128i kv = _mm_set1_epi8(static_cast<char>(k));
+        __m128i c, lanes;
+        unsigned valid;
+        for (int i = 0; i < nt; i += 16) {
+            load_chunk_sse2(first_chars, nt, i, c, lanes, valid);
+            unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, kv))) & valid;
+            if (eq)
+                return i + __builtin_ctz(eq);
+        }
+        return -1;
+    }
+
+    static void select_sse2(const uint8_t* first_chars, int nt, uint8_t k, bool sorted,
+        int& match_idx, int& less_idx, int& max_idx)
+    {
+        match_idx = -1;
+        less_idx = -1;
+        max_idx = (nt > 0) ? (nt - 1) : -1;
+
+        if (nt <= 0)
+            return;
+
+        const __m128i kv = _mm_set1_epi8(static_cast<char>(k));
+        __m128i c, lanes;
+        unsigned valid;
+
+        if (sorted && nt > FIRST_CHAR_SORTED_MIN) {
+            // Insertion position is the number of chars below k. Past four
+            // 16-byte chunks the binary search is cheaper.
+            if (nt > 64) {
+                select_scalar(first_chars, nt, k, sorted, match_idx, less_idx, max_idx);
+                return;
+            }
+            int lb = 0;
+            for (int i = 0; i < nt; i += 16) {
+                load_chunk_sse2(first_chars, nt, i, c, lanes, valid);
+                unsigned ge = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(c, kv), c)));
+                lb += __builtin_popcount(~ge & valid);
+            }
+            if (lb < nt && first_chars[lb] == k)
+                match_idx = lb;
+            less_idx = lb - 1;
+            return;
+        }
+
+        // Pass 1: first match, largest char below k (stored as c + 1 so that
+        // zero means none) and largest char.
+        const __m128i one = _mm_set1_epi8(1);
+        __m128i lt_max = _mm_setzero_si128();
+        __m128i c_max = _mm_setzero_si128();
+        for (int i = 0; i < nt; i += 16) {
+            load_chunk_sse2(first_chars, nt, i, c, lanes, valid);
+            if (match_idx < 0) {
+                unsigned eq = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, kv))) & valid;
+                if (eq)
+                    match_idx = i + __builtin_ctz(eq);
+            }
+            __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(c, kv), c);
+            lt_max = _mm_max_epu8(lt_max, _mm_andnot_si128(ge, _mm_add_epi8(c, one)));
+            c_max = _mm_max_epu8(c_max, _mm_and_si128(c, lanes));
+        }
+        int lt_val = hmax_epu8_sse2(lt_max);
+        const __m128i ltv = _mm_set1_epi8(static_cast<char>(lt_val - 1));
+        const __m128i cmv = _mm_set1_epi8(static_cast<char>(hmax_epu8_sse2(c_max)));
+
+        // Pass 2: first positions of those values.
+        max_idx = -1;
+        for (int i = 0; i < nt && (max_idx < 0 || (lt_val > 0 && less_idx < 0)); i += 16) {
+            load_chunk_sse2(first_chars, nt, i, c, lanes, valid);
+            if (max_idx < 0) {
+                unsigned m = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, cmv))) & valid;
+                if (m)
+                    max_idx = i + __builtin_ctz(m);
+            }
+            if (lt_val > 0 && less_idx < 0) {
+                unsigned m = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(c, ltv))) & valid;
+                if (m)
+                    less_idx = i + __builtin_ctz(m);
+            }
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////
+    // AVX2 (compiled with a target attribute, only called after cpuid check)
+    ///////////////////////////////////////////////////////////////////////
+
+    __attribute__((target("avx2"))) static inline void load_chunk_avx2(const uint8_t* first_chars,
+        int nt, int i, __m256i& c, __m256i& lanes, unsigned& valid)
+    {
+        int rem = nt - i;
+        if (rem >= 32) {
+            c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first_chars + i));
+            lanes = _mm256_set1_epi8(-1);
+            valid = 0xFFFFFFFFU;
+        } else {
+            alignas(32) uint8_t buf[32];
+            memset(buf, 0xFF, sizeof(buf));
+            memcpy(buf, first_chars + i, rem);
+            c = _mm256_load_si256(reinterpret_cast<const __m256i*>(buf));
+            lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lane_mask_table + 32 - rem));
+            valid = (1U << rem) - 1;
+        }
+    }
+
+    __attribute__((target("avx2"))) static inline uint8_t hmax_epu8_avx2(__m256i v)
+    {
+        return hmax_epu8_sse2(_mm_max_epu8(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+    }
+
+    __attribute__((target("avx2"))) static int match_avx2(const uint8_t* first_chars, int nt, uint8_t k)
+    {
+        if (nt <= 16)
+            return match_sse2(first_chars, nt, k);
+        const __m256i kv = _mm256_set1_epi8(static_cast<char>(k));
+        __m256i c, lanes;
+        unsigned valid;
+        for (int i = 0; i < nt; i += 32) {
+            load_chunk_avx2(first_chars, nt, i, c, lanes, valid);
+            unsigned eq = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, kv))) & valid;
+            if (eq)
+                return i + __builtin_ctz(eq);
+        }
+        return -1;
+    }
+
+    __attribute__((target("avx2"))) static void select_avx2(const uint8_t* first_chars, int nt,
+        uint8_t k, bool sorted, int& match_idx, int& less_idx, int& max_idx)
+    {
+        if (nt <= 16) {
+            select_sse2(first_chars, nt, k, sorted, match_idx, less_idx, max_idx);
+            return;
+        }
+
+        match_idx = -1;
+        less_idx = -1;
+        max_idx = nt - 1;
+
+        const __m256i kv = _mm256_set1_epi8(static_cast<char>(k));
+        __m256i c, lanes;
+        unsigned valid;
+
+        if (sorted && nt > FIRST_CHAR_SORTED_MIN) {
+            int lb = 0;
+            for (int i = 0; i < nt; i += 32) {
+                load_chunk_avx2(first_chars, nt, i, c, lanes, valid);
+                unsigned ge = static_cast<unsigned>(
+                    _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(c, kv), c)));
+                lb += __builtin_popcount(~ge & valid);
+            }
+            if (lb < nt && first_chars[lb] == k)
+                match_idx = lb;
+            less_idx = lb - 1;
+            return;
+        }
+
+        const __m256i one = _mm256_set1_epi8(1);
+        __m256i lt_max = _mm256_setzero_si256();
+        __m256i c_max = _mm256_setzero_si256();
+        for (int i = 0; i < nt; i += 32) {
+            load_chunk_avx2(first_chars, nt, i, c, lanes, valid);
+            if (match_idx < 0) {
+                unsigned eq = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, kv))) & valid;
+                if (eq)
+                    match_idx = i + __builtin_ctz(eq);
+            }
+            __m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(c, kv), c);
+            lt_max = _mm256_max_epu8(lt_max, _mm256_andnot_si256(ge, _mm256_add_epi8(c, one)));
+            c_max = _mm256_max_epu8(c_max, _mm256_and_si256(c, lanes));
+        }
+        int lt_val = hmax_epu8_avx2(lt_max);
+        const __m256i ltv = _mm256_set1_epi8(static_cast<char>(lt_val - 1));
+        const __m256i cmv = _mm256_set1_epi8(static_cast<char>(hmax_epu8_avx2(c_max)));
+
+        max_idx = -1;
+        for (int i = 0; i < nt && (max_idx < 0 || (lt_val > 0 && less_idx < 0)); i += 32) {
+            load_chunk_avx2(first_chars, nt, i, c, lanes, valid);
+            if (max_idx < 0) {
+                unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, cmv))) & valid;
+                if (m)
+                    max_idx = i + __builtin_ctz(m);
+            }
+            if (lt_val > 0 && less_idx < 0) {
+                unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, ltv))) & valid;
+                if (m)
+                    less_idx = i + __builtin_ctz(m);
+            }
+        }
+    }
+
+#endif // MB_FIRST_CHAR_X86
+
+    static const FirstCharKernel scalar_kernel = { "scalar", select_scalar, match_scalar };
+#ifdef MB_FIRST_CHAR_X86
+    static const FirstCharKernel sse2_kernel = { "sse2", select_sse2, match_sse2 };
+    static const FirstCharKernel avx2_kernel = { "avx2", select_avx2, match_avx2 };
+
+    static bool cpu_has_avx2()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    int AvailableFirstCharKernels(const FirstCharKernel** kernels, int max_kernels)
+    {
+        int n = 0;
+        if (n < max_kernels)
+            kernels[n++] = &scalar_kernel;
+#ifdef MB_FIRST_CHAR_X86
+        if (n < max_kernels)
+            kernels[n++] = &sse2_kernel;
+        if (n < max_kernels && cpu_has_avx2())
+            kernels[n++] = &avx2_kernel;
+#endif
+        return n;
+    }
+
+    // Constant-initialized, so lookups made before the dispatcher below runs
+    // (static init order) still get a valid kernel.
+    const FirstCharKernel* first_char_kernel = &scalar_kernel;
+
+    namespace {
+        struct FirstCharKernelInit {
+            FirstCharKernelInit()
+            {
+                const FirstCharKernel* kernels[3];
+                int n = AvailableFirstCharKernels(kernels, 3);
+                first_char_kernel = kernels[n - 1];
+            }
+        } first_char_kernel_init;
+    }
+
+} // namespace detail
+} // namespace mabain
@@ -0,0 +1,39 @@
+/**
+ * Internal helper: child selection over a node's first-char table.
+ * Scalar, SSE2 and AVX2 kernels; one is picked at load time via cpuid so
+ * portable builds still use vector instructions when the CPU has them.
+ * Not part of the public API.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace mabain {
+namespace detail {
+
+    // match_idx: first index whose char equals k, or -1.
+    // less_idx:  index of the largest char below k (first occurrence), or -1.
+    // max_idx:   index of the largest char (first occurrence).
+    // For sorted nodes with more than FIRST_CHAR_SORTED_MIN edges, less_idx and
+    // max_idx are derived from the insertion position instead.
+    typedef void (*FirstCharSelectFn)(const uint8_t* first_chars, int nt, uint8_t k,
+        bool sorted, int& match_idx, int& less_idx, int& max_idx);
+    // First index whose char equals k, or -1.
+    typedef int (*FirstCharMatchFn)(const uint8_t* first_chars, int nt, uint8_t k);
+
+    struct FirstCharKernel {
+        const char* name;
+        FirstCharSelectFn select;
+        FirstCharMatchFn match;
+    };
+
+    static constexpr int FIRST_CHAR_SORTED_MIN = 10;
+
+    // Kernel chosen for this process; never null.
+    extern const FirstCharKernel* first_char_kernel;
+
+    // Kernels usable on this CPU, scalar first. Returns the number written.
+    int AvailableFirstCharKernels(const FirstCharKernel** kernels, int max_kernels);
+
+} // namespace detail
+} // namespace mabain
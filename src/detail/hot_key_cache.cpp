@@ -0,0 +1,164 @@
+/**
+ * Internal per-handle hot key cache; see hot_key_cache.h.
+ */
+
+#include "detail/hot_key_cache.h"
+#include "dict.h"
+#include "error.h"
+#include "integer_4b_5b.h"
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+namespace mabain {
+namespace detail {
+
+    HotKeyCache::HotKeyCache(Dict& d, uint32_t capacity)
+        : dict(d)
+        , lfree(d.GetLockFreePtr())
+        , last_counter(0)
+        , hit_count(0)
+        , miss_count(0)
+    {
+        uint64_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        entries.resize(size);
+        for (Entry& entry : entries)
+            entry.num_edges = 0;
+        mask = size - 1;
+    }
+
+    int HotKeyCache::find(const uint8_t* key, int len, MBData& data)
+    {
+        SearchEngine engine(dict);
+        // Entries only describe the main root; bypass while rc builds a new tree.
+        if ((data.options & ~CONSTS::OPTION_READ_SAVED_EDGE) != 0
+            || dict.GetHeaderPtr()->rc_root_offset.load(MEMORY_ORDER_READER) != 0)
+            return engine.find(key, len, data);
+
+        LockFreeData snap;
+        lfree->ReaderLockFreeStart(snap);
+        if (static_cast<int32_t>(snap.counter - last_counter) < 0) {
+            for (Entry& entry : entries)
+                entry.num_edges = 0;
+        }
+        last_counter = snap.counter;
+
+        uint64_t hash = std::hash<std::string_view>()(
+            std::string_view(reinterpret_cast<const char*>(key), len));
+        Entry& entry = entries[hash & mask];
+        if (entry.num_edges > 0 && entry.hash == hash && entry.key.size() == static_cast<size_t>(len)
+            && memcmp(entry.key.data(), key, len) == 0) {
+            if (readEntry(entry, snap, data) == MBError::SUCCESS) {
+                data.match_len = len;
+                hit_count++;
+                return MBError::SUCCESS;
+            }
+            entry.num_edges = 0;
+        }
+
+        miss_count++;
+        IndexHeader* header = dict.GetHeaderPtr();
+        SearchEngine::EdgeTrace trace;
+        engine.setEdgeTrace(&trace);
+        int attempts = 0;
+        uint32_t free_seq;
+        while (true) {
+            free_seq = header->index_free_seq.load(std::memory_order_acquire);
+            int rval = engine.find(key, len, data);
+            if (rval != MBError::SUCCESS)
+                return rval;
+            // find does not re-check the last edge after reading the value;
+            // validate the whole path so that a torn value is neither
+            // returned nor cached.
+            if (trace.count > SearchEngine::EdgeTrace::MAX_EDGES)
+                return rval;
+            if (lfree->ReaderLockFreeUnchanged(snap, trace.offsets, trace.count))
+                break;
+            if (attempts++ >= CONSTS::LOCK_FREE_RETRY_LIMIT)
+                return MBError::TRY_AGAIN;
+            lfree->ReaderLockFreeStart(snap);
+        }
+        fillEntry(entry, hash, key, len, trace, snap, free_seq, data);
+        return MBError::SUCCESS;
+    }
+
+    int HotKeyCache::readEntry(Entry& entry, const LockFreeData& snap, MBData& data)
+    {
+        IndexHeader* header = dict.GetHeaderPtr();
+        size_t leaf_offset = entry.edge_offsets[entry.num_edges - 1];
+        uint32_t free_seq = header->index_free_seq.load(std::memory_order_acquire);
+        bool in_rc = header->rc_m_index_off_pre != 0 || header->rc_m_data_off_pre != 0;
+        // No node released since the entry was validated means the leaf edge
+        // is still where it was and rereading it is enough. Otherwise the
+        // path must not have been touched since then.
+        bool moved = in_rc || free_seq != entry.free_seq;
+        LockFreeData since;
+        since.counter = entry.counter;
+        if (moved && !lfree->ReaderLockFreeUnchanged(since, entry.edge_offsets, entry.num_edges))
+            return MBError::TRY_AGAIN;
+
+        // The writer counter restarts from zero when a writer reopens the DB;
+        // make sure the leaf edge still points at the cached value.
+        uint8_t edge[EDGE_SIZE];
+        if (dict.GetMM()->ReadData(edge, EDGE_SIZE, leaf_offset) != EDGE_SIZE
+            || !(edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF)
+            || Get6BInteger(edge + EDGE_NODE_LEADING_POS) != entry.data_offset)
+            return MBError::TRY_AGAIN;
+
+        int rval = dict.ReadDataByOffset(entry.data_offset, data);
+        if (rval != MBError::SUCCESS)
+            return rval;
+        if (moved) {
+            if (!lfree->ReaderLockFreeUnchanged(since, entry.edge_offsets, entry.num_edges))
+                return MBError::TRY_AGAIN;
+            // The whole path is valid as of snap; later hits check from here.
+            entry.counter = snap.counter;
+            if (!in_rc)
+                entry.free_seq = free_seq;
+        } else {
+            // Only the leaf edge was checked, so the entry keeps its counter.
+            if (!lfree->ReaderLockFreeUnchanged(snap, &leaf_offset, 1))
+                return MBError::TRY_AGAIN;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->index_free_seq.load(std::memory_order_relaxed) != free_seq)
+                return MBError::TRY_AGAIN;
+        }
+        data.data_offset = entry.data_offset;
+        return MBError::SUCCESS;
+    }
+
+    void HotKeyCache::fillEntry(Entry& entry, uint64_t hash, const uint8_t* key, int len,
+        const SearchEngine::EdgeTrace& trace, const LockFreeData& snap, uint32_t free_seq,
+        const MBData& data)
+    {
+        // Only leaf matches on the main root are cached; values stored in an
+        // internal node header are not covered by the edge offsets.
+        if (trace.count <= 0
+            || !(data.edge_ptrs.flag_ptr[0] & EDGE_FLAG_DATA_OFF)
+            || data.edge_ptrs.offset != trace.offsets[trace.count - 1]
+            || dict.GetHeaderPtr()->rc_root_offset.load(MEMORY_ORDER_READER) != 0)
+            return;
+
+        entry.hash = hash;
+        entry.key.assign(reinterpret_cast<const char*>(key), len);
+        entry.data_offset = data.data_offset;
+        entry.counter = snap.counter;
+        entry.free_seq = free_seq;
+        memcpy(entry.edge_offsets, trace.offsets, trace.count * sizeof(size_t));
+        entry.num_edges = trace.count;
+    }
+
+    void HotKeyCache::printStats(std::ostream& os) const
+    {
+        uint64_t total = hit_count + miss_count;
+        os << "Hot key cache:\n";
+        os << "\tCapacity: " << entries.size() << std::endl;
+        os << "\tHits: " << hit_count << std::endl;
+        os << "\tMisses: " << miss_count << std::endl;
+        os << "\tHit rate: " << (total > 0 ? 100.0 * hit_count / total : 0.0) << "%" << std::endl;
+    }
+
+} // namespace detail
+} // namespace mabain
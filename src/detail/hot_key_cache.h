@@ -0,0 +1,66 @@
+/**
+ * Internal helper: per-handle cache of resolved leaf edges for hot keys.
+ * An entry maps a full key to the offsets of the edges on its path and to
+ * its data offset. While no index node has been released since an entry was
+ * validated, its leaf edge has not moved and a hit only rereads that edge;
+ * otherwise the path is checked against the lock-free writer counter and
+ * offset cache. Not part of the public API.
+ */
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "detail/search_engine.h"
+#include "dict.h"
+#include "mb_data.h"
+
+namespace mabain {
+namespace detail {
+
+    class HotKeyCache {
+    public:
+        // capacity is rounded up to a power of two.
+        HotKeyCache(Dict& d, uint32_t capacity);
+
+        // Same contract as SearchEngine::find.
+        int find(const uint8_t* key, int len, MBData& data);
+
+        void printStats(std::ostream& os) const;
+        uint64_t hits() const { return hit_count; }
+        uint64_t misses() const { return miss_count; }
+
+    private:
+        struct Entry {
+            uint64_t hash;
+            std::string key;
+            size_t data_offset;
+            // lock-free counter and index_free_seq the path was last
+            // validated at
+            uint32_t counter;
+            uint32_t free_seq;
+            int num_edges; // 0 if the entry is empty
+            size_t edge_offsets[SearchEngine::EdgeTrace::MAX_EDGES];
+        };
+
+        int readEntry(Entry& entry, const LockFreeData& snap, MBData& data);
+        void fillEntry(Entry& entry, uint64_t hash, const uint8_t* key, int len,
+            const SearchEngine::EdgeTrace& trace, const LockFreeData& snap, uint32_t free_seq,
+            const MBData& data);
+
+        Dict& dict;
+        LockFree* lfree;
+        std::vector<Entry> entries;
+        uint64_t mask;
+        // highest counter seen; a counter going backwards means the writer
+        // restarted and every entry is dropped
+        uint32_t last_counter;
+
+        uint64_t hit_count;
+        uint64_t miss_count;
+    };
+
+} // namespace detail
+} // namespace mabain
@@ -0,0 +1,506 @@
+/**
+ * Internal ordered traversal; see range_scanner.h.
+ */
+
+#include "detail/range_scanner.h"
+#include "error.h"
+#include "integer_4b_5b.h"
+#include <algorithm>
+#include <cstring>
+#include <time.h>
+
+namespace mabain {
+namespace detail {
+
+    static inline int compare_keys(const uint8_t* a, int alen, const uint8_t* b, int blen)
+    {
+        int cmp = memcmp(a, b, std::min(alen, blen));
+        return (cmp != 0) ? cmp : alen - blen;
+    }
+
+    RangeScanner::RangeScanner(Dict& d, bool reverse_order)
+        : RangeScanner(d, reverse_order, 0)
+    {
+    }
+
+    RangeScanner::RangeScanner(Dict& d, bool reverse_order, size_t root)
+        : dict(d)
+        , lfree(d.GetLockFreePtr())
+        , reverse(reverse_order)
+        , root_off(root)
+        , main_rval(MBError::NOT_INITIALIZED)
+        , rc_rval(MBError::NOT_INITIALIZED)
+        , merging(false)
+        , depth(0)
+        , end_key(nullptr)
+        , end_key_len(-1)
+        , resume_inclusive(true)
+        , seek_last(reverse_order)
+        , positioned(false)
+    {
+        snap.counter = 0;
+        frames.reserve(16);
+    }
+
+    void RangeScanner::seek(const uint8_t* target, int len, bool inclusive)
+    {
+        resume_key.clear();
+        if (len > 0)
+            resume_key.assign(reinterpret_cast<const char*>(target), len);
+        resume_inclusive = inclusive;
+        seek_last = reverse && len == 0;
+        positioned = false;
+        merging = false;
+        depth = 0;
+    }
+
+    void RangeScanner::setEnd(const uint8_t* end, int end_len)
+    {
+        end_key = end;
+        end_key_len = end_len;
+    }
+
+    int RangeScanner::next()
+    {
+        if (root_off == 0) {
+            size_t rc_root = dict.GetHeaderPtr()->rc_root_offset.load(MEMORY_ORDER_READER);
+            if (rc_root != 0)
+                return nextMerged(rc_root);
+            if (merging) {
+                // Continue in the main tree after the last merged entry.
+                merging = false;
+                positioned = false;
+            }
+            if (dict.reader_rc_off != 0) {
+                dict.reader_rc_off = 0;
+                dict.RemoveUnused(0);
+                dict.mm.RemoveUnused(0);
+            }
+        }
+        return nextInTree();
+    }
+
+    int RangeScanner::nextInTree()
+    {
+        int rval = MBError::SUCCESS;
+        for (int attempts = 0;; attempts++) {
+            if (!positioned) {
+                rval = position();
+                positioned = (rval == MBError::SUCCESS);
+            }
+            if (positioned) {
+                rval = step();
+                if (rval == MBError::SUCCESS)
+                    return rval;
+                if (rval != MBError::TRY_AGAIN) {
+                    depth = 0;
+                    return rval;
+                }
+                positioned = false;
+            }
+            if (rval != MBError::TRY_AGAIN || attempts >= CONSTS::LOCK_FREE_RETRY_LIMIT)
+                return rval;
+            nanosleep((const struct timespec[]) { { 0, 10L } }, NULL);
+        }
+    }
+
+    // Both trees are walked by child scanners that stay positioned between
+    // calls; only the one whose entry was returned advances, and each seeks
+    // again from its own last entry after a lost race. When rc finishes the
+    // main tree is searched again from the last returned key; rc copies its
+    // entries to the main tree before it drops the rc tree, so none is missed.
+    int RangeScanner::nextMerged(size_t rc_root)
+    {
+        dict.reader_rc_off = rc_root;
+        if (!merging || rc_scanner->root_off != rc_root) {
+            if (!main_scanner)
+                main_scanner.reset(new RangeScanner(dict, reverse, 0));
+            if (!rc_scanner || rc_scanner->root_off != rc_root)
+                rc_scanner.reset(new RangeScanner(dict, reverse, rc_root));
+            RangeScanner* children[] = { main_scanner.get(), rc_scanner.get() };
+            for (RangeScanner* child : children) {
+                child->setEnd(end_key, end_key_len);
+                child->resume_key = resume_key;
+                child->resume_inclusive = resume_inclusive;
+                child->seek_last = seek_last;
+                child->positioned = false;
+            }
+            main_rval = MBError::NOT_INITIALIZED;
+            rc_rval = MBError::NOT_INITIALIZED;
+            positioned = false;
+            merging = true;
+        }
+
+        if (rc_rval == MBError::NOT_INITIALIZED) {
+            int rval = rc_scanner->nextInTree();
+            if (rval != MBError::SUCCESS && rval != MBError::NOT_EXIST)
+                return rval;
+            rc_rval = rval;
+        }
+        if (main_rval == MBError::NOT_INITIALIZED) {
+            int rval = main_scanner->nextInTree();
+            if (rval != MBError::SUCCESS && rval != MBError::NOT_EXIST)
+                return rval;
+            main_rval = rval;
+        }
+        if (rc_rval == MBError::NOT_EXIST && main_rval == MBError::NOT_EXIST)
+            return MBError::NOT_EXIST;
+
+        int cmp = 1;
+        if (rc_rval == MBError::NOT_EXIST) {
+            cmp = -1;
+        } else if (main_rval == MBError::SUCCESS) {
+            const std::string& main_key = main_scanner->curr_key;
+            const std::string& rc_key = rc_scanner->curr_key;
+            cmp = compare_keys(reinterpret_cast<const uint8_t*>(main_key.data()), main_key.size(),
+                reinterpret_cast<const uint8_t*>(rc_key.data()), rc_key.size());
+            if (reverse)
+                cmp = -cmp;
+        }
+        if (cmp < 0) {
+            main_rval = MBError::NOT_INITIALIZED;
+            return takeEntry(*main_scanner);
+        }
+        // The rc tree entry replaces a main tree entry with the same key.
+        if (cmp == 0)
+            main_rval = MBError::NOT_INITIALIZED;
+        rc_rval = MBError::NOT_INITIALIZED;
+        return takeEntry(*rc_scanner);
+    }
+
+    int RangeScanner::takeEntry(const RangeScanner& from)
+    {
+        const MBData& value = from.curr_value;
+        if (curr_value.buff_len < value.data_len + 1 && curr_value.Resize(value.data_len) != MBError::SUCCESS)
+            return MBError::NO_MEMORY;
+        memcpy(curr_value.buff, value.buff, value.data_len);
+        curr_value.data_len = value.data_len;
+        curr_value.bucket_index = value.bucket_index;
+        curr_value.data_offset = value.data_offset;
+        curr_key = from.curr_key;
+        resume_key = curr_key;
+        resume_inclusive = false;
+        seek_last = false;
+        return MBError::SUCCESS;
+    }
+
+    int RangeScanner::scan(const uint8_t* start, int start_len, const uint8_t* end, int end_len,
+        int64_t limit, const DB::ScanVisitor& visitor)
+    {
+        if (end_len >= 0 && compare_keys(start, start_len, end, end_len) >= 0)
+            return MBError::SUCCESS;
+
+        setEnd(end, end_len);
+        seek(start, start_len, true);
+        int64_t count = 0;
+        while (true) {
+            int rval = next();
+            if (rval == MBError::NOT_EXIST)
+                return MBError::SUCCESS;
+            if (rval != MBError::SUCCESS)
+                return rval;
+            if (!visitor(curr_key.data(), curr_key.size(), curr_value.buff, curr_value.data_len))
+                return MBError::SUCCESS;
+            if (limit > 0 && ++count == limit)
+                return MBError::SUCCESS;
+        }
+    }
+
+    // Rebuild the frame stack from the resume position.
+    int RangeScanner::position()
+    {
+        depth = 0;
+        curr_key.clear();
+        lfree->ReaderLockFreeStart(snap);
+        int rval = pushNode((root_off != 0) ? root_off : dict.GetMM()->GetRootOffset(), 0);
+        if (rval != MBError::SUCCESS)
+            return rval;
+
+        const uint8_t* target = reinterpret_cast<const uint8_t*>(resume_key.data());
+        int target_len = resume_key.size();
+        if (!reverse)
+            return positionForward(target, target_len, resume_inclusive);
+        if (seek_last) {
+            frames[0].next = frames[0].nt;
+            return MBError::SUCCESS;
+        }
+        return positionReverse(target, target_len, resume_inclusive);
+    }
+
+    // Descend along target so that the walk continues with the first key
+    // not less than target (greater than target if not inclusive).
+    int RangeScanner::positionForward(const uint8_t* target, int target_len, bool inclusive)
+    {
+        int matched = 0;
+        while (true) {
+            Frame& frame = frames[depth - 1];
+            frame.next = 0;
+            if (matched == target_len) {
+                if (!inclusive)
+                    frame.emit_match = false;
+                return MBError::SUCCESS;
+            }
+            // The node's own key is a proper prefix of target.
+            frame.emit_match = false;
+
+            uint8_t c = target[matched];
+            int pos = 0;
+            while (pos < frame.nt && frame.first_chars[frame.order[pos]] < c)
+                pos++;
+            frame.next = pos;
+            if (pos == frame.nt || frame.first_chars[frame.order[pos]] != c)
+                return MBError::SUCCESS;
+
+            int idx = frame.order[pos];
+            const uint8_t* edge = frame.edges + idx * EDGE_SIZE;
+            if (edge[EDGE_LEN_POS] == 0) {
+                frame.next = pos + 1;
+                return MBError::SUCCESS;
+            }
+            int rval = appendEdgeKey(frame, idx);
+            if (rval != MBError::SUCCESS)
+                return rval;
+
+            int label_len = static_cast<int>(curr_key.size()) - matched;
+            int target_rem = target_len - matched;
+            int cmp = memcmp(curr_key.data() + matched, target + matched, std::min(label_len, target_rem));
+            if (cmp < 0) {
+                frame.next = pos + 1;
+                return MBError::SUCCESS;
+            }
+            if (cmp > 0 || label_len > target_rem)
+                return MBError::SUCCESS;
+
+            // The edge label is a prefix of the rest of target.
+            if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF) {
+                if (label_len < target_rem || !inclusive)
+                    frame.next = pos + 1;
+                return MBError::SUCCESS;
+            }
+            frame.next = pos + 1;
+            rval = pushNode(Get6BInteger(edge + EDGE_NODE_LEADING_POS), curr_key.size());
+            if (rval != MBError::SUCCESS)
+                return rval;
+            matched += label_len;
+        }
+    }
+
+    // Descend along target so that the walk continues with the last key not
+    // greater than target (less than target if not inclusive).
+    int RangeScanner::positionReverse(const uint8_t* target, int target_len, bool inclusive)
+    {
+        int matched = 0;
+        while (true) {
+            Frame& frame = frames[depth - 1];
+            if (matched == target_len) {
+                // Every child is greater than target.
+                frame.next = 0;
+                if (!inclusive)
+                    frame.emit_match = false;
+                return MBError::SUCCESS;
+            }
+
+            // Children before pos are less than target.
+            uint8_t c = target[matched];
+            int pos = 0;
+            while (pos < frame.nt && frame.first_chars[frame.order[pos]] < c)
+                pos++;
+            frame.next = pos;
+            if (pos == frame.nt || frame.first_chars[frame.order[pos]] != c)
+                return MBError::SUCCESS;
+
+            int idx = frame.order[pos];
+            const uint8_t* edge = frame.edges + idx * EDGE_SIZE;
+            if (edge[EDGE_LEN_POS] == 0)
+                return MBError::SUCCESS;
+            int rval = appendEdgeKey(frame, idx);
+            if (rval != MBError::SUCCESS)
+                return rval;
+
+            int label_len = static_cast<int>(curr_key.size()) - matched;
+            int target_rem = target_len - matched;
+            int cmp = memcmp(curr_key.data() + matched, target + matched, std::min(label_len, target_rem));
+            if (cmp < 0) {
+                frame.next = pos + 1;
+                return MBError::SUCCESS;
+            }
+            if (cmp > 0 || label_len > target_rem)
+                return MBError::SUCCESS;
+
+            // The edge label is a prefix of the rest of target.
+            if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF) {
+                if (label_len < target_rem || inclusive)
+                    frame.next = pos + 1;
+                return MBError::SUCCESS;
+            }
+            // The child is visited through the pushed frame only.
+            rval = pushNode(Get6BInteger(edge + EDGE_NODE_LEADING_POS), curr_key.size());
+            if (rval != MBError::SUCCESS)
+                return rval;
+            matched += label_len;
+        }
+    }
+
+    // Walk the frame stack up to the next entry.
+    int RangeScanner::step()
+    {
+        while (depth > 0) {
+            Frame& frame = frames[depth - 1];
+            int idx;
+            if (!reverse && frame.emit_match) {
+                frame.emit_match = false;
+                curr_key.resize(frame.key_len);
+                return emit(Get6BInteger(frame.header + 2));
+            }
+            if (reverse ? frame.next > 0 : frame.next < frame.nt) {
+                idx = reverse ? frame.order[--frame.next] : frame.order[frame.next++];
+            } else if (reverse && frame.emit_match) {
+                // A node's own key sorts before all of its children.
+                frame.emit_match = false;
+                curr_key.resize(frame.key_len);
+                return emit(Get6BInteger(frame.header + 2));
+            } else {
+                // Nothing below this node was changed while it was walked.
+                if (!pathUnchanged())
+                    return MBError::TRY_AGAIN;
+                depth--;
+                continue;
+            }
+
+            const uint8_t* edge = frame.edges + idx * EDGE_SIZE;
+            if (edge[EDGE_LEN_POS] == 0)
+                continue;
+            int rval = appendEdgeKey(frame, idx);
+            if (rval != MBError::SUCCESS)
+                return rval;
+
+            // Every key below this edge starts with curr_key.
+            if (end_key_len >= 0
+                && compare_keys(reinterpret_cast<const uint8_t*>(curr_key.data()), curr_key.size(),
+                       end_key, end_key_len)
+                    >= 0)
+                return pathUnchanged() ? MBError::NOT_EXIST : MBError::TRY_AGAIN;
+
+            size_t offset = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+            if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF)
+                return emit(offset);
+            rval = pushNode(offset, curr_key.size());
+            if (rval != MBError::SUCCESS)
+                return rval;
+        }
+        return MBError::NOT_EXIST;
+    }
+
+    int RangeScanner::pushNode(size_t node_off, int key_len)
+    {
+        if (depth == static_cast<int>(frames.size()))
+            frames.emplace_back();
+        Frame& frame = frames[depth++];
+        frame.node_off = node_off;
+        frame.node_end = node_off;
+        frame.key_len = key_len;
+        frame.nt = 0;
+        frame.next = 0;
+        frame.emit_match = false;
+
+        const DictMem* mm = dict.GetMM();
+        int rval = MBError::SUCCESS;
+        if (mm->ReadData(frame.header, NODE_EDGE_KEY_FIRST, node_off) != NODE_EDGE_KEY_FIRST) {
+            rval = MBError::READ_ERROR;
+        } else {
+            int nt = frame.header[1] + 1;
+            frame.node_end = node_off + NODE_EDGE_KEY_FIRST + nt + nt * EDGE_SIZE;
+            if (mm->ReadData(frame.first_chars, nt, node_off + NODE_EDGE_KEY_FIRST) != nt
+                || mm->ReadData(frame.edges, nt * EDGE_SIZE, node_off + NODE_EDGE_KEY_FIRST + nt)
+                    != nt * EDGE_SIZE)
+                rval = MBError::READ_ERROR;
+            frame.nt = nt;
+        }
+        if (!pathUnchanged())
+            return MBError::TRY_AGAIN;
+        if (rval != MBError::SUCCESS)
+            return rval;
+
+        frame.emit_match = frame.header[0] & FLAG_NODE_MATCH;
+        int nt = frame.nt;
+        if (frame.header[0] & FLAG_NODE_SORTED) {
+            for (int i = 0; i < nt; i++)
+                frame.order[i] = i;
+        } else if (nt <= 16) {
+            for (int i = 0; i < nt; i++) {
+                int j = i;
+                for (; j > 0 && frame.first_chars[frame.order[j - 1]] > frame.first_chars[i]; j--)
+                    frame.order[j] = frame.order[j - 1];
+                frame.order[j] = i;
+            }
+        } else {
+            int16_t index_of[NUM_ALPHABET];
+            std::fill(index_of, index_of + NUM_ALPHABET, -1);
+            for (int i = 0; i < nt; i++)
+                index_of[frame.first_chars[i]] = i;
+            frame.nt = 0;
+            for (int c = 0; c < NUM_ALPHABET; c++) {
+                if (index_of[c] >= 0)
+                    frame.order[frame.nt++] = index_of[c];
+            }
+        }
+        if (reverse)
+            frame.next = frame.nt;
+        return MBError::SUCCESS;
+    }
+
+    // Set curr_key to the frame's key followed by the label of edge idx.
+    int RangeScanner::appendEdgeKey(const Frame& frame, int idx)
+    {
+        const uint8_t* edge = frame.edges + idx * EDGE_SIZE;
+        int edge_len = edge[EDGE_LEN_POS];
+        curr_key.resize(frame.key_len);
+        curr_key.push_back(static_cast<char>(frame.first_chars[idx]));
+        if (edge_len > LOCAL_EDGE_LEN) {
+            curr_key.resize(frame.key_len + edge_len);
+            if (dict.GetMM()->ReadData(reinterpret_cast<uint8_t*>(&curr_key[frame.key_len + 1]),
+                    edge_len - 1, Get5BInteger(edge))
+                != edge_len - 1)
+                return pathUnchanged() ? MBError::READ_ERROR : MBError::TRY_AGAIN;
+        } else if (edge_len > 1) {
+            curr_key.append(reinterpret_cast<const char*>(edge), edge_len - 1);
+        }
+        return MBError::SUCCESS;
+    }
+
+    int RangeScanner::emit(size_t data_offset)
+    {
+        int rval = dict.ReadDataByOffset(data_offset, curr_value);
+        if (!pathUnchanged())
+            return MBError::TRY_AGAIN;
+        if (rval != MBError::SUCCESS)
+            return rval;
+
+        resume_key.assign(curr_key);
+        resume_inclusive = false;
+        seek_last = false;
+        return MBError::SUCCESS;
+    }
+
+    // True if the writer has not touched any node on the current path since
+    // snap; snap then moves forward so that long walks do not run out of
+    // the writer's offset cache.
+    bool RangeScanner::pathUnchanged()
+    {
+        size_t modified[MAX_OFFSET_CACHE + 1];
+        int num_modified;
+        LockFreeData current;
+        if (!lfree->ReaderLockFreeModified(snap, modified, num_modified, current))
+            return false;
+        for (int i = 0; i < num_modified; i++) {
+            for (int j = 0; j < depth; j++) {
+                if (modified[i] >= frames[j].node_off && modified[i] < frames[j].node_end)
+                    return false;
+            }
+        }
+        snap = current;
+        return true;
+    }
+
+} // namespace detail
+} // namespace mabain
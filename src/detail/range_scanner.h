@@ -0,0 +1,111 @@
+/**
+ * Internal helper: ordered traversal of the main tree.
+ * While rc runs, entries are also in the rc tree, which takes precedence
+ * over the main tree as in SearchEngine::find; both trees are then walked
+ * by child scanners whose next entries are merged.
+ * Nodes on the current path are copied into a stack of frames whose
+ * children are visited in first-char order, ascending or descending; keys
+ * are built in a single reused buffer and values are copied into a reused
+ * MBData. Every entry is validated against the lock-free writer log before
+ * it is returned; when a write races the traversal, the scanner seeks again
+ * from the last key it returned. Not part of the public API.
+ */
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "db.h"
+#include "dict.h"
+#include "lock_free.h"
+#include "mb_data.h"
+
+namespace mabain {
+namespace detail {
+
+    class RangeScanner {
+    public:
+        explicit RangeScanner(Dict& d, bool reverse = false);
+
+        // Position before the first key >= target, or > target if not
+        // inclusive; <= and < for a reverse scanner. target may be NULL when
+        // len is 0; a reverse scanner then starts from the largest key.
+        void seek(const uint8_t* target, int len, bool inclusive);
+        // Stop at the first key >= end; end_len < 0 means no bound. Only
+        // applies to forward scanners.
+        void setEnd(const uint8_t* end, int end_len);
+        // Advance to the next entry: SUCCESS, NOT_EXIST past the last entry,
+        // or TRY_AGAIN if the writer keeps racing the traversal.
+        int next();
+
+        const std::string& key() const { return curr_key; }
+        const MBData& value() const { return curr_value; }
+
+        // Visit keys in [start, end) in ascending order; end_len < 0 means
+        // no upper bound and limit 0 means no limit.
+        int scan(const uint8_t* start, int start_len, const uint8_t* end, int end_len,
+            int64_t limit, const DB::ScanVisitor& visitor);
+
+    private:
+        struct Frame {
+            size_t node_off;
+            size_t node_end;
+            int key_len; // key bytes leading to this node
+            int nt;
+            // Forward: next position in order. Reverse: positions left to
+            // visit, taken from the back.
+            int next;
+            bool emit_match; // the node's own value is still to be visited
+            uint8_t header[NODE_EDGE_KEY_FIRST];
+            uint8_t first_chars[NUM_ALPHABET];
+            uint8_t order[NUM_ALPHABET];
+            uint8_t edges[NUM_ALPHABET * EDGE_SIZE];
+        };
+
+        RangeScanner(Dict& d, bool reverse, size_t root);
+
+        int nextInTree();
+        int nextMerged(size_t rc_root);
+        int takeEntry(const RangeScanner& from);
+        int position();
+        int positionForward(const uint8_t* target, int target_len, bool inclusive);
+        int positionReverse(const uint8_t* target, int target_len, bool inclusive);
+        int step();
+        int pushNode(size_t node_off, int key_len);
+        int appendEdgeKey(const Frame& frame, int idx);
+        int emit(size_t data_offset);
+        bool pathUnchanged();
+
+        Dict& dict;
+        LockFree* lfree;
+        const bool reverse;
+        // 0 for the main tree
+        const size_t root_off;
+        // Child walks of the main and rc trees while rc runs. Each rval is
+        // the child's last nextInTree result, NOT_INITIALIZED once its entry
+        // has been returned.
+        std::unique_ptr<RangeScanner> main_scanner;
+        std::unique_ptr<RangeScanner> rc_scanner;
+        int main_rval;
+        int rc_rval;
+        bool merging;
+        LockFreeData snap;
+        std::vector<Frame> frames;
+        int depth;
+        std::string curr_key;
+        MBData curr_value;
+        const uint8_t* end_key;
+        int end_key_len;
+
+        // Where to resume after a lost race: the seek target until the first
+        // entry is returned, then the last returned key, exclusive.
+        std::string resume_key;
+        bool resume_inclusive;
+        bool seek_last; // reverse walk from the largest key
+        bool positioned;
+    };
+
+} // namespace detail
+} // namespace mabain
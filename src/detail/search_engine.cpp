@@ -7,6 +7,7 @@
 #include "detail/lf_guard.h"
 #include "dict.h"
 #include "util/prefix_cache.h"
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <time.h>
@@ -14,6 +15,17 @@
 namespace mabain {
 namespace detail {
 
+    // multiFind lane states. Each round a lane performs one step whose memory
+    // was prefetched in the previous round.
+    enum {
+        LANE_ROOT = 0, // root edge prefetched
+        LANE_NODE, // child node header prefetched; select the next edge
+        LANE_EDGE, // out-of-line edge key prefetched; compare it
+        LANE_DATA, // key matched; value header prefetched
+        LANE_DONE,
+        LANE_RETRY // lost a lock-free race; redo with the single-key path
+    };
+
     int SearchEngine::find(const uint8_t* key, int len, MBData& data)
     {
         int rval;
@@ -37,13 +49,295 @@ namespace detail {
             }
         }
 
+        // Keys ruled out by the Bloom filter are not in the tree; this holds
+        // for traced lookups too, which only record the edges of a match.
+        // Lookups with internal options may search for prefixes of a key;
+        // they always walk the tree.
+        bool filtered = false;
+        if (dict.bloom_filter && (data.options & ~CONSTS::OPTION_KEY_ONLY) == 0
+            && dict.BloomFilterExcludes(key, len, filtered))
+            return MBError::NOT_EXIST;
+
+        // Exact-match shortcut; the tree stays authoritative on any miss.
+        // Traced lookups walk the tree to record the edges of the match.
+        if (trace == nullptr && dict.hash_index && (data.options & ~CONSTS::OPTION_KEY_ONLY) == 0
+            && dict.FindByHashIndex(key, len, data) == MBError::SUCCESS) {
+            data.match_len = len;
+            return MBError::SUCCESS;
+        }
+
         rval = tryFindAtRoot(0, key, len, data);
         if (rval == MBError::SUCCESS)
             data.match_len = len;
+        else if (rval == MBError::NOT_EXIST && filtered)
+            dict.bloom_filter_false_positives.fetch_add(1, std::memory_order_relaxed);
 
         return rval;
     }
 
+    void SearchEngine::multiFind(const uint8_t* const* keys, const int* lens, int num_keys,
+        MBData* data, int* rvals)
+    {
+        size_t rc_root_offset = dict.GetHeaderPtr()->rc_root_offset.load(MEMORY_ORDER_READER);
+        if (rc_root_offset != 0) {
+            // Two roots are live while rc is running; use the single-key path.
+            for (int i = 0; i < num_keys; i++)
+                rvals[i] = (keys[i] == nullptr) ? MBError::INVALID_ARG : find(keys[i], lens[i], data[i]);
+            return;
+        }
+        if (dict.reader_rc_off != 0) {
+            dict.reader_rc_off = 0;
+            dict.RemoveUnused(0);
+            dict.mm.RemoveUnused(0);
+        }
+
+        MultiFindLane lanes[MULTI_FIND_WINDOW];
+        for (int base = 0; base < num_keys; base += MULTI_FIND_WINDOW) {
+            int nlanes = std::min(MULTI_FIND_WINDOW, num_keys - base);
+            for (int i = 0; i < nlanes; i++)
+                multiFindInit(lanes[i], keys[base + i], lens[base + i], data[base + i]);
+
+            int active = nlanes;
+            while (active > 0) {
+                active = 0;
+                for (int i = 0; i < nlanes; i++) {
+                    if (lanes[i].state >= LANE_DONE)
+                        continue;
+                    multiFindStep(lanes[i], data[base + i]);
+                    if (lanes[i].state < LANE_DONE)
+                        active++;
+                }
+            }
+
+            for (int i = 0; i < nlanes; i++) {
+                MultiFindLane& lane = lanes[i];
+                MBData& mbd = data[base + i];
+                if (lane.state == LANE_RETRY) {
+                    mbd.options &= ~CONSTS::OPTION_READ_SAVED_EDGE;
+                    lane.rval = tryFindAtRoot(0, lane.key, lane.full_len, mbd);
+                }
+                if (lane.rval == MBError::SUCCESS)
+                    mbd.match_len = lane.full_len;
+                rvals[base + i] = lane.rval;
+            }
+        }
+    }
+
+    void SearchEngine::multiFindInit(MultiFindLane& lane, const uint8_t* key, int len, MBData& data) const
+    {
+        lane.key = key;
+        lane.key_cursor = key;
+        lane.len = len;
+        lane.full_len = len;
+        lane.steps = 0;
+        lane.rval = MBError::NOT_EXIST;
+        lane.edge_offset_prev = 0;
+        data.options &= ~CONSTS::OPTION_READ_SAVED_EDGE;
+#ifdef __LOCK_FREE__
+        dict.lfree.ReaderLockFreeStart(lane.snap);
+#endif
+
+        if (key == nullptr) {
+            lane.rval = MBError::INVALID_ARG;
+            lane.state = LANE_DONE;
+        } else if (len <= 0) {
+            lane.state = LANE_DONE;
+        } else if (data.options & CONSTS::OPTION_FIND_AND_STORE_PARENT) {
+            // Parent bookkeeping is only done by the single-key path.
+            lane.state = LANE_RETRY;
+        } else {
+            lane.state = LANE_ROOT;
+            prefetchIndex(dict.mm.GetRootOffset() + NODE_EDGE_KEY_FIRST + NUM_ALPHABET
+                    + key[0] * EDGE_SIZE,
+                EDGE_SIZE);
+        }
+    }
+
+    void SearchEngine::multiFindStep(MultiFindLane& lane, MBData& data)
+    {
+        switch (lane.state) {
+        case LANE_ROOT:
+            multiFindRoot(lane, data);
+            break;
+        case LANE_NODE:
+            multiFindNode(lane, data);
+            break;
+        case LANE_EDGE:
+            multiFindEdge(lane, data);
+            break;
+        case LANE_DATA:
+            multiFindFinish(lane, readMatchedValue(data, data.edge_ptrs, false, lane.snap));
+            break;
+        default:
+            break;
+        }
+    }
+
+    inline void SearchEngine::multiFindFinish(MultiFindLane& lane, int rval) const
+    {
+        lane.rval = rval;
+        lane.state = (rval == MBError::TRY_AGAIN) ? LANE_RETRY : LANE_DONE;
+    }
+
+    // Same checks as findInternal at the root level.
+    void SearchEngine::multiFindRoot(MultiFindLane& lane, MBData& data)
+    {
+        EdgePtrs& edge_ptrs = data.edge_ptrs;
+        int consumed = 0;
+        if (seedFromCache(lane.key, lane.len, edge_ptrs, data, lane.key_cursor, lane.len, consumed)) {
+            if (lane.len <= 0) {
+                multiFindResolve(lane, data);
+            } else if (isLeaf(edge_ptrs)) {
+                multiFindFinish(lane, MBError::NOT_EXIST);
+            } else {
+                multiFindDescend(lane, data);
+            }
+            return;
+        }
+
+        int rval = MBError::NOT_EXIST;
+        bool descend = false;
+#ifdef __LOCK_FREE__
+        dict.lfree.ReaderLockFreeStart(lane.snap);
+#endif
+        if (dict.mm.GetRootEdge(0, lane.key[0], edge_ptrs) != MBError::SUCCESS) {
+            multiFindFinish(lane, MBError::READ_ERROR);
+            return;
+        }
+
+        int edge_len = edge_ptrs.len_ptr[0];
+        int edge_len_m1 = edge_len - 1;
+        const uint8_t* key_buff;
+        if (edge_len == 0) {
+            rval = MBError::NOT_EXIST;
+        } else if (loadEdgeKey(edge_ptrs, data, key_buff, edge_len_m1) != MBError::SUCCESS) {
+            rval = MBError::READ_ERROR;
+        } else if (edge_len < lane.len) {
+            if (remainderMatches(key_buff, lane.key_cursor, edge_len_m1) && !isLeaf(edge_ptrs)) {
+                lane.key_cursor += edge_len;
+                lane.len -= edge_len;
+                descend = true;
+                rval = MBError::SUCCESS;
+            }
+        } else if (edge_len == lane.len) {
+            if (remainderMatches(key_buff, lane.key_cursor, edge_len_m1)) {
+                lane.len = 0;
+                multiFindResolve(lane, data);
+                return;
+            }
+        }
+
+#ifdef __LOCK_FREE__
+        if (dict.lfree.ReaderLockFreeStop(lane.snap, edge_ptrs.offset, data) != MBError::SUCCESS) {
+            lane.state = LANE_RETRY;
+            return;
+        }
+#endif
+        if (descend)
+            multiFindDescend(lane, data);
+        else
+            multiFindFinish(lane, rval);
+    }
+
+    // Enter the child node of the current edge. The lock-free snapshot taken
+    // here covers the rest of the traversal, as in traverseFromEdge.
+    void SearchEngine::multiFindDescend(MultiFindLane& lane, MBData& data) const
+    {
+#ifdef __LOCK_FREE__
+        dict.lfree.ReaderLockFreeStart(lane.snap);
+#endif
+        lane.edge_offset_prev = data.edge_ptrs.offset;
+        prefetchIndex(Get6BInteger(data.edge_ptrs.offset_ptr), NODE_EDGE_KEY_FIRST);
+        lane.state = LANE_NODE;
+    }
+
+    void SearchEngine::multiFindNode(MultiFindLane& lane, MBData& data)
+    {
+        EdgePtrs& edge_ptrs = data.edge_ptrs;
+        int rval;
+        if (++lane.steps > CONSTS::FIND_TRAVERSAL_LIMIT) {
+            rval = MBError::UNKNOWN_ERROR;
+        } else {
+            rval = dict.mm.NextEdgeFast(lane.key_cursor, edge_ptrs, data);
+            if (rval != MBError::SUCCESS)
+                rval = dict.mm.NextEdge(lane.key_cursor, edge_ptrs, data.node_buff, data);
+        }
+#ifdef __LOCK_FREE__
+        if (dict.lfree.ReaderLockFreeStop(lane.snap,
+                rval == MBError::SUCCESS ? lane.edge_offset_prev : edge_ptrs.offset, data)
+            != MBError::SUCCESS) {
+            lane.state = LANE_RETRY;
+            return;
+        }
+#endif
+        if (rval != MBError::SUCCESS) {
+            multiFindFinish(lane, rval);
+            return;
+        }
+
+        int edge_len = edge_ptrs.len_ptr[0];
+        if (edge_len > LOCAL_EDGE_LEN) {
+            prefetchIndex(Get5BInteger(edge_ptrs.ptr), edge_len - 1);
+            lane.state = LANE_EDGE;
+            return;
+        }
+        multiFindEdge(lane, data);
+    }
+
+    // Same checks as one iteration of traverseFromEdge after the edge is read.
+    void SearchEngine::multiFindEdge(MultiFindLane& lane, MBData& data)
+    {
+        EdgePtrs& edge_ptrs = data.edge_ptrs;
+        const uint8_t* key_buff;
+        int edge_len = edge_ptrs.len_ptr[0];
+        int edge_len_m1 = edge_len - 1;
+        int rval = compareCurrEdgeTail(edge_ptrs, data, lane.key_cursor, key_buff, edge_len, edge_len_m1);
+        if (rval != MBError::SUCCESS) {
+#ifdef __LOCK_FREE__
+            if (dict.lfree.ReaderLockFreeStop(lane.snap, edge_ptrs.offset, data) != MBError::SUCCESS) {
+                lane.state = LANE_RETRY;
+                return;
+            }
+#endif
+            multiFindFinish(lane, rval);
+            return;
+        }
+
+        lane.len -= edge_len;
+        if (lane.len <= 0) {
+            multiFindResolve(lane, data);
+            return;
+        }
+        if (isLeaf(edge_ptrs)) {
+            multiFindFinish(lane, MBError::NOT_EXIST);
+            return;
+        }
+
+        lane.key_cursor += edge_len;
+        lane.edge_offset_prev = edge_ptrs.offset;
+        prefetchIndex(Get6BInteger(edge_ptrs.offset_ptr), NODE_EDGE_KEY_FIRST);
+        lane.state = LANE_NODE;
+    }
+
+    // Key fully matched: prefetch the value header (or the match node header
+    // for internal matches) and read it in the next round.
+    void SearchEngine::multiFindResolve(MultiFindLane& lane, MBData& data) const
+    {
+        if (data.options & CONSTS::OPTION_KEY_ONLY) {
+            multiFindFinish(lane, MBError::SUCCESS);
+            return;
+        }
+        const EdgePtrs& edge_ptrs = data.edge_ptrs;
+        if (isLeaf(edge_ptrs)) {
+            const uint8_t* p = dict.GetShmPtr(Get6BInteger(edge_ptrs.offset_ptr), DATA_HDR_BYTE);
+            if (p != nullptr)
+                __builtin_prefetch(p, 0, 3);
+        } else {
+            prefetchIndex(Get6BInteger(edge_ptrs.offset_ptr), NODE_EDGE_KEY_FIRST);
+        }
+        lane.state = LANE_DATA;
+    }
+
     int SearchEngine::findPrefix(const uint8_t* key, int len, MBData& data)
     {
         int rval;
@@ -96,9 +390,81 @@ namespace detail {
     }
 
     int SearchEngine::lowerBound(const uint8_t* key, int len, MBData& data, std::string* bound_key)
+    {
+        size_t rc_root_offset = dict.GetHeaderPtr()->rc_root_offset.load(MEMORY_ORDER_READER);
+        if (rc_root_offset == 0) {
+            if (dict.reader_rc_off != 0) {
+                dict.reader_rc_off = 0;
+                dict.RemoveUnused(0);
+                dict.mm.RemoveUnused(0);
+            }
+            return tryLowerBoundAtRoot(0, key, len, data, bound_key);
+        }
+
+        // Entries added during rc are in the rc tree and take precedence over
+        // the main tree; the bound is the larger of the two candidates.
+        dict.reader_rc_off = rc_root_offset;
+        MBData data_rc(0, data.options);
+        std::string key_rc;
+        std::string key_main;
+        int rval_rc = tryLowerBoundAtRoot(rc_root_offset, key, len, data_rc, &key_rc);
+        if (rval_rc != MBError::SUCCESS && rval_rc != MBError::NOT_EXIST)
+            return rval_rc;
+        int rval = tryLowerBoundAtRoot(0, key, len, data, &key_main);
+        if (rval != MBError::SUCCESS && rval != MBError::NOT_EXIST)
+            return rval;
+
+        if (rval_rc == MBError::SUCCESS && (rval == MBError::NOT_EXIST || key_rc >= key_main)) {
+            if (!(data.options & CONSTS::OPTION_KEY_ONLY)) {
+                if (data.buff_len < data_rc.data_len + 1 && data.Resize(data_rc.data_len) != MBError::SUCCESS)
+                    return MBError::NO_MEMORY;
+                memcpy(data.buff, data_rc.buff, data_rc.data_len);
+                data.data_len = data_rc.data_len;
+                data.bucket_index = data_rc.bucket_index;
+            }
+            data.data_offset = data_rc.data_offset;
+            data.match_len = data_rc.match_len;
+            key_main.swap(key_rc);
+            rval = MBError::SUCCESS;
+        }
+        if (rval == MBError::SUCCESS && bound_key != nullptr)
+            bound_key->append(key_main);
+        return rval;
+    }
+
+    // Retry with bounded backoff while the writer races the traversal; the
+    // partial results of a failed attempt are discarded.
+    int SearchEngine::tryLowerBoundAtRoot(size_t root_off, const uint8_t* key, int len, MBData& data,
+        std::string* bound_key)
+    {
+        size_t bound_key_len = (bound_key != nullptr) ? bound_key->size() : 0;
+        int match_len = data.match_len;
+        int rval = lowerBoundAtRoot(root_off, key, len, data, bound_key);
+#ifdef __LOCK_FREE__
+        int attempts = 0;
+        while (rval == MBError::TRY_AGAIN && attempts++ < CONSTS::LOCK_FREE_RETRY_LIMIT) {
+            nanosleep((const struct timespec[]) { { 0, 10L } }, NULL);
+            if (bound_key != nullptr)
+                bound_key->resize(bound_key_len);
+            data.match_len = match_len;
+            data.options &= ~CONSTS::OPTION_INTERNAL_NODE_BOUND;
+            rval = lowerBoundAtRoot(root_off, key, len, data, bound_key);
+        }
+#endif
+        return rval;
+    }
+
+    int SearchEngine::lowerBoundAtRoot(size_t root_off, const uint8_t* key, int len, MBData& data,
+        std::string* bound_key)
     {
         int rval;
         EdgePtrs& edge_ptrs = data.edge_ptrs;
+        BoundReadSet reads;
+        reads.count = 0;
+#ifdef __LOCK_FREE__
+        dict.lfree.ReaderLockFreeStart(reads.snap);
+#endif
+        bound_reads = &reads;
         EdgePtrs bound_edge_ptrs;
         bound_edge_ptrs.curr_edge_index = -1;
 
@@ -112,7 +478,7 @@ namespace detail {
         };
 
         int root_key = key[0];
-        rval = lowerBoundCore(key, len, data, bound_key, bound_edge_ptrs, bound_state, root_key);
+        rval = lowerBoundCore(root_off, key, len, data, bound_key, bound_edge_ptrs, bound_state, root_key);
 
         if (rval == MBError::NOT_EXIST) {
             if (bound_state.use_curr_edge) {
@@ -129,27 +495,72 @@ namespace detail {
                     InitTempEdgePtrs(bound_edge_ptrs);
                     rval = readLowerBound(bound_edge_ptrs, data, bound_key, bound_state.le_edge_key);
                 } else {
-                    rval = readBoundFromRootEdge(edge_ptrs, data, root_key, bound_key);
+                    rval = readBoundFromRootEdge(root_off, edge_ptrs, data, root_key, bound_key);
                 }
             }
         } else if (rval == MBError::SUCCESS && bound_key) {
             bound_key->append(reinterpret_cast<const char*>(key), data.match_len);
         }
 
+        // Torn reads can surface as any error; the final check decides.
+        if (rval != MBError::TRY_AGAIN && validateBoundReads() != MBError::SUCCESS)
+            rval = MBError::TRY_AGAIN;
+        bound_reads = nullptr;
         return rval;
     }
 
-    int SearchEngine::lowerBoundCore(const uint8_t* key, int len, MBData& data, std::string* bound_key,
-        EdgePtrs& bound_edge_ptrs, BoundSearchState& bound_state, int root_key) const
+    // Record an edge read by lowerBound and check it, together with every
+    // edge read before it, against the lock-free writer log.
+    int SearchEngine::checkBoundRead(size_t edge_offset) const
+    {
+        if (bound_reads == nullptr)
+            return MBError::SUCCESS;
+        if (bound_reads->count < BoundReadSet::MAX_EDGES)
+            bound_reads->offsets[bound_reads->count] = edge_offset;
+        bound_reads->count++;
+        return validateBoundReads();
+    }
+
+    // Node contents are covered by the parent edge, which is where the writer
+    // reports node updates. On success the snapshot moves forward so that
+    // long traversals do not outrun the writer's offset cache.
+    int SearchEngine::validateBoundReads() const
+    {
+#ifdef __LOCK_FREE__
+        if (bound_reads == nullptr)
+            return MBError::SUCCESS;
+        size_t modified[MAX_OFFSET_CACHE + 1];
+        int num_modified;
+        LockFreeData current;
+        if (!dict.lfree.ReaderLockFreeModified(bound_reads->snap, modified, num_modified, current))
+            return MBError::TRY_AGAIN;
+        if (num_modified > 0 && bound_reads->count > BoundReadSet::MAX_EDGES)
+            return MBError::TRY_AGAIN;
+        for (int i = 0; i < num_modified; i++) {
+            for (int j = 0; j < bound_reads->count; j++) {
+                if (modified[i] == bound_reads->offsets[j])
+                    return MBError::TRY_AGAIN;
+            }
+        }
+        bound_reads->snap = current;
+#endif
+        return MBError::SUCCESS;
+    }
+
+    int SearchEngine::lowerBoundCore(size_t root_off, const uint8_t* key, int len, MBData& data,
+        std::string* bound_key, EdgePtrs& bound_edge_ptrs, BoundSearchState& bound_state,
+        int root_key) const
     {
         EdgePtrs& edge_ptrs = data.edge_ptrs;
 
-        // Always operate on the main root (no rc_root_offset diversion)
-        int ret = dict.mm.GetRootEdge(0, root_key, edge_ptrs);
+        int ret = dict.mm.GetRootEdge(root_off, root_key, edge_ptrs);
+        if (ret != MBError::SUCCESS)
+            return ret;
+        ret = checkBoundRead(edge_ptrs.offset);
         if (ret != MBError::SUCCESS)
             return ret;
         if (edge_ptrs.len_ptr[0] == 0) {
-            return readBoundFromRootEdge(edge_ptrs, data, root_key, bound_key);
+            return readBoundFromRootEdge(root_off, edge_ptrs, data, root_key, bound_key);
         }
 
         const uint8_t* key_cursor = key;
@@ -164,41 +575,40 @@ namespace detail {
             if (dict.mm.ReadData(bound_state.node_buff, edge_label_len, edge_label_off) != edge_label_len)
                 return MBError::READ_ERROR;
             edge_label_ptr = bound_state.node_buff;
+            ret = validateBoundReads();
+            if (ret != MBError::SUCCESS)
+                return ret;
         } else {
             edge_label_ptr = edge_ptrs.ptr;
         }
 
-        if (edge_len < len) {
-            int label_cmp = memcmp(edge_label_ptr, key_cursor + 1, edge_label_len);
-            if (label_cmp != 0) {
-                if (label_cmp < 0) {
-                    bound_state.use_curr_edge = true;
-                    if (bound_key) {
-                        bound_key->push_back(static_cast<char>(key[0]));
-                        bound_key->append(reinterpret_cast<const char*>(edge_label_ptr), edge_label_len);
-                    }
-                }
-                return readBoundFromRootEdge(edge_ptrs, data, root_key, bound_key);
+        // Compare the label with the key bytes it overlaps. A smaller label
+        // puts the bound in the largest entry under this root edge; a larger
+        // one, or a key ending inside the label, puts it under an earlier root
+        // edge.
+        int cmp_len = std::min(edge_len, len) - 1;
+        int label_cmp = cmp_len > 0 ? memcmp(edge_label_ptr, key_cursor + 1, cmp_len) : 0;
+        if (label_cmp < 0) {
+            bound_state.use_curr_edge = true;
+            if (bound_key) {
+                bound_key->push_back(static_cast<char>(key[0]));
+                bound_key->append(reinterpret_cast<const char*>(edge_label_ptr), edge_label_len);
             }
+            return MBError::NOT_EXIST;
+        }
+        if (label_cmp > 0 || edge_len > len)
+            return readBoundFromRootEdge(root_off, edge_ptrs, data, root_key, bound_key);
 
+        // A leaf edge matching a prefix of the key holds the bound.
+        if (edge_len < len && !(edge_ptrs.flag_ptr[0] & EDGE_FLAG_DATA_OFF)) {
             len -= edge_len;
             key_cursor += edge_len;
             data.match_len += edge_len;
             rval = traverseToLowerBound(key_cursor, len, edge_ptrs, data, bound_edge_ptrs, bound_state);
-        } else if (edge_len == len) {
-            if (len > 1 && memcmp(edge_label_ptr, key + 1, len - 1) != 0) {
-                if (memcmp(edge_label_ptr, key + 1, len - 1) < 0) {
-                    bound_state.use_curr_edge = true;
-                    if (bound_key) {
-                        bound_key->append(reinterpret_cast<const char*>(key), data.match_len + 1);
-                        bound_key->append(reinterpret_cast<const char*>(edge_label_ptr), len - 1);
-                    }
-                }
-            } else {
-                rval = dict.ReadDataFromEdge(data, edge_ptrs);
-                if (rval == MBError::SUCCESS)
-                    data.match_len += edge_len;
-            }
+        } else {
+            rval = dict.ReadDataFromEdge(data, edge_ptrs);
+            if (rval == MBError::SUCCESS)
+                data.match_len += edge_len;
         }
 
         return rval;
@@ -310,9 +720,17 @@ namespace detail {
         const uint8_t* key_buff;
         // Do not seed from prefix cache for operations that require
         // precise parent/edge bookkeeping (e.g., remove) or during rc view.
-        bool use_cache = true
+        bool use_cache = trace == nullptr
             && !(dict.reader_rc_off != 0 && root_off == dict.reader_rc_off)
             && !(data.options & CONSTS::OPTION_FIND_AND_STORE_PARENT);
+        if (trace != nullptr)
+            trace->count = 0;
+        // Taken before any edge is read; the matched edge is checked against
+        // it again once the value is copied.
+        LockFreeData value_snap = {};
+#ifdef __LOCK_FREE__
+        dict.lfree.ReaderLockFreeStart(value_snap);
+#endif
         bool used_cache = use_cache ? seedFromCache(key, len, edge_ptrs, data, key_cursor, len, consumed) : false;
 
         if (!used_cache) {
@@ -360,11 +778,12 @@ namespace detail {
 #endif
                     return MBError::NOT_EXIST;
                 }
+                traceEdge(edge_ptrs.offset);
                 key_cursor += edge_len;
                 consumed += edge_len;
                 len -= edge_len;
                 if (len <= 0) {
-                    return resolveMatchOrInDict(data, edge_ptrs, true);
+                    return readMatchedValue(data, edge_ptrs, true, value_snap);
                 }
                 if (isLeaf(edge_ptrs)) {
 #ifdef __LOCK_FREE__
@@ -380,7 +799,8 @@ namespace detail {
             } else if (edge_len == len) {
                 if (remainderMatches(key_buff, key_cursor, edge_len_m1)) {
                     // Find does not update prefix cache; writer seeds during Add
-                    return resolveMatchOrInDict(data, edge_ptrs, true);
+                    traceEdge(edge_ptrs.offset);
+                    return readMatchedValue(data, edge_ptrs, true, value_snap);
                 }
 #ifdef __LOCK_FREE__
                 {
@@ -412,7 +832,7 @@ namespace detail {
 
         if (used_cache) {
             if (len <= 0)
-                return resolveMatchOrInDict(data, edge_ptrs, false);
+                return readMatchedValue(data, edge_ptrs, false, value_snap);
             if (isLeaf(edge_ptrs))
                 return MBError::NOT_EXIST;
         }
@@ -474,10 +894,14 @@ namespace detail {
             if (rval == MBError::NOT_EXIST)
                 break;
 
+            traceEdge(edge_ptrs.offset);
             len -= edge_len;
             if (len <= 0) {
-                int _ret = resolveMatchOrInDict(data, edge_ptrs, false);
-                return _ret;
+#ifdef __LOCK_FREE__
+                return readMatchedValue(data, edge_ptrs, false, lf_guard.snap);
+#else
+                return resolveMatchOrInDict(data, edge_ptrs, false);
+#endif
             }
             if (isLeaf(edge_ptrs)) {
                 return MBError::NOT_EXIST;
@@ -601,6 +1025,13 @@ namespace detail {
             uint8_t* edge_str_buff = dict.mm.GetShmPtr(edge_str_off, edge_len_m1);
             if (edge_str_buff != nullptr) {
                 key->append((const char*)edge_str_buff, edge_len_m1);
+            } else {
+                // The label is in a block that is not mapped.
+                size_t key_len = key->size();
+                key->resize(key_len + edge_len_m1);
+                if (dict.mm.ReadData(reinterpret_cast<uint8_t*>(&(*key)[key_len]), edge_len_m1, edge_str_off)
+                    != edge_len_m1)
+                    key->resize(key_len);
             }
         } else if (edge_len_m1 > 0) {
             key->append(reinterpret_cast<const char*>(edge_ptrs.ptr), edge_len_m1);
@@ -613,8 +1044,10 @@ namespace detail {
         rval = dict.mm.ReadData(edge_ptrs.edge_buff, EDGE_SIZE, edge_ptrs.offset);
         if (rval != EDGE_SIZE)
             return MBError::READ_ERROR;
+        rval = checkBoundRead(edge_ptrs.offset);
+        if (rval != MBError::SUCCESS)
+            return rval;
 
-        rval = MBError::SUCCESS;
         int max_key = -1;
         while (!(edge_ptrs.flag_ptr[0] & EDGE_FLAG_DATA_OFF)) {
             if (bound_key != nullptr && le_edge_key >= 0) {
@@ -625,6 +1058,9 @@ namespace detail {
             rval = dict.mm.NextMaxEdge(edge_ptrs, data.node_buff, data, max_key);
             if (rval != MBError::SUCCESS)
                 break;
+            rval = checkBoundRead(edge_ptrs.offset);
+            if (rval != MBError::SUCCESS)
+                return rval;
             le_edge_key = max_key;
         }
 
@@ -642,13 +1078,16 @@ namespace detail {
         return rval;
     }
 
-    int SearchEngine::readBoundFromRootEdge(EdgePtrs& edge_ptrs, MBData& data,
+    int SearchEngine::readBoundFromRootEdge(size_t root_off, EdgePtrs& edge_ptrs, MBData& data,
         int root_key, std::string* bound_key) const
     {
         int rval = MBError::NOT_EXIST;
         int ret;
         for (int i = root_key - 1; i >= 0; i--) {
-            ret = dict.mm.GetRootEdge(0, i, edge_ptrs);
+            ret = dict.mm.GetRootEdge(root_off, i, edge_ptrs);
+            if (ret != MBError::SUCCESS)
+                return ret;
+            ret = checkBoundRead(edge_ptrs.offset);
             if (ret != MBError::SUCCESS)
                 return ret;
             if (edge_ptrs.len_ptr[0] != 0) {
@@ -692,6 +1131,9 @@ namespace detail {
             // update the best "less-than" candidate in bound_edge_ptrs.
             int candidate_le_key = -1;
             int status = dict.mm.NextLowerBoundEdge(key, len, edge_ptrs, state.node_buff, data, bound_edge_ptrs, candidate_le_key);
+            int lf_status = (status == MBError::SUCCESS) ? checkBoundRead(edge_ptrs.offset) : validateBoundReads();
+            if (lf_status != MBError::SUCCESS)
+                return lf_status;
 
             // Record candidate metadata (depth/key) for bound_key reconstruction.
             if (state.bound_key && candidate_le_key >= 0) {
@@ -712,15 +1154,22 @@ namespace detail {
                 if (dict.mm.ReadData(state.node_buff, edge_label_len, edge_label_off) != edge_label_len)
                     return MBError::READ_ERROR;
                 edge_label_ptr = state.node_buff;
+                status = validateBoundReads();
+                if (status != MBError::SUCCESS)
+                    return status;
             } else {
                 edge_label_ptr = edge_ptrs.ptr;
             }
 
             // Compare the remainder of the edge label with the remaining key bytes.
             // Any divergence returns NOT_EXIST to the caller, carrying the best
-            // candidate captured so far in bound_edge_ptrs.
+            // candidate captured so far in bound_edge_ptrs. So does a key that
+            // ends inside the label, since every entry under the edge is greater.
             if (edge_label_len > 0) {
-                int label_cmp = memcmp(edge_label_ptr, key + 1, edge_label_len);
+                int cmp_len = std::min(edge_len, len) - 1;
+                int label_cmp = cmp_len > 0 ? memcmp(edge_label_ptr, key + 1, cmp_len) : 0;
+                if (label_cmp == 0 && edge_len > len)
+                    return MBError::NOT_EXIST;
                 if (label_cmp != 0) {
                     // If the edge label is strictly less than the key suffix, signal
                     // that the current subtree itself is a valid lower-bound pivot.
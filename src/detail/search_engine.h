@@ -45,11 +45,48 @@ namespace detail {
         // Longest prefix match
         int findPrefix(const uint8_t* key, int len, MBData& data);
 
-        // Lower bound (largest entry not greater than key)
+        // Lower bound (largest entry not greater than key). Safe to run
+        // concurrently with the writer; also searches the rc tree while
+        // resource collection is running.
         int lowerBound(const uint8_t* key, int len, MBData& data, std::string* bound_key);
 
+        // Batched exact match. Keys are walked in lockstep, MULTI_FIND_WINDOW at
+        // a time; the next node/edge of every in-flight key is prefetched before
+        // any of them is compared. rvals[i] receives the result for keys[i].
+        void multiFind(const uint8_t* const* keys, const int* lens, int num_keys,
+            MBData* data, int* rvals);
+
+        static constexpr int MULTI_FIND_WINDOW = 16;
+
+        // Offsets of the edges matched by the last find, root edge first.
+        // count may exceed MAX_EDGES; only the first MAX_EDGES are kept.
+        struct EdgeTrace {
+            static constexpr int MAX_EDGES = 16;
+            size_t offsets[MAX_EDGES];
+            int count;
+        };
+        // Record the matched edges of subsequent finds into trace. Tracing
+        // bypasses the prefix cache so that every edge on the path is seen.
+        void setEdgeTrace(EdgeTrace* edge_trace) { trace = edge_trace; }
+
     private:
         Dict& dict;
+        EdgeTrace* trace = nullptr;
+
+        // Per-key traversal state for multiFind
+        struct MultiFindLane {
+            const uint8_t* key;
+            const uint8_t* key_cursor;
+            int len;
+            int full_len;
+            int state;
+            int steps;
+            int rval;
+            size_t edge_offset_prev;
+#ifdef __LOCK_FREE__
+            LockFreeData snap;
+#endif
+        };
 
         // Exact-find internals
         inline int tryFindAtRoot(size_t root_off, const uint8_t* key, int len, MBData& data);
@@ -57,6 +94,17 @@ namespace detail {
         int traverseFromEdge(const uint8_t*& key_cursor, int& len, int& consumed,
             const uint8_t* full_key, int full_len, EdgePtrs& edge_ptrs, MBData& data);
 
+        // Batched exact-find internals
+        void multiFindInit(MultiFindLane& lane, const uint8_t* key, int len, MBData& data) const;
+        void multiFindStep(MultiFindLane& lane, MBData& data);
+        void multiFindRoot(MultiFindLane& lane, MBData& data);
+        void multiFindNode(MultiFindLane& lane, MBData& data);
+        void multiFindEdge(MultiFindLane& lane, MBData& data);
+        void multiFindDescend(MultiFindLane& lane, MBData& data) const;
+        void multiFindResolve(MultiFindLane& lane, MBData& data) const;
+        inline void multiFindFinish(MultiFindLane& lane, int rval) const;
+        inline void prefetchIndex(size_t offset, int size) const;
+
         // Prefix internals
         int findPrefixInternal(size_t root_off, const uint8_t* key, int len, MBData& data);
         int traversePrefixFromEdge(const uint8_t* key_base, const uint8_t*& key_cursor, int& len,
@@ -71,6 +119,9 @@ namespace detail {
         inline int compareCurrEdgeTail(const EdgePtrs& edge_ptrs, MBData& data, const uint8_t* p,
             const uint8_t*& key_buff, int& edge_len, int& edge_len_m1) const;
         inline int resolveMatchOrInDict(MBData& data, EdgePtrs& edge_ptrs, bool at_root) const;
+        inline int readMatchedValue(MBData& data, EdgePtrs& edge_ptrs, bool at_root,
+            const LockFreeData& snap) const;
+        inline void traceEdge(size_t offset) const;
         // Root-edge accessor (reads directly from DictMem)
         // Fast-path: try to seed traversal state from the prefix cache.
         // Returns true when an entry is found (depth 2 or 3), and advances
@@ -80,15 +131,35 @@ namespace detail {
             MBData& data, const uint8_t*& key_cursor, int& len_remaining, int& consumed) const;
         // declared once above
 
+        // Edges read by the current lowerBound. Each read is checked against
+        // the lock-free writer log together with all reads before it, since a
+        // bound may be resolved from any edge seen on the way down.
+        struct BoundReadSet {
+            static constexpr int MAX_EDGES = 64;
+            LockFreeData snap;
+            size_t offsets[MAX_EDGES];
+            int count; // may exceed MAX_EDGES; then any write is a conflict
+        };
+        BoundReadSet* bound_reads = nullptr;
+
         // Lower-bound internals
+        int tryLowerBoundAtRoot(size_t root_off, const uint8_t* key, int len, MBData& data,
+            std::string* bound_key);
+        int lowerBoundAtRoot(size_t root_off, const uint8_t* key, int len, MBData& data,
+            std::string* bound_key);
+        int checkBoundRead(size_t edge_offset) const;
+        int validateBoundReads() const;
         void appendEdgeKey(std::string* key, int edge_key, const EdgePtrs& edge_ptrs) const;
         int readLowerBound(EdgePtrs& edge_ptrs, MBData& data, std::string* bound_key, int le_edge_key) const;
-        int readBoundFromRootEdge(EdgePtrs& edge_ptrs, MBData& data, int root_key, std::string* bound_key) const;
+        int readBoundFromRootEdge(size_t root_off, EdgePtrs& edge_ptrs, MBData& data, int root_key,
+            std::string* bound_key) const;
         // Core lower-bound traversal from root-key edge until first resolution point.
         // Returns SUCCESS when value is read, NOT_EXIST when caller should pivot to
-        // saved candidate (bound_edge_ptrs/use_curr_edge), or READ_ERROR on IO error.
-        int lowerBoundCore(const uint8_t* key, int len, MBData& data, std::string* bound_key,
-            EdgePtrs& bound_edge_ptrs, BoundSearchState& bound_state, int root_key) const;
+        // saved candidate (bound_edge_ptrs/use_curr_edge), READ_ERROR on IO error,
+        // or TRY_AGAIN if the writer modified an edge that was read.
+        int lowerBoundCore(size_t root_off, const uint8_t* key, int len, MBData& data,
+            std::string* bound_key, EdgePtrs& bound_edge_ptrs, BoundSearchState& bound_state,
+            int root_key) const;
         int traverseToLowerBound(const uint8_t* key, int len, EdgePtrs& edge_ptrs, MBData& data,
             EdgePtrs& bound_edge_ptrs, BoundSearchState& state) const;
     };
@@ -143,6 +214,15 @@ namespace detail {
         return remainderMatches(key_buff, p, edge_len_m1) ? MBError::SUCCESS : MBError::NOT_EXIST;
     }
 
+    inline void SearchEngine::traceEdge(size_t offset) const
+    {
+        if (trace == nullptr)
+            return;
+        if (trace->count < EdgeTrace::MAX_EDGES)
+            trace->offsets[trace->count] = offset;
+        trace->count++;
+    }
+
     inline int SearchEngine::resolveMatchOrInDict(MBData& data, EdgePtrs& edge_ptrs, bool at_root) const
     {
         if (data.options & CONSTS::OPTION_FIND_AND_STORE_PARENT) {
@@ -160,6 +240,23 @@ namespace detail {
         return dict.ReadDataFromEdge(data, edge_ptrs);
     }
 
+    // The value is copied after the last lock-free check of the edge. Check
+    // the edge again so that a value rewritten in place, or a buffer released
+    // and reused by the writer, since snap is not returned.
+    inline int SearchEngine::readMatchedValue(MBData& data, EdgePtrs& edge_ptrs, bool at_root,
+        const LockFreeData& snap) const
+    {
+        int rval = resolveMatchOrInDict(data, edge_ptrs, at_root);
+#ifdef __LOCK_FREE__
+        if (rval == MBError::SUCCESS && !(data.options & CONSTS::OPTION_KEY_ONLY)
+            && !dict.lfree.ReaderLockFreeUnchanged(snap, &edge_ptrs.offset, 1))
+            return MBError::TRY_AGAIN;
+#else
+        (void)snap;
+#endif
+        return rval;
+    }
+
     // Reads root edges via DictMem; no per-thread root cache.
 
     inline int SearchEngine::loadEdgeKey(const EdgePtrs& edge_ptrs, MBData& data, const uint8_t*& key_buff, int edge_len_m1) const
@@ -183,6 +280,14 @@ namespace detail {
         return MBError::SUCCESS;
     }
 
+    inline void SearchEngine::prefetchIndex(size_t offset, int size) const
+    {
+        // Only a hint; regions outside the mapped window are simply skipped.
+        const uint8_t* p = dict.mm.GetShmPtr(offset, size);
+        if (p != nullptr)
+            __builtin_prefetch(p, 0, 3);
+    }
+
     inline bool SearchEngine::seedFromCache(const uint8_t* key, int len, EdgePtrs& edge_ptrs,
         MBData& data, const uint8_t*& key_cursor, int& len_remaining, int& consumed) const
     {
@@ -0,0 +1,268 @@
+/**
+ * Internal subtree count queries; see subtree_counter.h.
+ */
+
+#include "detail/subtree_counter.h"
+#include "error.h"
+#include "integer_4b_5b.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <time.h>
+
+namespace mabain {
+namespace detail {
+
+    SubtreeCounter::SubtreeCounter(Dict& d)
+        : dict(d)
+        , mm(d.GetMM())
+        , header(d.GetHeaderPtr())
+    {
+    }
+
+    int SubtreeCounter::countPrefix(const uint8_t* prefix, int len, int64_t& count)
+    {
+        return run([&]() { return countPrefixOnce(prefix, len, count); });
+    }
+
+    int SubtreeCounter::rank(const uint8_t* key, int len, int64_t& rank)
+    {
+        return run([&]() { return rankOnce(key, len, rank); });
+    }
+
+    int SubtreeCounter::select(int64_t n, MBData& data, std::string* key)
+    {
+        int rval = run([&]() { return selectOnce(n, data); });
+        if (rval == MBError::SUCCESS && key != nullptr)
+            key->assign(path);
+        return rval;
+    }
+
+    // Run a query between two even reads of the update sequence. Anything
+    // read while the writer was updating the tree, including errors from
+    // following stale offsets, is discarded and the query is run again.
+    template <typename Query>
+    int SubtreeCounter::run(Query query)
+    {
+        if (!mm->SubtreeCountEnabled())
+            return MBError::NOT_ALLOWED;
+
+        for (int attempts = 0;; attempts++) {
+            int rval = MBError::TRY_AGAIN;
+            uint32_t seq = header->subtree_count_seq.load(std::memory_order_acquire);
+            if (!(seq & 1)) {
+                rval = query();
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (header->subtree_count_seq.load(std::memory_order_relaxed) != seq)
+                    rval = MBError::TRY_AGAIN;
+            }
+            if (rval != MBError::TRY_AGAIN || attempts >= CONSTS::LOCK_FREE_RETRY_LIMIT)
+                return rval;
+            nanosleep((const struct timespec[]) { { 0, 10L } }, NULL);
+        }
+    }
+
+    int SubtreeCounter::countPrefixOnce(const uint8_t* prefix, int len, int64_t& count)
+    {
+        count = 0;
+        size_t node_off = mm->GetRootOffset();
+        if (len == 0)
+            return mm->ReadSubtreeCount(node_off, count);
+
+        // Every step consumes at least one byte of the prefix.
+        while (true) {
+            int rval = readNode(node_off);
+            if (rval != MBError::SUCCESS)
+                return rval;
+            const uint8_t* first = std::find(node.first_chars, node.first_chars + node.nt, prefix[0]);
+            if (first == node.first_chars + node.nt)
+                return MBError::SUCCESS;
+            int idx = first - node.first_chars;
+            const uint8_t* edge = edgeAt(idx);
+            int edge_len = edge[EDGE_LEN_POS];
+            if (edge_len == 0)
+                return MBError::SUCCESS;
+            rval = readLabel(idx, edge_len);
+            if (rval != MBError::SUCCESS)
+                return rval;
+            if (memcmp(label, prefix, std::min(edge_len, len)) != 0)
+                return MBError::SUCCESS;
+            // The prefix ends on this edge: everything below it matches.
+            if (len <= edge_len)
+                return mm->EdgeSubtreeCount(edge, count);
+            if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF)
+                return MBError::SUCCESS;
+            prefix += edge_len;
+            len -= edge_len;
+            node_off = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+        }
+    }
+
+    // Keys below lesser siblings are all smaller, and so is the key of every
+    // matching node passed on the way down since it is a proper prefix.
+    int SubtreeCounter::rankOnce(const uint8_t* key, int len, int64_t& rank)
+    {
+        rank = 0;
+        if (len == 0)
+            return MBError::SUCCESS;
+
+        size_t node_off = mm->GetRootOffset();
+        while (true) {
+            int rval = readNode(node_off);
+            if (rval != MBError::SUCCESS)
+                return rval;
+            if (node.header[0] & FLAG_NODE_MATCH)
+                rank++;
+
+            int match_idx = -1;
+            for (int i = 0; i < node.nt; i++) {
+                if (node.first_chars[i] < key[0]) {
+                    int64_t count;
+                    rval = mm->EdgeSubtreeCount(edgeAt(i), count);
+                    if (rval != MBError::SUCCESS)
+                        return rval;
+                    rank += count;
+                } else if (node.first_chars[i] == key[0]) {
+                    match_idx = i;
+                }
+            }
+            if (match_idx < 0)
+                return MBError::SUCCESS;
+
+            const uint8_t* edge = edgeAt(match_idx);
+            int edge_len = edge[EDGE_LEN_POS];
+            if (edge_len == 0)
+                return MBError::SUCCESS;
+            rval = readLabel(match_idx, edge_len);
+            if (rval != MBError::SUCCESS)
+                return rval;
+            int cmp_len = std::min(edge_len, len);
+            int diff = std::mismatch(label, label + cmp_len, key).first - label;
+            if (diff < cmp_len) {
+                if (label[diff] < key[diff]) {
+                    int64_t count;
+                    rval = mm->EdgeSubtreeCount(edge, count);
+                    if (rval != MBError::SUCCESS)
+                        return rval;
+                    rank += count;
+                }
+                return MBError::SUCCESS;
+            }
+            // The key ends inside the label: everything below is greater.
+            if (len < edge_len)
+                return MBError::SUCCESS;
+
+            key += edge_len;
+            len -= edge_len;
+            if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF) {
+                if (len > 0)
+                    rank++;
+                return MBError::SUCCESS;
+            }
+            // The key ends at the child: nothing below it is smaller.
+            if (len == 0)
+                return MBError::SUCCESS;
+            node_off = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+        }
+    }
+
+    int SubtreeCounter::selectOnce(int64_t n, MBData& data)
+    {
+        path.clear();
+        size_t node_off = mm->GetRootOffset();
+        int64_t total;
+        int rval = mm->ReadSubtreeCount(node_off, total);
+        if (rval != MBError::SUCCESS)
+            return rval;
+        if (n < 0 || n >= total)
+            return MBError::NOT_EXIST;
+
+        uint8_t order[NUM_ALPHABET];
+        size_t data_offset;
+        while (true) {
+            rval = readNode(node_off);
+            if (rval != MBError::SUCCESS)
+                return rval;
+            if (node.header[0] & FLAG_NODE_MATCH) {
+                if (n == 0) {
+                    data_offset = Get6BInteger(node.header + 2);
+                    break;
+                }
+                n--;
+            }
+
+            for (int i = 0; i < node.nt; i++)
+                order[i] = static_cast<uint8_t>(i);
+            if (!(node.header[0] & FLAG_NODE_SORTED)) {
+                std::sort(order, order + node.nt, [this](uint8_t a, uint8_t b) {
+                    return node.first_chars[a] < node.first_chars[b];
+                });
+            }
+            int idx = -1;
+            for (int i = 0; i < node.nt; i++) {
+                int64_t count;
+                rval = mm->EdgeSubtreeCount(edgeAt(order[i]), count);
+                if (rval != MBError::SUCCESS)
+                    return rval;
+                if (n < count) {
+                    idx = order[i];
+                    break;
+                }
+                n -= count;
+            }
+            // Counts that do not add up can only come from a racing update.
+            if (idx < 0)
+                return MBError::TRY_AGAIN;
+
+            const uint8_t* edge = edgeAt(idx);
+            int edge_len = edge[EDGE_LEN_POS];
+            if (path.size() + edge_len > static_cast<size_t>(CONSTS::MAX_KEY_LENGHTH))
+                return MBError::TRY_AGAIN;
+            rval = readLabel(idx, edge_len);
+            if (rval != MBError::SUCCESS)
+                return rval;
+            path.append(reinterpret_cast<const char*>(label), edge_len);
+            if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF) {
+                if (n != 0)
+                    return MBError::TRY_AGAIN;
+                data_offset = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+                break;
+            }
+            node_off = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+        }
+
+        rval = dict.ReadDataByOffset(data_offset, data);
+        if (rval == MBError::SUCCESS)
+            data.data_offset = data_offset;
+        return rval;
+    }
+
+    int SubtreeCounter::readNode(size_t offset)
+    {
+        node.offset = offset;
+        if (mm->ReadData(node.header, NODE_EDGE_KEY_FIRST, offset) != NODE_EDGE_KEY_FIRST)
+            return MBError::READ_ERROR;
+        node.nt = node.header[1] + 1;
+        if (mm->ReadData(node.first_chars, node.nt, offset + NODE_EDGE_KEY_FIRST) != node.nt
+            || mm->ReadData(node.edges, node.nt * EDGE_SIZE, offset + NODE_EDGE_KEY_FIRST + node.nt)
+                != node.nt * EDGE_SIZE)
+            return MBError::READ_ERROR;
+        return MBError::SUCCESS;
+    }
+
+    // Full label of edge idx, first character included
+    int SubtreeCounter::readLabel(int idx, int edge_len)
+    {
+        const uint8_t* edge = edgeAt(idx);
+        label[0] = node.first_chars[idx];
+        if (edge_len > LOCAL_EDGE_LEN) {
+            if (mm->ReadData(label + 1, edge_len - 1, Get5BInteger(edge)) != edge_len - 1)
+                return MBError::READ_ERROR;
+        } else if (edge_len > 1) {
+            memcpy(label + 1, edge, edge_len - 1);
+        }
+        return MBError::SUCCESS;
+    }
+
+} // namespace detail
+} // namespace mabain
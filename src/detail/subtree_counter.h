@@ -0,0 +1,58 @@
+/**
+ * Internal helper: prefix counts, rank and select over the per-node subtree
+ * entry counts of DBs created with OPTION_SUBTREE_COUNT. A query descends
+ * the main tree once and reads the counts of the children it passes; it is
+ * repeated when the writer's update sequence shows that the tree changed
+ * underneath it. Not part of the public API.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "dict.h"
+#include "mb_data.h"
+
+namespace mabain {
+namespace detail {
+
+    class SubtreeCounter {
+    public:
+        explicit SubtreeCounter(Dict& d);
+
+        // Number of entries whose key starts with prefix
+        int countPrefix(const uint8_t* prefix, int len, int64_t& count);
+        // Number of entries whose key is less than key
+        int rank(const uint8_t* key, int len, int64_t& rank);
+        // Entry at 0-based position n in ascending key order; NOT_EXIST if
+        // n is out of range.
+        int select(int64_t n, MBData& data, std::string* key);
+
+    private:
+        struct Node {
+            size_t offset;
+            int nt;
+            uint8_t header[NODE_EDGE_KEY_FIRST];
+            uint8_t first_chars[NUM_ALPHABET];
+            uint8_t edges[NUM_ALPHABET * EDGE_SIZE];
+        };
+
+        template <typename Query>
+        int run(Query query);
+        int countPrefixOnce(const uint8_t* prefix, int len, int64_t& count);
+        int rankOnce(const uint8_t* key, int len, int64_t& rank);
+        int selectOnce(int64_t n, MBData& data);
+        int readNode(size_t offset);
+        int readLabel(int idx, int edge_len);
+        const uint8_t* edgeAt(int idx) const { return node.edges + idx * EDGE_SIZE; }
+
+        Dict& dict;
+        DictMem* mm;
+        IndexHeader* header;
+        Node node;
+        uint8_t label[NUM_ALPHABET];
+        std::string path;
+    };
+
+} // namespace detail
+} // namespace mabain
@@ -16,9 +16,12 @@
 
 // @author Changxue Deng <chadeng@cisco.com>
 
+#include <algorithm>
 #include <errno.h>
 #include <iostream>
+#include <limits>
 #include <stdlib.h>
+#include <vector>
 
 #include "async_writer.h"
 #include "db.h"
@@ -31,22 +34,100 @@
 #include "util/prefix_cache.h"
 
 #define DATA_HEADER_SIZE 32
+#define HASH_INDEX_DEFAULT_CAPACITY (1ULL << 20)
+#define HASH_INDEX_INLINE_KEY 24
+#define BLOOM_FILTER_DEFAULT_KEYS (1ULL << 20)
 
 namespace mabain {
 
+namespace {
+    // Readers skip the hash index while a writer update is in flight.
+    class HashIndexUpdateScope {
+    public:
+        explicit HashIndexUpdateScope(Dict& d)
+            : dict(d)
+        {
+            dict.BeginHashIndexUpdate();
+        }
+        ~HashIndexUpdateScope() { dict.EndHashIndexUpdate(); }
+
+    private:
+        Dict& dict;
+    };
+
+    // Readers skip the subtree counts while a writer update is in flight.
+    class SubtreeCountUpdateScope {
+    public:
+        explicit SubtreeCountUpdateScope(Dict& d)
+            : dict(d)
+        {
+            dict.BeginSubtreeCountUpdate();
+        }
+        ~SubtreeCountUpdateScope() { dict.EndSubtreeCountUpdate(); }
+
+    private:
+        Dict& dict;
+    };
+
+    // The group commit flusher holds off the header sync while a writer
+    // update is in flight.
+    class GroupSyncUpdateScope {
+    public:
+        explicit GroupSyncUpdateScope(Dict& d)
+            : dict(d)
+        {
+            dict.BeginGroupSyncUpdate();
+        }
+        ~GroupSyncUpdateScope() { dict.EndGroupSyncUpdate(); }
+
+    private:
+        Dict& dict;
+    };
+
+    // Readers skip the Bloom filter while the writer clears it.
+    class BloomFilterUpdateScope {
+    public:
+        explicit BloomFilterUpdateScope(Dict& d)
+            : dict(d)
+        {
+            dict.BeginBloomFilterUpdate();
+        }
+        ~BloomFilterUpdateScope() { dict.EndBloomFilterUpdate(); }
+
+    private:
+        Dict& dict;
+    };
+}
+
 Dict::Dict(const std::string& mbdir, bool init_header, int datasize,
     int db_options, size_t memsize_index, size_t memsize_data,
     uint32_t block_sz_idx, uint32_t block_sz_data,
     int max_num_index_blk, int max_num_data_blk,
     int64_t entry_per_bucket, uint32_t queue_size,
-    const char* queue_dir)
+    const char* queue_dir, uint32_t queue_lanes, uint32_t connect_id)
     : DRMBase(mbdir, db_options, false)
     , mm(mbdir, init_header, memsize_index, db_options, block_sz_idx, max_num_index_blk, queue_size)
-    , queue(NULL)
 {
     status = MBError::NOT_INITIALIZED;
     reader_rc_off = 0;
     slaq = NULL;
+    shmq_seq = 0;
+    shmq_lane = 0;
+    hash_index_capacity = 0;
+    hash_index_depth = 0;
+    subtree_count_depth = 0;
+    group_sync_depth = 0;
+    bloom_filter_blocks = 0;
+    bloom_filter_depth = 0;
+    bloom_filter_skips = 0;
+    bloom_filter_false_positives = 0;
+    write_batch = false;
+    batch_count = 0;
+    batch_updates = 0;
+    batch_data_off = 0;
+    batch_data_end = 0;
+    batch_data_need = 0;
+    batch_data_ptr = NULL;
 
     header = mm.GetHeaderPtr();
     if (header == NULL) {
@@ -69,8 +150,11 @@ Dict::Dict(const std::string& mbdir, bool init_header, int datasize,
 
     if (!(db_options & CONSTS::READ_ONLY_DB)) {
         // initialize shared memory queue
-        slaq = qmgr.CreateFile(header->shm_queue_id, queue_size, queue_dir, db_options);
-        queue = slaq->queue;
+        slaq = qmgr.CreateFile(header->shm_queue_id, queue_size, queue_lanes, queue_dir,
+            db_options, header, init_header);
+        // Handles of one process share a lane unless they have connect ids;
+        // handles whose ids map to the same lane contend on its tail.
+        shmq_lane = (connect_id != 0 ? connect_id : static_cast<uint32_t>(getpid())) % slaq->num_lanes;
     }
     lfree.LockFreeInit(&header->lock_free, header, db_options);
     mm.InitLockFreePtr(&lfree);
@@ -119,6 +203,18 @@ Dict::Dict(const std::string& mbdir, bool init_header, int datasize,
                 throw (int)MBError::INVALID_ARG;
             }
         }
+        // A writer without the hash index option leaves the index stale.
+        if ((options & CONSTS::ACCESS_MODE_WRITER) && !(options & CONSTS::OPTION_HASH_INDEX)
+            && header->hash_index_capacity != 0) {
+            header->hash_index_seq.fetch_or(1, MEMORY_ORDER_WRITER);
+            header->hash_index_capacity = 0;
+        }
+        // Keys added without the Bloom filter option are not in the filter.
+        if ((options & CONSTS::ACCESS_MODE_WRITER) && !(options & CONSTS::OPTION_BLOOM_FILTER)
+            && header->bloom_filter_blocks != 0) {
+            header->bloom_filter_seq.fetch_or(1, MEMORY_ORDER_WRITER);
+            header->bloom_filter_blocks = 0;
+        }
         // Self-consistency: if DB lacks embedded cache region, ignore option.
         if (!(header->pfxcache_size > 0) && (options & CONSTS::OPTION_PREFIX_CACHE)) {
             Logger::Log(LOG_LEVEL_WARN, "Prefix cache option set but DB has no embedded cache; disabling.");
@@ -263,6 +359,13 @@ int Dict::Init(uint32_t id)
 
 void Dict::Destroy()
 {
+    if (group_sync) {
+        SetGroupSync(NULL);
+        mm.SetGroupSync(NULL);
+        group_sync.reset();
+    }
+    if (!retired_buffers.empty())
+        freeRetiredBuffers(minViewEpoch());
     mm.Destroy();
 
     if (free_lists != NULL)
@@ -283,11 +386,50 @@ int Dict::Status() const
 // if overwrite is true and an entry with input key already exists, the old data will
 // be overwritten. Otherwise, IN_DICT will be returned.
 int Dict::Add(const uint8_t* key, int len, MBData& data, bool overwrite)
+{
+    GroupSyncUpdateScope sync_scope(*this);
+    SubtreeCountUpdateScope count_scope(*this);
+    // The key is in the filter before readers can find it in the tree.
+    if (bloom_filter)
+        AddBloomFilter(key, len);
+    if (!hash_index)
+        return AddEntry(key, len, data, overwrite);
+
+    HashIndexUpdateScope scope(*this);
+    int rval = AddEntry(key, len, data, overwrite);
+    if (rval == MBError::SUCCESS) {
+        // The rc tree is not covered by the index; the key is put back when
+        // rc moves it to the main tree.
+        if (data.options & CONSTS::OPTION_RC_MODE)
+            hash_index->Erase(key, len);
+        else
+            PutHashIndex(key, len, data.data_offset);
+    }
+    return rval;
+}
+
+inline void Dict::AddCount(int64_t delta)
+{
+    if (write_batch)
+        batch_count += delta;
+    else
+        header->count += delta;
+}
+
+inline void Dict::AddUpdate()
+{
+    if (write_batch)
+        batch_updates++;
+    else
+        header->num_update++;
+}
+
+int Dict::AddEntry(const uint8_t* key, int len, MBData& data, bool overwrite)
 {
     if (!(options & CONSTS::ACCESS_MODE_WRITER)) {
         return MBError::NOT_ALLOWED;
     }
-    if (len > CONSTS::MAX_KEY_LENGHTH || data.data_len > CONSTS::MAX_DATA_SIZE || len <= 0 || data.data_len <= 0)
+    if (len > CONSTS::MAX_KEY_LENGHTH || data.data_len > CONSTS::MAX_LARGE_DATA_SIZE || len <= 0 || data.data_len <= 0)
         return MBError::OUT_OF_BOUND;
 
     EdgePtrs edge_ptrs;
@@ -304,9 +446,11 @@ int Dict::Add(const uint8_t* key, int len, MBData& data, bool overwrite)
         if (data.options & CONSTS::OPTION_RC_MODE) {
             header->rc_count++;
         } else {
-            header->count++;
-            header->num_update++;
+            AddCount(1);
+            AddUpdate();
         }
+        if (mm.SubtreeCountEnabled())
+            return mm.UpdateSubtreeCounts(data.options & CONSTS::OPTION_RC_MODE, key, len, 1);
         return MBError::SUCCESS;
     }
 
@@ -386,10 +530,13 @@ int Dict::Add(const uint8_t* key, int len, MBData& data, bool overwrite)
             header->rc_count++;
     } else {
         if (rval == MBError::SUCCESS)
-            header->num_update++;
+            AddUpdate();
         if (inc_count)
-            header->count++;
+            AddCount(1);
     }
+    // New keys are counted on their path once the tree is updated.
+    if (rval == MBError::SUCCESS && inc_count && mm.SubtreeCountEnabled())
+        rval = mm.UpdateSubtreeCounts(data.options & CONSTS::OPTION_RC_MODE, key, orig_len, 1);
     // After a successful add, seed prefix cache at canonical 2/3-byte boundaries.
     if (rval == MBError::SUCCESS && prefix_cache) {
         SeedCanonicalBoundariesAfterAdd(key, orig_len, /*from_add=*/true);
@@ -646,23 +793,97 @@ int Dict::ReadDataFromEdge(MBData& data, const EdgePtrs& edge_ptrs) const
         data_off = Get6BInteger(node_buff + 2);
     }
     data.data_offset = data_off;
+    return readValue(data_off, data);
+}
 
+// Read the value in the data buffer at data_off
+int Dict::readValue(size_t data_off, MBData& data) const
+{
     uint16_t data_len[2];
     // Read data length first
     if (ReadData(reinterpret_cast<uint8_t*>(&data_len[0]), DATA_HDR_BYTE, data_off)
         != DATA_HDR_BYTE)
         return MBError::READ_ERROR;
+    data.bucket_index = data_len[1];
+    if (data_len[0] & DATA_EXTENT_FLAG)
+        return readExtents(data_off, data_len[0] & ~DATA_EXTENT_FLAG, data);
     data_off += DATA_HDR_BYTE;
-    if (data.buff_len < data_len[0] + 1) {
-        if (data.Resize(data_len[0]) != MBError::SUCCESS)
+    if (data.options & CONSTS::OPTION_DATA_VIEW) {
+        // Caller maps or copies the value itself.
+        data.data_len = data_len[0];
+        return MBError::SUCCESS;
+    }
+    int len = data_len[0];
+    if (data.options & CONSTS::OPTION_READ_RANGE) {
+        int64_t start = std::min<int64_t>(data.range_offset, len);
+        data_off += start;
+        len = std::min<int64_t>(len - start, data.buff_len);
+    } else if (data.buff_len < len + 1) {
+        if (data.Resize(len) != MBError::SUCCESS)
             return MBError::NO_MEMORY;
     }
 
-    if (ReadData(data.buff, data_len[0], data_off) != data_len[0])
+    if (ReadData(data.buff, len, data_off) != len)
         return MBError::READ_ERROR;
 
-    data.data_len = data_len[0];
-    data.bucket_index = data_len[1];
+    data.data_len = len;
+    return MBError::SUCCESS;
+}
+
+// Read a value stored in extents, see reserveExtents. The extents are found
+// through the list at data_off; a list that does not match the extents it
+// points to was changed by the writer while it was read.
+int Dict::readExtents(size_t data_off, int extents_len, MBData& data) const
+{
+    uint64_t value_len;
+    data_off += DATA_HDR_BYTE;
+    if (ReadData(reinterpret_cast<uint8_t*>(&value_len), sizeof(value_len), data_off)
+        != sizeof(value_len))
+        return MBError::READ_ERROR;
+    int num_extents = (extents_len - static_cast<int>(sizeof(value_len))) / OFFSET_SIZE;
+    if (value_len > static_cast<uint64_t>(num_extents) * CONSTS::MAX_DATA_SIZE
+        || value_len <= static_cast<uint64_t>(num_extents - 1) * CONSTS::MAX_DATA_SIZE)
+        return MBError::TRY_AGAIN;
+    if (data.options & CONSTS::OPTION_DATA_VIEW) {
+        // Not contiguous; the caller has to look it up again for a copy.
+        data.options &= ~CONSTS::OPTION_DATA_VIEW;
+        data.data_len = value_len;
+        return MBError::SUCCESS;
+    }
+
+    int64_t start = 0;
+    int len = value_len;
+    if (data.options & CONSTS::OPTION_READ_RANGE) {
+        start = std::min<int64_t>(data.range_offset, value_len);
+        len = std::min<int64_t>(value_len - start, data.buff_len);
+    } else if (data.buff_len < len + 1) {
+        if (data.Resize(len) != MBError::SUCCESS)
+            return MBError::NO_MEMORY;
+    }
+
+    uint8_t* buff = data.buff;
+    int64_t end = start + len;
+    uint8_t extent_ptr[OFFSET_SIZE];
+    for (int i = start / CONSTS::MAX_DATA_SIZE; start < end; i++) {
+        if (ReadData(extent_ptr, OFFSET_SIZE, data_off + sizeof(value_len) + i * OFFSET_SIZE)
+            != OFFSET_SIZE)
+            return MBError::READ_ERROR;
+        size_t extent_off = Get6BInteger(extent_ptr);
+        int64_t extent_start = static_cast<int64_t>(i) * CONSTS::MAX_DATA_SIZE;
+        uint16_t extent_len;
+        if (ReadData(reinterpret_cast<uint8_t*>(&extent_len), DATA_SIZE_BYTE, extent_off)
+            != DATA_SIZE_BYTE)
+            return MBError::READ_ERROR;
+        if (extent_len != std::min<int64_t>(value_len - extent_start, CONSTS::MAX_DATA_SIZE))
+            return MBError::TRY_AGAIN;
+        int n = std::min<int64_t>(end, extent_start + extent_len) - start;
+        if (ReadData(buff, n, extent_off + DATA_HDR_BYTE + (start - extent_start)) != n)
+            return MBError::READ_ERROR;
+        buff += n;
+        start += n;
+    }
+
+    data.data_len = len;
     return MBError::SUCCESS;
 }
 
@@ -682,6 +903,7 @@ int Dict::DeleteDataFromEdge(MBData& data, EdgePtrs& edge_ptrs)
         if (ReadData(reinterpret_cast<uint8_t*>(&data_len), DATA_SIZE_BYTE, data_off)
             != DATA_SIZE_BYTE)
             return MBError::READ_ERROR;
+        data_len = releaseExtents(data_off, data_len);
         if (options & CONSTS::OPTION_JEMALLOC) {
             rel_size = data_len + DATA_HDR_BYTE;
         } else {
@@ -712,6 +934,7 @@ int Dict::DeleteDataFromEdge(MBData& data, EdgePtrs& edge_ptrs)
                 != DATA_SIZE_BYTE)
                 return MBError::READ_ERROR;
 
+            data_len = releaseExtents(data_off, data_len);
             if (options & CONSTS::OPTION_JEMALLOC) {
                 rel_size = data_len + DATA_HDR_BYTE;
             } else {
@@ -733,24 +956,7 @@ int Dict::ReadDataFromNode(MBData& data, const uint8_t* node_ptr) const
         return MBError::NOT_EXIST;
 
     data.data_offset = data_off;
-
-    // Read data length first
-    uint16_t data_len[2];
-    if (ReadData(reinterpret_cast<uint8_t*>(&data_len[0]), DATA_HDR_BYTE, data_off)
-        != DATA_HDR_BYTE)
-        return MBError::READ_ERROR;
-    data_off += DATA_HDR_BYTE;
-
-    if (data.buff_len < data_len[0] + 1) {
-        if (data.Resize(data_len[0]) != MBError::SUCCESS)
-            return MBError::NO_MEMORY;
-    }
-    if (ReadData(data.buff, data_len[0], data_off) != data_len[0])
-        return MBError::READ_ERROR;
-
-    data.data_len = data_len[0];
-    data.bucket_index = data_len[1];
-    return MBError::SUCCESS;
+    return readValue(data_off, data);
 }
 
 void Dict::PrintStats(std::ostream* out_stream) const
@@ -786,6 +992,13 @@ void Dict::PrintStats(std::ostream& out_stream) const
 
     kv_file->PrintStats(out_stream);
     qmgr.PrintStats(out_stream, header);
+    if (hash_index)
+        hash_index->PrintStats(out_stream);
+    if (bloom_filter) {
+        bloom_filter->PrintStats(out_stream);
+        out_stream << "\tLookups skipped: " << GetBloomFilterSkips() << std::endl;
+        out_stream << "\tFalse positives: " << GetBloomFilterFalsePositives() << std::endl;
+    }
 
 #ifdef __DEBUG__
     out_stream << "Size of tracking buffer: " << buffer_map.size() << std::endl;
@@ -889,6 +1102,8 @@ void Dict::ReadNodeHeader(size_t node_off, int& node_size, int& match,
         throw (int)MBError::READ_ERROR;
 
     node_size = mm.GetNodeSizePtr()[node_buff[1]];
+    if (node_buff[0] & FLAG_NODE_INDEXED)
+        node_size += NODE_INDEX_SIZE;
     if (node_buff[0] & FLAG_NODE_MATCH) {
         match = MATCH_NODE;
         data_offset = Get6BInteger(node_buff + 2);
@@ -937,6 +1152,157 @@ int Dict::Remove(const uint8_t* key, int len)
 }
 
 int Dict::Remove(const uint8_t* key, int len, MBData& data)
+{
+    GroupSyncUpdateScope sync_scope(*this);
+    SubtreeCountUpdateScope count_scope(*this);
+    if (!hash_index)
+        return RemoveEntry(key, len, data);
+
+    HashIndexUpdateScope scope(*this);
+    int rval = RemoveEntry(key, len, data);
+    if (rval == MBError::SUCCESS)
+        hash_index->Erase(key, len);
+    return rval;
+}
+
+// Same as Add and Remove for every entry, with the per-call work done once
+// for the batch: the seqlocks of the hash index and the subtree counts are
+// taken once, data buffers come from one reservation and the header counters
+// are updated at the end. Sorted keys make each walk follow nodes the
+// previous one has just touched.
+int Dict::Write(WriteBatch& batch, bool overwrite)
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER))
+        return MBError::NOT_ALLOWED;
+
+    batch.Sort();
+    batch.skipped = 0;
+    size_t data_size = 0;
+    if (!(options & CONSTS::OPTION_JEMALLOC)) {
+        for (const WriteBatch::Entry& entry : batch.entries) {
+            if (entry.value_len > 0)
+                data_size += free_lists->GetAlignmentSize(entry.value_len + DATA_HDR_BYTE);
+        }
+    }
+
+    GroupSyncUpdateScope sync_scope(*this);
+    SubtreeCountUpdateScope count_scope(*this);
+    HashIndexUpdateScope scope(*this);
+    BeginWriteBatch(data_size);
+    int rval = MBError::SUCCESS;
+    try {
+        MBData data;
+        for (const WriteBatch::Entry& entry : batch.entries) {
+            const uint8_t* key = batch.Key(entry);
+            if (entry.value_len > 0) {
+                if (bloom_filter)
+                    AddBloomFilter(key, entry.key_len);
+                data.buff = const_cast<uint8_t*>(batch.Value(entry));
+                data.data_len = entry.value_len;
+                data.options = 0;
+                rval = AddEntry(key, entry.key_len, data, overwrite);
+                if (rval == MBError::SUCCESS && hash_index)
+                    PutHashIndex(key, entry.key_len, data.data_offset);
+            } else {
+                MBData remove_data(0, CONSTS::OPTION_FIND_AND_STORE_PARENT);
+                rval = RemoveEntry(key, entry.key_len, remove_data);
+                if (rval == MBError::SUCCESS && hash_index)
+                    hash_index->Erase(key, entry.key_len);
+            }
+            if (rval == MBError::IN_DICT || rval == MBError::NOT_EXIST) {
+                batch.skipped++;
+                rval = MBError::SUCCESS;
+            } else if (rval != MBError::SUCCESS) {
+                break;
+            }
+        }
+        data.buff = NULL;
+    } catch (int error) {
+        rval = error;
+    }
+    EndWriteBatch();
+    return rval;
+}
+
+// Read the value of key, compute the new value and write it back. The writer
+// is the only one updating the DB, so no other update can come in between.
+int Dict::Update(const uint8_t* key, int len, int type, const uint8_t* operand, int operand_len,
+    bool rc_mode)
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER))
+        return MBError::NOT_ALLOWED;
+
+    MBData current;
+    detail::SearchEngine engine(*this);
+    int rval = engine.find(key, len, current);
+    if (rval != MBError::SUCCESS && rval != MBError::NOT_EXIST)
+        return rval;
+    bool exists = (rval == MBError::SUCCESS);
+    if (!exists)
+        current.data_len = 0;
+
+    std::string value;
+    switch (type) {
+    case MABAIN_ASYNC_TYPE_INCREMENT: {
+        // Wrap around on overflow.
+        uint64_t number = 0;
+        uint64_t delta;
+        if (operand_len != sizeof(delta))
+            return MBError::INVALID_ARG;
+        if (exists) {
+            if (current.data_len != sizeof(number))
+                return MBError::INVALID_SIZE;
+            memcpy(&number, current.buff, sizeof(number));
+        }
+        memcpy(&delta, operand, sizeof(delta));
+        number += delta;
+        value.assign(reinterpret_cast<const char*>(&number), sizeof(number));
+        break;
+    }
+    case MABAIN_ASYNC_TYPE_APPEND:
+        value.reserve(current.data_len + operand_len);
+        value.assign(reinterpret_cast<const char*>(current.buff), current.data_len);
+        value.append(reinterpret_cast<const char*>(operand), operand_len);
+        break;
+    case MABAIN_UPDATE_TYPE_CAS: {
+        int32_t expected_len;
+        if (operand_len < static_cast<int>(sizeof(expected_len)))
+            return MBError::INVALID_ARG;
+        memcpy(&expected_len, operand, sizeof(expected_len));
+        operand += sizeof(expected_len);
+        operand_len -= sizeof(expected_len);
+        if (expected_len < 0 || expected_len > operand_len)
+            return MBError::INVALID_ARG;
+        if (expected_len == 0 ? exists
+                              : (current.data_len != expected_len || memcmp(current.buff, operand, expected_len) != 0))
+            return MBError::COMPARE_FAILED;
+        value.assign(reinterpret_cast<const char*>(operand) + expected_len, operand_len - expected_len);
+        break;
+    }
+    case MABAIN_ASYNC_TYPE_MERGE:
+        if (!merge_operator)
+            return MBError::NOT_ALLOWED;
+        if (!merge_operator(exists ? current.buff : NULL, current.data_len, operand, operand_len, value))
+            return MBError::INVALID_ARG;
+        break;
+    default:
+        return MBError::INVALID_ARG;
+    }
+
+    MBData data(0, rc_mode ? CONSTS::OPTION_RC_MODE : 0);
+    data.buff = reinterpret_cast<uint8_t*>(const_cast<char*>(value.data()));
+    data.data_len = static_cast<int>(value.size());
+    rval = Add(key, len, data, true);
+    data.buff = NULL;
+    return rval;
+}
+
+void Dict::SetMergeOperator(const DB::MergeOperator& merge)
+{
+    merge_operator = merge;
+}
+
+int Dict::RemoveEntry(const uint8_t* key, int len, MBData& data)
 {
     if (!(options & CONSTS::ACCESS_MODE_WRITER)) {
         return MBError::NOT_ALLOWED;
@@ -955,6 +1321,12 @@ int Dict::Remove(const uint8_t* key, int len, MBData& data)
         detail::SearchEngine engine(*this);
         rval = engine.find(key, len, data);
     }
+    // Counts are taken off while the whole path is still in place.
+    if (rval == MBError::IN_DICT && mm.SubtreeCountEnabled()) {
+        int count_rval = mm.UpdateSubtreeCounts(false, key, len, -1);
+        if (count_rval != MBError::SUCCESS)
+            return count_rval;
+    }
     if (rval == MBError::IN_DICT) {
         rval = DeleteDataFromEdge(data, data.edge_ptrs);
         while (rval == MBError::TRY_AGAIN) {
@@ -974,7 +1346,9 @@ int Dict::Remove(const uint8_t* key, int len, MBData& data)
     }
 
     if (rval == MBError::SUCCESS) {
-        header->count--;
+        AddCount(-1);
+        if (bloom_filter)
+            header->bloom_filter_removed++;
     }
 
     return rval;
@@ -983,6 +1357,17 @@ int Dict::Remove(const uint8_t* key, int len, MBData& data)
 int Dict::RemoveAll()
 {
     int rval = MBError::SUCCESS;
+    GroupSyncUpdateScope sync_scope(*this);
+    HashIndexUpdateScope scope(*this);
+    SubtreeCountUpdateScope count_scope(*this);
+    BloomFilterUpdateScope filter_scope(*this);
+    ClearHashIndex();
+    ClearBloomFilter();
+    header->BumpIndexFreeSeq();
+    // Every data buffer goes, including those kept for value views.
+    DropRetiredBuffers();
+    BeginValueUpdate();
+    EndValueUpdate();
 
     mm.ClearMem(); // clear memory will re-initialize jemalloc
     if (options & CONSTS::OPTION_JEMALLOC) {
@@ -1006,6 +1391,10 @@ int Dict::RemoveAll()
     header->count = 0;
     header->eviction_bucket_index = 0;
     header->num_update = 0;
+    if (rval == MBError::SUCCESS && mm.SubtreeCountEnabled()) {
+        int64_t count;
+        rval = mm.RebuildSubtreeCounts(count);
+    }
     return rval;
 }
 
@@ -1014,16 +1403,20 @@ pthread_mutex_t* Dict::GetShmLockPtr() const
     return &(slaq->lock);
 }
 
-AsyncNode* Dict::GetAsyncQueuePtr() const
+shm_lock_and_queue* Dict::GetAsyncQueuePtr() const
 {
-    return slaq->queue;
+    return slaq;
 }
 
 // Reserve buffer and write to it
 // The pending_data_buff_size in jemalloc mode is the total size of all allocated data buffers
 // The pending_data_buff_size in non-jemalloc mode is the total size of all free data buffers
-void Dict::ReserveData(const uint8_t* buff, int size, size_t& offset)
+void Dict::ReserveData(const uint8_t* buff, int size, size_t& offset, uint16_t len_flag)
 {
+    if (size > CONSTS::MAX_DATA_SIZE) {
+        reserveExtents(buff, size, offset);
+        return;
+    }
     if (options & CONSTS::OPTION_JEMALLOC) {
         int buf_size = size + DATA_HDR_BYTE;
         void* ptr = kv_file->Malloc(buf_size, offset);
@@ -1034,18 +1427,14 @@ void Dict::ReserveData(const uint8_t* buff, int size, size_t& offset)
             throw rval;
         }
         uint16_t dsize[2];
-        dsize[0] = static_cast<uint16_t>(size);
-        // store bucket index for LRU eviction
-        dsize[1] = (header->num_update / header->entry_per_bucket) % 0xFFFF;
-        if (dsize[1] == header->eviction_bucket_index && header->num_update > header->entry_per_bucket) {
-            header->eviction_bucket_index++;
-        }
+        dsize[0] = static_cast<uint16_t>(size) | len_flag;
+        dsize[1] = nextBucketIndex();
         memcpy(ptr, &dsize[0], DATA_HDR_BYTE);
         memcpy(static_cast<uint8_t*>(ptr) + DATA_HDR_BYTE, buff, size);
         // update the size of pending data buffer in the header
         header->pending_data_buff_size += (buf_size + JEMALLOC_ALIGNMENT - 1) & ~(JEMALLOC_ALIGNMENT - 1);
     } else {
-        reserveDataFL(buff, size, offset);
+        reserveDataFL(buff, size, offset, len_flag);
     }
 
 #ifdef __DEBUG__
@@ -1055,7 +1444,67 @@ void Dict::ReserveData(const uint8_t* buff, int size, size_t& offset)
 #endif
 }
 
-void Dict::reserveDataFL(const uint8_t* buff, int size, size_t& offset)
+// LRU bucket index stored in the header of a buffer written by the current update
+uint16_t Dict::nextBucketIndex()
+{
+    int64_t num_update = header->num_update + batch_updates;
+    uint16_t bucket_index = (num_update / header->entry_per_bucket) % 0xFFFF;
+    if (bucket_index == header->eviction_bucket_index && num_update > header->entry_per_bucket) {
+        header->eviction_bucket_index++;
+    }
+    return bucket_index;
+}
+
+// A value larger than MAX_DATA_SIZE is cut into extents of MAX_DATA_SIZE
+// bytes, each an ordinary data buffer. The buffer linked from the tree holds
+// the extent list: the 8-byte value length followed by the 6-byte extent
+// offsets, with DATA_EXTENT_FLAG set in its length.
+void Dict::reserveExtents(const uint8_t* buff, int size, size_t& offset)
+{
+    int num_extents = (size + CONSTS::MAX_DATA_SIZE - 1) / CONSTS::MAX_DATA_SIZE;
+    std::vector<uint8_t> extents(sizeof(uint64_t) + num_extents * OFFSET_SIZE);
+    uint64_t value_len = size;
+    memcpy(extents.data(), &value_len, sizeof(value_len));
+    uint8_t* extent_ptr = extents.data() + sizeof(value_len);
+    int i = 0;
+    try {
+        for (; i < num_extents; i++) {
+            int pos = i * CONSTS::MAX_DATA_SIZE;
+            size_t extent_off;
+            ReserveData(buff + pos, std::min(size - pos, CONSTS::MAX_DATA_SIZE), extent_off);
+            Write6BInteger(extent_ptr + i * OFFSET_SIZE, extent_off);
+        }
+        ReserveData(extents.data(), extents.size(), offset, DATA_EXTENT_FLAG);
+    } catch (int) {
+        while (i-- > 0)
+            ReleaseBuffer(Get6BInteger(extent_ptr + i * OFFSET_SIZE));
+        throw;
+    }
+}
+
+// Release the extents of a large value if data_len, the length stored in the
+// data buffer at offset, has DATA_EXTENT_FLAG set. Returns the length of the
+// buffer's own content.
+uint16_t Dict::releaseExtents(size_t offset, uint16_t data_len)
+{
+    if (!(data_len & DATA_EXTENT_FLAG))
+        return data_len;
+    data_len &= ~DATA_EXTENT_FLAG;
+    int num_extents = (data_len - sizeof(uint64_t)) / OFFSET_SIZE;
+    size_t extent_link = offset + DATA_HDR_BYTE + sizeof(uint64_t);
+    uint8_t buff[OFFSET_SIZE];
+    for (int i = 0; i < num_extents; i++, extent_link += OFFSET_SIZE) {
+        if (ReadData(buff, OFFSET_SIZE, extent_link) != OFFSET_SIZE) {
+            Logger::Log(LOG_LEVEL_WARN, "failed to read extent %d of value %llu", i, offset);
+            continue;
+        }
+        if (ReleaseBuffer(Get6BInteger(buff)) != MBError::SUCCESS)
+            Logger::Log(LOG_LEVEL_WARN, "failed to release extent %d of value %llu", i, offset);
+    }
+    return data_len;
+}
+
+void Dict::reserveDataFL(const uint8_t* buff, int size, size_t& offset, uint16_t len_flag)
 {
 #ifdef __DEBUG__
     assert(size <= CONSTS::MAX_DATA_SIZE);
@@ -1063,18 +1512,16 @@ void Dict::reserveDataFL(const uint8_t* buff, int size, size_t& offset)
     int buf_size = free_lists->GetAlignmentSize(size + DATA_HDR_BYTE);
     int buf_index = free_lists->GetBufferIndex(buf_size);
     uint16_t dsize[2];
-    dsize[0] = static_cast<uint16_t>(size);
-    // store bucket index for LRU eviction
-    dsize[1] = (header->num_update / header->entry_per_bucket) % 0xFFFF;
-    if (dsize[1] == header->eviction_bucket_index && header->num_update > header->entry_per_bucket) {
-        header->eviction_bucket_index++;
-    }
+    dsize[0] = static_cast<uint16_t>(size) | len_flag;
+    dsize[1] = nextBucketIndex();
 
     if (free_lists->GetBufferCountByIndex(buf_index) > 0) {
         offset = free_lists->RemoveBufferByIndex(buf_index);
         WriteData(reinterpret_cast<const uint8_t*>(&dsize[0]), DATA_HDR_BYTE, offset);
         WriteData(buff, size, offset + DATA_HDR_BYTE);
         header->pending_data_buff_size -= buf_size;
+    } else if (write_batch) {
+        ReserveBatchData(dsize, buff, size, buf_size, offset);
     } else {
         size_t old_off = header->m_data_offset;
         uint8_t* ptr;
@@ -1101,11 +1548,86 @@ void Dict::reserveDataFL(const uint8_t* buff, int size, size_t& offset)
     }
 }
 
+// Data buffers of a write batch that do not come from the free lists are
+// cut from one reservation at the end of the data file. Nothing else moves
+// m_data_offset during a batch, so an unused tail is given back by moving it
+// down again. The reservation does not cross a data block, which keeps the
+// alignment gap smaller than a data buffer as in the unbatched path.
+void Dict::ReserveBatchData(const uint16_t* dsize, const uint8_t* buff, int size, int buf_size,
+    size_t& offset)
+{
+    if (batch_data_end - batch_data_off < static_cast<size_t>(buf_size)) {
+        if (batch_data_off < batch_data_end)
+            header->m_data_offset = batch_data_off;
+        size_t want = std::max(batch_data_need, static_cast<size_t>(buf_size));
+        size_t room = header->data_block_size - header->m_data_offset % header->data_block_size;
+        if (room >= static_cast<size_t>(buf_size))
+            want = std::min(want, room);
+        want = std::min(want, static_cast<size_t>(std::min<uint64_t>(header->data_block_size, 0x40000000)));
+        size_t old_off = header->m_data_offset;
+        uint8_t* ptr;
+        // Readers map new sliding windows on their own; only use a pointer
+        // into memory that is mapped already.
+        int rval = kv_file->Reserve(header->m_data_offset, static_cast<int>(want), ptr, false);
+        if (rval != MBError::SUCCESS)
+            throw rval;
+        if (old_off < header->m_data_offset) {
+            ReleaseAlignmentBuffer(old_off, header->m_data_offset);
+            header->pending_data_buff_size += header->m_data_offset - old_off;
+        }
+        batch_data_off = header->m_data_offset;
+        header->m_data_offset += want;
+        batch_data_end = header->m_data_offset;
+        batch_data_ptr = ptr;
+    }
+
+    offset = batch_data_off;
+    if (batch_data_ptr != NULL) {
+        memcpy(batch_data_ptr, dsize, DATA_HDR_BYTE);
+        memcpy(batch_data_ptr + DATA_HDR_BYTE, buff, size);
+        batch_data_ptr += buf_size;
+    } else {
+        WriteData(reinterpret_cast<const uint8_t*>(dsize), DATA_HDR_BYTE, offset);
+        WriteData(buff, size, offset + DATA_HDR_BYTE);
+    }
+    batch_data_off += buf_size;
+    batch_data_need -= std::min(batch_data_need, static_cast<size_t>(buf_size));
+}
+
+void Dict::BeginWriteBatch(size_t data_size)
+{
+    write_batch = true;
+    batch_count = 0;
+    batch_updates = 0;
+    batch_data_off = 0;
+    batch_data_end = 0;
+    batch_data_ptr = NULL;
+    batch_data_need = (options & CONSTS::OPTION_JEMALLOC) ? 0 : data_size;
+}
+
+void Dict::EndWriteBatch()
+{
+    if (batch_data_off < batch_data_end)
+        header->m_data_offset = batch_data_off;
+    batch_data_off = batch_data_end = 0;
+    batch_data_ptr = NULL;
+    header->count += batch_count;
+    header->num_update += batch_updates;
+    write_batch = false;
+}
+
 int Dict::ReleaseBuffer(size_t offset, int size)
 {
 #ifdef __DEBUG__
     remove_tracking_buffer(offset, size);
 #endif
+    if (retireBuffer(offset, size))
+        return MBError::SUCCESS;
+    return freeBuffer(offset, size);
+}
+
+int Dict::freeBuffer(size_t offset, int size)
+{
     if (options & CONSTS::OPTION_JEMALLOC) {
         if (offset >= header->jemalloc_data_free_start) {
             kv_file->Free(offset);
@@ -1128,6 +1650,22 @@ int Dict::ReleaseBuffer(size_t offset, int size)
     }
 }
 
+// ReserveData moves the eviction index past the bucket being filled once per
+// bucket; do the same for every bucket touched by updates num_update to
+// num_update + n - 1.
+void Dict::AddBulkUpdates(int64_t n)
+{
+    int64_t per_bucket = header->entry_per_bucket;
+    int64_t end = header->num_update + n;
+    int64_t update = std::max(header->num_update, per_bucket + 1);
+    while (update < end) {
+        if ((update / per_bucket) % 0xFFFF == header->eviction_bucket_index)
+            header->eviction_bucket_index++;
+        update = (update / per_bucket + 1) * per_bucket;
+    }
+    header->num_update = end;
+}
+
 void Dict::ReleaseAlignmentBuffer(size_t offset, size_t alignment_off)
 {
     // alignment is not a real buffer, so no need to track it
@@ -1143,6 +1681,13 @@ int Dict::ReleaseBuffer(size_t offset)
 #ifdef __DEBUG__
     remove_tracking_buffer(offset);
 #endif
+    if (retireBuffer(offset, 0))
+        return MBError::SUCCESS;
+    return freeBuffer(offset);
+}
+
+int Dict::freeBuffer(size_t offset)
+{
     // First read the size of the data buffer
     uint16_t data_size;
     if (ReadData(reinterpret_cast<uint8_t*>(&data_size), DATA_SIZE_BYTE, offset) != DATA_SIZE_BYTE) {
@@ -1157,7 +1702,7 @@ int Dict::ReleaseBuffer(size_t offset)
         }
         return MBError::READ_ERROR;
     }
-    data_size += DATA_HDR_BYTE;
+    data_size = releaseExtents(offset, data_size) + DATA_HDR_BYTE;
     if (options & CONSTS::OPTION_JEMALLOC) {
         if (offset >= header->jemalloc_data_free_start) {
             kv_file->Free(offset);
@@ -1181,6 +1726,125 @@ int Dict::ReleaseBuffer(size_t offset)
     }
 }
 
+// Lowest epoch of the reader slots in use, UINT64_MAX if there is none. A
+// slot being claimed may still hold 0, which keeps everything retired.
+uint64_t Dict::minViewEpoch() const
+{
+    uint64_t min_epoch = std::numeric_limits<uint64_t>::max();
+    for (uint32_t i = 0; i < header->reader_epoch_slot_count; i++) {
+        const ReaderEpochSlot& slot = header->reader_epoch_slot[i];
+        if (slot.connect_id.load(MEMORY_ORDER_READER) == 0)
+            continue;
+        min_epoch = std::min(min_epoch, slot.epoch.load(MEMORY_ORDER_READER));
+    }
+    return min_epoch;
+}
+
+// Value views point into data buffers without holding a reference. A buffer
+// released while a view may be pinned on it is retired instead of freed, so
+// that the view keeps reading the value it found. Returns false if the buffer
+// can be freed now.
+bool Dict::retireBuffer(size_t offset, int size)
+{
+    // Views are not pinned during data rc, which reclaims the space anyway.
+    if (header->rc_m_data_off_pre != 0)
+        return false;
+    // Pairs with DB::FindView: either a view pinned before the edge update
+    // shows up here, or it found the updated edge.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t min_epoch = minViewEpoch();
+    if (!retired_buffers.empty())
+        freeRetiredBuffers(min_epoch);
+    if (min_epoch == std::numeric_limits<uint64_t>::max())
+        return false;
+
+    // Views pinned from now on get a later epoch.
+    uint64_t epoch = header->reader_epoch.fetch_add(1, std::memory_order_seq_cst);
+    retired_buffers.push_back({ offset, size, epoch });
+    return true;
+}
+
+void Dict::freeRetiredBuffers(uint64_t min_epoch)
+{
+    while (!retired_buffers.empty() && retired_buffers.front().epoch < min_epoch) {
+        const RetiredBuffer& buf = retired_buffers.front();
+        if (buf.size > 0)
+            freeBuffer(buf.offset, buf.size);
+        else
+            freeBuffer(buf.offset);
+        retired_buffers.pop_front();
+    }
+}
+
+void Dict::DropRetiredBuffers()
+{
+    retired_buffers.clear();
+}
+
+// Overwrite the buffer at mbd.data_offset with the new value if the value fits
+// in it and the writer has OPTION_OVERWRITE_IN_PLACE. Readers recheck the edge
+// after copying the value and retry on the rewrite, and hash index readers are
+// held off by the hash index sequence. A writer killed in the middle can leave
+// a partial value in the buffer, which is why the option is off by default.
+// Returns false if a new buffer has to be reserved.
+bool Dict::overwriteData(const EdgePtrs& edge_ptrs, MBData& mbd)
+{
+    if (!(options & CONSTS::OPTION_OVERWRITE_IN_PLACE))
+        return false;
+    // A pinned value view may be reading this buffer.
+    if (minViewEpoch() != std::numeric_limits<uint64_t>::max())
+        return false;
+    // Resource collection moves buffers; let it see a new one.
+    if ((mbd.options & CONSTS::OPTION_RC_MODE) || header->rc_root_offset != 0)
+        return false;
+    if (mbd.data_len > CONSTS::MAX_DATA_SIZE)
+        return false;
+
+    uint16_t dsize[2];
+    if (ReadData(reinterpret_cast<uint8_t*>(&dsize[0]), DATA_SIZE_BYTE, mbd.data_offset) != DATA_SIZE_BYTE)
+        return false;
+    // Large values are replaced with their extents.
+    if (dsize[0] & DATA_EXTENT_FLAG)
+        return false;
+    size_t old_size;
+    size_t new_size;
+    if (options & CONSTS::OPTION_JEMALLOC) {
+        // jemalloc cannot shrink the buffer in place.
+        old_size = (dsize[0] + DATA_HDR_BYTE + JEMALLOC_ALIGNMENT - 1) & ~(JEMALLOC_ALIGNMENT - 1);
+        new_size = (mbd.data_len + DATA_HDR_BYTE + JEMALLOC_ALIGNMENT - 1) & ~(JEMALLOC_ALIGNMENT - 1);
+        if (new_size != old_size)
+            return false;
+    } else {
+        old_size = free_lists->GetAlignmentSize(dsize[0] + DATA_HDR_BYTE);
+        new_size = free_lists->GetAlignmentSize(mbd.data_len + DATA_HDR_BYTE);
+        if (new_size > old_size)
+            return false;
+    }
+    dsize[0] = static_cast<uint16_t>(mbd.data_len);
+    dsize[1] = nextBucketIndex();
+
+    // The edge does not change; readers retrying on it read the same edge.
+    memcpy(header->excep_buff, edge_ptrs.ptr, EDGE_SIZE);
+    header->excep_offset = mbd.data_offset;
+#ifdef __LOCK_FREE__
+    header->excep_lf_offset = edge_ptrs.offset;
+    lfree.WriterLockFreeStart(edge_ptrs.offset);
+#endif
+    header->excep_updating_status = EXCEP_STATUS_OVERWRITE_DATA;
+    BeginValueUpdate();
+    WriteData(reinterpret_cast<const uint8_t*>(&dsize[0]), DATA_HDR_BYTE, mbd.data_offset);
+    WriteData(mbd.buff, mbd.data_len, mbd.data_offset + DATA_HDR_BYTE);
+    EndValueUpdate();
+#ifdef __LOCK_FREE__
+    lfree.WriterLockFreeStop();
+#endif
+    header->excep_updating_status = EXCEP_STATUS_NONE;
+
+    if (new_size < old_size)
+        ReleaseBuffer(mbd.data_offset + new_size, old_size - new_size);
+    return true;
+}
+
 int Dict::UpdateDataBuffer(EdgePtrs& edge_ptrs, bool overwrite, MBData& mbd, bool& inc_count)
 {
     if (edge_ptrs.flag_ptr[0] & EDGE_FLAG_DATA_OFF) {
@@ -1189,8 +1853,11 @@ int Dict::UpdateDataBuffer(EdgePtrs& edge_ptrs, bool overwrite, MBData& mbd, boo
         mbd.data_offset = Get6BInteger(edge_ptrs.offset_ptr);
         if (!overwrite)
             return MBError::IN_DICT;
-        if (ReleaseBuffer(mbd.data_offset) != MBError::SUCCESS)
-            Logger::Log(LOG_LEVEL_WARN, "failed to release data buffer: %llu", mbd.data_offset);
+        if (overwriteData(edge_ptrs, mbd))
+            return MBError::SUCCESS;
+        // The old buffer is released once the edge points to the new one,
+        // so that ReserveData cannot hand it out while readers still use it.
+        size_t old_data_offset = mbd.data_offset;
         ReserveData(mbd.buff, mbd.data_len, mbd.data_offset);
         Write6BInteger(edge_ptrs.offset_ptr, mbd.data_offset);
 
@@ -1205,6 +1872,8 @@ int Dict::UpdateDataBuffer(EdgePtrs& edge_ptrs, bool overwrite, MBData& mbd, boo
         lfree.WriterLockFreeStop();
 #endif
         header->excep_updating_status = EXCEP_STATUS_NONE;
+        if (ReleaseBuffer(old_data_offset) != MBError::SUCCESS)
+            Logger::Log(LOG_LEVEL_WARN, "failed to release data buffer: %llu", old_data_offset);
     } else {
         uint8_t* node_buff = header->excep_buff;
         size_t node_off = Get6BInteger(edge_ptrs.offset_ptr);
@@ -1212,13 +1881,18 @@ int Dict::UpdateDataBuffer(EdgePtrs& edge_ptrs, bool overwrite, MBData& mbd, boo
         if (mm.ReadData(node_buff, NODE_EDGE_KEY_FIRST, node_off) != NODE_EDGE_KEY_FIRST)
             return MBError::READ_ERROR;
 
+        bool release_old = false;
+        size_t old_data_offset = 0;
         if (node_buff[0] & FLAG_NODE_MATCH) {
             inc_count = false;
             mbd.data_offset = Get6BInteger(node_buff + 2);
             if (!overwrite)
                 return MBError::IN_DICT;
-            if (ReleaseBuffer(mbd.data_offset) != MBError::SUCCESS)
-                Logger::Log(LOG_LEVEL_WARN, "failed to release data buffer %llu", mbd.data_offset);
+            if (overwriteData(edge_ptrs, mbd))
+                return MBError::SUCCESS;
+            // Released below, as for leaf edges.
+            release_old = true;
+            old_data_offset = mbd.data_offset;
             node_buff[NODE_EDGE_KEY_FIRST] = 0;
         } else {
             // set the match flag
@@ -1241,6 +1915,8 @@ int Dict::UpdateDataBuffer(EdgePtrs& edge_ptrs, bool overwrite, MBData& mbd, boo
         lfree.WriterLockFreeStop();
 #endif
         header->excep_updating_status = EXCEP_STATUS_NONE;
+        if (release_old && ReleaseBuffer(old_data_offset) != MBError::SUCCESS)
+            Logger::Log(LOG_LEVEL_WARN, "failed to release data buffer %llu", old_data_offset);
     }
 
     return MBError::SUCCESS;
@@ -1299,6 +1975,29 @@ LockFree* Dict::GetLockFreePtr()
     return &lfree;
 }
 
+// The data file is added before the index file so that the flusher syncs
+// values before the edges that point to them.
+void Dict::StartGroupSync(int interval_ms, size_t max_bytes)
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER) || group_sync)
+        return;
+    group_sync.reset(new GroupSync(mbdir_ + "_mabain_h", interval_ms, max_bytes));
+    SetGroupSync(group_sync.get());
+    mm.SetGroupSync(group_sync.get());
+}
+
+void Dict::BeginGroupSyncUpdate()
+{
+    if (group_sync && group_sync_depth++ == 0)
+        group_sync->BeginUpdate();
+}
+
+void Dict::EndGroupSyncUpdate()
+{
+    if (group_sync && --group_sync_depth == 0)
+        group_sync->EndUpdate();
+}
+
 void Dict::Flush() const
 {
     if (!(options & CONSTS::ACCESS_MODE_WRITER))
@@ -1456,6 +2155,14 @@ int Dict::ExceptionRecovery()
 #endif
         mm.WriteData(header->excep_buff, OFFSET_SIZE - 1, header->excep_offset);
         break;
+    case EXCEP_STATUS_RC_EXTENT:
+        WriteData(header->excep_buff, OFFSET_SIZE, header->excep_offset);
+        break;
+    case EXCEP_STATUS_OVERWRITE_DATA:
+        // The old value is gone; the buffer may hold part of the new one.
+        Logger::Log(LOG_LEVEL_WARN, "value at data offset %llu may be partially written",
+            header->excep_offset);
+        break;
     default:
         Logger::Log(LOG_LEVEL_ERROR, "unknown exception status: %d",
             header->excep_updating_status);
@@ -1493,24 +2200,329 @@ void Dict::WriteData(const uint8_t* buff, unsigned len, size_t offset) const
 
 int Dict::ReadDataByOffset(size_t offset, MBData& data) const
 {
-    uint16_t hdr[2];
-    if (ReadData(reinterpret_cast<uint8_t*>(&hdr[0]), DATA_HDR_BYTE, offset) != DATA_HDR_BYTE) {
-        return MBError::READ_ERROR;
+    return readValue(offset, data);
+}
+
+int Dict::OpenHashIndex(size_t capacity)
+{
+    bool writer = options & CONSTS::ACCESS_MODE_WRITER;
+    size_t cap = 1024;
+    bool intact = false;
+    if (writer) {
+        if (capacity == 0)
+            capacity = HASH_INDEX_DEFAULT_CAPACITY;
+        while (cap < capacity)
+            cap <<= 1;
+        // The index left by the last writer still matches the tree unless
+        // it was marked stale or that writer stopped in the middle of an update.
+        intact = header->hash_index_capacity == cap
+            && !(header->hash_index_seq.load(std::memory_order_relaxed) & 1);
+        BeginHashIndexUpdate();
+        header->hash_index_capacity = 0;
+    } else {
+        cap = header->hash_index_capacity;
+        if (cap == 0) {
+            Logger::Log(LOG_LEVEL_INFO, "hash index is not maintained by the writer");
+            return MBError::NOT_INITIALIZED;
+        }
     }
 
-    // store data length
-    data.data_len = hdr[0];
-    // store bucket index
-    data.bucket_index = hdr[1];
-    // resize data buffer using size from header
-    data.Resize(hdr[0]);
-    offset += DATA_HDR_BYTE;
-    if (ReadData(data.buff, hdr[0], offset) != hdr[0]) {
-        return MBError::READ_ERROR;
+    int rval = MBError::SUCCESS;
+    try {
+        hash_index.reset(new HashMap(mbdir_, cap,
+            options & (CONSTS::ACCESS_MODE_WRITER | CONSTS::MEMORY_ONLY_MODE),
+            1, HASH_INDEX_INLINE_KEY, HashMap::MemoryMB(cap)));
+        hash_index_capacity = hash_index->Capacity();
+        // Otherwise the writer rebuilds it from the tree once the DB is ready.
+        if (writer && intact && !hash_index->Created())
+            PublishHashIndex();
+    } catch (int error) {
+        Logger::Log(LOG_LEVEL_WARN, "failed to open hash index: %s", MBError::get_error_str(error));
+        hash_index.reset();
+        rval = error;
+    }
+
+    if (writer)
+        EndHashIndexUpdate();
+    return rval;
+}
+
+void Dict::BeginHashIndexUpdate()
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER) || !(options & CONSTS::OPTION_HASH_INDEX))
+        return;
+    if (hash_index_depth++ == 0) {
+        uint32_t seq = header->hash_index_seq.load(std::memory_order_relaxed);
+        seq += (seq & 1) ? 2 : 1;
+        header->hash_index_seq.store(seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+}
+
+void Dict::MarkHashIndexStale()
+{
+    if (!hash_index)
+        return;
+    BeginHashIndexUpdate();
+    header->hash_index_capacity = 0;
+    EndHashIndexUpdate();
+}
+
+void Dict::PublishHashIndex()
+{
+    if (hash_index)
+        header->hash_index_capacity = hash_index_capacity;
+}
+
+bool Dict::HashIndexStale() const
+{
+    return hash_index && header->hash_index_capacity != hash_index_capacity;
+}
+
+void Dict::BeginValueUpdate()
+{
+    uint64_t seq = header->value_seq.load(std::memory_order_relaxed);
+    seq += (seq & 1) ? 2 : 1;
+    header->value_seq.store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Dict::EndValueUpdate()
+{
+    uint64_t seq = header->value_seq.load(std::memory_order_relaxed);
+    header->value_seq.store(seq + 1, std::memory_order_release);
+}
+
+void Dict::EndHashIndexUpdate()
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER) || !(options & CONSTS::OPTION_HASH_INDEX))
+        return;
+    if (--hash_index_depth == 0) {
+        uint32_t seq = header->hash_index_seq.load(std::memory_order_relaxed);
+        header->hash_index_seq.store(seq + 1, std::memory_order_release);
     }
+}
+
+void Dict::BeginSubtreeCountUpdate()
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER) || !mm.SubtreeCountEnabled())
+        return;
+    if (subtree_count_depth++ == 0) {
+        uint32_t seq = header->subtree_count_seq.load(std::memory_order_relaxed);
+        seq += (seq & 1) ? 2 : 1;
+        header->subtree_count_seq.store(seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+}
+
+void Dict::EndSubtreeCountUpdate()
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER) || !mm.SubtreeCountEnabled())
+        return;
+    if (--subtree_count_depth == 0) {
+        uint32_t seq = header->subtree_count_seq.load(std::memory_order_relaxed);
+        header->subtree_count_seq.store(seq + 1, std::memory_order_release);
+    }
+}
+
+bool Dict::SubtreeCountStale() const
+{
+    return mm.SubtreeCountEnabled() && subtree_count_depth == 0
+        && (header->subtree_count_seq.load(std::memory_order_relaxed) & 1);
+}
+
+void Dict::ClearHashIndex()
+{
+    if (hash_index)
+        hash_index->Clear();
+}
+
+void Dict::PutHashIndex(const uint8_t* key, int len, size_t data_offset)
+{
+    // A full table only costs the tree lookup for keys that do not fit.
+    if (hash_index && len <= HASH_INDEX_INLINE_KEY)
+        hash_index->Put(key, len, data_offset);
+}
+
+void Dict::BeginHashIndexMoves()
+{
+    hash_index_moves.clear();
+    if (!hash_index)
+        return;
+    std::vector<std::pair<size_t, size_t>> refs;
+    hash_index->ListRefs(refs);
+    hash_index_moves.reserve(refs.size());
+    hash_index_moves.insert(refs.begin(), refs.end());
+}
+
+void Dict::MoveHashIndexEntry(size_t old_offset, size_t new_offset)
+{
+    auto range = hash_index_moves.equal_range(old_offset);
+    if (range.first == range.second)
+        return;
+    std::vector<size_t> buckets;
+    for (auto it = range.first; it != range.second; ++it)
+        buckets.push_back(it->second);
+    hash_index_moves.erase(range.first, range.second);
+    // Reorder moves a value past the end of the data; collect may move it again.
+    for (size_t bucket : buckets) {
+        hash_index->UpdateRef(bucket, old_offset, new_offset);
+        hash_index_moves.emplace(new_offset, bucket);
+    }
+}
+
+void Dict::EndHashIndexMoves()
+{
+    std::unordered_multimap<size_t, size_t>().swap(hash_index_moves);
+}
+
+// Exact lookup through the hash index. Returns NOT_EXIST whenever the index
+// cannot answer (miss, writer update in flight, index not maintained); the
+// caller then searches the tree. Entries hold the whole key inline, so a hit
+// is confirmed by the 64-bit hash, the length and the key bytes; longer keys
+// are not indexed and always go to the tree.
+int Dict::FindByHashIndex(const uint8_t* key, int len, MBData& data) const
+{
+    if (len > HASH_INDEX_INLINE_KEY)
+        return MBError::NOT_EXIST;
+
+    uint32_t seq = header->hash_index_seq.load(std::memory_order_acquire);
+    if ((seq & 1) || header->hash_index_capacity != hash_index_capacity)
+        return MBError::NOT_EXIST;
+
+    size_t data_offset;
+    if (!hash_index->Get(key, len, data_offset) || data_offset < GetStartDataOffset())
+        return MBError::NOT_EXIST;
+    int rval = MBError::SUCCESS;
+    if (!(data.options & CONSTS::OPTION_KEY_ONLY))
+        rval = ReadDataByOffset(data_offset, data);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (rval != MBError::SUCCESS || header->hash_index_seq.load(std::memory_order_relaxed) != seq)
+        return MBError::NOT_EXIST;
+    data.data_offset = data_offset;
     return MBError::SUCCESS;
 }
 
+int Dict::OpenBloomFilter(size_t num_keys)
+{
+    bool writer = options & CONSTS::ACCESS_MODE_WRITER;
+    size_t blocks;
+    bool intact = false;
+    if (writer) {
+        if (num_keys == 0)
+            num_keys = BLOOM_FILTER_DEFAULT_KEYS;
+        blocks = BloomFilter::BlocksForKeys(num_keys);
+        // A filter left by the last writer still covers the tree unless that
+        // writer stopped while clearing it.
+        intact = header->bloom_filter_blocks == blocks
+            && !(header->bloom_filter_seq.load(std::memory_order_relaxed) & 1);
+        BeginBloomFilterUpdate();
+        header->bloom_filter_blocks = 0;
+    } else {
+        blocks = header->bloom_filter_blocks;
+        if (blocks == 0) {
+            Logger::Log(LOG_LEVEL_INFO, "bloom filter is not maintained by the writer");
+            return MBError::NOT_INITIALIZED;
+        }
+    }
+
+    int rval = MBError::SUCCESS;
+    try {
+        bloom_filter.reset(new BloomFilter(mbdir_, blocks,
+            options & (CONSTS::ACCESS_MODE_WRITER | CONSTS::MEMORY_ONLY_MODE)));
+        bloom_filter_blocks = bloom_filter->NumBlocks();
+        // Otherwise the writer rebuilds it from the tree once the DB is ready.
+        if (writer && intact && !bloom_filter->Created())
+            PublishBloomFilter();
+    } catch (int error) {
+        Logger::Log(LOG_LEVEL_WARN, "failed to open bloom filter: %s", MBError::get_error_str(error));
+        bloom_filter.reset();
+        rval = error;
+    }
+
+    if (writer)
+        EndBloomFilterUpdate();
+    return rval;
+}
+
+void Dict::BeginBloomFilterUpdate()
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER) || !(options & CONSTS::OPTION_BLOOM_FILTER))
+        return;
+    if (bloom_filter_depth++ == 0) {
+        uint32_t seq = header->bloom_filter_seq.load(std::memory_order_relaxed);
+        seq += (seq & 1) ? 2 : 1;
+        header->bloom_filter_seq.store(seq, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+}
+
+void Dict::EndBloomFilterUpdate()
+{
+    if (!(options & CONSTS::ACCESS_MODE_WRITER) || !(options & CONSTS::OPTION_BLOOM_FILTER))
+        return;
+    if (--bloom_filter_depth == 0) {
+        uint32_t seq = header->bloom_filter_seq.load(std::memory_order_relaxed);
+        header->bloom_filter_seq.store(seq + 1, std::memory_order_release);
+    }
+}
+
+void Dict::ClearBloomFilter()
+{
+    if (!bloom_filter)
+        return;
+    bloom_filter->Clear();
+    header->bloom_filter_removed = 0;
+}
+
+void Dict::AddBloomFilter(const uint8_t* key, int len)
+{
+    if (len <= 0)
+        return;
+    bloom_filter->Add(key, len);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void Dict::PublishBloomFilter()
+{
+    if (bloom_filter)
+        header->bloom_filter_blocks = bloom_filter_blocks;
+}
+
+bool Dict::BloomFilterStale() const
+{
+    return bloom_filter && header->bloom_filter_blocks != bloom_filter_blocks;
+}
+
+bool Dict::BloomFilterWorn() const
+{
+    return bloom_filter
+        && header->bloom_filter_removed > bloom_filter->Capacity() / BloomFilter::REBUILD_DIVISOR;
+}
+
+// True only if the filter rules the key out. checked is set when the filter
+// was consulted and passed the key, so that a miss in the tree can be counted
+// as a false positive.
+bool Dict::BloomFilterExcludes(const uint8_t* key, int len, bool& checked) const
+{
+    checked = false;
+    uint32_t seq = header->bloom_filter_seq.load(std::memory_order_acquire);
+    if ((seq & 1) || header->bloom_filter_blocks != bloom_filter_blocks || len <= 0)
+        return false;
+
+    bool may_contain = bloom_filter->MayContain(key, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->bloom_filter_seq.load(std::memory_order_relaxed) != seq)
+        return false;
+    if (may_contain) {
+        checked = true;
+        return false;
+    }
+    bloom_filter_skips.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
 // Prefix traversal moved to SearchEngine
 
 }
@@ -19,24 +19,37 @@
 #ifndef __DICT_H__
 #define __DICT_H__
 
+#include <deque>
 #include <memory>
 #include <stdint.h>
 #include <string.h>
 #include <string>
+#include <unordered_map>
 
 #include "async_writer.h"
+#include "bloom_filter.h"
 #include "dict_mem.h"
 #include "drm_base.h"
+#include "group_sync.h"
+#include "hash_map.h"
 #include "lock_free.h"
 #include "mb_data.h"
 #include "mb_pipe.h"
 #include "rollable_file.h"
 #include "shm_queue_mgr.h"
 #include "util/prefix_cache.h"
+#include "write_batch.h"
+
+// Compare-and-swap update of Dict::Update. It is applied only in the writer
+// process and never queued, since a queued swap could not report whether it
+// matched.
+#define MABAIN_UPDATE_TYPE_CAS 8
+
 // forward declare
 namespace mabain {
 namespace detail {
     class SearchEngine;
+    class RangeScanner;
 }
 class PrefixCache;
 }
@@ -57,7 +70,8 @@ public:
         uint32_t block_sz_index, uint32_t block_sz_data,
         int max_num_index_blk, int max_num_data_blk,
         int64_t entry_per_bucket, uint32_t queue_size,
-        const char* queue_dir);
+        const char* queue_dir, uint32_t queue_lanes = MB_NUM_SHM_QUEUE_LANES,
+        uint32_t connect_id = 0);
     virtual ~Dict();
     void Destroy();
 
@@ -76,18 +90,41 @@ public:
     // Delete all entries
     int RemoveAll();
 
+    // Read-modify-write update of type MABAIN_ASYNC_TYPE_INCREMENT, APPEND or
+    // MERGE, or MABAIN_UPDATE_TYPE_CAS; see DB::Increment. The CAS operand is
+    // the int32_t length of the expected value followed by the expected and
+    // the new value.
+    int Update(const uint8_t* key, int len, int type, const uint8_t* operand, int operand_len,
+        bool rc_mode = false);
+    void SetMergeOperator(const DB::MergeOperator& merge);
+
     // multiple-process updates using shared memory queue
     int SHMQ_Add(const char* key, int key_len, const char* data, int data_len,
         bool overwrite);
     int SHMQ_Remove(const char* key, int len);
     int SHMQ_RemoveAll();
+    int SHMQ_Update(const char* key, int key_len, int type, const char* operand, int operand_len);
     int SHMQ_Backup(const char* backup_dir);
     int SHMQ_CollectResource(int64_t m_index_rc_size, int64_t m_data_rc_size,
         int64_t max_dbsz, int64_t max_dbcnt);
     void SHMQ_Signal();
     bool SHMQ_Busy() const;
-
-    void ReserveData(const uint8_t* buff, int size, size_t& offset);
+    // Sequence number of the last update queued through this handle
+    uint64_t SHMQ_LastSeq() const
+    {
+        return shmq_seq;
+    }
+    // Lane of the async queue the updates of this handle are queued in
+    uint32_t SHMQ_Lane() const
+    {
+        return shmq_lane;
+    }
+    bool SHMQ_Applied(uint64_t seq) const;
+    int SHMQ_WaitApplied(uint64_t seq, int timeout_ms) const;
+
+    // Values larger than MAX_DATA_SIZE are stored in extents; len_flag is
+    // or'ed into the length kept in the buffer header.
+    void ReserveData(const uint8_t* buff, int size, size_t& offset, uint16_t len_flag = 0);
     void WriteData(const uint8_t* buff, unsigned len, size_t offset) const;
 
     // Print dictinary stats
@@ -114,7 +151,7 @@ public:
         MBData& data) const;
 
     pthread_mutex_t* GetShmLockPtr() const;
-    AsyncNode* GetAsyncQueuePtr() const;
+    shm_lock_and_queue* GetAsyncQueuePtr() const;
 
     void UpdateNumReader(int delta) const;
     int UpdateNumWriter(int delta) const;
@@ -134,13 +171,102 @@ public:
     // when the DB was created with embedded cache. Readers attach if present.
     PrefixCache* ActivePrefixCache() const;
 
+    // Exact-match hash index (OPTION_HASH_INDEX): key -> data offset.
+    // Writers keep the index left by the last writer unless it is stale;
+    // readers attach only if the writer maintains it. Exact Find tries it
+    // before the tree for keys of up to HASH_INDEX_INLINE_KEY bytes.
+    int OpenHashIndex(size_t capacity);
+    bool HashIndexEnabled() const { return static_cast<bool>(hash_index); }
+    // Writer only; readers ignore the index between Begin and End. Calls nest.
+    void BeginHashIndexUpdate();
+    void EndHashIndexUpdate();
+    // Writer only; Mark is called before data offsets change without the
+    // index, Publish once the index holds every key in the tree again.
+    void MarkHashIndexStale();
+    void PublishHashIndex();
+    // Set while the index does not match the tree
+    bool HashIndexStale() const;
+    // Writer only; value views taken before End are no longer valid.
+    void BeginValueUpdate();
+    void EndValueUpdate();
+    // Writer only; forgets data buffers whose release waits for value views
+    // when data rc or RemoveAll reclaims their space anyway.
+    void DropRetiredBuffers();
+    void ClearHashIndex();
+    void PutHashIndex(const uint8_t* key, int len, size_t data_offset);
+    // Writer only; data rc moves values without their keys. Between Begin
+    // and End, MoveHashIndexEntry points the entry of a moved value at its
+    // new offset.
+    void BeginHashIndexMoves();
+    void MoveHashIndexEntry(size_t old_offset, size_t new_offset);
+    void EndHashIndexMoves();
+
+    // Per-subtree entry counts (OPTION_SUBTREE_COUNT at DB creation). Writer
+    // only; readers ignore the counts between Begin and End. Calls nest.
+    void BeginSubtreeCountUpdate();
+    void EndSubtreeCountUpdate();
+    // Set when a writer stopped in the middle of an update
+    bool SubtreeCountStale() const;
+
+    // Group commit (SYNC_GROUP_COMMIT). Writer only; the flusher is stopped
+    // after a last group in Destroy.
+    void StartGroupSync(int interval_ms, size_t max_bytes);
+    GroupSync* GetGroupSync() const { return group_sync.get(); }
+    // Writer only; the flusher does not sync the header between Begin and
+    // End. Calls nest.
+    void BeginGroupSyncUpdate();
+    void EndGroupSyncUpdate();
+
+    // Apply the entries of batch in key order; see DB::Write. Writer only.
+    int Write(WriteBatch& batch, bool overwrite);
+    // Count n updates whose data buffers were written by a parallel bulk
+    // load; their LRU buckets follow num_update as in ReserveData. Writer only.
+    void AddBulkUpdates(int64_t n);
+
+    // Negative-lookup Bloom filter (OPTION_BLOOM_FILTER). The writer adds
+    // every key before inserting it; exact Find returns NOT_EXIST without
+    // walking the tree for keys the filter rules out. Readers attach only if
+    // the writer maintains it.
+    int OpenBloomFilter(size_t num_keys);
+    bool BloomFilterEnabled() const { return static_cast<bool>(bloom_filter); }
+    // Writer only; readers ignore the filter between Begin and End. Calls nest.
+    void BeginBloomFilterUpdate();
+    void EndBloomFilterUpdate();
+    void ClearBloomFilter();
+    void AddBloomFilter(const uint8_t* key, int len);
+    // Writer only; called once the filter holds every key in the tree.
+    void PublishBloomFilter();
+    // Set while the filter does not cover every key in the tree
+    bool BloomFilterStale() const;
+    // Set once so many keys were removed since the last rebuild that the
+    // filter should be refilled from the tree
+    bool BloomFilterWorn() const;
+    // Lookups answered by the filter, and lookups it passed that missed the tree
+    uint64_t GetBloomFilterSkips() const { return bloom_filter_skips.load(std::memory_order_relaxed); }
+    uint64_t GetBloomFilterFalsePositives() const
+    {
+        return bloom_filter_false_positives.load(std::memory_order_relaxed);
+    }
+
 private:
     // Allow internal SearchEngine to orchestrate lookups without exposing members publicly
     friend class detail::SearchEngine;
+    friend class detail::RangeScanner;
     friend class DictReleaseTestPeer;
     // Search internals moved to detail::SearchEngine
     // Prefix traversal helpers moved to SearchEngine.
     // Traversal helpers are owned by SearchEngine.
+    int AddEntry(const uint8_t* key, int len, MBData& data, bool overwrite);
+    int RemoveEntry(const uint8_t* key, int len, MBData& data);
+    int FindByHashIndex(const uint8_t* key, int len, MBData& data) const;
+    bool BloomFilterExcludes(const uint8_t* key, int len, bool& checked) const;
+    // Header counters; held back while a write batch is applied
+    inline void AddCount(int64_t delta);
+    inline void AddUpdate();
+    void BeginWriteBatch(size_t data_size);
+    void EndWriteBatch();
+    void ReserveBatchData(const uint16_t* dsize, const uint8_t* buff, int size, int buf_size,
+        size_t& offset);
     int ReleaseBuffer(size_t offset);
     int UpdateDataBuffer(EdgePtrs& edge_ptrs, bool overwrite, MBData& mbd, bool& inc_count);
     int ReadDataFromEdge(MBData& data, const EdgePtrs& edge_ptrs) const;
@@ -148,12 +274,25 @@ private:
     int DeleteDataFromEdge(MBData& data, EdgePtrs& edge_ptrs);
     int ReadNodeMatch(size_t node_off, int& match, MBData& data) const;
     int SHMQ_PrepareSlot(AsyncNode* node_ptr);
-    AsyncNode* SHMQ_AcquireSlot(int& err) const;
+    AsyncNode* SHMQ_AcquireSlot(int key_len, int data_len, int& err) const;
+    int shmqAddParts(const char* key, int key_len, const char* data, int data_len,
+        bool overwrite);
 
     // Bound traversal helpers moved to SearchEngine.
-    void reserveDataFL(const uint8_t* buff, int size, size_t& offset);
+    void reserveDataFL(const uint8_t* buff, int size, size_t& offset, uint16_t len_flag);
+    void reserveExtents(const uint8_t* buff, int size, size_t& offset);
+    uint16_t releaseExtents(size_t offset, uint16_t data_len);
+    int readValue(size_t data_off, MBData& data) const;
+    int readExtents(size_t data_off, int extents_len, MBData& data) const;
+    uint16_t nextBucketIndex();
+    bool overwriteData(const EdgePtrs& edge_ptrs, MBData& mbd);
     int ReleaseBuffer(size_t offset, int size);
     void ReleaseAlignmentBuffer(size_t offset, size_t alignment_off);
+    int freeBuffer(size_t offset, int size);
+    int freeBuffer(size_t offset);
+    uint64_t minViewEpoch() const;
+    bool retireBuffer(size_t offset, int size);
+    void freeRetiredBuffers(uint64_t min_epoch);
 
     // Memory management
     DictMem mm;
@@ -164,14 +303,51 @@ private:
     LockFree lfree;
 
     size_t reader_rc_off;
-    AsyncNode* queue;
     shm_lock_and_queue* slaq;
+    uint64_t shmq_seq;
+    uint32_t shmq_lane;
     MBPipe mbp;
     // Hold a reference to shared memory queue file so that the async thread can access it during process exit
     ShmQueueMgr qmgr;
 
     // Optional lookup accelerators for Find
     std::unique_ptr<PrefixCache> prefix_cache;
+    std::unique_ptr<HashMap> hash_index;
+    size_t hash_index_capacity;
+    int hash_index_depth;
+    // data offset -> hash index buckets while rc moves values
+    std::unordered_multimap<size_t, size_t> hash_index_moves;
+    int subtree_count_depth;
+    std::unique_ptr<BloomFilter> bloom_filter;
+    size_t bloom_filter_blocks;
+    int bloom_filter_depth;
+    mutable std::atomic<uint64_t> bloom_filter_skips;
+    mutable std::atomic<uint64_t> bloom_filter_false_positives;
+    std::unique_ptr<GroupSync> group_sync;
+    int group_sync_depth;
+
+    // Data buffers released while value views (DB::FindView) were pinned,
+    // oldest first. Each is freed once no view pinned before its release
+    // remains; size 0 means the size is read from the buffer.
+    struct RetiredBuffer {
+        size_t offset;
+        int size;
+        uint64_t epoch;
+    };
+    std::deque<RetiredBuffer> retired_buffers;
+
+    // Write batch state: data buffers are carved from [batch_data_off,
+    // batch_data_end), which ends at m_data_offset; batch_data_need is the
+    // estimated size of the buffers still to come.
+    bool write_batch;
+    int64_t batch_count;
+    int64_t batch_updates;
+    size_t batch_data_off;
+    size_t batch_data_end;
+    size_t batch_data_need;
+    uint8_t* batch_data_ptr;
+    // merge operator for MABAIN_ASYNC_TYPE_MERGE updates
+    DB::MergeOperator merge_operator;
     std::string mbdir_;
 
     // Cache seeding for Add is handled inside SeedCanonicalBoundariesAfterAdd
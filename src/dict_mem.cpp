@@ -19,9 +19,11 @@
 #include <iostream>
 #include <limits.h>
 #include <string>
+#include <vector>
 
 #include "async_writer.h"
 #include "db.h"
+#include "detail/first_char_select.h"
 #include "dict_mem.h"
 #include "error.h"
 #include "integer_4b_5b.h"
@@ -35,33 +37,43 @@
 
 namespace mabain {
 
-// Binary search helper on the first-character array of a node.
-// Returns the first index i in [0, n] such that arr[i] >= key.
-// If i == n or arr[i] != key, then key is not present and i is the
-// insertion position (lower_bound).
-static inline int lower_bound_first_char(const uint8_t* arr, int n, uint8_t key)
-{
-    int l = 0, r = n;
-    while (l < r) {
-        int m = l + ((r - l) >> 1);
-        if (arr[m] < key)
-            l = m + 1;
-        else
-            r = m;
-    }
-    return l;
-}
 static inline size_t edge_offset_of(size_t node_off, int nt, int idx)
 {
     return node_off + NODE_EDGE_KEY_FIRST + nt + (size_t)idx * EDGE_SIZE;
 }
 
-constexpr int kBinarySearchThreshold = 10;
-static inline bool use_binary_search(int nt) { return nt > kBinarySearchThreshold; }
+// The optional subtree count follows the edges of a node with nt edges.
+static inline size_t subtree_count_offset(size_t node_off, int nt)
+{
+    return node_off + NODE_EDGE_KEY_FIRST + (size_t)nt * (1 + EDGE_SIZE);
+}
+
+// The optional dense node index follows the edges and the subtree count.
+static inline size_t node_index_offset(size_t node_off, int nt, bool subtree_count)
+{
+    return subtree_count_offset(node_off, nt) + (subtree_count ? SUBTREE_COUNT_SIZE : 0);
+}
+
+// Edge index from a dense node index slot. Absent characters are marked
+// with NODE_INDEX_ABSENT, which is out of range unless the node has all 256
+// first characters.
+static inline int node_index_slot(uint8_t slot, int nt)
+{
+    return (slot < nt) ? slot : -1;
+}
+
+// Nodes up to this size are scanned inline; larger ones go to the vector
+// kernel selected at startup (see detail/first_char_select.cpp).
+constexpr int kInlineScanMax = 4;
 
 static inline void select_edge_indices(const uint8_t* first_chars,
     int nt, uint8_t k, bool sorted, int& match_idx, int& less_idx, int& max_idx)
 {
+    if (nt > kInlineScanMax) {
+        detail::first_char_kernel->select(first_chars, nt, k, sorted, match_idx, less_idx, max_idx);
+        return;
+    }
+
     match_idx = -1;
     less_idx = -1;
     max_idx = (nt > 0) ? (nt - 1) : -1;
@@ -69,16 +81,6 @@ static inline void select_edge_indices(const uint8_t* first_chars,
     if (nt <= 0)
         return;
 
-    if (sorted && use_binary_search(nt)) {
-        int lb = lower_bound_first_char(first_chars, nt, k);
-        if (lb < nt && first_chars[lb] == k)
-            match_idx = lb;
-        less_idx = lb - 1;
-        if (less_idx < 0)
-            less_idx = -1;
-        return;
-    }
-
     // Linear scan for small nt
     int max_val = first_chars[0];
     max_idx = 0;
@@ -95,6 +97,18 @@ static inline void select_edge_indices(const uint8_t* first_chars,
     }
 }
 
+// Exact-match lookups only need the matching index.
+static inline int select_match_index(const uint8_t* first_chars, int nt, uint8_t k)
+{
+    if (nt > kInlineScanMax)
+        return detail::first_char_kernel->match(first_chars, nt, k);
+    for (int i = 0; i < nt; ++i) {
+        if (first_chars[i] == k)
+            return i;
+    }
+    return -1;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////
@@ -112,11 +126,14 @@ static inline void select_edge_indices(const uint8_t* first_chars,
 /////////////////////////////////////////////////////////////////////////////////////
 // NODE MEMORY LAYOUT
 // Node size is 1 + 1 + 6 + NT + NT*13
-// X************   Flags (0x01 bit indicating match found)
+// X************   Flags (0x01 match found, 0x02 sorted, 0x04 dense node index)
 // *X***********   nt-1, where nt is the number of edges for this node
 // **XXXXXX*****   Data offset
 // NT bytes        First character of each edge
 // NT edges        Each edge is 13 bytes (NT * 13 total)
+// XXXXXXXX        Optional 8-byte subtree entry count (OPTION_SUBTREE_COUNT)
+// 256 bytes       Optional edge index of each first character (FLAG_NODE_INDEXED),
+//                 only in nodes with at least DENSE_NODE_MIN_EDGES edges
 // Note: We use 6 bytes to store both index and data offsets, so the maximum supported
 //       size for data and index is 281,474,976,710,655 bytes (or 255 TB).
 /////////////////////////////////////////////////////////////////////////////////////
@@ -132,6 +149,7 @@ DictMem::DictMem(const std::string& mbdir, bool init_header, size_t memsize,
     root_offset_rc = 0;
     node_ptr = NULL;
     node_size = NULL;
+    dense_node_index = false;
 
     assert(sizeof(IndexHeader) <= (unsigned)RollableFile::page_size);
     bool map_hdr = true;
@@ -162,6 +180,11 @@ DictMem::DictMem(const std::string& mbdir, bool init_header, size_t memsize,
             Destroy();
             throw (int)MBError::INVALID_SIZE;
         }
+        // The node layout is fixed when the DB is created.
+        if ((mode & CONSTS::ACCESS_MODE_WRITER) && (mode & CONSTS::OPTION_SUBTREE_COUNT)
+            && header->subtree_count == 0) {
+            Logger::Log(LOG_LEVEL_WARN, "subtree count option set but DB was created without subtree counts; ignoring.");
+        }
     } else {
         // Explicitly cast to void* because GCC 8 is (rightfully) upset that this is
         // "writing to an object of type '...' with no trivial copy-assignment".
@@ -169,6 +192,7 @@ DictMem::DictMem(const std::string& mbdir, bool init_header, size_t memsize,
         // This new warning is `-Werror=class-memaccess`.
         memset(reinterpret_cast<void*>(header), 0, sizeof(IndexHeader));
         header->index_block_size = block_size;
+        header->subtree_count = (mode & CONSTS::OPTION_SUBTREE_COUNT) ? 1 : 0;
     }
     kv_file = new RollableFile(mbdir + "_mabain_i",
         static_cast<size_t>(header->index_block_size),
@@ -192,9 +216,12 @@ DictMem::DictMem(const std::string& mbdir, bool init_header, size_t memsize,
     for (int i = 0; i < NUM_ALPHABET; i++) {
         int nt = i + 1;
         node_size[i] = 1 + 1 + OFFSET_SIZE + nt + nt * EDGE_SIZE;
+        if (header->subtree_count)
+            node_size[i] += SUBTREE_COUNT_SIZE;
     }
 
-    node_ptr = new uint8_t[node_size[NUM_ALPHABET - 1]];
+    node_ptr = new uint8_t[node_size[NUM_ALPHABET - 1] + NODE_INDEX_SIZE];
+    dense_node_index = (mode & CONSTS::OPTION_DENSE_NODE_INDEX) != 0;
 
     if (init_header) {
         // set writer options
@@ -243,6 +270,7 @@ void DictMem::InitRootNode()
     for (int i = 0; i < NUM_ALPHABET; i++) {
         root_node[NODE_EDGE_KEY_FIRST + i] = static_cast<uint8_t>(i);
     }
+    InitSubtreeCount(root_node, NUM_ALPHABET, 0);
 
     if (node_move)
         WriteData(root_node, node_size[NUM_ALPHABET - 1], root_offset);
@@ -302,6 +330,84 @@ void DictMem::AddRootEdge(EdgePtrs& edge_ptrs, const uint8_t* key,
 #endif
 }
 
+// Fill in an edge whose label starts with its first character; the first
+// character itself is kept in the parent node. Labels longer than
+// LOCAL_EDGE_LEN are stored by the caller at label_offset.
+void DictMem::InitBulkEdge(uint8_t* edge, const uint8_t* label, int len, bool leaf, size_t target,
+    size_t label_offset) const
+{
+    memset(edge, 0, EDGE_SIZE);
+    edge[EDGE_LEN_POS] = static_cast<uint8_t>(len);
+    if (len > LOCAL_EDGE_LEN)
+        Write5BInteger(edge, label_offset);
+    else if (len > 1)
+        memcpy(edge, label + 1, len - 1);
+    edge[EDGE_FLAG_POS] = leaf ? EDGE_FLAG_DATA_OFF : 0;
+    Write6BInteger(edge + EDGE_NODE_LEADING_POS, target);
+}
+
+int DictMem::BulkNodeSize(int nt) const
+{
+    return free_lists->GetAlignmentSize(NodeSize(nt - 1, UseNodeIndex(nt)));
+}
+
+// The buffer must be zeroed and hold BulkNodeSize(nt) bytes.
+void DictMem::FillBulkNode(uint8_t* node, const uint8_t* first_chars, const uint8_t* edges, int nt,
+    bool match, size_t data_offset, int64_t count) const
+{
+    bool indexed = UseNodeIndex(nt);
+    node[0] = FLAG_NODE_SORTED | (match ? FLAG_NODE_MATCH : FLAG_NODE_NONE);
+    node[1] = static_cast<uint8_t>(nt - 1);
+    if (match)
+        Write6BInteger(node + 2, data_offset);
+    memcpy(node + NODE_EDGE_KEY_FIRST, first_chars, nt);
+    memcpy(node + NODE_EDGE_KEY_FIRST + nt, edges, (size_t)nt * EDGE_SIZE);
+    InitSubtreeCount(node, nt, count);
+    InitNodeIndex(node, nt, indexed);
+}
+
+// Nodes are not reachable until their parent edge is written, so they are
+// filled in place without the lock-free protocol.
+size_t DictMem::AddBulkNode(const uint8_t* first_chars, const uint8_t* edges, int nt, bool match,
+    size_t data_offset, int64_t count)
+{
+    bool indexed = UseNodeIndex(nt);
+    size_t offset;
+    uint8_t* node;
+    bool node_move = ReserveNode(nt - 1, offset, node, indexed);
+    memset(node, 0, NodeSize(nt - 1, indexed));
+    FillBulkNode(node, first_chars, edges, nt, match, data_offset, count);
+
+    if (node_move)
+        WriteData(node, NodeSize(nt - 1, indexed), offset);
+    header->n_edges += nt;
+    return offset;
+}
+
+// A bulk load that stops early leaves the tree with the subtrees linked so
+// far; there is no exception status to replay.
+int DictMem::AddBulkRootEdge(const uint8_t* edge, uint8_t first_char, int64_t count)
+{
+    EdgePtrs edge_ptrs;
+    int rval = GetRootEdge_Writer(false, first_char, edge_ptrs);
+    if (rval != MBError::SUCCESS)
+        return rval;
+    if (edge_ptrs.len_ptr[0] != 0)
+        return MBError::IN_DICT;
+
+    memcpy(edge_ptrs.ptr, edge, EDGE_SIZE);
+#ifdef __LOCK_FREE__
+    lfree->WriterLockFreeStart(edge_ptrs.offset);
+#endif
+    WriteEdge(edge_ptrs);
+#ifdef __LOCK_FREE__
+    lfree->WriterLockFreeStop();
+#endif
+    if (SubtreeCountEnabled())
+        return AddSubtreeCount(root_offset, NUM_ALPHABET, count);
+    return MBError::SUCCESS;
+}
+
 void DictMem::UpdateTailEdge(EdgePtrs& edge_ptrs, int match_len, MBData& data,
     EdgePtrs& tail_edge, uint8_t& new_key_first,
     bool& map_new_sliding)
@@ -413,6 +519,14 @@ int DictMem::InsertNode(EdgePtrs& edge_ptrs, int match_len,
     uint8_t new_key_first;
     UpdateTailEdge(edge_ptrs, match_len, data, new_edge_ptrs, new_key_first,
         map_new_sliding);
+    // The new node takes over the entries below the old edge. The new key
+    // is counted by UpdateSubtreeCounts once the node is linked.
+    if (SubtreeCountEnabled()) {
+        int64_t count;
+        if (EdgeSubtreeCount(new_edge_ptrs.ptr, count) != MBError::SUCCESS)
+            throw (int)MBError::READ_ERROR;
+        InitSubtreeCount(node, 1, count);
+    }
 
     int release_buffer_size = 0;
     size_t edge_str_off = 0;
@@ -495,6 +609,12 @@ int DictMem::AddLink(EdgePtrs& edge_ptrs, int match_len, const uint8_t* key,
     tail_edge_tmp_ptrs.offset_ptr = tail_edge_tmp_ptrs.flag_ptr + 1;
     UpdateTailEdge(edge_ptrs, match_len, data, tail_edge_tmp_ptrs, new_key_first,
         map_new_sliding);
+    if (SubtreeCountEnabled()) {
+        int64_t count;
+        if (EdgeSubtreeCount(tail_edge_tmp, count) != MBError::SUCCESS)
+            throw (int)MBError::READ_ERROR;
+        InitSubtreeCount(node, 2, count);
+    }
 
     int release_buffer_size = 0;
     size_t edge_str_off;
@@ -580,8 +700,10 @@ int DictMem::UpdateNode(EdgePtrs& edge_ptrs, const uint8_t* key, int key_len,
     NodePtrs node_ptrs;
     uint8_t* node;
     bool map_new_sliding = false;
+    bool indexed = UseNodeIndex(nt + 1);
+    bool old_indexed = false;
 
-    node_move = ReserveNode(nt, node_ptrs.offset, node);
+    node_move = ReserveNode(nt, node_ptrs.offset, node, indexed);
     if (node_move)
         map_new_sliding = true;
     InitNodePtrs(node, nt, node_ptrs);
@@ -596,6 +718,7 @@ int DictMem::UpdateNode(EdgePtrs& edge_ptrs, const uint8_t* key, int key_len,
             Write6BInteger(node_ptrs.ptr + 2, old_node_off);
             edge_ptrs.flag_ptr[0] &= ~EDGE_FLAG_DATA_OFF;
             node[0] = FLAG_NODE_MATCH | FLAG_NODE_NONE;
+            InitSubtreeCount(node, 1, 1);
         }
     } else {
 #ifdef __DEBUG__
@@ -608,6 +731,13 @@ int DictMem::UpdateNode(EdgePtrs& edge_ptrs, const uint8_t* key, int key_len,
             return MBError::READ_ERROR;
         if (ReadData(node_ptrs.ptr + copy_size + 1, EDGE_SIZE * nt, old_node_off + copy_size) != EDGE_SIZE * nt)
             return MBError::READ_ERROR;
+        old_indexed = node[0] & FLAG_NODE_INDEXED;
+        if (SubtreeCountEnabled()) {
+            int64_t count;
+            if (ReadSubtreeCount(old_node_off, count) != MBError::SUCCESS)
+                return MBError::READ_ERROR;
+            InitSubtreeCount(node, nt + 1, count);
+        }
 
         release_node_index = nt - 1;
     }
@@ -664,12 +794,13 @@ int DictMem::UpdateNode(EdgePtrs& edge_ptrs, const uint8_t* key, int key_len,
         node_ptrs.ptr[0] |= FLAG_NODE_SORTED;
     else
         node_ptrs.ptr[0] &= ~FLAG_NODE_SORTED;
+    InitNodeIndex(node, nt + 1, indexed);
 
     if (node_move)
-        WriteData(node, node_size[nt], node_ptrs.offset);
+        WriteData(node, NodeSize(nt, indexed), node_ptrs.offset);
 
     if (release_node_index >= 0)
-        ReleaseNode(old_node_off, release_node_index);
+        ReleaseNode(old_node_off, release_node_index, old_indexed);
 #ifdef __LOCK_FREE__
     header->excep_lf_offset = edge_ptrs.offset;
     header->excep_updating_status = EXCEP_STATUS_ADD_EDGE;
@@ -697,22 +828,16 @@ bool DictMem::FindNext(const unsigned char* key, int keylen, int& match_len,
 #ifdef __DEBUG__
     assert(node_base_off != 0);
 #endif
-    // Read node flags and nt-1
-    uint8_t node_flag;
-    if (ReadData(&node_flag, 1, node_base_off) != 1)
-        return false;
-    if (ReadData(key_tmp, 1, node_base_off + 1) != 1)
+    // Read flags and nt-1
+    if (ReadData(key_tmp, 2, node_base_off) != 2)
         return false;
-    bool sorted = (node_flag & FLAG_NODE_SORTED);
-    int nt = key_tmp[0];
+    uint8_t node_flags = key_tmp[0];
+    int nt = key_tmp[1];
     edge_ptr.curr_nt = nt;
     nt++;
-    // Load edge key first
-    const size_t first_char_off = node_base_off + NODE_EDGE_KEY_FIRST;
-    if (ReadData(key_tmp, nt, first_char_off) != nt)
+    int match_idx;
+    if (SelectEdge(node_base_off, node_flags, nt, key[0], key_tmp, match_idx) != MBError::SUCCESS)
         return false;
-    int match_idx, less_idx_unused, max_idx_unused;
-    select_edge_indices(key_tmp, nt, key[0], sorted, match_idx, less_idx_unused, max_idx_unused);
     if (match_idx < 0)
         return false;
 
@@ -764,11 +889,11 @@ bool DictMem::FindNext(const unsigned char* key, int keylen, int& match_len,
 
 // Reserve buffer for a new node.
 // The allocated in-memory buffer must be initialized to zero.
-bool DictMem::ReserveNode(int nt, size_t& offset, uint8_t*& ptr)
+bool DictMem::ReserveNode(int nt, size_t& offset, uint8_t*& ptr, bool indexed)
 {
     bool ret;
     if (options & CONSTS::OPTION_JEMALLOC) {
-        size_t buf_size = node_size[nt];
+        size_t buf_size = NodeSize(nt, indexed);
         ptr = (uint8_t*)kv_file->Malloc(buf_size, offset);
         if (ptr == nullptr) {
             int rval = kv_file->GetLastAllocError();
@@ -780,7 +905,7 @@ bool DictMem::ReserveNode(int nt, size_t& offset, uint8_t*& ptr)
         size_t rel_size = ((size_t)buf_size + JEMALLOC_ALIGNMENT - 1) & ~(JEMALLOC_ALIGNMENT - 1);
         header->pending_index_buff_size += (int64_t)rel_size;
     } else {
-        ret = reserveNodeFL(nt, offset, ptr);
+        ret = reserveNodeFL(nt, offset, ptr, indexed);
     }
 
 #ifdef __DEBUG__
@@ -791,13 +916,13 @@ bool DictMem::ReserveNode(int nt, size_t& offset, uint8_t*& ptr)
     return ret;
 }
 
-bool DictMem::reserveNodeFL(int nt, size_t& offset, uint8_t*& ptr)
+bool DictMem::reserveNodeFL(int nt, size_t& offset, uint8_t*& ptr, bool indexed)
 {
 #ifdef __DEBUG__
     assert(nt >= 0 && nt < 256);
 #endif
 
-    int buf_size = free_lists->GetAlignmentSize(node_size[nt]);
+    int buf_size = free_lists->GetAlignmentSize(NodeSize(nt, indexed));
     int buf_index = free_lists->GetBufferIndex(buf_size);
 
     header->n_states++;
@@ -909,15 +1034,16 @@ void DictMem::reserveDataFL(const uint8_t* key, int size, size_t& offset, bool m
 }
 
 // Release node buffer
-void DictMem::ReleaseNode(size_t offset, int nt)
+void DictMem::ReleaseNode(size_t offset, int nt, bool indexed)
 {
+    header->BumpIndexFreeSeq();
 #ifdef __DEBUG__
     remove_tracking_buffer(offset);
 #endif
     if (options & CONSTS::OPTION_JEMALLOC) {
         if (offset >= header->jemalloc_index_free_start) {
             kv_file->Free(offset);
-            size_t rel_size = ((size_t)node_size[nt] + JEMALLOC_ALIGNMENT - 1) & ~(JEMALLOC_ALIGNMENT - 1);
+            size_t rel_size = ((size_t)NodeSize(nt, indexed) + JEMALLOC_ALIGNMENT - 1) & ~(JEMALLOC_ALIGNMENT - 1);
             header->pending_index_buff_size -= (int64_t)rel_size;
             if (header->pending_index_buff_size < 0) {
                 Logger::Log(LOG_LEVEL_WARN,
@@ -936,22 +1062,22 @@ void DictMem::ReleaseNode(size_t offset, int nt)
                 offset, header->jemalloc_index_free_start);
         }
     } else {
-        releaseNodeFL(offset, nt);
+        releaseNodeFL(offset, nt, indexed);
     }
 }
 
-void DictMem::releaseNodeFL(size_t offset, int nt)
+void DictMem::releaseNodeFL(size_t offset, int nt, bool indexed)
 {
     if (nt < 0)
         return;
 
-    int buf_index = free_lists->GetBufferIndex(node_size[nt]);
+    int buf_index = free_lists->GetBufferIndex(NodeSize(nt, indexed));
     int rval = free_lists->AddBufferByIndex(buf_index, offset);
     if (rval == MBError::SUCCESS)
         header->n_states--;
     else
         Logger::Log(LOG_LEVEL_ERROR, "failed to release node buffer");
-    header->pending_index_buff_size += free_lists->GetAlignmentSize(node_size[nt]);
+    header->pending_index_buff_size += free_lists->GetAlignmentSize(NodeSize(nt, indexed));
 }
 
 // Release edge string buffer
@@ -1219,32 +1345,34 @@ int DictMem::NextEdge(const uint8_t* key, EdgePtrs& edge_ptrs, uint8_t* node_buf
     MBData& mbdata) const
 {
     size_t node_off;
-    int nt = -1;
-    int ret = ReadNode(node_off, edge_ptrs, node_buff, mbdata, nt);
+    if ((mbdata.options & CONSTS::OPTION_READ_SAVED_EDGE) && edge_ptrs.offset == mbdata.edge_ptrs.offset)
+        node_off = Get6BInteger(mbdata.edge_ptrs.offset_ptr);
+    else
+        node_off = Get6BInteger(edge_ptrs.offset_ptr);
+    if (ReadData(node_buff, NODE_EDGE_KEY_FIRST, node_off) != NODE_EDGE_KEY_FIRST)
+        return MBError::READ_ERROR;
+
+    // First characters are only loaded into node_buff for nodes without an index.
+    int nt = node_buff[1] + 1;
+    int match_idx;
+    int ret = SelectEdge(node_off, node_buff[0], nt, key[0], node_buff + NODE_EDGE_KEY_FIRST, match_idx);
     if (ret != MBError::SUCCESS)
         return ret;
-
-    {
-        const uint8_t* first_chars = node_buff + NODE_EDGE_KEY_FIRST;
-        bool sorted = (node_buff[0] & FLAG_NODE_SORTED);
-        int match_idx, less_idx_unused, max_idx_unused;
-        select_edge_indices(first_chars, nt, key[0], sorted, match_idx, less_idx_unused, max_idx_unused);
-        if (match_idx >= 0) {
-            if (mbdata.options & CONSTS::OPTION_FIND_AND_STORE_PARENT) {
-                edge_ptrs.curr_nt = nt;
-                edge_ptrs.curr_edge_index = match_idx;
-                edge_ptrs.parent_offset = edge_ptrs.offset;
-                edge_ptrs.curr_node_offset = node_off;
-            }
-            size_t offset_new = edge_offset_of(node_off, nt, match_idx);
-            int byte_read = ReadData(edge_ptrs.edge_buff, EDGE_SIZE, offset_new);
-            if (byte_read != EDGE_SIZE)
-                return MBError::READ_ERROR;
-            edge_ptrs.offset = offset_new;
-            return MBError::SUCCESS;
-        }
+    if (match_idx < 0)
         return MBError::NOT_EXIST;
+
+    if (mbdata.options & CONSTS::OPTION_FIND_AND_STORE_PARENT) {
+        edge_ptrs.curr_nt = nt;
+        edge_ptrs.curr_edge_index = match_idx;
+        edge_ptrs.parent_offset = edge_ptrs.offset;
+        edge_ptrs.curr_node_offset = node_off;
     }
+    size_t offset_new = edge_offset_of(node_off, nt, match_idx);
+    int byte_read = ReadData(edge_ptrs.edge_buff, EDGE_SIZE, offset_new);
+    if (byte_read != EDGE_SIZE)
+        return MBError::READ_ERROR;
+    edge_ptrs.offset = offset_new;
+    return MBError::SUCCESS;
 }
 
 int DictMem::NextEdgeFast(const uint8_t* key, EdgePtrs& edge_ptrs, MBData& mbdata) const
@@ -1261,15 +1389,22 @@ int DictMem::NextEdgeFast(const uint8_t* key, EdgePtrs& edge_ptrs, MBData& mbdat
     if (hdr == nullptr)
         return MBError::READ_ERROR;
     int nt = hdr[1] + 1;
-    // Read first-chars table directly
-    const uint8_t* first_chars = GetShmPtr(node_off + NODE_EDGE_KEY_FIRST, nt);
-    if (first_chars == nullptr)
-        return MBError::READ_ERROR;
-    bool sorted = (hdr[0] & FLAG_NODE_SORTED) != 0;
+    int match_idx;
+    if (hdr[0] & FLAG_NODE_INDEXED) {
+        // Dense node: one index byte instead of the first-chars table
+        const uint8_t* slot = GetShmPtr(node_index_offset(node_off, nt, header->subtree_count) + key[0], 1);
+        if (slot == nullptr)
+            return MBError::READ_ERROR;
+        match_idx = node_index_slot(*slot, nt);
+    } else {
+        // Read first-chars table directly
+        const uint8_t* first_chars = GetShmPtr(node_off + NODE_EDGE_KEY_FIRST, nt);
+        if (first_chars == nullptr)
+            return MBError::READ_ERROR;
 
-    // Select matching child index for key[0]
-    int match_idx, less_idx_unused, max_idx_unused;
-    select_edge_indices(first_chars, nt, key[0], sorted, match_idx, less_idx_unused, max_idx_unused);
+        // Select matching child index for key[0]
+        match_idx = select_match_index(first_chars, nt, key[0]);
+    }
     if (match_idx < 0)
         return MBError::NOT_EXIST;
 
@@ -1319,7 +1454,8 @@ int DictMem::RemoveEdgeSizeN(const EdgePtrs& edge_ptrs,
     uint8_t* node;
 
     // Reserve for the new node
-    node_move = ReserveNode(nt - 2, new_node_offset, node);
+    bool indexed = UseNodeIndex(nt - 1);
+    node_move = ReserveNode(nt - 2, new_node_offset, node, indexed);
 
     // Copy data from old node
     uint8_t* first_key_ptr = node + NODE_EDGE_KEY_FIRST;
@@ -1348,10 +1484,18 @@ int DictMem::RemoveEdgeSizeN(const EdgePtrs& edge_ptrs,
         }
         old_edge_offset += EDGE_SIZE;
     }
+    // The removed key was already taken off the count.
+    if (SubtreeCountEnabled()) {
+        int64_t count;
+        if (ReadSubtreeCount(node_offset, count) != MBError::SUCCESS)
+            return MBError::READ_ERROR;
+        InitSubtreeCount(node, nt - 1, count);
+    }
+    InitNodeIndex(node, nt - 1, indexed);
 
     // Write the new node before free
     if (node_move)
-        WriteData(node, node_size[nt - 2], new_node_offset);
+        WriteData(node, NodeSize(nt - 2, indexed), new_node_offset);
 
     // Update the link from parent edge to the new node offset
     Write6BInteger(header->excep_buff, new_node_offset);
@@ -1440,7 +1584,7 @@ int DictMem::RemoveEdgeByIndex(const EdgePtrs& edge_ptrs, MBData& data)
     header->excep_updating_status = EXCEP_STATUS_NONE;
 
     header->n_edges--;
-    ReleaseNode(header->excep_offset, nt - 1);
+    ReleaseNode(header->excep_offset, nt - 1, old_node_buffer[0] & FLAG_NODE_INDEXED);
     if (str_size_rel > 0)
         ReleaseBuffer(str_off_rel, str_size_rel);
 
@@ -1491,6 +1635,267 @@ const int* DictMem::GetNodeSizePtr() const
     return node_size;
 }
 
+bool DictMem::SubtreeCountEnabled() const
+{
+    return header->subtree_count != 0;
+}
+
+void DictMem::InitSubtreeCount(uint8_t* node, int nt, int64_t count) const
+{
+    if (SubtreeCountEnabled())
+        memcpy(node + subtree_count_offset(0, nt), &count, SUBTREE_COUNT_SIZE);
+}
+
+int DictMem::ReadSubtreeCount(size_t node_off, int64_t& count) const
+{
+    uint8_t nt_m1;
+    if (ReadData(&nt_m1, 1, node_off + 1) != 1)
+        return MBError::READ_ERROR;
+    if (ReadData(reinterpret_cast<uint8_t*>(&count), SUBTREE_COUNT_SIZE,
+            subtree_count_offset(node_off, nt_m1 + 1))
+        != SUBTREE_COUNT_SIZE)
+        return MBError::READ_ERROR;
+    return MBError::SUCCESS;
+}
+
+int DictMem::EdgeSubtreeCount(const uint8_t* edge, int64_t& count) const
+{
+    if (edge[EDGE_LEN_POS] == 0) {
+        count = 0;
+        return MBError::SUCCESS;
+    }
+    if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF) {
+        count = 1;
+        return MBError::SUCCESS;
+    }
+    return ReadSubtreeCount(Get6BInteger(edge + EDGE_NODE_LEADING_POS), count);
+}
+
+int DictMem::AddSubtreeCount(size_t node_off, int nt, int64_t delta) const
+{
+    int64_t count;
+    size_t count_off = subtree_count_offset(node_off, nt);
+    if (ReadData(reinterpret_cast<uint8_t*>(&count), SUBTREE_COUNT_SIZE, count_off) != SUBTREE_COUNT_SIZE)
+        return MBError::READ_ERROR;
+    count += delta;
+    WriteData(reinterpret_cast<const uint8_t*>(&count), SUBTREE_COUNT_SIZE, count_off);
+    return MBError::SUCCESS;
+}
+
+// Walk the path of a key that is in the tree, adding delta to the root and
+// to every node the key passes through or ends at. The first character of
+// an edge selects it; the rest of the label is not compared.
+int DictMem::UpdateSubtreeCounts(bool rc_mode, const uint8_t* key, int len, int64_t delta)
+{
+    size_t node_off = rc_mode ? root_offset_rc : root_offset;
+    int nt = NUM_ALPHABET;
+    uint8_t first_chars[NUM_ALPHABET];
+    uint8_t edge[EDGE_SIZE];
+    uint8_t node_hdr[2] = { 0, 0 };
+
+    while (true) {
+        if (AddSubtreeCount(node_off, nt, delta) != MBError::SUCCESS)
+            return MBError::READ_ERROR;
+        if (len <= 0)
+            return MBError::SUCCESS;
+
+        int idx = key[0];
+        if (nt != NUM_ALPHABET) {
+            if (SelectEdge(node_off, node_hdr[0], nt, key[0], first_chars, idx) != MBError::SUCCESS)
+                return MBError::READ_ERROR;
+            if (idx < 0)
+                return MBError::NOT_EXIST;
+        }
+        if (ReadData(edge, EDGE_SIZE, edge_offset_of(node_off, nt, idx)) != EDGE_SIZE)
+            return MBError::READ_ERROR;
+        int edge_len = edge[EDGE_LEN_POS];
+        if (edge_len == 0 || edge_len > len)
+            return MBError::NOT_EXIST;
+        key += edge_len;
+        len -= edge_len;
+        if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF)
+            return (len == 0) ? MBError::SUCCESS : MBError::NOT_EXIST;
+
+        node_off = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+        if (ReadData(node_hdr, 2, node_off) != 2)
+            return MBError::READ_ERROR;
+        nt = node_hdr[1] + 1;
+    }
+}
+
+// Post-order walk of the main tree; each node is written once all of its
+// children have been counted.
+int DictMem::RebuildSubtreeCounts(int64_t& count)
+{
+    struct CountFrame {
+        size_t node_off;
+        int nt;
+        int next;
+        int64_t count;
+    };
+    std::vector<CountFrame> frames;
+    frames.push_back({ root_offset, NUM_ALPHABET, 0, 0 });
+    uint8_t edge[EDGE_SIZE];
+    uint8_t node_hdr[NODE_EDGE_KEY_FIRST];
+
+    while (true) {
+        CountFrame& frame = frames.back();
+        if (frame.next == frame.nt) {
+            int64_t node_count = frame.count;
+            WriteData(reinterpret_cast<const uint8_t*>(&node_count), SUBTREE_COUNT_SIZE,
+                subtree_count_offset(frame.node_off, frame.nt));
+            frames.pop_back();
+            if (frames.empty()) {
+                count = node_count;
+                return MBError::SUCCESS;
+            }
+            frames.back().count += node_count;
+            continue;
+        }
+
+        if (ReadData(edge, EDGE_SIZE, edge_offset_of(frame.node_off, frame.nt, frame.next)) != EDGE_SIZE)
+            return MBError::READ_ERROR;
+        frame.next++;
+        if (edge[EDGE_LEN_POS] == 0)
+            continue;
+        if (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF) {
+            frame.count++;
+            continue;
+        }
+        if (frames.size() > static_cast<size_t>(CONSTS::MAX_KEY_LENGHTH))
+            return MBError::INVALID_SIZE;
+
+        size_t child_off = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+        if (ReadData(node_hdr, NODE_EDGE_KEY_FIRST, child_off) != NODE_EDGE_KEY_FIRST)
+            return MBError::READ_ERROR;
+        frames.push_back({ child_off, node_hdr[1] + 1, 0, (node_hdr[0] & FLAG_NODE_MATCH) ? 1 : 0 });
+    }
+}
+
+bool DictMem::DenseNodeIndexEnabled() const
+{
+    return dense_node_index;
+}
+
+// Allocation size of a node with nt + 1 edges, indexed like node_size
+int DictMem::NodeSize(int nt, bool indexed) const
+{
+    return node_size[nt] + (indexed ? NODE_INDEX_SIZE : 0);
+}
+
+// Whether a new node with nt edges gets a dense node index
+bool DictMem::UseNodeIndex(int nt) const
+{
+    return dense_node_index && nt >= DENSE_NODE_MIN_EDGES;
+}
+
+// Set or clear the index of a node buffer with nt edges. The index is built
+// from the first characters, so it must be called after they are in place.
+void DictMem::InitNodeIndex(uint8_t* node, int nt, bool indexed) const
+{
+    if (!indexed) {
+        node[0] &= ~FLAG_NODE_INDEXED;
+        return;
+    }
+
+    node[0] |= FLAG_NODE_INDEXED;
+    uint8_t* index = node + node_index_offset(0, nt, header->subtree_count);
+    const uint8_t* first_chars = node + NODE_EDGE_KEY_FIRST;
+    memset(index, NODE_INDEX_ABSENT, NODE_INDEX_SIZE);
+    for (int i = 0; i < nt; i++)
+        index[first_chars[i]] = static_cast<uint8_t>(i);
+}
+
+// Index of the edge starting with key in the node at node_off, or -1. Dense
+// nodes are looked up in their index; otherwise the first characters are
+// read into first_chars and searched.
+int DictMem::SelectEdge(size_t node_off, uint8_t node_flags, int nt, uint8_t key,
+    uint8_t* first_chars, int& idx) const
+{
+    if (node_flags & FLAG_NODE_INDEXED) {
+        uint8_t slot;
+        if (ReadData(&slot, 1, node_index_offset(node_off, nt, header->subtree_count) + key) != 1)
+            return MBError::READ_ERROR;
+        idx = node_index_slot(slot, nt);
+        return MBError::SUCCESS;
+    }
+
+    if (ReadData(first_chars, nt, node_off + NODE_EDGE_KEY_FIRST) != nt)
+        return MBError::READ_ERROR;
+    idx = select_match_index(first_chars, nt, key);
+    return MBError::SUCCESS;
+}
+
+// Pre-order walk of the main tree. A dense node without an index is copied
+// to a new indexed node and its parent edge relinked as in RemoveEdgeSizeN;
+// the walk then continues below the copy.
+int DictMem::IndexDenseNodes(int64_t& converted)
+{
+    converted = 0;
+    if (!dense_node_index)
+        return MBError::SUCCESS;
+
+    struct WalkFrame {
+        size_t node_off;
+        int nt;
+        int next;
+    };
+    std::vector<WalkFrame> frames;
+    frames.push_back({ root_offset, NUM_ALPHABET, 0 });
+    uint8_t edge[EDGE_SIZE];
+    uint8_t node_hdr[NODE_EDGE_KEY_FIRST];
+
+    while (!frames.empty()) {
+        WalkFrame& frame = frames.back();
+        if (frame.next == frame.nt) {
+            frames.pop_back();
+            continue;
+        }
+
+        size_t edge_off = edge_offset_of(frame.node_off, frame.nt, frame.next);
+        frame.next++;
+        if (ReadData(edge, EDGE_SIZE, edge_off) != EDGE_SIZE)
+            return MBError::READ_ERROR;
+        if (edge[EDGE_LEN_POS] == 0 || (edge[EDGE_FLAG_POS] & EDGE_FLAG_DATA_OFF))
+            continue;
+        if (frames.size() > static_cast<size_t>(CONSTS::MAX_KEY_LENGHTH))
+            return MBError::INVALID_SIZE;
+
+        size_t child_off = Get6BInteger(edge + EDGE_NODE_LEADING_POS);
+        if (ReadData(node_hdr, NODE_EDGE_KEY_FIRST, child_off) != NODE_EDGE_KEY_FIRST)
+            return MBError::READ_ERROR;
+        int nt = node_hdr[1] + 1;
+        if (UseNodeIndex(nt) && !(node_hdr[0] & FLAG_NODE_INDEXED)) {
+            uint8_t* node;
+            size_t new_off;
+            bool node_move = ReserveNode(nt - 1, new_off, node, true);
+            if (ReadData(node, node_size[nt - 1], child_off) != node_size[nt - 1])
+                return MBError::READ_ERROR;
+            InitNodeIndex(node, nt, true);
+            if (node_move)
+                WriteData(node, NodeSize(nt - 1, true), new_off);
+
+            header->excep_offset = child_off;
+            header->excep_lf_offset = edge_off;
+            header->excep_updating_status = EXCEP_STATUS_REMOVE_EDGE;
+            Write6BInteger(header->excep_buff, new_off);
+#ifdef __LOCK_FREE__
+            lfree->WriterLockFreeStart(edge_off);
+#endif
+            WriteData(header->excep_buff, OFFSET_SIZE, edge_off + EDGE_NODE_LEADING_POS);
+#ifdef __LOCK_FREE__
+            lfree->WriterLockFreeStop();
+#endif
+            header->excep_updating_status = EXCEP_STATUS_NONE;
+            ReleaseNode(child_off, nt - 1, false);
+            child_off = new_off;
+            converted++;
+        }
+        frames.push_back({ child_off, nt, 0 });
+    }
+    return MBError::SUCCESS;
+}
+
 void DictMem::InitLockFreePtr(LockFree* lf)
 {
     lfree = lf;
@@ -97,6 +97,37 @@ public:
     void Flush() const;
     void Purge() const;
 
+    // Per-subtree entry counts (OPTION_SUBTREE_COUNT). Every node stores the
+    // number of entries below it, including its own, after its edges.
+    bool SubtreeCountEnabled() const;
+    int ReadSubtreeCount(size_t node_off, int64_t& count) const;
+    // Entries reachable through an edge: 1 for a leaf, the child count otherwise
+    int EdgeSubtreeCount(const uint8_t* edge, int64_t& count) const;
+    // Writer only; add delta to every node on the path of an existing key
+    int UpdateSubtreeCounts(bool rc_mode, const uint8_t* key, int len, int64_t delta);
+    // Writer only; recount the main tree bottom-up
+    int RebuildSubtreeCounts(int64_t& count);
+
+    // Dense nodes (OPTION_DENSE_NODE_INDEX) carry a 256-byte map from first
+    // character to edge index, flagged by FLAG_NODE_INDEXED; readers use it
+    // when present. Writer only; rewrite dense nodes created without it.
+    bool DenseNodeIndexEnabled() const;
+    int IndexDenseNodes(int64_t& converted);
+
+    // Bulk load (see BulkLoader). Writer only. A node is written once with
+    // all of its edges, which are given in first-character order; children
+    // are written before their parents.
+    void InitBulkEdge(uint8_t* edge, const uint8_t* label, int len, bool leaf, size_t target,
+        size_t label_offset) const;
+    // Buffer size of a bulk node with nt edges, and its contents
+    int BulkNodeSize(int nt) const;
+    void FillBulkNode(uint8_t* node, const uint8_t* first_chars, const uint8_t* edges, int nt,
+        bool match, size_t data_offset, int64_t count) const;
+    size_t AddBulkNode(const uint8_t* first_chars, const uint8_t* edges, int nt, bool match,
+        size_t data_offset, int64_t count);
+    // Link a finished subtree of count entries to an empty root edge
+    int AddBulkRootEdge(const uint8_t* edge, uint8_t first_char, int64_t count);
+
     // Updates in RC mode
     size_t InitRootNode_RC();
     int ClearRootEdges_RC() const;
@@ -106,8 +137,13 @@ public:
 
 private:
     friend class DictMemReleaseTestPeer;
-    bool ReserveNode(int nt, size_t& offset, uint8_t*& ptr);
-    void ReleaseNode(size_t offset, int nt);
+    bool ReserveNode(int nt, size_t& offset, uint8_t*& ptr, bool indexed = false);
+    void ReleaseNode(size_t offset, int nt, bool indexed = false);
+    int NodeSize(int nt, bool indexed) const;
+    bool UseNodeIndex(int nt) const;
+    void InitNodeIndex(uint8_t* node, int nt, bool indexed) const;
+    int SelectEdge(size_t node_off, uint8_t node_flags, int nt, uint8_t key,
+        uint8_t* first_chars, int& idx) const;
     void ReleaseBuffer(size_t offset, int size);
     void UpdateTailEdge(EdgePtrs& edge_ptrs, int match_len, MBData& data,
         EdgePtrs& tail_edge, uint8_t& new_key_first,
@@ -124,13 +160,16 @@ private:
         int& str_size_rel);
     int ReadNode(size_t& offset, EdgePtrs& edge_ptrs, uint8_t* node_buff,
         MBData& mbdata, int& nt) const;
+    void InitSubtreeCount(uint8_t* node, int nt, int64_t count) const;
+    int AddSubtreeCount(size_t node_off, int nt, int64_t delta) const;
     void reserveDataFL(const uint8_t* key, int size, size_t& offset, bool map_new_sliding);
-    bool reserveNodeFL(int nt, size_t& offset, uint8_t*& ptr);
-    void releaseNodeFL(size_t offset, int nt);
+    bool reserveNodeFL(int nt, size_t& offset, uint8_t*& ptr, bool indexed);
+    void releaseNodeFL(size_t offset, int nt, bool indexed);
     void releaseBufferFL(size_t offset, int size);
 
     int* node_size;
     bool is_valid;
+    bool dense_node_index;
 
     size_t root_offset;
     uint8_t* node_ptr;
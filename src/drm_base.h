@@ -28,6 +28,8 @@
 #define DATA_BUFFER_ALIGNMENT 1
 #define DATA_SIZE_BYTE 2
 #define DATA_HDR_BYTE 4
+// Set in the length of a data buffer that holds the extent list of a large value
+#define DATA_EXTENT_FLAG 0x8000
 #define OFFSET_SIZE 6
 #define EDGE_SIZE 13
 #define EDGE_LEN_POS 5
@@ -35,11 +37,16 @@
 #define EDGE_FLAG_DATA_OFF 0x01
 #define FLAG_NODE_MATCH 0x01
 #define FLAG_NODE_SORTED 0x02
+#define FLAG_NODE_INDEXED 0x04
 #define FLAG_NODE_NONE 0x0
 #define BUFFER_ALIGNMENT 1
 #define LOCAL_EDGE_LEN 6
 #define LOCAL_EDGE_LEN_M1 5
 #define EDGE_NODE_LEADING_POS 7
+#define SUBTREE_COUNT_SIZE 8
+#define NODE_INDEX_SIZE 256
+#define NODE_INDEX_ABSENT 0xFF
+#define DENSE_NODE_MIN_EDGES 48
 #define EXCEP_STATUS_NONE 0
 #define EXCEP_STATUS_ADD_EDGE 1
 #define EXCEP_STATUS_ADD_DATA_OFF 2
@@ -51,6 +58,8 @@
 #define EXCEP_STATUS_RC_DATA 8
 #define EXCEP_STATUS_RC_TREE 9
 #define EXCEP_STATUS_REBUILD_ROOT_EDGE 10
+#define EXCEP_STATUS_OVERWRITE_DATA 11
+#define EXCEP_STATUS_RC_EXTENT 12
 #define MB_EXCEPTION_BUFF_SIZE 16
 
 #define REBUILD_STATE_NORMAL 0
@@ -59,6 +68,9 @@
 #define REBUILD_STATE_CUTOVER 3
 #define REBUILD_STATE_POST 4
 #define MB_MAX_READER_EPOCH_SLOT 64
+// Default seconds data rc waits for pinned value views before it runs anyway
+#define MB_VIEW_RC_MAX_WAIT 60
+#define MB_ASYNC_SHM_MAX_LANES 16
 #define MB_MAX_REUSABLE_BLOCKS 64
 #define REUSABLE_BLOCK_STATE_QUARANTINED 1
 #define REUSABLE_BLOCK_STATE_READY 2
@@ -205,7 +217,8 @@ typedef struct _IndexHeader {
     std::atomic<uint64_t> reader_epoch;
     ReaderEpochSlot reader_epoch_slot[MB_MAX_READER_EPOCH_SLOT];
 
-    // multi-process async queue
+    // multi-process async queue; queue_index and writer_index count the
+    // records queued and processed, the ring positions are kept in the queue
     int async_queue_size;
     std::atomic<uint32_t> queue_index;
     uint32_t writer_index;
@@ -219,6 +232,63 @@ typedef struct _IndexHeader {
     uint32_t pfx_cap3;      // number of slots in 3-byte table
     uint32_t pfx_cap4;      // number of slots in 4-byte table
 
+    // Exact-match hash index (<mbdir>_hashmap) kept by writers opened with
+    // OPTION_HASH_INDEX. hash_index_capacity is 0 while the index does not
+    // match the tree, e.g. the current writer does not maintain it or data rc
+    // moved the values. hash_index_seq is odd while the writer updates
+    // the tree and the index may disagree with it.
+    uint64_t hash_index_capacity;
+    std::atomic<uint32_t> hash_index_seq;
+
+    // Per-subtree entry counts. subtree_count is set when the DB is created
+    // with OPTION_SUBTREE_COUNT; every index node then ends with an 8-byte
+    // count of the entries below it. subtree_count_seq is odd while the
+    // writer updates the tree and the counts may disagree with it.
+    uint32_t subtree_count;
+    std::atomic<uint32_t> subtree_count_seq;
+
+    // Negative-lookup Bloom filter (<mbdir>_bloom) kept by writers opened
+    // with OPTION_BLOOM_FILTER. bloom_filter_blocks is 0 while the filter
+    // does not cover every key in the tree. bloom_filter_seq is odd while the
+    // writer clears or rebuilds it. bloom_filter_removed counts the keys
+    // removed since the last rebuild; they still pass the filter until rc
+    // rebuilds it, which it does once they exceed 1/8 of the capacity.
+    uint64_t bloom_filter_blocks;
+    std::atomic<uint32_t> bloom_filter_seq;
+    uint32_t bloom_filter_removed;
+
+    // Completion of async queue updates. An update queued by a reader gets
+    // its lane and the lane position after its record as sequence number,
+    // and async_applied_seq is the position up to which the async writer has
+    // processed each lane. async_applied_event is a futex word the writer
+    // bumps when async_applied_seq moves while async_applied_waiters handles
+    // wait in DB::WaitApplied.
+    std::atomic<uint64_t> async_applied_seq[MB_ASYNC_SHM_MAX_LANES];
+    std::atomic<uint32_t> async_applied_event;
+    std::atomic<uint32_t> async_applied_waiters;
+
+    // Value views (DB::FindView) point into the data file. The writer keeps
+    // released data buffers while views are pinned, so value_seq only moves
+    // when it rewrites a value in place (odd while it does), starts data rc or
+    // removes all entries. A view is valid while value_seq has not moved since
+    // the lookup. view_rc_wait_since is the time data rc was first put off
+    // for pinned views, 0 if it is not waiting.
+    std::atomic<uint64_t> value_seq;
+    int64_t view_rc_wait_since;
+
+    // Per-handle hot key caches remember where leaf edges are. An edge only
+    // moves when the node holding it is released, all entries are removed
+    // or rc reorders the index; index_free_seq moves whenever that happens.
+    std::atomic<uint32_t> index_free_seq;
+
+    // Writer only.
+    void BumpIndexFreeSeq()
+    {
+        index_free_seq.store(index_free_seq.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
     void SetRebuildActive()
     {
         rebuild_active = 1u;
@@ -259,7 +329,7 @@ public:
                 if (index) {
                     free_lists = new FreeList(mbdir + "_ibfl", BUFFER_ALIGNMENT, NUM_BUFFER_RESERVE);
                 } else {
-                    free_lists = new FreeList(mbdir + "_dbfl", BUFFER_ALIGNMENT, NUM_BUFFER_RESERVE);
+                    free_lists = new FreeList(mbdir + "_dbfl", DATA_BUFFER_ALIGNMENT, NUM_DATA_BUFFER_RESERVE);
                 }
             }
         }
@@ -270,8 +340,11 @@ public:
     }
 
     inline virtual void WriteData(const uint8_t* buff, unsigned len, size_t offset) const = 0;
-    inline int Reserve(size_t& offset, int size, uint8_t*& ptr);
+    inline int Reserve(size_t& offset, int size, uint8_t*& ptr, bool map_new_sliding = true);
     inline uint8_t* GetShmPtr(size_t offset, int size) const;
+    // Record a write through a pointer from GetShmPtr for group commit
+    inline void MarkDirty(size_t offset, int size) const;
+    inline void SetGroupSync(GroupSync* sync);
     inline size_t CheckAlignment(size_t offset, int size) const;
     inline int ReadData(uint8_t* buff, unsigned len, size_t offset) const;
     inline size_t GetJemallocAllocSize() const;
@@ -350,9 +423,9 @@ inline void DRMBase::WriteData(const uint8_t* buff, unsigned len, size_t offset)
     }
 }
 
-inline int DRMBase::Reserve(size_t& offset, int size, uint8_t*& ptr)
+inline int DRMBase::Reserve(size_t& offset, int size, uint8_t*& ptr, bool map_new_sliding)
 {
-    return kv_file->Reserve(offset, size, ptr);
+    return kv_file->Reserve(offset, size, ptr, map_new_sliding);
 }
 
 inline uint8_t* DRMBase::GetShmPtr(size_t offset, int size) const
@@ -360,6 +433,16 @@ inline uint8_t* DRMBase::GetShmPtr(size_t offset, int size) const
     return kv_file->GetShmPtr(offset, size);
 }
 
+inline void DRMBase::MarkDirty(size_t offset, int size) const
+{
+    kv_file->MarkDirty(offset, size);
+}
+
+inline void DRMBase::SetGroupSync(GroupSync* sync)
+{
+    kv_file->SetGroupSync(sync);
+}
+
 inline size_t DRMBase::CheckAlignment(size_t offset, int size) const
 {
     return kv_file->CheckAlignment(offset, size);
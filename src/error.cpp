@@ -48,6 +48,7 @@ const char* MBError::error_str[] = {
     "version mismatch",
     "jemalloc error",
     "timeout",
+    "value comparison failed",
 
     ///////////////////////////////////
     "DB not exist",
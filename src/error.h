@@ -53,6 +53,7 @@ public:
         VERSION_MISMATCH = 23,
         JEMALLOC_ERROR = 24,
         TIMEOUT = 25,
+        COMPARE_FAILED = 26,
 
         // NO_DB should be the last enum.
         NO_DB
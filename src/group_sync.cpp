@@ -0,0 +1,266 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "group_sync.h"
+#include "logger.h"
+#include "rollable_file.h"
+
+namespace mabain {
+
+// The flusher opens its own descriptors instead of using the writer's
+// mappings, which the writer may remap (sliding window) while a group is
+// written back. Data written through any mapping of a file is synced by
+// syncing the file.
+static int sync_fd(int fd)
+{
+#ifdef __APPLE__
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+GroupSync::GroupSync(const std::string& hdr_path, int interval, size_t bytes)
+    : header_path(hdr_path)
+    , interval_ms(interval > 0 ? interval : GROUP_SYNC_INTERVAL_MS_DEFAULT)
+    , max_bytes(bytes > 0 ? bytes : GROUP_SYNC_BYTES_DEFAULT)
+    , pending_bytes(0)
+    , write_seq(0)
+    , durable_seq(0)
+    , sync_error(MBError::SUCCESS)
+    , stop(false)
+{
+    flusher = std::thread(&GroupSync::Run, this);
+}
+
+// Write back what is still pending before returning
+GroupSync::~GroupSync()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    flush_cond.notify_all();
+    flusher.join();
+}
+
+int GroupSync::AddFile(const std::string& path, size_t block_size)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    SyncFile file;
+    file.path = path;
+    file.block_size = block_size;
+    files.push_back(file);
+    return static_cast<int>(files.size()) - 1;
+}
+
+// Called by the writer for every change. Consecutive writes usually hit the
+// same or the next page, so they are merged with the last range here; the
+// rest is coalesced by the flusher.
+void GroupSync::AddRange(int file, size_t offset, size_t size)
+{
+    size_t page_mask = static_cast<size_t>(RollableFile::page_size) - 1;
+    size_t start = offset & ~page_mask;
+    size_t end = (offset + size + page_mask) & ~page_mask;
+
+    bool notify;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<DirtyRange>& ranges = files[file].ranges;
+        if (!ranges.empty() && start <= ranges.back().end && end >= ranges.back().start) {
+            ranges.back().start = std::min(ranges.back().start, start);
+            ranges.back().end = std::max(ranges.back().end, end);
+        } else {
+            ranges.push_back({ start, end });
+        }
+        write_seq++;
+        notify = pending_bytes < max_bytes && pending_bytes + size >= max_bytes;
+        pending_bytes += size;
+    }
+    if (notify)
+        flush_cond.notify_one();
+}
+
+void GroupSync::BeginUpdate()
+{
+    update_gate.lock();
+}
+
+void GroupSync::EndUpdate()
+{
+    update_gate.unlock();
+}
+
+// Changes to the header are not recorded; every group syncs the header. A
+// mark makes sure that one more group is written back after the call.
+uint64_t GroupSync::Mark()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return ++write_seq;
+}
+
+uint64_t GroupSync::DurableSeq() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return durable_seq;
+}
+
+int GroupSync::Wait(uint64_t seq)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (seq > write_seq)
+        return MBError::INVALID_ARG;
+    durable_cond.wait(guard, [this, seq]() { return durable_seq >= seq; });
+    return sync_error;
+}
+
+void GroupSync::Run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        flush_cond.wait_for(guard, std::chrono::milliseconds(interval_ms),
+            [this]() { return stop || pending_bytes >= max_bytes; });
+        if (durable_seq == write_seq) {
+            if (stop)
+                break;
+            continue;
+        }
+
+        // Write back what is pending while the writer goes on.
+        std::vector<std::vector<DirtyRange>> ranges(files.size());
+        TakeRanges(ranges);
+        guard.unlock();
+        int rval = SyncRanges(ranges);
+
+        // The header only counts what is in the ranges taken with the writer
+        // held off; sync those and the header before letting it go.
+        int sync_rval;
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> gate(update_gate);
+            guard.lock();
+            ranges.assign(files.size(), std::vector<DirtyRange>());
+            TakeRanges(ranges);
+            seq = write_seq;
+            guard.unlock();
+            sync_rval = SyncRanges(ranges);
+            if (sync_rval == MBError::SUCCESS)
+                sync_rval = SyncHeader();
+        }
+        if (rval == MBError::SUCCESS)
+            rval = sync_rval;
+        guard.lock();
+
+        if (rval != MBError::SUCCESS && sync_error == MBError::SUCCESS)
+            sync_error = rval;
+        durable_seq = seq;
+        durable_cond.notify_all();
+    }
+}
+
+// Called with lock held
+void GroupSync::TakeRanges(std::vector<std::vector<DirtyRange>>& ranges)
+{
+    for (size_t i = 0; i < files.size(); i++)
+        ranges[i].swap(files[i].ranges);
+    pending_bytes = 0;
+}
+
+// Files are synced in the order they were added (data before index). Within a
+// file the coalesced ranges of all touched blocks are queued for write-back
+// first, then each block is synced once.
+int GroupSync::SyncRanges(std::vector<std::vector<DirtyRange>>& ranges)
+{
+    int rval = MBError::SUCCESS;
+    for (size_t i = 0; i < ranges.size(); i++) {
+        std::vector<DirtyRange>& file_ranges = ranges[i];
+        if (file_ranges.empty())
+            continue;
+        std::string path;
+        size_t block_size;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            path = files[i].path;
+            block_size = files[i].block_size;
+        }
+
+        std::sort(file_ranges.begin(), file_ranges.end(),
+            [](const DirtyRange& a, const DirtyRange& b) { return a.start < b.start; });
+        std::vector<int> fds;
+        int block_fd = -1;
+        size_t fd_block = SIZE_MAX;
+        size_t last_end = 0;
+        for (const DirtyRange& range : file_ranges) {
+            // Coalesce with the ranges already written back
+            size_t start = std::max(range.start, last_end);
+            last_end = std::max(last_end, range.end);
+            while (start < range.end) {
+                size_t block = start / block_size;
+                size_t end = std::min(range.end, (block + 1) * block_size);
+                if (block != fd_block) {
+                    fd_block = block;
+                    std::string block_path = path + std::to_string(block);
+                    block_fd = open(block_path.c_str(), O_RDWR);
+                    // A missing block was removed with its content.
+                    if (block_fd >= 0) {
+                        fds.push_back(block_fd);
+                    } else if (errno != ENOENT) {
+                        Logger::Log(LOG_LEVEL_ERROR, "failed to open %s for sync: errno %d",
+                            block_path.c_str(), errno);
+                        rval = MBError::WRITE_ERROR;
+                    }
+                }
+#ifdef __linux__
+                if (block_fd >= 0)
+                    sync_file_range(block_fd, start - block * block_size, end - start,
+                        SYNC_FILE_RANGE_WRITE);
+#endif
+                start = end;
+            }
+        }
+        for (int fd : fds) {
+            if (sync_fd(fd) != 0) {
+                Logger::Log(LOG_LEVEL_ERROR, "failed to sync %s: errno %d", path.c_str(), errno);
+                rval = MBError::WRITE_ERROR;
+            }
+            close(fd);
+        }
+    }
+    return rval;
+}
+
+int GroupSync::SyncHeader()
+{
+    int rval = MBError::SUCCESS;
+    int fd = open(header_path.c_str(), O_RDWR);
+    if (fd < 0 || sync_fd(fd) != 0) {
+        Logger::Log(LOG_LEVEL_ERROR, "failed to sync %s: errno %d", header_path.c_str(), errno);
+        rval = MBError::WRITE_ERROR;
+    }
+    if (fd >= 0)
+        close(fd);
+    return rval;
+}
+
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GROUP_SYNC_H__
+#define __GROUP_SYNC_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mabain {
+
+#define GROUP_SYNC_INTERVAL_MS_DEFAULT 10
+#define GROUP_SYNC_BYTES_DEFAULT (4 * 1024 * 1024)
+
+// Group commit for a writer opened with SYNC_GROUP_COMMIT. Instead of syncing
+// every write, the index and data files record the ranges the writer changes
+// (RollableFile::MarkDirty). A background thread takes the pending ranges
+// every interval_ms milliseconds, or as soon as max_bytes bytes are pending,
+// and writes them back in one group: data and index blocks first, then the
+// header. The header that counts an entry or moves m_index_offset is thus
+// never on disk before the buffers it points to, which is what
+// ExceptionRecovery relies on after a crash.
+//
+// The header is synced from the writer's mapping, so it must not move past
+// the ranges taken with it. The writer holds the update gate while it changes
+// buffers and the header counters pointing to them (BeginUpdate/EndUpdate),
+// and the flusher takes the last ranges of a group and syncs the header with
+// the gate held. Most ranges are written back before that, so the writer is
+// only held off for the tail of the group.
+//
+// Every recorded range advances the write sequence; a group is durable up to
+// the sequence taken with its ranges.
+class GroupSync {
+public:
+    GroupSync(const std::string& header_path, int interval_ms, size_t max_bytes);
+    ~GroupSync();
+
+    // Register a rollable file with blocks <path><N>; returns its file id
+    int AddFile(const std::string& path, size_t block_size);
+    void AddRange(int file, size_t offset, size_t size);
+    // Writer only; calls do not nest.
+    void BeginUpdate();
+    void EndUpdate();
+    // Sequence number covering all writes made so far
+    uint64_t Mark();
+    uint64_t DurableSeq() const;
+    // Block until the writes up to seq are on disk. Returns the first sync
+    // error seen, if any.
+    int Wait(uint64_t seq);
+
+private:
+    struct DirtyRange {
+        size_t start;
+        size_t end;
+    };
+    struct SyncFile {
+        std::string path;
+        size_t block_size;
+        std::vector<DirtyRange> ranges;
+    };
+
+    void Run();
+    void TakeRanges(std::vector<std::vector<DirtyRange>>& ranges);
+    int SyncRanges(std::vector<std::vector<DirtyRange>>& ranges);
+    int SyncHeader();
+
+    std::string header_path;
+    int interval_ms;
+    size_t max_bytes;
+
+    // Held by the writer during an update and by the flusher while it syncs
+    // the header; taken before lock.
+    std::mutex update_gate;
+    mutable std::mutex lock;
+    // Wakes the flusher when max_bytes are pending or on stop
+    std::condition_variable flush_cond;
+    // Wakes Wait when a group is durable
+    std::condition_variable durable_cond;
+    std::vector<SyncFile> files;
+    size_t pending_bytes;
+    uint64_t write_seq;
+    uint64_t durable_seq;
+    int sync_error;
+    bool stop;
+    std::thread flusher;
+};
+
+}
+
+#endif
@@ -29,7 +29,8 @@ static inline size_t floor_pow2_sz(size_t x)
 }
 
 // Fast 64-bit hash; uses XXH3 when available, otherwise FNV-1a.
-// Always avoids publishing 0 by substituting a fixed non-zero value.
+// Never returns EMPTY_HASH or TOMBSTONE_HASH; those are substituted by a
+// fixed value.
 uint64_t HashMap::fnv1a64(const uint8_t* data, int len)
 {
     uint64_t h = 0;
@@ -45,7 +46,7 @@ uint64_t HashMap::fnv1a64(const uint8_t* data, int len)
         h *= kPrime;
     }
 #endif
-    return h ? h : 0xA5A5A5A5A5A5A5A5ULL;
+    return h > TOMBSTONE_HASH ? h : 0xA5A5A5A5A5A5A5A5ULL;
 }
 
 HashMap::HashMap(const std::string& mbdir, size_t capacity, int options,
@@ -55,6 +56,7 @@ HashMap::HashMap(const std::string& mbdir, size_t capacity, int options,
     , file_(path_, /*block*/ (size_t)memcap_mb << 20, /*memcap*/ (size_t)memcap_mb << 20, options, /*max_block*/ 1)
     , hdr_(nullptr)
     , compact_(compact64)
+    , created_(false)
 {
     size_t cap = floor_pow2_sz(std::max<size_t>(capacity, 1024));
     if (cap < 1024)
@@ -72,11 +74,27 @@ HashMap::HashMap(const std::string& mbdir, size_t capacity, int options,
     }
     hdr_ = reinterpret_cast<HMHeader*>(p);
     bool need_init = (hdr_->magic != 0x484D4150U); // 'HMAP'
-    if (need_init || (options & CONSTS::ACCESS_MODE_WRITER)) {
-        initialize_header(cap, stripes, ik);
+    if (options & CONSTS::ACCESS_MODE_WRITER) {
+        size_t bsz = compact_ ? sizeof(BucketCompact) : sizeof(BucketFull);
+        bool valid = !need_init && hdr_->version == 1 && hdr_->capacity == cap
+            && hdr_->stripes == stripes && hdr_->inline_key == (compact_ ? 0 : ik)
+            && hdr_->bucket_size == bsz;
+        if (!valid) {
+            initialize_header(cap, stripes, ik);
+            created_ = true;
+        }
+    } else if (need_init) {
+        // Readers cannot initialize the map; the writer has to create it first.
+        throw (int)MBError::NOT_INITIALIZED;
     }
 }
 
+size_t HashMap::MemoryMB(size_t capacity)
+{
+    size_t bytes = sizeof(HMHeader) + capacity * sizeof(BucketFull);
+    return (bytes + (1ULL << 20) - 1) >> 20;
+}
+
 HashMap::~HashMap()
 {
     // RollableFile owns mappings and flush
@@ -154,7 +172,8 @@ bool HashMap::Get(const uint8_t* key, int len, size_t& ref_offset) const
     size_t idx = index_of(h);
     size_t cap = hdr_->capacity;
 
-    // Linear probe with stride=1; readers are lock-free.
+    // Linear probe with stride=1; readers are lock-free. Tombstones never
+    // match a key hash and are probed past.
     // For backward compatibility with older maps that used striped probing,
     // we do not stop on first empty unless stride==1 in header.
     uint32_t stride = 1;
@@ -221,15 +240,23 @@ int HashMap::Put(const uint8_t* key, int len, size_t ref_offset, bool overwrite)
     size_t cap = hdr_->capacity;
     uint32_t stride = 1;
     size_t first_free = (size_t)-1;
+    bool free_is_empty = false;
     bool is_compact = (hdr_->bucket_size == sizeof(BucketCompact));
     for (size_t probe = 0; probe < cap; ++probe) {
         size_t bi = (idx + probe * stride) & hdr_->mask;
         if (is_compact) {
             BucketCompact* b = bucket_compact_ptr(bi);
             uint64_t bh = b->hash.load(std::memory_order_relaxed);
-            if (bh == 0) {
+            if (bh == TOMBSTONE_HASH) {
                 if (first_free == (size_t)-1)
                     first_free = bi;
+                continue;
+            }
+            if (bh == EMPTY_HASH) {
+                if (first_free == (size_t)-1) {
+                    first_free = bi;
+                    free_is_empty = true;
+                }
                 break;
             }
             if (bh == h) {
@@ -242,9 +269,16 @@ int HashMap::Put(const uint8_t* key, int len, size_t ref_offset, bool overwrite)
         } else {
             BucketFull* b = bucket_full_ptr(bi);
             uint64_t bh = b->hash.load(std::memory_order_relaxed);
-            if (bh == 0) {
+            if (bh == TOMBSTONE_HASH) {
                 if (first_free == (size_t)-1)
                     first_free = bi;
+                continue;
+            }
+            if (bh == EMPTY_HASH) {
+                if (first_free == (size_t)-1) {
+                    first_free = bi;
+                    free_is_empty = true;
+                }
                 break;
             }
             if (bh == h) {
@@ -269,6 +303,9 @@ int HashMap::Put(const uint8_t* key, int len, size_t ref_offset, bool overwrite)
         // Table is full or heavily clustered; avoid O(cap) scans per insert.
         return MBError::NO_RESOURCE;
     }
+    // Keep 1/32 of the buckets empty so that probes for missing keys end.
+    if (free_is_empty && hdr_->used.load(std::memory_order_relaxed) >= cap - (cap >> 5))
+        return MBError::NO_RESOURCE;
     if (is_compact) {
         BucketCompact* b = bucket_compact_ptr(first_free);
         b->ref_offset = ref_offset;
@@ -284,7 +321,8 @@ int HashMap::Put(const uint8_t* key, int len, size_t ref_offset, bool overwrite)
         }
         b->hash.store(h, std::memory_order_release);
     }
-    hdr_->used.fetch_add(1, std::memory_order_relaxed);
+    if (free_is_empty)
+        hdr_->used.fetch_add(1, std::memory_order_relaxed);
     return MBError::SUCCESS;
 }
 
@@ -310,7 +348,7 @@ int HashMap::Erase(const uint8_t* key, int len)
                 continue;
             }
             if (bh == h) {
-                reinterpret_cast<std::atomic<uint64_t>&>(b->hash).store(0, std::memory_order_release);
+                reinterpret_cast<std::atomic<uint64_t>&>(b->hash).store(TOMBSTONE_HASH, std::memory_order_release);
                 return MBError::SUCCESS;
             }
         } else {
@@ -322,7 +360,7 @@ int HashMap::Erase(const uint8_t* key, int len)
                 continue;
             }
             if (bh == h) {
-                b->hash.store(0, std::memory_order_release);
+                b->hash.store(TOMBSTONE_HASH, std::memory_order_release);
                 return MBError::SUCCESS;
             }
         }
@@ -330,6 +368,62 @@ int HashMap::Erase(const uint8_t* key, int len)
     return MBError::NOT_EXIST;
 }
 
+void HashMap::Clear()
+{
+    if (!(options_ & CONSTS::ACCESS_MODE_WRITER))
+        return;
+    bool is_compact = (hdr_->bucket_size == sizeof(BucketCompact));
+    for (size_t i = 0; i < hdr_->capacity; ++i) {
+        if (is_compact)
+            bucket_compact_ptr(i)->hash.store(EMPTY_HASH, std::memory_order_relaxed);
+        else
+            bucket_full_ptr(i)->hash.store(EMPTY_HASH, std::memory_order_relaxed);
+    }
+    hdr_->used.store(0, std::memory_order_release);
+}
+
+void HashMap::ListRefs(std::vector<std::pair<size_t, size_t>>& refs) const
+{
+    bool is_compact = (hdr_->bucket_size == sizeof(BucketCompact));
+    for (size_t i = 0; i < hdr_->capacity; ++i) {
+        uint64_t bh;
+        size_t ref;
+        if (is_compact) {
+            BucketCompact* b = bucket_compact_ptr(i);
+            bh = b->hash.load(std::memory_order_relaxed);
+            ref = b->ref_offset;
+        } else {
+            BucketFull* b = bucket_full_ptr(i);
+            bh = b->hash.load(std::memory_order_relaxed);
+            ref = b->ref_offset;
+        }
+        if (bh != EMPTY_HASH && bh != TOMBSTONE_HASH)
+            refs.emplace_back(ref, i);
+    }
+}
+
+void HashMap::UpdateRef(size_t bucket, size_t old_ref, size_t new_ref)
+{
+    if (!(options_ & CONSTS::ACCESS_MODE_WRITER) || bucket >= hdr_->capacity)
+        return;
+    // Same publish order as Put: body first, then the hash again.
+    if (hdr_->bucket_size == sizeof(BucketCompact)) {
+        BucketCompact* b = bucket_compact_ptr(bucket);
+        uint64_t bh = b->hash.load(std::memory_order_relaxed);
+        if (bh == EMPTY_HASH || bh == TOMBSTONE_HASH || b->ref_offset != old_ref)
+            return;
+        b->ref_offset = new_ref;
+        b->hash.store(bh, std::memory_order_release);
+    } else {
+        BucketFull* b = bucket_full_ptr(bucket);
+        uint64_t bh = b->hash.load(std::memory_order_relaxed);
+        if (bh == EMPTY_HASH || bh == TOMBSTONE_HASH || b->ref_offset != old_ref)
+            return;
+        b->ref_offset = new_ref;
+        b->hash.store(bh, std::memory_order_release);
+    }
+}
+
 void HashMap::PrintStats(std::ostream& os) const
 {
     os << "HashMap stats:\n"
@@ -10,6 +10,8 @@
 #include <cstdint>
 #include <ostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "mabain_consts.h"
 #include "rollable_file.h"
@@ -23,17 +25,37 @@ public:
     // options: reader/writer flags from CONSTS.
     // num_stripes: deprecated; ignored (lock-free; single-writer assumed).
     // inline_key: bytes of key to inline for quick equality screening (0..32 reasonable).
+    // A writer keeps the entries of an existing map with the same layout and
+    // capacity and zeroes it otherwise.
     HashMap(const std::string& mbdir, size_t capacity, int options,
         uint32_t num_stripes = 64, uint32_t inline_key = 16, size_t memcap_mb = 32,
         bool compact64 = false);
     ~HashMap();
 
     // Insert or update an entry. overwrite=true replaces existing ref_offset on match.
+    // Returns NO_RESOURCE once new keys would push the table past its load limit.
     int Put(const uint8_t* key, int len, size_t ref_offset, bool overwrite = true);
     // Lookup; returns true on hit and sets ref_offset.
     bool Get(const uint8_t* key, int len, size_t& ref_offset) const;
     // Remove an entry by key. Returns 0 on success, NOT_FOUND if missing.
+    // The bucket becomes a tombstone so that later probes still reach
+    // entries placed behind it.
     int Erase(const uint8_t* key, int len);
+    // Drop all entries (writer only).
+    void Clear();
+    // Writer only: appends (ref_offset, bucket) for every entry, so that the
+    // owner of the referenced buffers can follow them when they move.
+    void ListRefs(std::vector<std::pair<size_t, size_t>>& refs) const;
+    // Writer only: points the entry in bucket at new_ref if it still holds
+    // old_ref.
+    void UpdateRef(size_t bucket, size_t old_ref, size_t new_ref);
+
+    size_t Capacity() const { return hdr_->capacity; }
+    // True if the writer zeroed the map when opening it.
+    bool Created() const { return created_; }
+    // Size in MB of a full-bucket map with the given capacity; readers must
+    // open the map with the same memcap_mb as the writer.
+    static size_t MemoryMB(size_t capacity);
 
     void PrintStats(std::ostream& os) const;
     void Flush() const;
@@ -49,7 +71,7 @@ private:
         uint32_t inline_key; // bytes of inline key comparison
         uint32_t bucket_size; // sizeof(Bucket)
         uint32_t reserved;
-        std::atomic<uint64_t> used;
+        std::atomic<uint64_t> used; // non-empty buckets, tombstones included
         size_t stripes_off; // deprecated; 0
         size_t buckets_off; // offset to first Bucket
     };
@@ -68,6 +90,10 @@ private:
         size_t ref_offset;
     };
 
+    // Bucket hash values with special meaning; fnv1a64 never returns them.
+    static const uint64_t EMPTY_HASH = 0;
+    static const uint64_t TOMBSTONE_HASH = 1;
+
     // Hash helpers
     static uint64_t fnv1a64(const uint8_t* data, int len);
 
@@ -88,6 +114,7 @@ private:
     mutable RollableFile file_;
     HMHeader* hdr_;
     bool compact_;
+    bool created_;
 };
 
 } // namespace mabain
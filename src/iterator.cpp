@@ -17,6 +17,7 @@
 // @author Changxue Deng <chadeng@cisco.com>
 
 #include "db.h"
+#include "detail/range_scanner.h"
 #include "detail/search_engine.h"
 #include "dict.h"
 #include "integer_4b_5b.h"
@@ -456,4 +457,81 @@ void DB::iterator::add_node_offset(size_t node_offset)
         throw rval;
 }
 
+/////////////////////////////////////////////////////////////////////
+// DB cursor
+// Example to read the newest entries of time-prefixed keys first
+// DB::Cursor cursor(db, true);
+// for (int rval = cursor.Seek(prefix_end); rval == MBError::SUCCESS; rval = cursor.Next()) {
+//     std::cout << cursor.key() << "\n";
+// }
+/////////////////////////////////////////////////////////////////////
+
+DB::Cursor::Cursor(const DB& db, bool reverse)
+    : db_ref(db)
+    , last_rval(MBError::NOT_EXIST)
+{
+    if (db.status == MBError::SUCCESS)
+        scanner.reset(new detail::RangeScanner(*db.dict, reverse));
+}
+
+DB::Cursor::~Cursor()
+{
+}
+
+int DB::Cursor::SeekToFirst()
+{
+    return Move(true, NULL, 0);
+}
+
+int DB::Cursor::Seek(const char* key, int len)
+{
+    if (key == NULL || len <= 0)
+        return MBError::INVALID_ARG;
+    return Move(true, reinterpret_cast<const uint8_t*>(key), len);
+}
+
+int DB::Cursor::Seek(const std::string& key)
+{
+    return Seek(key.data(), key.size());
+}
+
+// A move that gave up with TRY_AGAIN can be retried with Next.
+int DB::Cursor::Next()
+{
+    if (last_rval != MBError::SUCCESS && last_rval != MBError::TRY_AGAIN)
+        return MBError::NOT_EXIST;
+    return Move(false, NULL, 0);
+}
+
+int DB::Cursor::Move(bool seek, const uint8_t* key, int len)
+{
+    if (scanner == nullptr)
+        return MBError::NOT_INITIALIZED;
+    if (db_ref.options & CONSTS::ASYNC_WRITER_MODE)
+        return MBError::NOT_ALLOWED;
+
+    uint64_t reader_epoch = db_ref.BeginReaderEpochGuard();
+    if (seek)
+        scanner->seek(key, len, true);
+    int rval = scanner->next();
+    db_ref.EndReaderEpochGuard(reader_epoch);
+    last_rval = rval;
+    return rval;
+}
+
+bool DB::Cursor::Valid() const
+{
+    return last_rval == MBError::SUCCESS;
+}
+
+const std::string& DB::Cursor::key() const
+{
+    return scanner->key();
+}
+
+const MBData& DB::Cursor::value() const
+{
+    return scanner->value();
+}
+
 }
@@ -90,6 +90,7 @@ int LockFree::ReaderLockFreeStop(const LockFreeData& snapshot, size_t reader_off
         case EXCEP_STATUS_RC_NODE:
         case EXCEP_STATUS_RC_EDGE_STR:
         case EXCEP_STATUS_RC_DATA:
+        case EXCEP_STATUS_OVERWRITE_DATA:
             memcpy(mbdata.edge_ptrs.edge_buff, header->excep_buff, EDGE_SIZE);
             mbdata.edge_ptrs.offset = curr_offset;
             break;
@@ -133,4 +134,64 @@ int LockFree::ReaderLockFreeStop(const LockFreeData& snapshot, size_t reader_off
     return MBError::SUCCESS;
 }
 
+//////////////////////////////////////////////////
+// DO NOT CHANGE THE LOAD ORDER IN THIS FUNCTION.
+//////////////////////////////////////////////////
+bool LockFree::ReaderLockFreeUnchanged(const LockFreeData& snapshot, const size_t* offsets,
+    int num_offsets) const
+{
+    size_t curr_offset = shm_data_ptr->offset.load(MEMORY_ORDER_READER);
+    uint32_t curr_counter = shm_data_ptr->counter.load(MEMORY_ORDER_READER);
+
+    for (int i = 0; i < num_offsets; i++) {
+        if (offsets[i] == curr_offset)
+            return false;
+    }
+
+    uint32_t count_diff = curr_counter - snapshot.counter;
+    if (count_diff == 0)
+        return true;
+    if (count_diff >= MAX_OFFSET_CACHE)
+        return false;
+
+    for (unsigned i = 0; i < count_diff; i++) {
+        size_t modified = shm_data_ptr->offset_cache[(snapshot.counter + i) % MAX_OFFSET_CACHE].load(MEMORY_ORDER_READER);
+        for (int j = 0; j < num_offsets; j++) {
+            if (offsets[j] == modified)
+                return false;
+        }
+    }
+
+    count_diff = shm_data_ptr->counter.load(MEMORY_ORDER_READER) - snapshot.counter;
+    return count_diff < MAX_OFFSET_CACHE;
+}
+
+//////////////////////////////////////////////////
+// DO NOT CHANGE THE LOAD ORDER IN THIS FUNCTION.
+//////////////////////////////////////////////////
+bool LockFree::ReaderLockFreeModified(const LockFreeData& snapshot,
+    size_t offsets[MAX_OFFSET_CACHE + 1], int& num_offsets, LockFreeData& current) const
+{
+    size_t curr_offset = shm_data_ptr->offset.load(MEMORY_ORDER_READER);
+    uint32_t curr_counter = shm_data_ptr->counter.load(MEMORY_ORDER_READER);
+
+    // The modification in progress, if any, is cached at curr_counter.
+    current.counter = curr_counter;
+    num_offsets = 0;
+    if (curr_offset != MAX_6B_OFFSET)
+        offsets[num_offsets++] = curr_offset;
+
+    uint32_t count_diff = curr_counter - snapshot.counter;
+    if (count_diff == 0)
+        return true;
+    if (count_diff >= MAX_OFFSET_CACHE)
+        return false;
+
+    for (unsigned i = 0; i < count_diff; i++)
+        offsets[num_offsets++] = shm_data_ptr->offset_cache[(snapshot.counter + i) % MAX_OFFSET_CACHE].load(MEMORY_ORDER_READER);
+
+    count_diff = shm_data_ptr->counter.load(MEMORY_ORDER_READER) - snapshot.counter;
+    return count_diff < MAX_OFFSET_CACHE;
+}
+
 }
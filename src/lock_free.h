@@ -59,6 +59,16 @@ public:
     // If there was race condition, this function returns MBError::TRY_AGAIN.
     int ReaderLockFreeStop(const LockFreeData& snapshot, size_t reader_offset,
         MBData& mbdata);
+    // Side-effect free check for offsets cached across lookups. Returns true
+    // if the writer has not modified, and is not modifying, any of offsets
+    // since snapshot.
+    bool ReaderLockFreeUnchanged(const LockFreeData& snapshot, const size_t* offsets,
+        int num_offsets) const;
+    // Collect the offsets the writer has modified, or is modifying, since
+    // snapshot. Returns false if they can no longer be determined. On success
+    // current is set to a snapshot that later calls can start from.
+    bool ReaderLockFreeModified(const LockFreeData& snapshot,
+        size_t offsets[MAX_OFFSET_CACHE + 1], int& num_offsets, LockFreeData& current) const;
 
 private:
     LockFreeShmData* shm_data_ptr;
@@ -27,6 +27,7 @@ const int CONSTS::SYNC_ON_WRITE = 0x4;
 const int CONSTS::USE_SLIDING_WINDOW = 0x8;
 const int CONSTS::MEMORY_ONLY_MODE = 0x10;
 const int CONSTS::READ_ONLY_DB = 0x20;
+const int CONSTS::SYNC_GROUP_COMMIT = 0x10000;
 
 const int CONSTS::OPTION_FIND_AND_STORE_PARENT = 0x2;
 const int CONSTS::OPTION_RC_MODE = 0x4;
@@ -36,9 +37,19 @@ const int CONSTS::OPTION_SHMQ_RETRY = 0x20;
 const int CONSTS::OPTION_JEMALLOC = 0x40;
 const int CONSTS::OPTION_KEY_ONLY = 0x80;
 const int CONSTS::OPTION_PREFIX_CACHE = 0x100;
+const int CONSTS::OPTION_DATA_VIEW = 0x200;
+const int CONSTS::OPTION_HASH_INDEX = 0x400;
+const int CONSTS::OPTION_SUBTREE_COUNT = 0x800;
+const int CONSTS::OPTION_DENSE_NODE_INDEX = 0x1000;
+const int CONSTS::OPTION_BLOOM_FILTER = 0x2000;
+const int CONSTS::OPTION_READ_RANGE = 0x4000;
+const int CONSTS::OPTION_OVERWRITE_IN_PLACE = 0x8000;
+const int CONSTS::OPTION_ASYNC_HANDOFF = 0x20000;
 
 const int CONSTS::MAX_KEY_LENGHTH = 256;
 const int CONSTS::MAX_DATA_SIZE = 0x7FFF;
+// An extent list holds a 8-byte value length and 6-byte extent offsets.
+const int CONSTS::MAX_LARGE_DATA_SIZE = (0x7FFF - 8) / 6 * 0x7FFF;
 
 // Limit how many times readers retry when lock-free snapshot reports TRY_AGAIN
 const int CONSTS::LOCK_FREE_RETRY_LIMIT = 1000;
@@ -27,6 +27,7 @@ public:
     static const int ACCESS_MODE_WRITER;
     static const int ASYNC_WRITER_MODE;
     static const int SYNC_ON_WRITE;
+    static const int SYNC_GROUP_COMMIT; // Writer syncs changes in groups in the background
     static const int USE_SLIDING_WINDOW;
     static const int MEMORY_ONLY_MODE;
     static const int READ_ONLY_DB;
@@ -38,9 +39,18 @@ public:
     static const int OPTION_KEY_ONLY; // Skip value read in bound lookups
     static const int MAX_KEY_LENGHTH;
     static const int MAX_DATA_SIZE;
+    static const int MAX_LARGE_DATA_SIZE; // Values above MAX_DATA_SIZE are stored in extents
     static const int OPTION_SHMQ_RETRY;
     static const int OPTION_JEMALLOC;
     static const int OPTION_PREFIX_CACHE; // Enable embedded prefix cache at DB creation
+    static const int OPTION_DATA_VIEW; // Used internally only; locate value without copying
+    static const int OPTION_HASH_INDEX; // Maintain/use the exact-match hash index for Find
+    static const int OPTION_SUBTREE_COUNT; // Keep per-node subtree entry counts (set at DB creation)
+    static const int OPTION_DENSE_NODE_INDEX; // Writer builds first-char indexes for dense nodes
+    static const int OPTION_BLOOM_FILTER; // Maintain/use the negative-lookup Bloom filter for Find
+    static const int OPTION_READ_RANGE; // Used internally only; read part of the value
+    static const int OPTION_OVERWRITE_IN_PLACE; // Writer rewrites values that fit their buffer
+    static const int OPTION_ASYNC_HANDOFF; // Hand string AddAsync/RemoveAsync to the writer thread in its process
 
     // Max retries for lock-free reader retry loops before returning TRY_AGAIN
     static const int LOCK_FREE_RETRY_LIMIT;
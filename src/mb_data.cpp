@@ -18,6 +18,7 @@
 
 #include <string.h>
 
+#include "db.h"
 #include "error.h"
 #include "mb_data.h"
 
@@ -30,6 +31,7 @@ MBData::MBData()
     buff = NULL;
 
     match_len = 0;
+    range_offset = 0;
     options = 0;
     free_buffer = false;
 }
@@ -50,6 +52,7 @@ MBData::MBData(int size, int match_options)
 
     data_len = 0;
     match_len = 0;
+    range_offset = 0;
     options = match_options;
 }
 
@@ -129,4 +132,83 @@ int MBData::Resize(int size)
     return MBError::SUCCESS;
 }
 
+MBDataView::MBDataView()
+    : data(NULL)
+    , data_len(0)
+    , data_offset(0)
+    , bucket_index(0)
+    , db(NULL)
+    , pin(0)
+    , seq(0)
+    , copy(NULL)
+{
+}
+
+MBDataView::~MBDataView()
+{
+    Release();
+    delete copy;
+}
+
+MBDataView::MBDataView(MBDataView&& view)
+    : data(view.data)
+    , data_len(view.data_len)
+    , data_offset(view.data_offset)
+    , bucket_index(view.bucket_index)
+    , db(view.db)
+    , pin(view.pin)
+    , seq(view.seq)
+    , copy(view.copy)
+{
+    view.data = NULL;
+    view.data_len = 0;
+    view.pin = 0;
+    view.copy = NULL;
+}
+
+MBDataView& MBDataView::operator=(MBDataView&& view)
+{
+    if (this == &view)
+        return *this;
+
+    Release();
+    delete copy;
+    data = view.data;
+    data_len = view.data_len;
+    data_offset = view.data_offset;
+    bucket_index = view.bucket_index;
+    db = view.db;
+    pin = view.pin;
+    seq = view.seq;
+    copy = view.copy;
+    view.data = NULL;
+    view.data_len = 0;
+    view.pin = 0;
+    view.copy = NULL;
+    return *this;
+}
+
+void MBDataView::Release()
+{
+    if (pin != 0 && db != NULL)
+        db->EndReaderEpochGuard(pin);
+    pin = 0;
+    data = NULL;
+    data_len = 0;
+}
+
+bool MBDataView::IsPinned() const
+{
+    return pin != 0;
+}
+
+bool MBDataView::Valid() const
+{
+    if (data == NULL)
+        return false;
+    if (pin == 0 || db == NULL)
+        return true;
+    return db->LoadValueSeq() == seq;
+}
+
 }
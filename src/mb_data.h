@@ -94,6 +94,9 @@ public:
 
     // match length so far; only populated when match is found.
     int match_len;
+    // Start of the value range read with OPTION_READ_RANGE; at most buff_len
+    // bytes are read into buff.
+    int64_t range_offset;
     struct _EdgePtrs edge_ptrs;
     // temp buffer to hold the node
     uint8_t node_buff[NUM_ALPHABET + NODE_EDGE_KEY_FIRST];
@@ -102,6 +105,51 @@ private:
     bool free_buffer;
 };
 
+class DB;
+
+// Read-only value view returned by DB::FindView.
+// When the value lies in a mapped data block, data points straight into the
+// shared memory region and the view holds a reader epoch slot so that resource
+// collection does not relocate the value until the view is released. Values
+// that are not mapped (outside memcap or sliding window) are copied into a
+// buffer owned by the view. Removing or overwriting the key keeps the bytes
+// the view points at, as the writer only reuses a buffer once no view pinned
+// before its release remains. A view pinned for longer than
+// MBConfig::view_rc_max_wait seconds no longer holds off data rc, and RemoveAll
+// drops every value; Valid() returns false after either, in which case the
+// bytes read may be torn and the key has to be looked up again.
+class MBDataView {
+public:
+    MBDataView();
+    ~MBDataView();
+    MBDataView(MBDataView&& view);
+    MBDataView& operator=(MBDataView&& view);
+    MBDataView(const MBDataView&) = delete;
+    MBDataView& operator=(const MBDataView&) = delete;
+
+    // Drop the pinned slot; data is no longer valid after this call.
+    void Release();
+    // True if data points into the mapped data region.
+    bool IsPinned() const;
+    // True if the writer has not changed any value since the lookup, so the
+    // data read so far is intact. Copied views are always valid.
+    bool Valid() const;
+
+    const uint8_t* data;
+    int data_len;
+    size_t data_offset;
+    uint16_t bucket_index;
+
+private:
+    friend class DB;
+
+    const DB* db;
+    uint64_t pin;
+    uint64_t seq;
+    // fallback buffer for values that are not mapped
+    MBData* copy;
+};
+
 }
 
 #endif
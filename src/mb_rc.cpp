@@ -21,9 +21,11 @@
 #include <csignal>
 #include <cstdlib>
 #include <fstream>
+#include <limits>
 #include <sstream>
 #include <sys/time.h>
 
+#include "detail/search_engine.h"
 #include "dict.h"
 #include "dict_mem.h"
 #include "integer_4b_5b.h"
@@ -191,6 +193,10 @@ void ResourceCollection::ReclaimResource(int64_t min_index_size,
         }
     }
 
+    // Dense nodes written before the writer enabled their index are copied
+    // to indexed nodes; the old copies are reclaimed by the pass below.
+    IndexDenseNodes();
+
     if (min_index_size > 0 || min_data_size > 0) {
         Prepare(min_index_size, min_data_size);
         Logger::Log(LOG_LEVEL_INFO, "defragmentation started for [index - %s] [data - %s]",
@@ -198,9 +204,31 @@ void ResourceCollection::ReclaimResource(int64_t min_index_size,
             rc_type & RESOURCE_COLLECTION_TYPE_DATA ? " yes" : "no");
         gettimeofday(&start, NULL);
 
+        // Hash index lookups stay disabled while rc runs; index-only rc does
+        // not move data buffers and keeps the index. Data buffers are relocated
+        // without their keys; every move also updates the index entry that
+        // points at the buffer. If rc throws, the index stays stale until the
+        // writer reopens the DB and rebuilds it. Nodes move with their subtree
+        // counts, but count queries cannot follow the moves; they wait until
+        // rc is done.
+        bool move_hash_index = (rc_type & RESOURCE_COLLECTION_TYPE_DATA)
+            && dict->HashIndexEnabled() && !dict->HashIndexStale();
+        if (move_hash_index)
+            dict->BeginHashIndexMoves();
+        if (rc_type & RESOURCE_COLLECTION_TYPE_DATA)
+            dict->MarkHashIndexStale();
+        dict->BeginHashIndexUpdate();
+        dict->BeginSubtreeCountUpdate();
         ReorderBuffers();
         CollectBuffers();
         Finish();
+        dict->EndHashIndexMoves();
+        if (move_hash_index)
+            dict->PublishHashIndex();
+        if (dict->HashIndexStale())
+            RebuildHashIndex();
+        dict->EndSubtreeCountUpdate();
+        dict->EndHashIndexUpdate();
 
         gettimeofday(&stop, NULL);
         async_writer_ptr = NULL;
@@ -213,6 +241,12 @@ void ResourceCollection::ReclaimResource(int64_t min_index_size,
                 timediff / 1000.);
         }
     }
+
+    // Bloom filters cannot delete; removed and evicted keys are dropped by
+    // refilling the filter from the tree, once there are enough of them to
+    // be worth a pass over the DB.
+    if (dict->BloomFilterEnabled() && (dict->BloomFilterWorn() || dict->BloomFilterStale()))
+        RebuildBloomFilter();
 }
 
 int ResourceCollection::StartupShrink()
@@ -259,6 +293,8 @@ int ResourceCollection::StartupShrink()
     header->m_data_offset = data_tail;
     header->rc_m_index_off_pre = index_tail;
     header->rc_m_data_off_pre = data_tail;
+    header->BumpIndexFreeSeq();
+    dict->DropRetiredBuffers();
 
     rc_type = RESOURCE_COLLECTION_TYPE_INDEX | RESOURCE_COLLECTION_TYPE_DATA;
     if (index_free_lists != NULL)
@@ -324,6 +360,8 @@ int ResourceCollection::StartupEvacuate()
     const size_t data_source_start = AlignUpToBlock(data_boundary, header->data_block_size);
     if (index_source_start < index_boundary || data_source_start < data_boundary)
         return MBError::INVALID_SIZE;
+    // Data buffers move without their keys.
+    dict->MarkHashIndexStale();
 
     int rval = MBError::SUCCESS;
     if (startup_rebuild_.rebuild_state == REBUILD_STATE_COPY) {
@@ -653,6 +691,41 @@ void ResourceCollection::Prepare(int64_t min_index_size, int64_t min_data_size)
         rc_type &= ~RESOURCE_COLLECTION_TYPE_DATA;
     }
 
+    // Values pinned by DB::FindView must not be relocated. Publish the data rc
+    // start before checking the reader slots; new views see it and copy instead.
+    // Views pinned for longer than view_rc_max_wait seconds do not hold data
+    // rc off; they see value_seq move and are no longer valid.
+    if (rc_type & RESOURCE_COLLECTION_TYPE_DATA) {
+        MBConfig config;
+        db_ref.GetDBConfig(config);
+        const int max_wait = config.view_rc_max_wait != 0
+            ? static_cast<int>(config.view_rc_max_wait)
+            : MB_VIEW_RC_MAX_WAIT;
+        header->rc_m_data_off_pre = header->m_data_offset;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!IsReaderEpochQuiesced(std::numeric_limits<uint64_t>::max())) {
+            int64_t now = static_cast<int64_t>(time(NULL));
+            if (header->view_rc_wait_since == 0)
+                header->view_rc_wait_since = now;
+            if (now - header->view_rc_wait_since < max_wait) {
+                Logger::Log(LOG_LEVEL_INFO, "data defragmentation skipped since value views are pinned");
+                header->rc_m_data_off_pre = 0;
+                rc_type &= ~RESOURCE_COLLECTION_TYPE_DATA;
+            } else {
+                Logger::Log(LOG_LEVEL_WARN, "data defragmentation invalidates value views pinned "
+                                            "for more than %d seconds",
+                    max_wait);
+            }
+        }
+        if (rc_type & RESOURCE_COLLECTION_TYPE_DATA) {
+            header->view_rc_wait_since = 0;
+            // Buffers kept for views are not referenced; rc reclaims them.
+            dict->DropRetiredBuffers();
+            dict->BeginValueUpdate();
+            dict->EndValueUpdate();
+        }
+    }
+
     // minimum defragmentation throshold is not reached, skip grabage collection
     if (rc_type == 0) {
         Logger::Log(LOG_LEVEL_DEBUG, "pending_index_buff_size (%llu) min_index_size (%llu)",
@@ -680,6 +753,7 @@ void ResourceCollection::Prepare(int64_t min_index_size, int64_t min_data_size)
     data_reorder_status = MBError::NOT_INITIALIZED;
     header->rc_m_index_off_pre = header->m_index_offset;
     header->rc_m_data_off_pre = header->m_data_offset;
+    header->BumpIndexFreeSeq();
 
     if (async_writer_ptr) {
         // set rc root to at the end of max size
@@ -757,6 +831,7 @@ void ResourceCollection::Finish()
 
     header->rc_m_index_off_pre = 0;
     header->rc_m_data_off_pre = 0;
+    header->BumpIndexFreeSeq();
 
     // TODO the temp file cannot be removed here. It could cause some
     // rare race conditons.
@@ -837,6 +912,48 @@ bool ResourceCollection::MoveDataBuffer(int phase, size_t& offset_src, int size)
     return true;
 }
 
+// The extents of a large value are moved right before its extent list, so
+// that they take their place in the compacted data in the same order in every
+// phase. The list is updated in place; it is copied afterwards if it moves.
+void ResourceCollection::MoveExtents(int phase, const DBTraverseNode& dbt_node)
+{
+    uint16_t data_len;
+    if (dict->ReadData(reinterpret_cast<uint8_t*>(&data_len), DATA_SIZE_BYTE, dbt_node.data_offset)
+        != DATA_SIZE_BYTE)
+        throw (int)MBError::READ_ERROR;
+    if (!(data_len & DATA_EXTENT_FLAG))
+        return;
+
+    int num_extents = ((data_len & ~DATA_EXTENT_FLAG) - sizeof(uint64_t)) / OFFSET_SIZE;
+    size_t extent_link = dbt_node.data_offset + DATA_HDR_BYTE + sizeof(uint64_t);
+    for (int i = 0; i < num_extents; i++, extent_link += OFFSET_SIZE) {
+        uint8_t extent_ptr[OFFSET_SIZE];
+        if (dict->ReadData(extent_ptr, OFFSET_SIZE, extent_link) != OFFSET_SIZE)
+            throw (int)MBError::READ_ERROR;
+        size_t extent_off = Get6BInteger(extent_ptr);
+        uint16_t extent_len;
+        if (dict->ReadData(reinterpret_cast<uint8_t*>(&extent_len), DATA_SIZE_BYTE, extent_off)
+            != DATA_SIZE_BYTE)
+            throw (int)MBError::READ_ERROR;
+        int extent_size = DataBufferSize(extent_len);
+
+        bool moved;
+        if (phase == RESOURCE_COLLECTION_PHASE_EVACUATE_DATA) {
+            moved = MoveDataBufferEvacuate(extent_off, extent_size);
+        } else {
+            moved = MoveDataBuffer(phase, extent_off, extent_size);
+            data_size += extent_size;
+        }
+        if (moved) {
+            Write6BInteger(header->excep_buff, extent_off);
+            header->excep_offset = extent_link;
+            header->excep_updating_status = EXCEP_STATUS_RC_EXTENT;
+            dict->WriteData(header->excep_buff, OFFSET_SIZE, extent_link);
+            header->excep_updating_status = 0;
+        }
+    }
+}
+
 void ResourceCollection::DoTask(int phase, DBTraverseNode& dbt_node)
 {
     if (phase == RESOURCE_COLLECTION_PHASE_EVACUATE_INDEX) {
@@ -880,6 +997,7 @@ void ResourceCollection::DoTask(int phase, DBTraverseNode& dbt_node)
     if (phase == RESOURCE_COLLECTION_PHASE_EVACUATE_DATA) {
         header->excep_lf_offset = dbt_node.edge_offset;
         if (dbt_node.buffer_type & BUFFER_TYPE_DATA) {
+            MoveExtents(phase, dbt_node);
             if (MoveDataBufferEvacuate(dbt_node.data_offset, dbt_node.data_size)) {
                 Write6BInteger(header->excep_buff, dbt_node.data_offset);
 #ifdef __LOCK_FREE__
@@ -949,6 +1067,8 @@ void ResourceCollection::DoTask(int phase, DBTraverseNode& dbt_node)
 
     if (rc_type & RESOURCE_COLLECTION_TYPE_DATA) {
         if (dbt_node.buffer_type & BUFFER_TYPE_DATA) {
+            MoveExtents(phase, dbt_node);
+            size_t old_data_offset = dbt_node.data_offset;
             if (MoveDataBuffer(phase, dbt_node.data_offset, dbt_node.data_size)) {
                 Write6BInteger(header->excep_buff, dbt_node.data_offset);
 #ifdef __LOCK_FREE__
@@ -962,6 +1082,7 @@ void ResourceCollection::DoTask(int phase, DBTraverseNode& dbt_node)
 #ifdef __LOCK_FREE__
                 lfree->WriterLockFreeStop();
 #endif
+                dict->MoveHashIndexEntry(old_data_offset, dbt_node.data_offset);
             }
             data_size += dbt_node.data_size;
         }
@@ -1008,10 +1129,93 @@ void ResourceCollection::ReorderBuffers()
         Logger::Log(LOG_LEVEL_INFO, "adjusting db count to %lld from %lld", db_cnt, header->count);
         header->count = db_cnt;
     }
+    if (dmm->SubtreeCountEnabled()) {
+        int64_t root_count;
+        if (dmm->ReadSubtreeCount(dmm->GetRootOffset(), root_count) != MBError::SUCCESS
+            || root_count != db_cnt) {
+            RebuildSubtreeCounts();
+        }
+    }
     header->edge_str_size = edge_str_size;
     header->n_states = node_cnt;
 }
 
+void ResourceCollection::RebuildHashIndex()
+{
+    if (!dict->HashIndexEnabled())
+        return;
+
+    dict->BeginHashIndexUpdate();
+    dict->ClearHashIndex();
+    // The iterator does not expose data offsets; look each key up in the tree.
+    detail::SearchEngine engine(*dict);
+    MBData mbd(0, CONSTS::OPTION_DATA_VIEW);
+    int64_t count = 0;
+    DB db_itr(db_ref);
+    for (DB::iterator iter = db_itr.begin(false); iter != db_itr.end(); ++iter) {
+        mbd.options = CONSTS::OPTION_DATA_VIEW;
+        if (engine.find((const uint8_t*)iter.key.data(), iter.key.size(), mbd) != MBError::SUCCESS)
+            continue;
+        dict->PutHashIndex((const uint8_t*)iter.key.data(), iter.key.size(), mbd.data_offset);
+        count++;
+    }
+    dict->PublishHashIndex();
+    dict->EndHashIndexUpdate();
+    Logger::Log(LOG_LEVEL_INFO, "hash index rebuilt with %lld entries", count);
+}
+
+void ResourceCollection::RebuildBloomFilter()
+{
+    if (!dict->BloomFilterEnabled())
+        return;
+
+    dict->BeginBloomFilterUpdate();
+    dict->ClearBloomFilter();
+    int64_t count = 0;
+    DB db_itr(db_ref);
+    for (DB::iterator iter = db_itr.begin(false); iter != db_itr.end(); ++iter) {
+        dict->AddBloomFilter((const uint8_t*)iter.key.data(), iter.key.size());
+        count++;
+    }
+    dict->PublishBloomFilter();
+    dict->EndBloomFilterUpdate();
+    Logger::Log(LOG_LEVEL_INFO, "bloom filter rebuilt with %lld entries", count);
+}
+
+void ResourceCollection::RebuildSubtreeCounts()
+{
+    if (!dmm->SubtreeCountEnabled())
+        return;
+
+    dict->BeginSubtreeCountUpdate();
+    int64_t count = 0;
+    int rval = dmm->RebuildSubtreeCounts(count);
+    dict->EndSubtreeCountUpdate();
+    if (rval != MBError::SUCCESS) {
+        Logger::Log(LOG_LEVEL_ERROR, "failed to rebuild subtree counts: %s", MBError::get_error_str(rval));
+        return;
+    }
+    Logger::Log(LOG_LEVEL_INFO, "subtree counts rebuilt with %lld entries", count);
+}
+
+void ResourceCollection::IndexDenseNodes()
+{
+    if (!dmm->DenseNodeIndexEnabled())
+        return;
+
+    // Converted nodes move like nodes rewritten by Add.
+    dict->BeginSubtreeCountUpdate();
+    int64_t converted = 0;
+    int rval = dmm->IndexDenseNodes(converted);
+    dict->EndSubtreeCountUpdate();
+    if (rval != MBError::SUCCESS) {
+        Logger::Log(LOG_LEVEL_ERROR, "failed to index dense nodes: %s", MBError::get_error_str(rval));
+        return;
+    }
+    if (converted > 0)
+        Logger::Log(LOG_LEVEL_INFO, "dense node index added to %lld nodes", converted);
+}
+
 void ResourceCollection::ProcessRCTree()
 {
     Logger::Log(LOG_LEVEL_INFO, "resource collection done, traversing the rc tree %llu entries", header->rc_count);
@@ -99,6 +99,19 @@ public:
     // This function should be called when writer starts up.
     int ExceptionRecovery();
 
+    // Refill the exact-match hash index from the tree; no-op when the
+    // writer does not maintain the index.
+    void RebuildHashIndex();
+    // Recount the per-subtree entry counts from the tree; no-op when the DB
+    // was created without them.
+    void RebuildSubtreeCounts();
+    // Refill the Bloom filter from the tree, dropping removed keys; no-op
+    // when the writer does not maintain the filter.
+    void RebuildBloomFilter();
+    // Add the first-char index to dense nodes that lack it; no-op unless the
+    // writer was opened with OPTION_DENSE_NODE_INDEX.
+    void IndexDenseNodes();
+
     friend class ResourceCollectionTestPeer;
 
 private:
@@ -119,6 +132,7 @@ private:
     int EvacuateOneIndexBlock();
     int EvacuateOneDataBlock();
     bool MoveDataBuffer(int phase, size_t& offset_src, int size);
+    void MoveExtents(int phase, const DBTraverseNode& dbt_node);
     int LRUEviction(int64_t max_dbsz, int64_t max_dbcnt);
     void ProcessRCTree();
 
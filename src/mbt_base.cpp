@@ -112,14 +112,21 @@ void DBTraverseBase::GetAlignmentSize(DBTraverseNode& dbt_node) const
         if (dict->ReadData((uint8_t*)&data_size[0], DATA_HDR_BYTE, dbt_node.data_offset)
             != DATA_HDR_BYTE)
             throw (int)MBError::READ_ERROR;
-        if (db_ref.GetDBOptions() & CONSTS::OPTION_JEMALLOC) {
-            dbt_node.data_size = static_cast<int>(
-                (static_cast<size_t>(data_size[0] + DATA_HDR_BYTE) + JEMALLOC_ALIGNMENT - 1)
-                & ~(static_cast<size_t>(JEMALLOC_ALIGNMENT) - 1));
-        } else {
-            dbt_node.data_size = data_free_lists->GetAlignmentSize(data_size[0] + DATA_HDR_BYTE);
-        }
+        dbt_node.data_size = DataBufferSize(data_size[0]);
+    }
+}
+
+// Size of a data buffer holding data_len bytes; the extent flag of a large
+// value is not part of the length.
+int DBTraverseBase::DataBufferSize(uint16_t data_len) const
+{
+    data_len &= ~DATA_EXTENT_FLAG;
+    if (db_ref.GetDBOptions() & CONSTS::OPTION_JEMALLOC) {
+        return static_cast<int>(
+            (static_cast<size_t>(data_len + DATA_HDR_BYTE) + JEMALLOC_ALIGNMENT - 1)
+            & ~(static_cast<size_t>(JEMALLOC_ALIGNMENT) - 1));
     }
+    return data_free_lists->GetAlignmentSize(data_len + DATA_HDR_BYTE);
 }
 
 void DBTraverseBase::BufferCopy(size_t offset_dst, uint8_t* ptr_dst,
@@ -129,6 +136,7 @@ void DBTraverseBase::BufferCopy(size_t offset_dst, uint8_t* ptr_dst,
     if (ptr_src != NULL) {
         if (ptr_dst != NULL) {
             memcpy(ptr_dst, ptr_src, size);
+            drm->MarkDirty(offset_dst, size);
         } else {
             drm->WriteData(ptr_src, size, offset_dst);
         }
@@ -140,6 +148,7 @@ void DBTraverseBase::BufferCopy(size_t offset_dst, uint8_t* ptr_dst,
 
         if (ptr_dst != NULL) {
             memcpy(ptr_dst, rw_buffer, size);
+            drm->MarkDirty(offset_dst, size);
         } else {
             drm->WriteData(rw_buffer, size, offset_dst);
         }
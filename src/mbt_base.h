@@ -52,6 +52,7 @@ protected:
     void BufferCopy(size_t offset_dst, uint8_t* ptr_dst,
         size_t offset_src, const uint8_t* ptr_src,
         int size, DRMBase* drm);
+    int DataBufferSize(uint16_t data_len) const;
 
     // DBTraverseBase does not own these objects or pointers.
     const DB& db_ref;
@@ -62,6 +62,8 @@ RollableFile::RollableFile(const std::string& fpath, size_t blocksize, size_t me
     , max_num_block(max_block)
     , rc_offset_percentage(in_rc_offset_percentage)
     , mem_used(0)
+    , group_sync(NULL)
+    , sync_file(-1)
 {
     sliding_addr = NULL;
     sliding_mem_size = SLIDING_MEM_SIZE;
@@ -250,6 +252,7 @@ int RollableFile::Reserve(size_t& offset, int size, uint8_t*& ptr, bool map_new_
     if (files[order]->IsMapped()) {
         size_t index = offset % block_size;
         ptr = files[order]->GetMapAddr() + index;
+        MarkDirty(offset, size);
         return rval;
     }
 
@@ -266,6 +269,9 @@ int RollableFile::Reserve(size_t& offset, int size, uint8_t*& ptr, bool map_new_
             }
         }
     }
+    // Without ptr the caller writes with RandomWrite.
+    if (ptr != NULL)
+        MarkDirty(offset, size);
 
     return rval;
 }
@@ -314,6 +320,7 @@ size_t RollableFile::RandomWrite(const void* data, size_t size, off_t offset)
     int rval = CheckAndOpenFile(order, false);
     if (rval != MBError::SUCCESS)
         return 0;
+    MarkDirty(offset, size);
 
     // Check sliding map
     if (sliding_mmap && sliding_addr != NULL) {
@@ -398,6 +405,12 @@ void RollableFile::ResetSlidingWindow()
     sliding_map_off = 0;
 }
 
+void RollableFile::SetGroupSync(GroupSync* sync)
+{
+    group_sync = sync;
+    sync_file = sync != NULL ? sync->AddFile(path, block_size) : -1;
+}
+
 void RollableFile::Flush()
 {
     for (std::vector<std::shared_ptr<MmapFileIO>>::iterator it = files.begin();
@@ -512,9 +525,11 @@ void* RollableFile::Malloc(size_t size, size_t& offset)
         }
         unsigned arena_index = files[0]->mm_meta->arena_index;
         ptr = mallocx(size, MALLOCX_ARENA(arena_index) | MALLOCX_TCACHE_NONE);
-        if (ptr != nullptr)
+        if (ptr != nullptr) {
             offset = get_shm_offset(ptr);
-        else if (g_jemalloc_alloc_error == MBError::SUCCESS)
+            // The caller writes the buffer through ptr.
+            MarkDirty(offset, size);
+        } else if (g_jemalloc_alloc_error == MBError::SUCCESS)
             g_jemalloc_alloc_error = MBError::NO_MEMORY;
     }
     return ptr;
@@ -632,6 +647,7 @@ size_t RollableFile::MemWrite(const void* src, size_t size, size_t offset)
         }
     }
     memcpy(files[block_order]->GetMapAddr() + relative_offset, src, size);
+    MarkDirty(offset, size);
     return size;
 }
 
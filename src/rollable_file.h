@@ -28,6 +28,7 @@
 #include <unordered_map>
 #include <vector>
 
+#include "group_sync.h"
 #include "logger.h"
 #include "mmap_file.h"
 
@@ -68,6 +69,14 @@ public:
     void ResetSlidingWindow();
 
     void Flush();
+    // Record the ranges written for group commit (SYNC_GROUP_COMMIT); a
+    // NULL sync stops recording.
+    void SetGroupSync(GroupSync* sync);
+    void MarkDirty(size_t offset, size_t size)
+    {
+        if (group_sync != NULL)
+            group_sync->AddRange(sync_file, offset, size);
+    }
     size_t GetResourceCollectionOffset() const;
     void RemoveUnused(size_t max_size, bool writer_mode);
 
@@ -128,6 +137,9 @@ private:
     int rc_offset_percentage;
     size_t mem_used;
 
+    GroupSync* group_sync;
+    int sync_file;
+
     // jemalloc only
     static std::unordered_map<unsigned, RollableFile*> arena_manager_map;
 };
@@ -0,0 +1,442 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "logger.h"
+#include "mabain_consts.h"
+#include "sharded_db.h"
+
+namespace mabain {
+
+static std::string shard_dir(const std::string& mb_dir, int shard)
+{
+    return mb_dir + "shard_" + std::to_string(shard) + "/";
+}
+
+ShardedDB::ShardedDB(const MBConfig& db_config, int n_shards, const std::vector<int>& writer_shards)
+    : config(db_config)
+    , status(MBError::NOT_INITIALIZED)
+    , num_shards(0)
+{
+    if (config.mbdir == NULL) {
+        status = MBError::INVALID_ARG;
+        return;
+    }
+    mb_dir = config.mbdir;
+    if (mb_dir.empty() || mb_dir.back() != '/')
+        mb_dir += "/";
+    config.mbdir = NULL;
+
+    bool writer = (config.options & CONSTS::ACCESS_MODE_WRITER) != 0;
+    if (writer == writer_shards.empty()) {
+        Logger::Log(LOG_LEVEL_ERROR, "writer shards must be given for and only for writers");
+        status = MBError::INVALID_ARG;
+        return;
+    }
+    int rval = InitShardCount(n_shards, writer);
+    if (rval != MBError::SUCCESS) {
+        status = rval;
+        return;
+    }
+
+    writers.assign(num_shards, false);
+    shards.resize(num_shards);
+    for (int shard : writer_shards) {
+        if (shard < 0 || shard >= num_shards) {
+            status = MBError::INVALID_ARG;
+            return;
+        }
+        writers[shard] = true;
+    }
+
+    for (int i = 0; i < num_shards; i++) {
+        if (!writers[i])
+            continue;
+        std::string dir = shard_dir(mb_dir, i);
+        if (!(config.options & CONSTS::MEMORY_ONLY_MODE) && mkdir(dir.c_str(), 0755) != 0
+            && errno != EEXIST) {
+            Logger::Log(LOG_LEVEL_ERROR, "failed to create shard directory %s", dir.c_str());
+            status = MBError::OPEN_FAILURE;
+            return;
+        }
+        MBConfig shard_config = config;
+        shard_config.mbdir = dir.c_str();
+        shards[i].reset(new DB(shard_config));
+        if (!shards[i]->is_open()) {
+            status = shards[i]->Status();
+            shards[i].reset();
+            return;
+        }
+    }
+
+    status = MBError::SUCCESS;
+}
+
+ShardedDB::~ShardedDB()
+{
+    Close();
+}
+
+// The shard count is kept in mbdir so that every handle splits the keys the
+// same way. The first writer links it in place, so the file is never seen
+// half written.
+int ShardedDB::InitShardCount(int n_shards, bool writer)
+{
+    if (n_shards < 0 || n_shards > NUM_ALPHABET)
+        return MBError::INVALID_ARG;
+    if (config.options & CONSTS::MEMORY_ONLY_MODE) {
+        if (n_shards == 0)
+            return MBError::INVALID_ARG;
+        num_shards = n_shards;
+        return MBError::SUCCESS;
+    }
+
+    std::string path = mb_dir + "_mabain_shards";
+    if (writer && n_shards > 0 && access(path.c_str(), F_OK) != 0) {
+        std::string tmp = path + "." + std::to_string(getpid()) + "."
+            + std::to_string(reinterpret_cast<uintptr_t>(this));
+        std::ofstream out(tmp.c_str());
+        out << n_shards << "\n";
+        out.close();
+        if (!out || (link(tmp.c_str(), path.c_str()) != 0 && errno != EEXIST)) {
+            Logger::Log(LOG_LEVEL_ERROR, "failed to write %s", path.c_str());
+            unlink(tmp.c_str());
+            return MBError::WRITE_ERROR;
+        }
+        unlink(tmp.c_str());
+    }
+
+    std::ifstream in(path.c_str());
+    int recorded = 0;
+    if (!(in >> recorded))
+        return MBError::NO_DB;
+    if (recorded <= 0 || recorded > NUM_ALPHABET || (n_shards != 0 && n_shards != recorded)) {
+        Logger::Log(LOG_LEVEL_ERROR, "shard count %d does not match %d in %s",
+            n_shards, recorded, path.c_str());
+        return MBError::INVALID_ARG;
+    }
+    num_shards = recorded;
+    return MBError::SUCCESS;
+}
+
+int ShardedDB::ShardOf(const char* key, int len, int num_shards)
+{
+    if (len <= 0)
+        return 0;
+    return static_cast<uint8_t>(key[0]) * num_shards / NUM_ALPHABET;
+}
+
+void ShardedDB::ShardRange(int shard, int num_shards, int& first, int& end)
+{
+    first = (shard * NUM_ALPHABET + num_shards - 1) / num_shards;
+    end = ((shard + 1) * NUM_ALPHABET + num_shards - 1) / num_shards;
+}
+
+DB* ShardedDB::GetShard(int shard) const
+{
+    if (status != MBError::SUCCESS || shard < 0 || shard >= num_shards)
+        return NULL;
+    if (shards[shard] || writers[shard])
+        return shards[shard].get();
+
+    std::string dir = shard_dir(mb_dir, shard);
+    if (!(config.options & CONSTS::MEMORY_ONLY_MODE) && access((dir + "_mabain_h").c_str(), F_OK) != 0)
+        return NULL;
+    MBConfig shard_config = config;
+    shard_config.mbdir = dir.c_str();
+    shard_config.options &= ~(CONSTS::ACCESS_MODE_WRITER | CONSTS::ASYNC_WRITER_MODE);
+    std::unique_ptr<DB> db(new DB(shard_config));
+    if (!db->is_open())
+        return NULL;
+    shards[shard] = std::move(db);
+    return shards[shard].get();
+}
+
+bool ShardedDB::IsWriter(int shard) const
+{
+    return shard >= 0 && shard < num_shards && writers[shard];
+}
+
+int ShardedDB::UpdateShard(const char* key, int len, DB*& db) const
+{
+    if (key == NULL)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    int shard = ShardOf(key, len, num_shards);
+    if ((config.options & CONSTS::ACCESS_MODE_WRITER) && !writers[shard])
+        return MBError::NOT_ALLOWED;
+    db = GetShard(shard);
+    return db == NULL ? MBError::NO_DB : MBError::SUCCESS;
+}
+
+int ShardedDB::Add(const char* key, int len, const char* data, int data_len, bool overwrite)
+{
+    DB* db;
+    int rval = UpdateShard(key, len, db);
+    if (rval != MBError::SUCCESS)
+        return rval;
+    return db->Add(key, len, data, data_len, overwrite);
+}
+
+int ShardedDB::Add(const std::string& key, const std::string& value, bool overwrite)
+{
+    return Add(key.data(), key.size(), value.data(), value.size(), overwrite);
+}
+
+int ShardedDB::Remove(const char* key, int len)
+{
+    DB* db;
+    int rval = UpdateShard(key, len, db);
+    if (rval != MBError::SUCCESS)
+        return rval;
+    return db->Remove(key, len);
+}
+
+int ShardedDB::Remove(const std::string& key)
+{
+    return Remove(key.data(), key.size());
+}
+
+int ShardedDB::Write(WriteBatch& batch, bool overwrite)
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    std::vector<WriteBatch> parts(num_shards);
+    for (const WriteBatch::Entry& entry : batch.entries) {
+        const char* key = reinterpret_cast<const char*>(batch.Key(entry));
+        WriteBatch& part = parts[ShardOf(key, entry.key_len, num_shards)];
+        if (entry.value_len < 0)
+            part.Remove(key, entry.key_len);
+        else
+            part.Put(key, entry.key_len, reinterpret_cast<const char*>(batch.Value(entry)),
+                entry.value_len);
+    }
+
+    batch.skipped = 0;
+    for (int i = 0; i < num_shards; i++) {
+        if (parts[i].Size() == 0)
+            continue;
+        DB* db;
+        const WriteBatch::Entry& first = parts[i].entries[0];
+        int rval = UpdateShard(reinterpret_cast<const char*>(parts[i].Key(first)), first.key_len, db);
+        if (rval == MBError::SUCCESS)
+            rval = db->Write(parts[i], overwrite);
+        batch.skipped += parts[i].Skipped();
+        if (rval != MBError::SUCCESS)
+            return rval;
+    }
+    return MBError::SUCCESS;
+}
+
+int ShardedDB::Find(const char* key, int len, MBData& data) const
+{
+    if (key == NULL)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    DB* db = GetShard(ShardOf(key, len, num_shards));
+    if (db == NULL)
+        return MBError::NOT_EXIST;
+    return db->Find(key, len, data);
+}
+
+int ShardedDB::Find(const std::string& key, MBData& data) const
+{
+    return Find(key.data(), key.size(), data);
+}
+
+// Every prefix of a key has the same first byte, so the key's shard holds
+// all the candidates.
+int ShardedDB::FindLongestPrefix(const char* key, int len, MBData& data) const
+{
+    if (key == NULL)
+        return MBError::INVALID_ARG;
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    DB* db = GetShard(ShardOf(key, len, num_shards));
+    if (db == NULL)
+        return MBError::NOT_EXIST;
+    return db->FindLongestPrefix(key, len, data);
+}
+
+int ShardedDB::FindLongestPrefix(const std::string& key, MBData& data) const
+{
+    return FindLongestPrefix(key.data(), key.size(), data);
+}
+
+// Search the key's shard first, then the closest entry of the neighbouring
+// shards in the search direction.
+int ShardedDB::Neighbor(const std::string& key, bool reverse, bool inclusive, MBData& data,
+    std::string* neighbor_key) const
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    int shard = ShardOf(key.data(), key.size(), num_shards);
+    DB* db = GetShard(shard);
+    int rval = MBError::NOT_EXIST;
+    // DB appends the key it finds to neighbor_key.
+    if (neighbor_key != nullptr)
+        neighbor_key->clear();
+    if (db != NULL) {
+        if (reverse)
+            rval = inclusive ? db->FindLowerBound(key, data, neighbor_key) : db->Prev(key, data, neighbor_key);
+        else
+            rval = inclusive ? db->FindUpperBound(key, data, neighbor_key) : db->Next(key, data, neighbor_key);
+    }
+
+    int step = reverse ? -1 : 1;
+    for (int i = shard + step; rval == MBError::NOT_EXIST && i >= 0 && i < num_shards; i += step) {
+        db = GetShard(i);
+        if (db == NULL)
+            continue;
+        int first, end;
+        ShardRange(i, num_shards, first, end);
+        if (neighbor_key != nullptr)
+            neighbor_key->clear();
+        // The shards before the key's shard end below 256.
+        if (reverse)
+            rval = db->Prev(std::string(1, static_cast<char>(end)), data, neighbor_key);
+        else
+            rval = db->FindUpperBound(std::string(1, static_cast<char>(first)), data, neighbor_key);
+    }
+    return rval;
+}
+
+int ShardedDB::FindLowerBound(const std::string& key, MBData& data, std::string* bound_key) const
+{
+    return Neighbor(key, true, true, data, bound_key);
+}
+
+int ShardedDB::FindUpperBound(const std::string& key, MBData& data, std::string* bound_key) const
+{
+    return Neighbor(key, false, true, data, bound_key);
+}
+
+int ShardedDB::Next(const std::string& key, MBData& data, std::string* next_key) const
+{
+    return Neighbor(key, false, false, data, next_key);
+}
+
+int ShardedDB::Prev(const std::string& key, MBData& data, std::string* prev_key) const
+{
+    return Neighbor(key, true, false, data, prev_key);
+}
+
+// Each shard only holds its own keys, so the shards in the range are scanned
+// in order with the same bounds.
+int ShardedDB::Scan(const std::string& start_key, const std::string& end_key, int64_t limit,
+    const DB::ScanVisitor& visitor) const
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    int first = ShardOf(start_key.data(), start_key.size(), num_shards);
+    int last = end_key.empty() ? num_shards - 1 : ShardOf(end_key.data(), end_key.size(), num_shards);
+    int64_t visited = 0;
+    bool stopped = false;
+    DB::ScanVisitor count_visits = [&](const char* key, int key_len, const uint8_t* value, int value_len) {
+        visited++;
+        stopped = !visitor(key, key_len, value, value_len);
+        return !stopped;
+    };
+
+    for (int i = first; i <= last; i++) {
+        DB* db = GetShard(i);
+        if (db == NULL)
+            continue;
+        int rval = db->Scan(start_key, end_key, limit > 0 ? limit - visited : 0, count_visits);
+        if (rval != MBError::SUCCESS)
+            return rval;
+        if (stopped || (limit > 0 && visited >= limit))
+            break;
+    }
+    return MBError::SUCCESS;
+}
+
+int ShardedDB::CollectResource(int64_t min_index_rc_size, int64_t min_data_rc_size,
+    int64_t max_dbsiz, int64_t max_dbcnt)
+{
+    if (status != MBError::SUCCESS)
+        return MBError::NOT_INITIALIZED;
+
+    int rval = MBError::SUCCESS;
+    for (int i = 0; i < num_shards; i++) {
+        if (!writers[i])
+            continue;
+        int ret = shards[i]->CollectResource(min_index_rc_size, min_data_rc_size, max_dbsiz, max_dbcnt);
+        if (rval == MBError::SUCCESS)
+            rval = ret;
+    }
+    return rval;
+}
+
+int64_t ShardedDB::Count() const
+{
+    if (status != MBError::SUCCESS)
+        return -1;
+
+    int64_t count = 0;
+    for (int i = 0; i < num_shards; i++) {
+        DB* db = GetShard(i);
+        if (db != NULL)
+            count += db->Count();
+    }
+    return count;
+}
+
+int ShardedDB::Close()
+{
+    int rval = MBError::SUCCESS;
+    for (std::unique_ptr<DB>& db : shards) {
+        if (!db)
+            continue;
+        int ret = db->Close();
+        if (rval == MBError::SUCCESS)
+            rval = ret;
+        db.reset();
+    }
+    if (status == MBError::SUCCESS)
+        status = MBError::DB_CLOSED;
+    return rval;
+}
+
+int ShardedDB::Status() const
+{
+    return status;
+}
+
+bool ShardedDB::is_open() const
+{
+    return status == MBError::SUCCESS;
+}
+
+int ShardedDB::NumShards() const
+{
+    return num_shards;
+}
+
+}
@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SHARDED_DB_H__
+#define __SHARDED_DB_H__
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "db.h"
+
+namespace mabain {
+
+// A DB split by the first key byte into num_shards shards, each a DB of its
+// own in the subdirectory shard_<i>/ of mbdir. Shard i holds the keys whose
+// first byte c has c * num_shards / 256 == i, so every shard owns a range of
+// root edges and has its own writer lock, index and data files, free lists
+// and lock-free channel. Up to num_shards writer processes or threads can
+// then update the DB at the same time, one per shard.
+//
+// A writer handle writes the shards listed in writer_shards and rejects
+// updates of the other keys with MBError::NOT_ALLOWED. A reader handle
+// passes updates to the shard writers through their shared memory queues
+// like DB does. Both read every shard, and lookups, bound searches and
+// scans see the shards as one DB in key order. A shard whose writer has not
+// created it yet reads as empty until it exists. The rest of config applies
+// to each shard, including the memory caps.
+//
+// Like DB handles, a ShardedDB handle must not be shared across threads.
+class ShardedDB {
+public:
+    // num_shards is between 1 and 256. The first writer records it in mbdir;
+    // later handles must pass the same number or 0.
+    ShardedDB(const MBConfig& config, int num_shards,
+        const std::vector<int>& writer_shards = std::vector<int>());
+    ~ShardedDB();
+
+    ShardedDB(const ShardedDB&) = delete;
+    ShardedDB& operator=(const ShardedDB&) = delete;
+
+    int Add(const char* key, int len, const char* data, int data_len, bool overwrite = false);
+    int Add(const std::string& key, const std::string& value, bool overwrite = false);
+    int Remove(const char* key, int len);
+    int Remove(const std::string& key);
+    // Split batch by shard and write each part with DB::Write; the parts of
+    // the shards before a failed one stay applied.
+    int Write(WriteBatch& batch, bool overwrite = false);
+
+    int Find(const char* key, int len, MBData& data) const;
+    int Find(const std::string& key, MBData& data) const;
+    int FindLongestPrefix(const char* key, int len, MBData& data) const;
+    int FindLongestPrefix(const std::string& key, MBData& data) const;
+    int FindLowerBound(const std::string& key, MBData& data, std::string* bound_key = nullptr) const;
+    int FindUpperBound(const std::string& key, MBData& data, std::string* bound_key = nullptr) const;
+    int Next(const std::string& key, MBData& data, std::string* next_key = nullptr) const;
+    int Prev(const std::string& key, MBData& data, std::string* prev_key = nullptr) const;
+    // Same as DB::Scan across the shards
+    int Scan(const std::string& start_key, const std::string& end_key, int64_t limit,
+        const DB::ScanVisitor& visitor) const;
+
+    // Run DB::CollectResource on the shards written by this handle
+    int CollectResource(int64_t min_index_rc_size = 33554432, int64_t min_data_rc_size = 33554432,
+        int64_t max_dbsiz = MAX_6B_OFFSET, int64_t max_dbcnt = MAX_6B_OFFSET);
+
+    // Sum of the shard counts
+    int64_t Count() const;
+    int Close();
+    int Status() const;
+    bool is_open() const;
+
+    int NumShards() const;
+    // Shard of a key, and the first byte range [first, end) of a shard
+    static int ShardOf(const char* key, int len, int num_shards);
+    static void ShardRange(int shard, int num_shards, int& first, int& end);
+    // DB handle of a shard; NULL if the shard does not exist yet
+    DB* GetShard(int shard) const;
+    bool IsWriter(int shard) const;
+
+private:
+    int InitShardCount(int num_shards, bool writer);
+    int Neighbor(const std::string& key, bool reverse, bool inclusive, MBData& data,
+        std::string* neighbor_key) const;
+    int UpdateShard(const char* key, int len, DB*& db) const;
+
+    std::string mb_dir;
+    MBConfig config;
+    int status;
+    int num_shards;
+    std::vector<bool> writers;
+    // Reader shards are opened on first use once their writer created them.
+    mutable std::vector<std::unique_ptr<DB>> shards;
+};
+
+}
+
+#endif
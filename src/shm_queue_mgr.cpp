@@ -16,6 +16,8 @@
 
 // @author Changxue Deng <chadeng@cisco.com>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <sys/stat.h>
 
@@ -31,7 +33,8 @@ ShmQueueMgr::ShmQueueMgr()
 {
 }
 
-void ShmQueueMgr::InitShmObjects(shm_lock_and_queue* slaq, int queue_size)
+void ShmQueueMgr::InitShmObjects(shm_lock_and_queue* slaq, uint32_t num_lanes,
+    uint64_t ring_size, const IndexHeader* hdr)
 {
     int rval = MBError::SUCCESS;
 
@@ -39,13 +42,40 @@ void ShmQueueMgr::InitShmObjects(shm_lock_and_queue* slaq, int queue_size)
     if (rval != MBError::SUCCESS)
         throw rval;
 
-    slaq->initialized = 1;
+    // The writer finds records by their ready stamps, so the ring must not
+    // keep stamps from an earlier queue.
+    memset(slaq->ring, 0, num_lanes * ring_size);
+    slaq->num_lanes = num_lanes;
+    slaq->ring_size = ring_size;
+    // Positions are part of the sequence numbers of the updates, so a new
+    // queue continues where the last one stopped.
+    for (int i = 0; i < MB_ASYNC_SHM_MAX_LANES; i++) {
+        uint64_t start_pos = hdr->async_applied_seq[i].load(std::memory_order_relaxed);
+        // Keep the records aligned if the header is not from this queue.
+        start_pos &= ~static_cast<uint64_t>(MB_ASYNC_SHM_RECORD_ALIGN - 1);
+        slaq->lanes[i].tail.store(start_pos, std::memory_order_relaxed);
+        slaq->lanes[i].head.store(start_pos, std::memory_order_relaxed);
+    }
+    slaq->writer_parked.store(0, std::memory_order_relaxed);
+    memset(slaq->depth_hist, 0, sizeof(slaq->depth_hist));
+    memset(slaq->batch_hist, 0, sizeof(slaq->batch_hist));
+    slaq->initialized = MB_ASYNC_SHM_RING_VERSION;
+}
+
+// The lanes share the space of qsize updates of the largest size. A lane has
+// one slot more than its share so that a record of the maximal size always
+// fits once the ring is drained, wherever the ring wraps.
+static uint64_t lane_ring_size(int qsize, uint32_t num_lanes)
+{
+    uint64_t share = static_cast<uint64_t>(qsize) * MB_ASYNC_SHM_SLOT_SIZE / num_lanes;
+    share = (share + MB_ASYNC_SHM_RECORD_ALIGN - 1) & ~static_cast<uint64_t>(MB_ASYNC_SHM_RECORD_ALIGN - 1);
+    return std::max<uint64_t>(share, MB_ASYNC_SHM_SLOT_SIZE) + MB_ASYNC_SHM_SLOT_SIZE;
 }
 
-shm_lock_and_queue* ShmQueueMgr::CreateFile(uint64_t qid, int qsize,
-    const char* queue_dir, int options)
+shm_lock_and_queue* ShmQueueMgr::CreateFile(uint64_t qid, int qsize, uint32_t num_lanes,
+    const char* queue_dir, int options, const IndexHeader* hdr, bool init_header)
 {
-    if (qsize > MB_MAX_NUM_SHM_QUEUE_NODE)
+    if (qsize > MB_MAX_NUM_SHM_QUEUE_NODE || num_lanes == 0 || num_lanes > MB_ASYNC_LOCAL_LANE)
         throw (int)MBError::INVALID_SIZE;
     std::string qfile_path;
     if (queue_dir != NULL)
@@ -58,9 +88,14 @@ shm_lock_and_queue* ShmQueueMgr::CreateFile(uint64_t qid, int qsize,
         init_queue = true;
 
     bool map_qfile = true;
-    int q_buff_size = sizeof(shm_lock_and_queue);
-    if (qsize < MB_MAX_NUM_SHM_QUEUE_NODE)
-        q_buff_size -= sizeof(AsyncNode) * (MB_MAX_NUM_SHM_QUEUE_NODE - qsize);
+    uint64_t ring_size = lane_ring_size(qsize, num_lanes);
+    size_t q_buff_size = sizeof(shm_lock_and_queue) + num_lanes * ring_size;
+    if (!(options & CONSTS::ACCESS_MODE_WRITER)) {
+        // Readers map the lanes the writer has set up.
+        struct stat st;
+        if (stat(qfile_path.c_str(), &st) == 0 && st.st_size > (off_t)sizeof(shm_lock_and_queue))
+            q_buff_size = st.st_size;
+    }
     qfile = ResourcePool::getInstance().OpenFile(qfile_path,
         CONSTS::ACCESS_MODE_WRITER,
         q_buff_size,
@@ -73,14 +108,18 @@ shm_lock_and_queue* ShmQueueMgr::CreateFile(uint64_t qid, int qsize,
         throw (int)MBError::MMAP_FAILED;
 
     if (options & CONSTS::ACCESS_MODE_WRITER) {
-        if (init_queue)
+        if (init_queue || init_header || slaq->ring_size != ring_size || slaq->num_lanes != num_lanes)
             slaq->initialized = 0;
-        if (slaq->initialized == 0) {
+        if (slaq->initialized != MB_ASYNC_SHM_RING_VERSION) {
             Logger::Log(LOG_LEVEL_DEBUG, "initializing shared memory queue");
-            InitShmObjects(slaq, qsize);
+            InitShmObjects(slaq, num_lanes, ring_size, hdr);
         }
     } else {
-        if (slaq->initialized == 0) {
+        // Readers use the number of lanes the writer has set up.
+        if (slaq->initialized != MB_ASYNC_SHM_RING_VERSION || slaq->num_lanes == 0
+            || slaq->num_lanes > MB_ASYNC_LOCAL_LANE
+            || slaq->ring_size != lane_ring_size(qsize, slaq->num_lanes)
+            || sizeof(shm_lock_and_queue) + slaq->num_lanes * slaq->ring_size > q_buff_size) {
             Logger::Log(LOG_LEVEL_ERROR, "shared memory queue not intialized");
             throw (int)MBError::NOT_INITIALIZED;
         }
@@ -93,6 +132,28 @@ ShmQueueMgr::~ShmQueueMgr()
 {
 }
 
+// Print the non-empty buckets as <lower bound>:<count>
+void ShmQueueMgr::PrintHistogram(std::ostream& out_stream, const char* name,
+    const uint64_t* hist)
+{
+    out_stream << "\t" << name << " histogram:";
+    for (int i = 0; i < MB_ASYNC_SHM_HIST_BUCKETS; i++) {
+        if (hist[i] != 0)
+            out_stream << " " << (1ULL << i) << ":" << hist[i];
+    }
+    out_stream << std::endl;
+}
+
+void ShmQueueMgr::AddToHistogram(uint64_t* hist, uint64_t value)
+{
+    int bucket = 0;
+    while (value > 1 && bucket < MB_ASYNC_SHM_HIST_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    hist[bucket]++;
+}
+
 void ShmQueueMgr::PrintStats(std::ostream& out_stream, const IndexHeader* hdr) const
 {
     if (qfile != nullptr) {
@@ -108,6 +169,19 @@ void ShmQueueMgr::PrintStats(std::ostream& out_stream, const IndexHeader* hdr) c
             out_stream << "\tqueue index: " << hdr->queue_index << std::endl;
             out_stream << "\twriter index: " << hdr->writer_index << std::endl;
         }
+        if (addr != nullptr) {
+            const shm_lock_and_queue* slaq = reinterpret_cast<const shm_lock_and_queue*>(addr);
+            out_stream << "\tlanes: " << slaq->num_lanes << std::endl;
+            out_stream << "\tring size per lane: " << slaq->ring_size << std::endl;
+            for (uint32_t i = 0; i < slaq->num_lanes; i++) {
+                out_stream << "\tlane " << i << " head: "
+                           << slaq->lanes[i].head.load(std::memory_order_relaxed)
+                           << " tail: " << slaq->lanes[i].tail.load(std::memory_order_relaxed)
+                           << std::endl;
+            }
+            PrintHistogram(out_stream, "queue depth", slaq->depth_hist);
+            PrintHistogram(out_stream, "batch size", slaq->batch_hist);
+        }
     }
 }
 
@@ -33,38 +33,124 @@ namespace mabain {
 #define MABAIN_ASYNC_TYPE_REMOVE_ALL 3
 #define MABAIN_ASYNC_TYPE_RC 4
 #define MABAIN_ASYNC_TYPE_BACKUP 5
+// read-modify-write updates applied by Dict::Update
+#define MABAIN_ASYNC_TYPE_INCREMENT 6
+#define MABAIN_ASYNC_TYPE_APPEND 7
+// 8 is not used: compare-and-swap is never queued, see MABAIN_UPDATE_TYPE_CAS
+#define MABAIN_ASYNC_TYPE_MERGE 9
+// part of a value that does not fit in a queue slot
+#define MABAIN_ASYNC_TYPE_ADD_PART 10
 
-#define MB_ASYNC_SHM_KEY_SIZE 256
 #define MB_ASYNC_SHM_DATA_SIZE 0x7FFF
+// Seconds the writer waits for a record whose reader may have exited
 #define MB_ASYNC_SHM_LOCK_TMOUT 5
 
+// The async queue is a set of lanes, each a byte ring of variable-length
+// records. A record is a header followed by key_len bytes of key and
+// data_len bytes of data, and takes a multiple of MB_ASYNC_SHM_RECORD_ALIGN
+// bytes. A record that does not fit before the end of the ring is placed at
+// the start, after a record of type MABAIN_ASYNC_TYPE_NONE padding the rest
+// of the ring.
 typedef struct _AsyncNode {
-    std::atomic<bool> in_use;
-    std::atomic<uint16_t> num_reader;
-
-    char key[MB_ASYNC_SHM_KEY_SIZE];
-    char data[MB_ASYNC_SHM_DATA_SIZE];
+    // pos + 1 once the record can be processed; stored last by the reader
+    std::atomic<uint64_t> ready;
+    // position of the record in the lane
+    uint64_t pos;
+    uint32_t size;
     int key_len;
     int data_len;
     bool overwrite;
     char type;
+    char key[0];
+
+    char* data() { return key + key_len; }
+    const char* data() const { return key + key_len; }
 } AsyncNode;
 
+#define MB_ASYNC_SHM_RECORD_ALIGN 64
+#define MB_ASYNC_SHM_RECORD_SIZE(len) \
+    ((sizeof(AsyncNode) + (len) + MB_ASYNC_SHM_RECORD_ALIGN - 1) & ~static_cast<size_t>(MB_ASYNC_SHM_RECORD_ALIGN - 1))
+// Ring bytes per unit of queue size; each unit holds a record of the maximal
+// size, or many small ones.
+#define MB_ASYNC_SHM_SLOT_SIZE MB_ASYNC_SHM_RECORD_SIZE(CONSTS::MAX_KEY_LENGHTH + MB_ASYNC_SHM_DATA_SIZE)
+
+// Values larger than MB_ASYNC_SHM_DATA_SIZE are queued in parts of type
+// MABAIN_ASYNC_TYPE_ADD_PART. The data of each part starts with this header;
+// the writer adds the value once all parts of the transfer have arrived.
+typedef struct _AsyncPartHeader {
+    uint64_t transfer_id;
+    uint32_t value_len;
+    uint32_t part_offset;
+} AsyncPartHeader;
+
+#define MB_ASYNC_SHM_PART_SIZE (MB_ASYNC_SHM_DATA_SIZE - static_cast<int>(sizeof(AsyncPartHeader)))
+// Parts of a transfer not completed in this many seconds are dropped.
+#define MB_ASYNC_PART_TIMEOUT 60
+
+// Layout and wakeup protocol version of the queue file stored in initialized
+#define MB_ASYNC_SHM_RING_VERSION 5
+// Histogram buckets of the writer stats; bucket i counts values in
+// [2^i, 2^(i+1)), the last bucket everything above.
+#define MB_ASYNC_SHM_HIST_BUCKETS 16
+
+// Sequence numbers of queued updates hold the lane in the low bits and the
+// lane position after the record above them.
+#define MB_ASYNC_SHM_LANE_BITS 4
+#define MB_ASYNC_SHM_SEQ(lane, pos) (((pos) << MB_ASYNC_SHM_LANE_BITS) | (lane))
+#define MB_ASYNC_SHM_SEQ_LANE(seq) ((seq) & (MB_ASYNC_SHM_MAX_LANES - 1))
+#define MB_ASYNC_SHM_SEQ_POS(seq) ((seq) >> MB_ASYNC_SHM_LANE_BITS)
+// Updates submitted by threads of the writer process do not go through the
+// queue file; their sequence numbers use the last lane, which the queue file
+// does not have.
+#define MB_ASYNC_LOCAL_LANE (MB_ASYNC_SHM_MAX_LANES - 1)
+
+// Byte positions of the next record to reserve and the next record to
+// process in a lane. Both only increase; the offset in the ring of the lane
+// is pos % ring_size. A lane is multi-producer, single-consumer: the handles
+// queuing in it reserve records by a compare-and-swap on its tail.
+typedef struct _AsyncLane {
+    alignas(MB_ASYNC_SHM_RECORD_ALIGN) std::atomic<uint64_t> tail;
+    alignas(MB_ASYNC_SHM_RECORD_ALIGN) std::atomic<uint64_t> head;
+} AsyncLane;
+
 typedef struct _shm_lock_and_queue {
     int initialized;
     pthread_mutex_t lock;
-    AsyncNode queue[MB_MAX_NUM_SHM_QUEUE_NODE];
+    // number of lanes and bytes of ring per lane
+    uint32_t num_lanes;
+    uint64_t ring_size;
+    // Futex word, 1 while the writer sleeps; readers wake it only then.
+    std::atomic<uint32_t> writer_parked;
+    // Writer stats: records queued when the writer starts a batch, and
+    // records applied per batch.
+    uint64_t depth_hist[MB_ASYNC_SHM_HIST_BUCKETS];
+    uint64_t batch_hist[MB_ASYNC_SHM_HIST_BUCKETS];
+    AsyncLane lanes[MB_ASYNC_SHM_MAX_LANES];
+    // the rings of the lanes, one after another
+    alignas(MB_ASYNC_SHM_RECORD_ALIGN) char ring[0];
+
+    AsyncNode* node(uint32_t lane, uint64_t pos)
+    {
+        return reinterpret_cast<AsyncNode*>(ring + lane * ring_size + pos % ring_size);
+    }
 } shm_lock_and_queue;
 
 class ShmQueueMgr {
 public:
     ShmQueueMgr();
     ~ShmQueueMgr();
-    shm_lock_and_queue* CreateFile(uint64_t qid, int qsize, const char* queue_dir, int options);
+    // A queue initialized by the writer continues the lanes at the positions
+    // applied according to hdr. The writer of a new DB (init_header) always
+    // initializes the queue, which may be left from a DB erased before.
+    shm_lock_and_queue* CreateFile(uint64_t qid, int qsize, uint32_t num_lanes,
+        const char* queue_dir, int options, const IndexHeader* hdr, bool init_header = false);
     void PrintStats(std::ostream& out_stream, const IndexHeader* hdr) const;
+    static void AddToHistogram(uint64_t* hist, uint64_t value);
 
 private:
-    void InitShmObjects(shm_lock_and_queue* slaq, int queue_size);
+    void InitShmObjects(shm_lock_and_queue* slaq, uint32_t num_lanes, uint64_t ring_size,
+        const IndexHeader* hdr);
+    static void PrintHistogram(std::ostream& out_stream, const char* name, const uint64_t* hist);
     // hold a reference to the queue file
     std::shared_ptr<MmapFileIO> qfile;
 };
@@ -16,8 +16,10 @@
 
 // @author Changxue Deng <chadeng@cisco.com>
 
+#include <algorithm>
 #include <pthread.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "./util/shm_mutex.h"
 #include "async_writer.h"
@@ -29,37 +31,73 @@ namespace mabain {
 int Dict::SHMQ_Add(const char* key, int key_len, const char* data, int data_len,
     bool overwrite)
 {
-    if (key_len > MB_ASYNC_SHM_KEY_SIZE || data_len > MB_ASYNC_SHM_DATA_SIZE) {
+    if (key_len > CONSTS::MAX_KEY_LENGHTH || data_len > CONSTS::MAX_LARGE_DATA_SIZE) {
         return MBError::OUT_OF_BOUND;
     }
+    if (data_len > MB_ASYNC_SHM_DATA_SIZE)
+        return shmqAddParts(key, key_len, data, data_len, overwrite);
 
     int err = MBError::SUCCESS;
-    AsyncNode* node_ptr = SHMQ_AcquireSlot(err);
+    AsyncNode* node_ptr = SHMQ_AcquireSlot(key_len, data_len, err);
     if (node_ptr == nullptr)
         return err;
 
     memcpy(node_ptr->key, key, key_len);
-    memcpy(node_ptr->data, data, data_len);
-    node_ptr->key_len = key_len;
-    node_ptr->data_len = data_len;
+    memcpy(node_ptr->data(), data, data_len);
     node_ptr->overwrite = overwrite;
 
     node_ptr->type = MABAIN_ASYNC_TYPE_ADD;
     return SHMQ_PrepareSlot(node_ptr);
 }
 
+// Queue a value larger than a slot in parts. Nothing is queued if the first
+// part does not get a slot; after that each part waits for a slot, and the
+// writer drops the transfer if the rest does not arrive.
+int Dict::shmqAddParts(const char* key, int key_len, const char* data, int data_len,
+    bool overwrite)
+{
+    static std::atomic<uint32_t> transfer_seq(0);
+    AsyncPartHeader part_hdr;
+    part_hdr.transfer_id = (static_cast<uint64_t>(getpid()) << 32)
+        | transfer_seq.fetch_add(1, std::memory_order_relaxed);
+    part_hdr.value_len = data_len;
+
+    int part_len;
+    for (int pos = 0; pos < data_len; pos += part_len) {
+        part_len = std::min(data_len - pos, MB_ASYNC_SHM_PART_SIZE);
+        int err = MBError::SUCCESS;
+        int retry_cnt = 0;
+        AsyncNode* node_ptr;
+        int node_data_len = sizeof(part_hdr) + part_len;
+        while ((node_ptr = SHMQ_AcquireSlot(key_len, node_data_len, err)) == nullptr) {
+            if (pos == 0 || retry_cnt++ > MB_SHM_RETRY_TIMEOUT)
+                return err;
+            usleep(1);
+        }
+
+        part_hdr.part_offset = pos;
+        memcpy(node_ptr->key, key, key_len);
+        memcpy(node_ptr->data(), &part_hdr, sizeof(part_hdr));
+        memcpy(node_ptr->data() + sizeof(part_hdr), data + pos, part_len);
+        node_ptr->overwrite = overwrite;
+
+        node_ptr->type = MABAIN_ASYNC_TYPE_ADD_PART;
+        SHMQ_PrepareSlot(node_ptr);
+    }
+    return MBError::SUCCESS;
+}
+
 int Dict::SHMQ_Remove(const char* key, int len)
 {
-    if (len > MB_ASYNC_SHM_KEY_SIZE)
+    if (len > CONSTS::MAX_KEY_LENGHTH)
         return MBError::OUT_OF_BOUND;
 
     int err = MBError::SUCCESS;
-    AsyncNode* node_ptr = SHMQ_AcquireSlot(err);
+    AsyncNode* node_ptr = SHMQ_AcquireSlot(len, 0, err);
     if (node_ptr == nullptr)
         return err;
 
     memcpy(node_ptr->key, key, len);
-    node_ptr->key_len = len;
     node_ptr->type = MABAIN_ASYNC_TYPE_REMOVE;
     return SHMQ_PrepareSlot(node_ptr);
 }
@@ -67,7 +105,7 @@ int Dict::SHMQ_Remove(const char* key, int len)
 int Dict::SHMQ_RemoveAll()
 {
     int err = MBError::SUCCESS;
-    AsyncNode* node_ptr = SHMQ_AcquireSlot(err);
+    AsyncNode* node_ptr = SHMQ_AcquireSlot(0, 0, err);
     if (node_ptr == nullptr)
         return err;
 
@@ -75,18 +113,42 @@ int Dict::SHMQ_RemoveAll()
     return SHMQ_PrepareSlot(node_ptr);
 }
 
+int Dict::SHMQ_Update(const char* key, int key_len, int type, const char* operand,
+    int operand_len)
+{
+    if (type != MABAIN_ASYNC_TYPE_INCREMENT && type != MABAIN_ASYNC_TYPE_APPEND
+        && type != MABAIN_ASYNC_TYPE_MERGE)
+        return MBError::INVALID_ARG;
+    if (key_len > CONSTS::MAX_KEY_LENGHTH || operand_len > MB_ASYNC_SHM_DATA_SIZE) {
+        return MBError::OUT_OF_BOUND;
+    }
+
+    int err = MBError::SUCCESS;
+    AsyncNode* node_ptr = SHMQ_AcquireSlot(key_len, operand_len, err);
+    if (node_ptr == nullptr)
+        return err;
+
+    memcpy(node_ptr->key, key, key_len);
+    memcpy(node_ptr->data(), operand, operand_len);
+    node_ptr->overwrite = true;
+
+    node_ptr->type = type;
+    return SHMQ_PrepareSlot(node_ptr);
+}
+
 int Dict::SHMQ_Backup(const char* backup_dir)
 {
     if (backup_dir == nullptr)
         return MBError::INVALID_ARG;
-    if (strlen(backup_dir) >= MB_ASYNC_SHM_DATA_SIZE)
+    int dir_len = strlen(backup_dir);
+    if (dir_len >= MB_ASYNC_SHM_DATA_SIZE)
         return MBError::OUT_OF_BOUND;
 
     int err = MBError::SUCCESS;
-    AsyncNode* node_ptr = SHMQ_AcquireSlot(err);
+    AsyncNode* node_ptr = SHMQ_AcquireSlot(0, dir_len + 1, err);
     if (node_ptr == nullptr)
         return err;
-    snprintf(node_ptr->data, MB_ASYNC_SHM_DATA_SIZE, "%s", backup_dir);
+    memcpy(node_ptr->data(), backup_dir, dir_len + 1);
     node_ptr->type = MABAIN_ASYNC_TYPE_BACKUP;
     return SHMQ_PrepareSlot(node_ptr);
 }
@@ -97,12 +159,11 @@ int Dict::SHMQ_CollectResource(int64_t m_index_rc_size,
     int64_t max_dbcnt)
 {
     int err = MBError::SUCCESS;
-    AsyncNode* node_ptr = SHMQ_AcquireSlot(err);
+    AsyncNode* node_ptr = SHMQ_AcquireSlot(0, sizeof(int64_t) * 4, err);
     if (node_ptr == nullptr)
         return err;
 
-    int64_t* data_ptr = reinterpret_cast<int64_t*>(node_ptr->data);
-    node_ptr->data_len = sizeof(int64_t) * 4;
+    int64_t* data_ptr = reinterpret_cast<int64_t*>(node_ptr->data());
     data_ptr[0] = m_index_rc_size;
     data_ptr[1] = m_data_rc_size;
     data_ptr[2] = max_dbsz;
@@ -112,44 +173,128 @@ int Dict::SHMQ_CollectResource(int64_t m_index_rc_size,
     return SHMQ_PrepareSlot(node_ptr);
 }
 
-AsyncNode* Dict::SHMQ_AcquireSlot(int& err) const
+// Reserve a record for key_len bytes of key and data_len bytes of data in the
+// lane of this handle. Readers reserve records by moving the tail of the
+// lane; the writer frees them by moving the head. If the record does not fit
+// before the end of the ring, the rest of the ring is reserved as padding as
+// well.
+AsyncNode* Dict::SHMQ_AcquireSlot(int key_len, int data_len, int& err) const
 {
-    uint32_t index = header->queue_index.fetch_add(1, std::memory_order_release);
-    AsyncNode* node_ptr = queue + (index % header->async_queue_size);
+    uint64_t size = MB_ASYNC_SHM_RECORD_SIZE(key_len + data_len);
+    uint64_t ring_size = slaq->ring_size;
+    AsyncLane& lane = slaq->lanes[shmq_lane];
+    uint64_t tail = lane.tail.load(std::memory_order_relaxed);
+    uint64_t pad;
+    do {
+        uint64_t offset = tail % ring_size;
+        pad = (offset + size > ring_size) ? ring_size - offset : 0;
+        if (tail + pad + size - lane.head.load(std::memory_order_acquire) > ring_size) {
+            // The writer has not caught up yet.
+            err = MBError::TRY_AGAIN;
+            return nullptr;
+        }
+    } while (!lane.tail.compare_exchange_weak(tail, tail + pad + size,
+        std::memory_order_acquire, std::memory_order_relaxed));
 
-    if (node_ptr->in_use.load(std::memory_order_consume)) {
-        // This slot is being processed by writer.
-        err = MBError::TRY_AGAIN;
-        return nullptr;
-    }
-
-    uint16_t nreader = node_ptr->num_reader.fetch_add(1, std::memory_order_release);
-    if (nreader != 0) {
-        // This slot is being processed by another reader.
-        err = MBError::TRY_AGAIN;
-        return nullptr;
+    if (pad > 0) {
+        AsyncNode* pad_ptr = slaq->node(shmq_lane, tail);
+        pad_ptr->pos = tail;
+        pad_ptr->size = pad;
+        pad_ptr->key_len = 0;
+        pad_ptr->data_len = 0;
+        pad_ptr->type = MABAIN_ASYNC_TYPE_NONE;
+        pad_ptr->ready.store(tail + 1, std::memory_order_release);
+        tail += pad;
     }
 
+    AsyncNode* node_ptr = slaq->node(shmq_lane, tail);
+    node_ptr->pos = tail;
+    node_ptr->size = size;
+    node_ptr->key_len = key_len;
+    node_ptr->data_len = data_len;
+    node_ptr->overwrite = false;
     return node_ptr;
 }
 
 int Dict::SHMQ_PrepareSlot(AsyncNode* node_ptr)
 {
-    node_ptr->in_use.store(true, std::memory_order_release);
+    shmq_seq = MB_ASYNC_SHM_SEQ(shmq_lane, node_ptr->pos + node_ptr->size);
+    header->queue_index.fetch_add(1, std::memory_order_relaxed);
+    node_ptr->ready.store(node_ptr->pos + 1, std::memory_order_release);
 
-    mbp.Signal();
+    // Pairs with the fence in AsyncWriter::WaitForNode: either the writer
+    // sees the record before it parks or this reader sees it parked.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (slaq->writer_parked.load(std::memory_order_relaxed))
+        SHMQ_Signal();
     return MBError::SUCCESS;
 }
 
+// Wake the async writer. Only the reader that clears writer_parked makes the
+// wake system call; the others see the writer awake.
 void Dict::SHMQ_Signal()
 {
+#ifdef __linux__
+    if (slaq->writer_parked.exchange(0) != 0)
+        ShmFutexWake(&slaq->writer_parked, 1);
+#else
     mbp.Signal();
+#endif
+}
+
+// Whether the async writer has processed the lane of seq up to seq
+bool Dict::SHMQ_Applied(uint64_t seq) const
+{
+    return header->async_applied_seq[MB_ASYNC_SHM_SEQ_LANE(seq)].load(std::memory_order_acquire)
+        >= MB_ASYNC_SHM_SEQ_POS(seq);
+}
+
+// Wait until the async writer has processed the lane of seq up to seq. A
+// negative timeout waits without limit.
+int Dict::SHMQ_WaitApplied(uint64_t seq, int timeout_ms) const
+{
+    if (SHMQ_Applied(seq))
+        return MBError::SUCCESS;
+
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    int rval = MBError::SUCCESS;
+    header->async_applied_waiters.fetch_add(1);
+    while (true) {
+        uint32_t event = header->async_applied_event.load(std::memory_order_acquire);
+        if (SHMQ_Applied(seq))
+            break;
+
+        int wait_ms = 1000;
+        if (timeout_ms >= 0) {
+            gettimeofday(&now, NULL);
+            int elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+            if (elapsed_ms >= timeout_ms) {
+                rval = MBError::TIMEOUT;
+                break;
+            }
+            wait_ms = std::min(wait_ms, timeout_ms - elapsed_ms);
+        }
+#ifdef __linux__
+        ShmFutexWait(&header->async_applied_event, event, wait_ms);
+#else
+        // Poll where there is no futex.
+        (void)event;
+        usleep(1000);
+#endif
+    }
+    header->async_applied_waiters.fetch_sub(1);
+    return rval;
 }
 
 bool Dict::SHMQ_Busy() const
 {
-    if ((header->queue_index.load(std::memory_order_consume) != header->writer_index) || header->rc_flag == 1)
+    if (header->rc_flag == 1)
         return true;
+    for (uint32_t i = 0; i < slaq->num_lanes; i++) {
+        if (slaq->lanes[i].tail.load(std::memory_order_consume) != slaq->lanes[i].head.load(std::memory_order_consume))
+            return true;
+    }
 
     size_t rc_off = header->rc_root_offset.load(std::memory_order_consume);
     return rc_off != 0;
@@ -0,0 +1,191 @@
+/**
+ * Benchmark for the negative-lookup Bloom filter.
+ * Usage: ./bloom_filter_bench <n> [mbdir]
+ *   n: number of keys
+ *   mbdir: parent directory of the two databases (default: /var/tmp/mabain_test/)
+ * The same keys are loaded into a DB written without OPTION_BLOOM_FILTER and
+ * one written with it. Readers then run a mix of 40% hits and 60% misses;
+ * misses share all but the last byte with a key so that they walk the tree
+ * to the bottom. A tenth of the keys is removed to show the false positives
+ * they cause, and resource collection is run to rebuild the filter. Every
+ * lookup must return the expected result.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static const size_t MEMCAP = 512ULL << 20;
+
+static DB* open_db(const std::string& dir, int options, uint32_t filter_size)
+{
+    MBConfig config;
+    memset(&config, 0, sizeof(config));
+    config.mbdir = dir.c_str();
+    config.options = options;
+    config.memcap_index = MEMCAP;
+    config.memcap_data = MEMCAP;
+    config.bloom_filter_size = filter_size;
+    return new DB(config);
+}
+
+struct Probe {
+    std::string key;
+    size_t index; // of the key it was made from
+    bool hit;
+};
+
+static size_t count_misses(const std::vector<Probe>& probes)
+{
+    return std::count_if(probes.begin(), probes.end(), [](const Probe& p) { return !p.hit; });
+}
+
+// Average Find latency over probes; counts lookups whose result is not expected.
+static double time_finds(DB& db, const std::vector<Probe>& probes, size_t& errors)
+{
+    MBData mbd;
+    auto t0 = std::chrono::steady_clock::now();
+    for (const Probe& probe : probes) {
+        int rval = db.Find(probe.key, mbd);
+        if (rval != (probe.hit ? MBError::SUCCESS : MBError::NOT_EXIST))
+            errors++;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / probes.size();
+}
+
+static void report(const char* name, DB& reader, const std::vector<Probe>& probes, size_t& errors)
+{
+    size_t misses = count_misses(probes);
+    // Warm up once so that both DBs are measured from the page cache.
+    time_finds(reader, probes, errors);
+    uint64_t skips = reader.GetBloomFilterSkipCount();
+    uint64_t false_positives = reader.GetBloomFilterFalsePositiveCount();
+    double ns = time_finds(reader, probes, errors);
+    skips = reader.GetBloomFilterSkipCount() - skips;
+    false_positives = reader.GetBloomFilterFalsePositiveCount() - false_positives;
+    std::cout << name << ns << " ns/find, " << skips << " skipped, " << false_positives
+              << " false positives (" << 100.0 * false_positives / misses << "% of misses)\n";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    std::string mbdir = (argc >= 3) ? argv[2] : std::string("/var/tmp/mabain_test/");
+    if (n == 0 || n > 0xFFFFFFFFULL) {
+        std::cerr << "n must be positive and fit in 32 bits\n";
+        return 1;
+    }
+    const std::string plain_dir = mbdir + "plain/";
+    const std::string bloom_dir = mbdir + "bloom/";
+    std::string cmd = "mkdir -p " + plain_dir + " " + bloom_dir + " && rm -f " + plain_dir + "_* " + bloom_dir + "_*";
+    if (system(cmd.c_str()) != 0) {
+        std::cerr << "failed to prepare " << mbdir << "\n";
+        return 1;
+    }
+
+    std::mt19937_64 rng(0xB100);
+    std::vector<std::string> keys(n);
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)rng());
+        keys[i] = buf;
+    }
+    std::vector<Probe> probes;
+    for (size_t i = 0; i < n; i++) {
+        if (i % 5 < 2) {
+            probes.push_back({ keys[i], i, true });
+        } else {
+            // Upper-case hex never occurs in keys.
+            std::string miss = keys[i];
+            miss.back() = 'X';
+            probes.push_back({ miss, i, false });
+        }
+    }
+    std::shuffle(probes.begin(), probes.end(), rng);
+
+    size_t errors = 0;
+    DB* plain = open_db(plain_dir, CONSTS::WriterOptions(), 0);
+    DB* bloom = open_db(bloom_dir, CONSTS::WriterOptions() | CONSTS::OPTION_BLOOM_FILTER, n);
+    if (!plain->is_open() || !bloom->is_open()) {
+        std::cerr << "failed to open db\n";
+        return 2;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    for (const std::string& key : keys) {
+        if (plain->Add(key, key) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            return 2;
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (const std::string& key : keys) {
+        if (bloom->Add(key, key) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            return 2;
+        }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    std::cout << "Entries: " << n << ", add " << std::chrono::duration<double, std::nano>(t1 - t0).count() / n
+              << " ns plain, " << std::chrono::duration<double, std::nano>(t2 - t1).count() / n
+              << " ns with filter\n";
+
+    DB* plain_reader = open_db(plain_dir, CONSTS::ReaderOptions(), 0);
+    DB* bloom_reader = open_db(bloom_dir, CONSTS::ReaderOptions() | CONSTS::OPTION_BLOOM_FILTER, 0);
+    if (!plain_reader->is_open() || !bloom_reader->is_open()) {
+        std::cerr << "failed to open readers\n";
+        return 2;
+    }
+    report("Plain:     ", *plain_reader, probes, errors);
+    report("Filter:    ", *bloom_reader, probes, errors);
+
+    // Removed keys stay in the filter until resource collection rebuilds it.
+    for (size_t i = 0; i < n; i += 10) {
+        if (bloom->Remove(keys[i]) != MBError::SUCCESS) {
+            std::cerr << "Remove failed\n";
+            return 2;
+        }
+    }
+    for (Probe& probe : probes) {
+        if (probe.index % 10 == 0)
+            probe.hit = false;
+    }
+    report("Removed:   ", *bloom_reader, probes, errors);
+    t0 = std::chrono::steady_clock::now();
+    bloom->CollectResource(1, 1);
+    t1 = std::chrono::steady_clock::now();
+    std::cout << "Rebuild:   " << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms\n";
+    report("Rebuilt:   ", *bloom_reader, probes, errors);
+
+    plain_reader->Close();
+    bloom_reader->Close();
+    plain->Close();
+    bloom->Close();
+    delete plain_reader;
+    delete bloom_reader;
+    delete plain;
+    delete bloom;
+
+    if (errors != 0) {
+        std::cerr << errors << " lookup errors\n";
+        return 4;
+    }
+    return 0;
+}
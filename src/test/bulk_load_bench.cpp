@@ -0,0 +1,179 @@
+/**
+ * Benchmark for the bulk loader.
+ * Usage: ./bulk_load_bench <n> [mbdir] [threads]
+ *   n: number of keys
+ *   mbdir: parent directory of the databases (default: /var/tmp/mabain_test/)
+ *   threads: largest number of threads for ParallelBulkLoader (default: 4)
+ * The same sorted keys are loaded into a fresh DB with a loop of Add calls,
+ * with BulkLoader, and with ParallelBulkLoader for 1, 2, 4, ... threads.
+ * Every DB is checked to hold all keys afterwards, and the index size of
+ * each is printed.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../bulk_loader.h"
+#include "../db.h"
+#include "../dict.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static const size_t MEMCAP = 512ULL << 20;
+
+static DB* open_db(const std::string& dir)
+{
+    std::string cmd = "mkdir -p " + dir + " && rm -f " + dir + "_*";
+    if (system(cmd.c_str()) != 0)
+        return nullptr;
+    MBConfig config;
+    memset(&config, 0, sizeof(config));
+    config.mbdir = dir.c_str();
+    config.options = CONSTS::WriterOptions();
+    config.memcap_index = MEMCAP;
+    config.memcap_data = MEMCAP;
+    return new DB(config);
+}
+
+static size_t count_missing(DB& db, const std::vector<std::string>& keys)
+{
+    MBData mbd;
+    size_t missing = 0;
+    for (const std::string& key : keys) {
+        if (db.Find(key, mbd) != MBError::SUCCESS || mbd.data_len != (int)key.size())
+            missing++;
+    }
+    if (db.Count() != (int64_t)keys.size())
+        missing++;
+    return missing;
+}
+
+static void report(const char* name, DB* db, double ns, double base)
+{
+    IndexHeader* header = db->GetDictPtr()->GetHeaderPtr();
+    printf("%-12s %8.1f ns/key (%.2fx), index %zu bytes\n", name, ns, base / ns,
+        header->m_index_offset);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    std::string mbdir = (argc >= 3) ? argv[2] : std::string("/var/tmp/mabain_test/");
+    int max_threads = (argc >= 4) ? atoi(argv[3]) : 4;
+    if (n == 0 || n > 0xFFFFFFFFULL) {
+        std::cerr << "n must be positive and fit in 32 bits\n";
+        return 1;
+    }
+
+    std::mt19937_64 rng(0xB01C);
+    std::vector<std::string> keys(n);
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)rng());
+        keys[i] = buf;
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    size_t errors = 0;
+    DB* db = open_db(mbdir + "add/");
+    if (db == nullptr || !db->is_open()) {
+        std::cerr << "failed to open db\n";
+        return 2;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    for (const std::string& key : keys) {
+        if (db->Add(key, key) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            return 2;
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double base = std::chrono::duration<double, std::nano>(t1 - t0).count() / keys.size();
+    report("Add loop:", db, base, base);
+    errors += count_missing(*db, keys);
+    db->Close();
+    delete db;
+
+    db = open_db(mbdir + "bulk/");
+    if (db == nullptr || !db->is_open()) {
+        std::cerr << "failed to open db\n";
+        return 2;
+    }
+    t0 = std::chrono::steady_clock::now();
+    {
+        BulkLoader loader(*db);
+        for (const std::string& key : keys) {
+            if (loader.Add(key, key) != MBError::SUCCESS) {
+                std::cerr << "BulkLoader::Add failed\n";
+                return 2;
+            }
+        }
+        if (loader.Finish() != MBError::SUCCESS) {
+            std::cerr << "BulkLoader::Finish failed\n";
+            return 2;
+        }
+    }
+    t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / keys.size();
+    report("BulkLoader:", db, ns, base);
+    errors += count_missing(*db, keys);
+    db->Close();
+    delete db;
+
+    // Partition c holds the keys in [starts[c], starts[c + 1]).
+    std::vector<size_t> starts(NUM_ALPHABET + 1);
+    for (int c = 0; c <= NUM_ALPHABET; c++) {
+        starts[c] = std::lower_bound(keys.begin(), keys.end(), std::string(1, static_cast<char>(c)))
+            - keys.begin();
+    }
+    starts[NUM_ALPHABET] = keys.size();
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        db = open_db(mbdir + "parallel/");
+        if (db == nullptr || !db->is_open()) {
+            std::cerr << "failed to open db\n";
+            return 2;
+        }
+        t0 = std::chrono::steady_clock::now();
+        ParallelBulkLoader loader(*db, threads);
+        int rval = loader.Load([&keys, &starts](int c, BulkLoader& partition) {
+            for (size_t i = starts[c]; i < starts[c + 1]; i++) {
+                int rval = partition.Add(keys[i], keys[i]);
+                if (rval != MBError::SUCCESS)
+                    return rval;
+            }
+            return static_cast<int>(MBError::SUCCESS);
+        });
+        if (rval != MBError::SUCCESS) {
+            std::cerr << "ParallelBulkLoader::Load failed\n";
+            return 2;
+        }
+        t1 = std::chrono::steady_clock::now();
+        ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / keys.size();
+        std::string name = "Parallel(" + std::to_string(threads) + "):";
+        report(name.c_str(), db, ns, base);
+        errors += count_missing(*db, keys);
+        db->Close();
+        delete db;
+    }
+
+    if (errors != 0) {
+        std::cerr << errors << " lookup errors\n";
+        return 4;
+    }
+    return 0;
+}
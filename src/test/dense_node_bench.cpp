@@ -0,0 +1,160 @@
+/**
+ * Benchmark for the dense node index.
+ * Usage: ./dense_node_bench <n> [mbdir]
+ *   n: number of random 8-byte keys
+ *   mbdir: parent directory of the two databases (default: /var/tmp/mabain_test/)
+ * The same keys are loaded into a DB written without OPTION_DENSE_NODE_INDEX
+ * and one written with it. Index size and Find latency for hits and misses
+ * are reported for both; the first DB is then migrated by resource
+ * collection and measured again (its index size then also reflects the
+ * defragmentation). Every key must be found with its value.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static const size_t MEMCAP = 512ULL << 20;
+
+static DB* open_writer(const std::string& dir, int options)
+{
+    MBConfig config;
+    memset(&config, 0, sizeof(config));
+    config.mbdir = dir.c_str();
+    config.options = CONSTS::WriterOptions() | options;
+    config.memcap_index = MEMCAP;
+    config.memcap_data = MEMCAP;
+    return new DB(config);
+}
+
+static size_t index_size(DB& db)
+{
+    return db.GetDictPtr()->GetHeaderPtr()->m_index_offset;
+}
+
+// Average Find latency over keys; counts keys whose result is not expected.
+static double time_finds(DB& db, const std::vector<std::string>& keys, bool hit, size_t& errors)
+{
+    MBData mbd;
+    auto t0 = std::chrono::steady_clock::now();
+    for (const std::string& key : keys) {
+        int rval = db.Find(key, mbd);
+        if (hit) {
+            if (rval != MBError::SUCCESS || mbd.data_len != 8 || memcmp(mbd.buff, key.data(), 8) != 0)
+                errors++;
+        } else if (rval != MBError::NOT_EXIST) {
+            errors++;
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / keys.size();
+}
+
+static void report(const char* name, DB& writer, const std::string& dir,
+    const std::vector<std::string>& keys, const std::vector<std::string>& misses, size_t& errors)
+{
+    DB reader(dir.c_str(), CONSTS::ReaderOptions(), MEMCAP, MEMCAP);
+    if (!reader.is_open()) {
+        std::cerr << "failed to open reader for " << dir << "\n";
+        errors++;
+        return;
+    }
+    // Warm up once so both layouts are measured from the page cache.
+    time_finds(reader, keys, true, errors);
+    double hit_ns = time_finds(reader, keys, true, errors);
+    double miss_ns = time_finds(reader, misses, false, errors);
+    std::cout << name << "index " << index_size(writer) / 1024 << " KB, find " << hit_ns
+              << " ns, miss " << miss_ns << " ns\n";
+    reader.Close();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    std::string mbdir = (argc >= 3) ? argv[2] : std::string("/var/tmp/mabain_test/");
+    if (n == 0) {
+        std::cerr << "n must be positive\n";
+        return 1;
+    }
+    const std::string plain_dir = mbdir + "plain/";
+    const std::string dense_dir = mbdir + "dense/";
+    std::string cmd = "mkdir -p " + plain_dir + " " + dense_dir + " && rm -f " + plain_dir + "_* " + dense_dir + "_*";
+    if (system(cmd.c_str()) != 0) {
+        std::cerr << "failed to prepare " << mbdir << "\n";
+        return 1;
+    }
+
+    // Random keys make the top levels of the tree dense.
+    std::mt19937_64 rng(0xDE45E);
+    std::vector<std::string> keys(n);
+    std::vector<std::string> misses(n);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t k = rng();
+        keys[i].assign(reinterpret_cast<const char*>(&k), sizeof(k));
+        // Misses share the first seven bytes of a key.
+        k ^= 0xFF00000000000000ULL;
+        misses[i].assign(reinterpret_cast<const char*>(&k), sizeof(k));
+    }
+
+    size_t errors = 0;
+    DB* plain = open_writer(plain_dir, 0);
+    DB* dense = open_writer(dense_dir, CONSTS::OPTION_DENSE_NODE_INDEX);
+    if (!plain->is_open() || !dense->is_open()) {
+        std::cerr << "failed to open db\n";
+        return 2;
+    }
+    for (const std::string& key : keys) {
+        if (plain->Add(key, key) != MBError::SUCCESS || dense->Add(key, key) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            return 2;
+        }
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+
+    std::cout << "Entries: " << n << "\n";
+    report("Plain:    ", *plain, plain_dir, keys, misses, errors);
+    report("Indexed:  ", *dense, dense_dir, keys, misses, errors);
+    dense->Close();
+    delete dense;
+
+    // Reopen the plain DB with the option and let resource collection
+    // convert its dense nodes.
+    plain->Close();
+    delete plain;
+    plain = open_writer(plain_dir, CONSTS::OPTION_DENSE_NODE_INDEX);
+    if (!plain->is_open()) {
+        std::cerr << "failed to reopen db\n";
+        return 2;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    plain->CollectResource(1, 1);
+    auto t1 = std::chrono::steady_clock::now();
+    std::cout << "Migration: " << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms\n";
+    report("Migrated: ", *plain, plain_dir, keys, misses, errors);
+    plain->Close();
+    delete plain;
+
+    if (errors != 0) {
+        std::cerr << errors << " lookup errors\n";
+        return 4;
+    }
+    return 0;
+}
@@ -0,0 +1,223 @@
+/**
+ * Concurrency test for DB::FindView against resource collection.
+ * Usage: ./find_view_rc_test [n] [readers] [seconds] [mbdir]
+ *   n: number of stable keys (default: 20000)
+ *   readers: number of reader threads holding views (default: 4)
+ *   seconds: duration of the concurrent phase (default: 10)
+ *   mbdir: database directory (default: /var/tmp/mabain_test/)
+ * Readers hold zero-copy views on stable keys while a client churns other
+ * keys and keeps requesting defragmentation from the async writer. Every view
+ * is checked when taken and again just before it is released; any change in
+ * the viewed bytes means the value was relocated under a live view.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static std::string stable_key(int i)
+{
+    return "stable_" + std::to_string(i);
+}
+
+static int value_len(int i)
+{
+    return 2048 + (i * 37) % 6000;
+}
+
+static void fill_value(int i, std::string& value)
+{
+    value.resize(value_len(i));
+    for (size_t j = 0; j < value.size(); j++)
+        value[j] = static_cast<char>((i * 131 + j * 7) & 0xFF);
+}
+
+static bool check_value(int i, const uint8_t* data, int len)
+{
+    if (data == NULL || len != value_len(i))
+        return false;
+    for (int j = 0; j < len; j++) {
+        if (data[j] != static_cast<uint8_t>((i * 131 + j * 7) & 0xFF))
+            return false;
+    }
+    return true;
+}
+
+// Deterministic single-process check: a pinned view must make data
+// defragmentation back off, and it must run again once the view is released.
+static int check_rc_skip(const std::string& mbdir, int n)
+{
+    DB db(mbdir.c_str(), CONSTS::WriterOptions(), 256LL << 20, 256LL << 20);
+    if (!db.is_open()) {
+        std::cerr << "failed to open writer: " << db.StatusStr() << "\n";
+        return 2;
+    }
+    std::string value;
+    for (int i = 0; i < n; i++) {
+        fill_value(i, value);
+        std::string key = "garbage_" + std::to_string(i);
+        db.Add(key, value);
+        db.Remove(key);
+    }
+    int64_t pending = db.GetPendingDataBufferSize();
+
+    MBDataView view;
+    if (db.FindView(stable_key(0), view) != MBError::SUCCESS || !view.IsPinned()) {
+        std::cerr << "expected a pinned view on " << stable_key(0) << "\n";
+        return 3;
+    }
+    if (db.CollectResource(1, 1) != MBError::SUCCESS || db.GetPendingDataBufferSize() != pending) {
+        std::cerr << "data defragmentation ran while a view was pinned\n";
+        return 3;
+    }
+    if (!check_value(0, view.data, view.data_len)) {
+        std::cerr << "pinned view changed\n";
+        return 3;
+    }
+    view.Release();
+    if (db.CollectResource(1, 1) != MBError::SUCCESS || db.GetPendingDataBufferSize() >= pending) {
+        std::cerr << "data defragmentation did not run after the view was released\n";
+        return 3;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int n = (argc >= 2) ? std::atoi(argv[1]) : 20000;
+    int nreaders = (argc >= 3) ? std::atoi(argv[2]) : 4;
+    int seconds = (argc >= 4) ? std::atoi(argv[3]) : 10;
+    std::string mbdir = (argc >= 5) ? argv[4] : std::string("/var/tmp/mabain_test/");
+    if (n <= 0 || nreaders <= 0 || seconds <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [n] [readers] [seconds] [mbdir]\n";
+        return 1;
+    }
+
+    {
+        DB db(mbdir.c_str(), CONSTS::WriterOptions(), 256LL << 20, 256LL << 20);
+        if (!db.is_open()) {
+            std::cerr << "failed to open writer: " << db.StatusStr() << "\n";
+            return 2;
+        }
+        std::string value;
+        for (int i = 0; i < n; i++) {
+            fill_value(i, value);
+            if (db.Add(stable_key(i), value) != MBError::SUCCESS) {
+                std::cerr << "failed to add " << stable_key(i) << "\n";
+                return 2;
+            }
+        }
+    }
+
+    DB writer(mbdir.c_str(), CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE,
+        256LL << 20, 256LL << 20);
+    if (!writer.is_open()) {
+        std::cerr << "failed to open async writer: " << writer.StatusStr() << "\n";
+        return 2;
+    }
+
+    std::atomic<bool> stop { false };
+    std::atomic<uint64_t> pinned { 0 };
+    std::atomic<uint64_t> copied { 0 };
+    std::atomic<uint64_t> failures { 0 };
+    std::atomic<uint64_t> rc_requests { 0 };
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < nreaders; t++) {
+        readers.emplace_back([&, t]() {
+            DB db(mbdir.c_str(), CONSTS::ReaderOptions(), 256LL << 20, 256LL << 20);
+            if (!db.is_open()) {
+                failures++;
+                return;
+            }
+            std::mt19937 rng(t + 1);
+            std::uniform_int_distribution<int> key_dist(0, n - 1);
+            std::uniform_int_distribution<int> hold_dist(0, 200);
+            MBDataView view;
+            while (!stop.load(std::memory_order_relaxed)) {
+                int i = key_dist(rng);
+                if (db.FindView(stable_key(i), view) != MBError::SUCCESS
+                    || !check_value(i, view.data, view.data_len)) {
+                    failures++;
+                    continue;
+                }
+                if (view.IsPinned())
+                    pinned++;
+                else
+                    copied++;
+                std::this_thread::sleep_for(std::chrono::microseconds(hold_dist(rng)));
+                // A view invalidated by the writer may have changed.
+                if (!check_value(i, view.data, view.data_len) && view.Valid()) {
+                    if (failures++ < 10)
+                        std::cerr << "view on " << stable_key(i) << " changed while held\n";
+                }
+                view.Release();
+                std::this_thread::sleep_for(std::chrono::microseconds(hold_dist(rng)));
+            }
+        });
+    }
+
+    std::thread churn([&]() {
+        DB db(mbdir.c_str(), CONSTS::ReaderOptions(), 256LL << 20, 256LL << 20);
+        if (!db.is_open()) {
+            failures++;
+            return;
+        }
+        std::string value;
+        int round = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            for (int i = 0; i < 2000; i++) {
+                std::string key = "churn_" + std::to_string(i);
+                fill_value(i + round, value);
+                db.AddAsync(key.data(), key.size(), value.data(), value.size(), true);
+            }
+            for (int i = 0; i < 2000; i += 2) {
+                std::string key = "churn_" + std::to_string(i);
+                db.RemoveAsync(key.data(), key.size());
+            }
+            if (db.CollectResource(1, 1, MAX_6B_OFFSET, MAX_6B_OFFSET) == MBError::SUCCESS)
+                rc_requests++;
+            round++;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    churn.join();
+    for (auto& thr : readers)
+        thr.join();
+
+    // All stable keys must still read back intact.
+    {
+        DB db(mbdir.c_str(), CONSTS::ReaderOptions(), 256LL << 20, 256LL << 20);
+        MBDataView view;
+        for (int i = 0; i < n; i++) {
+            if (db.FindView(stable_key(i), view) != MBError::SUCCESS
+                || !check_value(i, view.data, view.data_len))
+                failures++;
+        }
+    }
+    writer.Close();
+
+    std::cout << "Pinned views:   " << pinned << "\n"
+              << "Copied views:   " << copied << "\n"
+              << "RC requests:    " << rc_requests << "\n"
+              << "Failures:       " << failures << "\n";
+    if (failures != 0 || pinned == 0)
+        return 4;
+
+    return check_rc_skip(mbdir, n);
+}
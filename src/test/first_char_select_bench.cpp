@@ -0,0 +1,138 @@
+/**
+ * Micro-benchmark for the first-char selection kernels used at every
+ * traversal level (scalar vs SSE2 vs AVX2, whichever the CPU supports).
+ * Usage: ./first_char_select_bench [iterations]
+ * Each fan-out profile builds a pool of node first-char tables, sorted or
+ * unsorted, and probes them with a mix of present and absent keys. All
+ * kernels are checked against the scalar results before timing.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "../detail/first_char_select.h"
+
+using namespace mabain;
+
+struct Profile {
+    const char* name;
+    int min_nt;
+    int max_nt;
+    bool sorted;
+};
+
+struct NodePool {
+    std::vector<uint8_t> chars; // NUM_ALPHABET bytes per node
+    std::vector<int> nts;
+    std::vector<bool> sorted;
+    std::vector<uint8_t> probes; // one probe key per node
+};
+
+static NodePool build_pool(const Profile& p, int num_nodes, std::mt19937& rng)
+{
+    NodePool pool;
+    pool.chars.resize((size_t)num_nodes * 256);
+    std::vector<int> alphabet(256);
+    std::iota(alphabet.begin(), alphabet.end(), 0);
+    std::uniform_int_distribution<int> nt_dist(p.min_nt, p.max_nt);
+    for (int n = 0; n < num_nodes; n++) {
+        int nt = nt_dist(rng);
+        std::shuffle(alphabet.begin(), alphabet.end(), rng);
+        uint8_t* fc = &pool.chars[(size_t)n * 256];
+        for (int i = 0; i < nt; i++)
+            fc[i] = static_cast<uint8_t>(alphabet[i]);
+        if (p.sorted)
+            std::sort(fc, fc + nt);
+        pool.nts.push_back(nt);
+        pool.sorted.push_back(p.sorted);
+        // 3 out of 4 probes hit, the rest are mostly misses
+        if (rng() % 4 != 0)
+            pool.probes.push_back(fc[rng() % nt]);
+        else
+            pool.probes.push_back(static_cast<uint8_t>(alphabet[std::min(nt, 255)]));
+    }
+    return pool;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = (argc >= 2) ? std::atoi(argv[1]) : 200;
+    if (iterations <= 0)
+        iterations = 200;
+    const int num_nodes = 4096;
+
+    const Profile profiles[] = {
+        { "leaf-ish  nt 2-4   unsorted", 2, 4, false },
+        { "small     nt 5-16  unsorted", 5, 16, false },
+        { "medium    nt 17-64 unsorted", 17, 64, false },
+        { "medium    nt 17-64 sorted", 17, 64, true },
+        { "root-near nt 128-256 unsorted", 128, 256, false },
+        { "root-near nt 128-256 sorted", 128, 256, true },
+    };
+
+    const detail::FirstCharKernel* kernels[4];
+    int num_kernels = detail::AvailableFirstCharKernels(kernels, 4);
+    std::cout << "Active kernel: " << detail::first_char_kernel->name << "\n";
+
+    std::mt19937 rng(0xBADC0DE);
+    int failures = 0;
+    for (const Profile& p : profiles) {
+        NodePool pool = build_pool(p, num_nodes, rng);
+
+        // Validate every kernel against scalar for match, select(k) and select(0)
+        for (int n = 0; n < num_nodes; n++) {
+            const uint8_t* fc = &pool.chars[(size_t)n * 256];
+            int nt = pool.nts[n];
+            uint8_t probes[2] = { pool.probes[n], 0 };
+            for (uint8_t k : probes) {
+                int m0, l0, x0;
+                kernels[0]->select(fc, nt, k, pool.sorted[n], m0, l0, x0);
+                for (int j = 1; j < num_kernels; j++) {
+                    int m, l, x;
+                    kernels[j]->select(fc, nt, k, pool.sorted[n], m, l, x);
+                    int mm = kernels[j]->match(fc, nt, k);
+                    if (m != m0 || l != l0 || x != x0 || mm != m0) {
+                        if (failures++ < 10)
+                            std::cerr << kernels[j]->name << " mismatch (" << p.name << ") nt=" << nt
+                                      << " k=" << (int)k << "\n";
+                    }
+                }
+            }
+        }
+
+        std::cout << p.name << "\n";
+        for (int j = 0; j < num_kernels; j++) {
+            const detail::FirstCharKernel* kern = kernels[j];
+            volatile int sink = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for (int it = 0; it < iterations; it++) {
+                for (int n = 0; n < num_nodes; n++)
+                    sink += kern->match(&pool.chars[(size_t)n * 256], pool.nts[n], pool.probes[n]);
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            for (int it = 0; it < iterations; it++) {
+                for (int n = 0; n < num_nodes; n++) {
+                    int m, l, x;
+                    kern->select(&pool.chars[(size_t)n * 256], pool.nts[n], pool.probes[n], pool.sorted[n], m, l, x);
+                    sink += m + l + x;
+                }
+            }
+            auto t2 = std::chrono::steady_clock::now();
+            double calls = (double)iterations * num_nodes;
+            std::cout << "\t" << kern->name << "\tmatch " << std::chrono::duration<double, std::nano>(t1 - t0).count() / calls
+                      << " ns\tselect " << std::chrono::duration<double, std::nano>(t2 - t1).count() / calls << " ns\n";
+        }
+    }
+
+    if (failures != 0) {
+        std::cerr << failures << " kernel mismatches\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**
+ * Benchmark and consistency check for the per-handle hot key cache.
+ * Usage: ./hot_key_cache_test <n> [lookups] [cache_size] [mbdir]
+ *   n: number of entries to insert
+ *   lookups: number of Zipfian lookups per mode (default: 4 * n)
+ *   cache_size: hot key cache entries (default: 4096)
+ *   mbdir: database directory (default: /var/tmp/mabain_test/)
+ * After timing Find with and without the cache, a writer thread keeps
+ * overwriting hot keys with increasing versions while a cached reader checks
+ * that it never sees a version older than one already committed.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static std::string make_key(size_t i)
+{
+    return "hot_key_" + std::to_string(i * 2654435761ULL % 1000000007ULL) + "_" + std::to_string(i);
+}
+
+static std::string make_value(const std::string& key, uint32_t version)
+{
+    return key + ":" + std::to_string(version);
+}
+
+// Parse the version from a value; -1 if it does not belong to key.
+static int64_t parse_version(const std::string& key, const MBData& mbd)
+{
+    if (mbd.data_len <= static_cast<int>(key.size()) + 1
+        || memcmp(mbd.buff, key.data(), key.size()) != 0 || mbd.buff[key.size()] != ':')
+        return -1;
+    std::string ver(reinterpret_cast<const char*>(mbd.buff) + key.size() + 1,
+        mbd.data_len - key.size() - 1);
+    return std::strtoll(ver.c_str(), nullptr, 10);
+}
+
+// Zipf(s = 1) sampler over [0, n)
+class Zipf {
+public:
+    explicit Zipf(size_t n)
+        : cdf(n)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / (i + 1);
+            cdf[i] = sum;
+        }
+        for (double& c : cdf)
+            c /= sum;
+    }
+    size_t operator()(std::mt19937_64& rng)
+    {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        size_t idx = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return idx < cdf.size() ? idx : cdf.size() - 1;
+    }
+
+private:
+    std::vector<double> cdf;
+};
+
+static std::unique_ptr<DB> open_reader(const std::string& mbdir, uint32_t cache_size)
+{
+    MBConfig config;
+    memset(&config, 0, sizeof(config));
+    config.mbdir = mbdir.c_str();
+    config.options = CONSTS::ReaderOptions();
+    config.memcap_index = 1024ULL << 20;
+    config.memcap_data = 1024ULL << 20;
+    config.hot_key_cache_size = cache_size;
+    return std::unique_ptr<DB>(new DB(config));
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [lookups] [cache_size] [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    size_t num_lookups = (argc >= 3) ? static_cast<size_t>(std::strtoull(argv[2], nullptr, 10)) : 4 * n;
+    uint32_t cache_size = (argc >= 4) ? static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)) : 4096;
+    std::string mbdir = (argc >= 5) ? argv[4] : std::string("/var/tmp/mabain_test/");
+    if (n == 0 || cache_size == 0) {
+        std::cerr << "n and cache_size must be positive\n";
+        return 1;
+    }
+
+    DB writer(mbdir.c_str(), CONSTS::WriterOptions(), 1024ULL << 20, 1024ULL << 20);
+    if (!writer.is_open()) {
+        std::cerr << "failed to open db: " << writer.StatusStr() << "\n";
+        return 2;
+    }
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        keys.emplace_back(make_key(i));
+        if (writer.Add(keys[i], make_value(keys[i], 0), true) != MBError::SUCCESS) {
+            std::cerr << "Add failed at i=" << i << "\n";
+            return 2;
+        }
+    }
+
+    Zipf zipf(n);
+    std::mt19937_64 rng(0x5EED);
+    std::vector<size_t> queries(num_lookups);
+    for (size_t& q : queries)
+        q = zipf(rng);
+
+    std::unique_ptr<DB> plain = open_reader(mbdir, 0);
+    std::unique_ptr<DB> cached = open_reader(mbdir, cache_size);
+    if (!plain->is_open() || !cached->is_open()) {
+        std::cerr << "failed to open reader\n";
+        return 2;
+    }
+
+    MBData mbd;
+    size_t mismatches = 0;
+    double avg_ns[2];
+    DB* handles[2] = { plain.get(), cached.get() };
+    for (int h = 0; h < 2; h++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t q : queries) {
+            if (handles[h]->Find(keys[q], mbd) != MBError::SUCCESS || parse_version(keys[q], mbd) != 0)
+                mismatches++;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        avg_ns[h] = std::chrono::duration<double, std::nano>(t1 - t0).count() / num_lookups;
+    }
+    std::cout << "Entries:        " << n << "\n"
+              << "Lookups:        " << num_lookups << " (zipf, cache " << cache_size << ")\n"
+              << "Avg Find:       " << avg_ns[0] << " ns\n"
+              << "Avg cached:     " << avg_ns[1] << " ns\n"
+              << "Speedup:        " << (avg_ns[1] > 0 ? avg_ns[0] / avg_ns[1] : 0.0) << "x\n";
+
+    // Writer overwrites hot keys; the cached reader must never go back in time.
+    std::vector<std::atomic<uint32_t>> committed(n);
+    for (auto& v : committed)
+        v.store(0);
+    std::atomic<bool> stop { false };
+    std::atomic<size_t> stale { 0 };
+    std::atomic<size_t> reads { 0 };
+    std::atomic<size_t> retries { 0 };
+    std::thread reader([&]() {
+        std::mt19937_64 rrng(0xFACE);
+        MBData rd;
+        while (!stop.load(std::memory_order_relaxed)) {
+            size_t k = zipf(rrng);
+            uint32_t floor = committed[k].load(std::memory_order_acquire);
+            int rval = cached->Find(keys[k], rd);
+            if (rval == MBError::TRY_AGAIN) {
+                // the writer is in the middle of updating the path
+                retries++;
+                continue;
+            }
+            reads++;
+            if (rval != MBError::SUCCESS || parse_version(keys[k], rd) < floor) {
+                if (stale++ < 10)
+                    std::cerr << "stale read on " << keys[k] << ": " << MBError::get_error_str(rval) << "\n";
+            }
+        }
+    });
+    std::mt19937_64 wrng(0xBEEF);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    size_t writes = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        size_t k = zipf(wrng);
+        uint32_t ver = committed[k].load(std::memory_order_relaxed) + 1;
+        if (writer.Add(keys[k], make_value(keys[k], ver), true) != MBError::SUCCESS) {
+            std::cerr << "overwrite failed\n";
+            break;
+        }
+        committed[k].store(ver, std::memory_order_release);
+        writes++;
+    }
+    stop = true;
+    reader.join();
+
+    std::cout << "Overwrites:     " << writes << "\n"
+              << "Checked reads:  " << reads << "\n"
+              << "Retried reads:  " << retries << "\n";
+    cached->PrintStats(std::cout);
+
+    cached->Close();
+    plain->Close();
+    writer.Close();
+    if (mismatches != 0 || stale != 0) {
+        std::cerr << mismatches << " mismatches, " << stale << " stale reads\n";
+        return 4;
+    }
+    return 0;
+}
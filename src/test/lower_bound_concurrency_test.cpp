@@ -0,0 +1,158 @@
+/**
+ * Stress test for FindLowerBound with one writer and concurrent readers.
+ * Usage: ./lower_bound_concurrency_test <n> [readers] [seconds] [mbdir]
+ *   n: key space; even keys are stable, odd keys are added and removed
+ *   readers: number of reader threads (default: 4)
+ *   seconds: test duration (default: 5)
+ *   mbdir: database directory (default: /var/tmp/mabain_test/)
+ * Every bound returned while the writer churns the odd keys must be either
+ * the stable floor of the query or the churned key sitting between that
+ * floor and the query, and its value must belong to the bound key.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static std::string make_key(size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "lb_%010zu", i);
+    return buf;
+}
+
+static std::string make_value(const std::string& key)
+{
+    return "v:" + key;
+}
+
+static int64_t parse_index(const std::string& key)
+{
+    if (key.size() != 13 || key.compare(0, 3, "lb_") != 0)
+        return -1;
+    return std::strtoll(key.c_str() + 3, nullptr, 10);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [readers] [seconds] [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    int num_readers = (argc >= 3) ? std::atoi(argv[2]) : 4;
+    int seconds = (argc >= 4) ? std::atoi(argv[3]) : 5;
+    std::string mbdir = (argc >= 5) ? argv[4] : std::string("/var/tmp/mabain_test/");
+    if (n < 4 || num_readers <= 0 || seconds <= 0) {
+        std::cerr << "n must be at least 4; readers and seconds must be positive\n";
+        return 1;
+    }
+
+    DB writer(mbdir.c_str(), CONSTS::WriterOptions(), 1024ULL << 20, 1024ULL << 20);
+    if (!writer.is_open()) {
+        std::cerr << "failed to open db: " << writer.StatusStr() << "\n";
+        return 2;
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        std::string key = make_key(i);
+        if (writer.Add(key, make_value(key)) != MBError::SUCCESS) {
+            std::cerr << "Add failed at i=" << i << "\n";
+            return 2;
+        }
+    }
+
+    std::atomic<bool> stop { false };
+    std::atomic<size_t> queries { 0 };
+    std::atomic<size_t> retries { 0 };
+    std::atomic<size_t> errors { 0 };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < num_readers; t++) {
+        readers.emplace_back([&, t]() {
+            DB reader(mbdir.c_str(), CONSTS::ReaderOptions(), 1024ULL << 20, 1024ULL << 20);
+            if (!reader.is_open()) {
+                errors++;
+                return;
+            }
+            std::mt19937_64 rng(0xB0D + t);
+            std::uniform_int_distribution<size_t> dist(0, n - 1);
+            MBData mbd;
+            std::string bound;
+            size_t local_queries = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                size_t q = dist(rng);
+                // Queries between keys force the search to back off to a
+                // lesser sibling or an ancestor.
+                std::string query = make_key(q);
+                if (rng() & 1)
+                    query.push_back('~');
+                bound.clear();
+                int rval = reader.FindLowerBound(query, mbd, &bound);
+                local_queries++;
+                if (rval == MBError::TRY_AGAIN) {
+                    retries++;
+                    continue;
+                }
+                int64_t idx = parse_index(bound);
+                bool ok = rval == MBError::SUCCESS
+                    && (idx == static_cast<int64_t>(q & ~static_cast<size_t>(1))
+                        || idx == static_cast<int64_t>(q))
+                    && make_value(bound).compare(0, std::string::npos,
+                           reinterpret_cast<const char*>(mbd.buff), mbd.data_len)
+                        == 0;
+                if (!ok && errors++ < 10) {
+                    std::cerr << "bad bound for " << query << ": " << MBError::get_error_str(rval)
+                              << " key=" << bound << "\n";
+                }
+            }
+            queries += local_queries;
+            reader.Close();
+        });
+    }
+
+    std::mt19937_64 wrng(0xBEEF);
+    std::uniform_int_distribution<size_t> wdist(0, n / 2 - 1);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    size_t writes = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        std::string key = make_key(wdist(wrng) * 2 + 1);
+        int rval = writer.Add(key, make_value(key));
+        if (rval == MBError::IN_DICT)
+            rval = writer.Remove(key);
+        if (rval != MBError::SUCCESS) {
+            std::cerr << "writer failed: " << MBError::get_error_str(rval) << "\n";
+            errors++;
+            break;
+        }
+        writes++;
+    }
+    stop = true;
+    for (auto& th : readers)
+        th.join();
+
+    std::cout << "Keys:           " << n << "\n"
+              << "Readers:        " << num_readers << "\n"
+              << "Writes:         " << writes << "\n"
+              << "Bound queries:  " << queries << "\n"
+              << "Gave up:        " << retries << "\n";
+
+    writer.Close();
+    if (errors != 0) {
+        std::cerr << errors << " errors\n";
+        return 4;
+    }
+    return 0;
+}
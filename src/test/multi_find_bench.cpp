@@ -0,0 +1,135 @@
+/**
+ * Benchmark DB::MultiFind against a loop of single DB::Find calls.
+ * Usage: ./multi_find_bench <n> [lookups] [batch] [mbdir] [memcap_mb]
+ *   n: number of entries to insert
+ *   lookups: number of random lookups per mode (default: n)
+ *   batch: keys per MultiFind call (default: 128)
+ *   mbdir: database directory (default: /var/tmp/mabain_test/)
+ *   memcap_mb: index/data memcap in MB (default: 1024)
+ * Every batch is also checked against the single-key results.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [lookups] [batch] [mbdir] [memcap_mb]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    size_t num_lookups = (argc >= 3) ? static_cast<size_t>(std::strtoull(argv[2], nullptr, 10)) : n;
+    size_t batch = (argc >= 4) ? static_cast<size_t>(std::strtoull(argv[3], nullptr, 10)) : 128;
+    std::string mbdir = (argc >= 5) ? argv[4] : std::string("/var/tmp/mabain_test/");
+    size_t memcap = ((argc >= 6) ? static_cast<size_t>(std::strtoull(argv[5], nullptr, 10)) : 1024) << 20;
+    if (n == 0 || batch == 0) {
+        std::cerr << "n and batch must be positive\n";
+        return 1;
+    }
+
+    DB db(mbdir.c_str(), CONSTS::WriterOptions(), memcap, memcap);
+    if (!db.is_open()) {
+        std::cerr << "failed to open db: " << db.StatusStr() << "\n";
+        return 2;
+    }
+
+    // Build and insert keys; a quarter of the lookups will miss.
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    std::mt19937_64 rng(0xC0FFEEULL);
+    std::uniform_int_distribution<uint64_t> dist64;
+    for (size_t i = 0; i < n; ++i) {
+        std::string k = "key_" + std::to_string(dist64(rng)) + "_" + std::to_string(i);
+        int rval = db.Add(k, k, true);
+        if (rval != MBError::SUCCESS) {
+            std::cerr << "Add failed at i=" << i << ": " << MBError::get_error_str(rval) << "\n";
+            return 2;
+        }
+        keys.emplace_back(std::move(k));
+    }
+    std::vector<std::string> absent;
+    absent.reserve(n / 4 + 1);
+    for (size_t i = 0; i < n / 4 + 1; ++i)
+        absent.emplace_back("nokey_" + std::to_string(dist64(rng)));
+
+    std::uniform_int_distribution<size_t> dist_idx(0, n - 1);
+    std::uniform_int_distribution<size_t> dist_abs(0, absent.size() - 1);
+    std::vector<std::string_view> qkeys(num_lookups);
+    for (size_t q = 0; q < num_lookups; ++q) {
+        if (q % 4 == 3)
+            qkeys[q] = absent[dist_abs(rng)];
+        else
+            qkeys[q] = keys[dist_idx(rng)];
+    }
+
+    // Single Find loop
+    MBData mbd;
+    std::vector<int> single_rval(num_lookups);
+    size_t single_hits = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < num_lookups; ++q) {
+        single_rval[q] = db.Find(qkeys[q].data(), static_cast<int>(qkeys[q].size()), mbd);
+        single_hits += (single_rval[q] == MBError::SUCCESS);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    // MultiFind in batches
+    std::vector<std::string_view> bkeys;
+    std::vector<MBData> out(batch);
+    std::vector<int> results;
+    size_t multi_hits = 0;
+    size_t mismatches = 0;
+    std::chrono::nanoseconds multi_ns(0);
+    for (size_t base = 0; base < num_lookups; base += batch) {
+        size_t cnt = std::min(batch, num_lookups - base);
+        bkeys.assign(qkeys.begin() + base, qkeys.begin() + base + cnt);
+        auto b0 = std::chrono::steady_clock::now();
+        int rval = db.MultiFind(bkeys, out, &results);
+        multi_ns += std::chrono::steady_clock::now() - b0;
+        if (rval != MBError::SUCCESS) {
+            std::cerr << "MultiFind failed: " << MBError::get_error_str(rval) << "\n";
+            return 3;
+        }
+        for (size_t i = 0; i < cnt; ++i) {
+            multi_hits += (results[i] == MBError::SUCCESS);
+            if (results[i] != single_rval[base + i]) {
+                mismatches++;
+            } else if (results[i] == MBError::SUCCESS
+                && (out[i].data_len != static_cast<int>(bkeys[i].size())
+                    || memcmp(out[i].buff, bkeys[i].data(), bkeys[i].size()) != 0)) {
+                mismatches++;
+            }
+        }
+    }
+
+    double single_avg = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / num_lookups;
+    double multi_avg = (double)multi_ns.count() / num_lookups;
+    std::cout << "Inserted:       " << n << "\n"
+              << "Lookups:        " << num_lookups << " (batch " << batch << ")\n"
+              << "Hits:           " << single_hits << " single, " << multi_hits << " multi\n"
+              << "Avg Find:       " << single_avg << " ns per key\n"
+              << "Avg MultiFind:  " << multi_avg << " ns per key\n"
+              << "Speedup:        " << (multi_avg > 0 ? single_avg / multi_avg : 0.0) << "x\n";
+
+    db.Close();
+    if (mismatches != 0) {
+        std::cerr << "MultiFind mismatched single Find on " << mismatches << " keys\n";
+        return 4;
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+/**
+ * Benchmark and consistency check for DB::Scan.
+ * Usage: ./range_scan_test <n> [scan_len] [mbdir]
+ *   n: number of time-bucketed entries to insert
+ *   scan_len: entries per range scan (default: 10000)
+ *   mbdir: database directory (default: /var/tmp/mabain_test/)
+ * After timing a full scan against DB::iterator and a reverse cursor, and a
+ * batch of bounded range scans, a writer thread keeps adding and removing
+ * keys in a separate bucket while a reader scans the stable buckets and
+ * checks that every stable key is visited exactly once, in ascending order,
+ * with the right value.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static const size_t KEYS_PER_BUCKET = 1000;
+
+static std::string make_key(const char* prefix, size_t i)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s_%010zu_%06zu", prefix, i / KEYS_PER_BUCKET, i % KEYS_PER_BUCKET);
+    return buf;
+}
+
+static std::string make_value(const std::string& key)
+{
+    return "v:" + key;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [scan_len] [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    size_t scan_len = (argc >= 3) ? static_cast<size_t>(std::strtoull(argv[2], nullptr, 10)) : 10000;
+    std::string mbdir = (argc >= 4) ? argv[3] : std::string("/var/tmp/mabain_test/");
+    if (n == 0 || scan_len == 0) {
+        std::cerr << "n and scan_len must be positive\n";
+        return 1;
+    }
+    if (scan_len > n)
+        scan_len = n;
+
+    DB writer(mbdir.c_str(), CONSTS::WriterOptions(), 1024ULL << 20, 1024ULL << 20);
+    if (!writer.is_open()) {
+        std::cerr << "failed to open db: " << writer.StatusStr() << "\n";
+        return 2;
+    }
+    for (size_t i = 0; i < n; i++) {
+        std::string key = make_key("ts", i);
+        if (writer.Add(key, make_value(key), true) != MBError::SUCCESS) {
+            std::cerr << "Add failed at i=" << i << "\n";
+            return 2;
+        }
+    }
+
+    DB reader(mbdir.c_str(), CONSTS::ReaderOptions(), 1024ULL << 20, 1024ULL << 20);
+    if (!reader.is_open()) {
+        std::cerr << "failed to open reader\n";
+        return 2;
+    }
+
+    // Full pass: iterator versus Scan
+    size_t iter_count = 0;
+    size_t iter_bytes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (DB::iterator iter = reader.begin(); iter != reader.end(); ++iter) {
+        iter_count++;
+        iter_bytes += iter.key.size() + iter.value.data_len;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    size_t scan_count = 0;
+    size_t scan_bytes = 0;
+    size_t misordered = 0;
+    std::string prev;
+    int rval = reader.Scan("", "", 0, [&](const char* key, int key_len, const uint8_t*, int value_len) {
+        if (scan_count > 0 && prev.compare(0, std::string::npos, key, key_len) >= 0)
+            misordered++;
+        prev.assign(key, key_len);
+        scan_count++;
+        scan_bytes += key_len + value_len;
+        return true;
+    });
+    auto t2 = std::chrono::steady_clock::now();
+    double iter_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+    double scan_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / n;
+
+    // Newest first: reverse cursor from the end
+    DB::Cursor cursor(reader, true);
+    size_t rev_count = 0;
+    t1 = std::chrono::steady_clock::now();
+    for (rval = cursor.SeekToFirst(); rval == MBError::SUCCESS; rval = cursor.Next()) {
+        if (rev_count > 0 && prev.compare(cursor.key()) <= 0)
+            misordered++;
+        prev = cursor.key();
+        rev_count++;
+    }
+    t2 = std::chrono::steady_clock::now();
+    double rev_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / n;
+
+    // Bounded scans starting at random buckets
+    const int num_ranges = 20;
+    std::mt19937_64 rng(0x5CA7);
+    size_t range_count = 0;
+    size_t range_errors = 0;
+    auto t3 = std::chrono::steady_clock::now();
+    for (int r = 0; r < num_ranges; r++) {
+        size_t first = std::uniform_int_distribution<size_t>(0, n - scan_len)(rng);
+        std::string start = make_key("ts", first);
+        std::string end = (first + scan_len < n) ? make_key("ts", first + scan_len) : std::string();
+        size_t expect = first;
+        rval = reader.Scan(start, end, 0, [&](const char* key, int key_len, const uint8_t*, int) {
+            if (make_key("ts", expect).compare(0, std::string::npos, key, key_len) != 0)
+                range_errors++;
+            expect++;
+            range_count++;
+            return true;
+        });
+        if (rval != MBError::SUCCESS || expect != first + scan_len)
+            range_errors++;
+    }
+    auto t4 = std::chrono::steady_clock::now();
+    double range_ns = std::chrono::duration<double, std::nano>(t4 - t3).count() / range_count;
+
+    std::cout << "Entries:        " << n << "\n"
+              << "Iterator:       " << iter_ns << " ns/entry (" << iter_count << " entries, unordered)\n"
+              << "Scan:           " << scan_ns << " ns/entry (" << scan_count << " entries)\n"
+              << "Speedup:        " << (scan_ns > 0 ? iter_ns / scan_ns : 0.0) << "x\n"
+              << "Reverse cursor: " << rev_ns << " ns/entry (" << rev_count << " entries)\n"
+              << "Range scans:    " << num_ranges << " x " << scan_len << " entries, "
+              << range_ns << " ns/entry\n";
+
+    // Writer churns a bucket that sorts between the stable keys.
+    std::atomic<bool> stop { false };
+    std::thread churn([&]() {
+        std::mt19937_64 wrng(0xBEEF);
+        std::uniform_int_distribution<size_t> dist(0, n - 1);
+        while (!stop.load(std::memory_order_relaxed)) {
+            std::string key = make_key("tr", dist(wrng));
+            if (writer.Add(key, make_value(key), true) != MBError::SUCCESS)
+                break;
+            writer.Remove(make_key("tr", dist(wrng)));
+        }
+    });
+
+    size_t passes = 0;
+    size_t bad_passes = 0;
+    size_t retried_passes = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (std::chrono::steady_clock::now() < deadline) {
+        size_t expect = 0;
+        bool ok = true;
+        rval = reader.Scan("", "", 0, [&](const char* key, int key_len, const uint8_t* value, int value_len) {
+            if (key_len < 2 || memcmp(key, "tr", 2) == 0)
+                return true;
+            std::string want = make_key("ts", expect++);
+            if (want.compare(0, std::string::npos, key, key_len) != 0
+                || make_value(want).compare(0, std::string::npos, reinterpret_cast<const char*>(value), value_len) != 0)
+                ok = false;
+            return ok;
+        });
+        if (rval == MBError::TRY_AGAIN) {
+            retried_passes++;
+            continue;
+        }
+        passes++;
+        if (rval != MBError::SUCCESS || !ok || expect != n) {
+            if (bad_passes++ < 10)
+                std::cerr << "bad pass: " << MBError::get_error_str(rval) << ", " << expect
+                          << " stable keys\n";
+        }
+    }
+    stop = true;
+    churn.join();
+
+    std::cout << "Concurrent:     " << passes << " passes, " << retried_passes << " gave up\n";
+
+    reader.Close();
+    writer.Close();
+    if (scan_count != n || iter_count != n || rev_count != n || scan_bytes != iter_bytes || misordered != 0
+        || range_errors != 0 || bad_passes != 0) {
+        std::cerr << "scan mismatch: " << misordered << " misordered, " << range_errors
+                  << " range errors, " << bad_passes << " bad passes\n";
+        return 4;
+    }
+    return 0;
+}
@@ -0,0 +1,331 @@
+/**
+ * Latency benchmark of the async writer queue.
+ * Usage: ./shm_queue_latency_bench <rounds> [mbdir] [producers]
+ *   rounds: number of single updates sent to a parked writer
+ *   mbdir: database directory (default: /var/tmp/mabain_test/)
+ *   producers: number of processes queuing at the same time (default: 4)
+ * The parent process runs the async writer. A child process opens the DB as
+ * a reader and sends its updates through the shared memory queue. Each round
+ * the child waits until the writer has parked, queues one update and times
+ * it until WaitApplied returns and the update can be found. The child then
+ * queues a
+ * burst of updates back to back, which the writer drains awake, to show the
+ * cost of queuing an update. Last, several producer processes with their own
+ * connect ids, and so their own queue lanes, queue updates at the same time.
+ * Finally, threads of the writer process add keys with the char* AddAsync,
+ * which applies each update under the writer lock, and with the string
+ * AddAsync of handles opened with OPTION_ASYNC_HANDOFF, which hand the
+ * update to the writer thread.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static const size_t MEMCAP = 64ULL << 20;
+static const int BURST = 100000;
+static const int PRODUCER_UPDATES = 50000;
+
+static MBConfig db_config(const std::string& mbdir, int options)
+{
+    MBConfig config;
+    memset(&config, 0, sizeof(config));
+    config.mbdir = mbdir.c_str();
+    config.options = options;
+    config.memcap_index = MEMCAP;
+    config.memcap_data = MEMCAP;
+    return config;
+}
+
+// Wait for the writer to apply the update with sequence number seq, which
+// added key.
+static bool wait_applied(const DB& db, uint64_t seq, const char* key, int len)
+{
+    if (db.WaitApplied(seq, 10000) != MBError::SUCCESS)
+        return false;
+    MBData mbd;
+    return db.Find(key, len, mbd) == MBError::SUCCESS;
+}
+
+static DB* open_reader(const std::string& mbdir, uint32_t connect_id, int options = 0)
+{
+    // The writer may still be starting.
+    MBConfig config = db_config(mbdir, CONSTS::ReaderOptions() | options);
+    config.connect_id = connect_id;
+    for (int i = 0; i < 1000; i++) {
+        DB* db = new DB(config);
+        if (db->is_open())
+            return db;
+        delete db;
+        usleep(10000);
+    }
+    std::cerr << "failed to open db\n";
+    return nullptr;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t i = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[i];
+}
+
+static int run_reader(const std::string& mbdir, int rounds)
+{
+    DB* db = open_reader(mbdir, 0);
+    if (db == nullptr)
+        return 2;
+
+    std::vector<double> latency(rounds);
+    char key[32];
+    uint64_t seq = 0;
+    for (int i = 0; i < rounds; i++) {
+        // Long enough for the writer to stop spinning and park.
+        usleep(5000);
+        int len = snprintf(key, sizeof(key), "round%d", i);
+        auto t0 = std::chrono::steady_clock::now();
+        if (db->AddAsync(key, len, key, len, false, seq) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            return 2;
+        }
+        if (!wait_applied(*db, seq, key, len)) {
+            std::cerr << "update not applied\n";
+            return 2;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        latency[i] = std::chrono::duration<double, std::micro>(t1 - t0).count();
+    }
+    std::sort(latency.begin(), latency.end());
+    printf("parked writer:  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+        percentile(latency, 0.5), percentile(latency, 0.99), latency.back());
+
+    auto t0 = std::chrono::steady_clock::now();
+    int len = 0;
+    for (int i = 0; i < BURST; i++) {
+        len = snprintf(key, sizeof(key), "burst%d", i);
+        if (db->AddAsync(key, len, key, len, false, seq) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            return 2;
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    if (!wait_applied(*db, seq, key, len)) {
+        std::cerr << "update not applied\n";
+        return 2;
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    printf("burst of %d:   %8.1f ns/enqueue  %8.1f ns/update drained\n", BURST,
+        std::chrono::duration<double, std::nano>(t1 - t0).count() / BURST,
+        std::chrono::duration<double, std::nano>(t2 - t0).count() / BURST);
+
+    db->Close();
+    delete db;
+    return 0;
+}
+
+static int run_producer(const std::string& mbdir, int id)
+{
+    DB* db = open_reader(mbdir, id + 1);
+    if (db == nullptr)
+        return 2;
+
+    char key[32];
+    uint64_t seq = 0;
+    int len = 0;
+    for (int i = 0; i < PRODUCER_UPDATES; i++) {
+        len = snprintf(key, sizeof(key), "p%d_%d", id, i);
+        if (db->AddAsync(key, len, key, len, false, seq) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            return 2;
+        }
+    }
+    if (!wait_applied(*db, seq, key, len)) {
+        std::cerr << "update not applied\n";
+        return 2;
+    }
+    db->Close();
+    delete db;
+    return 0;
+}
+
+// Fork the producers. They start once start_fd[1] is closed.
+static std::vector<pid_t> fork_producers(const std::string& mbdir, int producers,
+    const int* start_fd)
+{
+    std::vector<pid_t> pids;
+    for (int p = 0; p < producers; p++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "fork failed\n";
+            break;
+        }
+        if (pid == 0) {
+            close(start_fd[1]);
+            char c;
+            if (read(start_fd[0], &c, 1) != 0)
+                _exit(2);
+            int rval = run_producer(mbdir, p);
+            fflush(stdout);
+            _exit(rval);
+        }
+        pids.push_back(pid);
+    }
+    return pids;
+}
+
+// Start the producers at the same time and report the updates per second
+// applied. Returns false if a producer failed.
+static bool run_producers(const std::vector<pid_t>& pids, int producers, int start_fd)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    close(start_fd);
+    bool ok = static_cast<int>(pids.size()) == producers;
+    for (pid_t pid : pids) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok = false;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    if (ok) {
+        printf("%d producers:    %8.0f updates/s\n", producers,
+            producers * PRODUCER_UPDATES / std::chrono::duration<double>(t1 - t0).count());
+    }
+    return ok;
+}
+
+// Threads of the writer process add PRODUCER_UPDATES keys each, through the
+// string AddAsync of a handle with OPTION_ASYNC_HANDOFF if handoff is set. Returns false if an update failed.
+static bool run_local_producers(const std::string& mbdir, int producers, bool handoff)
+{
+    std::vector<std::thread> threads;
+    std::vector<int> failed(producers, 0);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&mbdir, &failed, p, handoff]() {
+            DB* db = open_reader(mbdir, 0, handoff ? CONSTS::OPTION_ASYNC_HANDOFF : 0);
+            if (db == nullptr) {
+                failed[p] = 1;
+                return;
+            }
+            uint64_t seq = 0;
+            std::string key;
+            for (int i = 0; i < PRODUCER_UPDATES && !failed[p]; i++) {
+                key = (handoff ? "h" : "l") + std::to_string(p) + "_" + std::to_string(i);
+                int rval = handoff ? db->AddAsync(key, key, false, seq)
+                                   : db->AddAsync(key.data(), key.size(), key.data(), key.size(), false, seq);
+                if (rval != MBError::SUCCESS)
+                    failed[p] = 1;
+            }
+            if (!failed[p] && !wait_applied(*db, seq, key.data(), key.size()))
+                failed[p] = 1;
+            db->Close();
+            delete db;
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    auto t1 = std::chrono::steady_clock::now();
+    for (int p = 0; p < producers; p++) {
+        if (failed[p]) {
+            std::cerr << "update failed\n";
+            return false;
+        }
+    }
+    printf("%d threads, %s: %8.0f updates/s\n", producers,
+        handoff ? "handoff" : "locked ",
+        producers * PRODUCER_UPDATES / std::chrono::duration<double>(t1 - t0).count());
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <rounds> [mbdir] [producers]\n";
+        return 1;
+    }
+    const int rounds = atoi(argv[1]);
+    std::string mbdir = (argc >= 3) ? argv[2] : std::string("/var/tmp/mabain_test/");
+    const int producers = (argc >= 4) ? atoi(argv[3]) : 4;
+    if (rounds <= 0) {
+        std::cerr << "rounds must be positive\n";
+        return 1;
+    }
+    if (producers < 0) {
+        std::cerr << "producers must not be negative\n";
+        return 1;
+    }
+    if (mbdir.back() != '/')
+        mbdir += "/";
+    std::string cmd = "mkdir -p " + mbdir + " && rm -f " + mbdir + "_*";
+    if (system(cmd.c_str()) != 0)
+        return 2;
+
+    // Fork before the writer starts its thread.
+    int start_fd[2];
+    if (pipe(start_fd) != 0)
+        return 2;
+    std::vector<pid_t> producer_pids = fork_producers(mbdir, producers, start_fd);
+    close(start_fd[0]);
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork failed\n";
+        return 2;
+    }
+    if (pid == 0) {
+        close(start_fd[1]);
+        usleep(100000);
+        int rval = run_reader(mbdir, rounds);
+        fflush(stdout);
+        _exit(rval);
+    }
+
+    MBConfig config = db_config(mbdir, CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    DB db(config);
+    if (!db.is_open()) {
+        std::cerr << "failed to open db\n";
+        kill(pid, SIGKILL);
+        for (pid_t producer_pid : producer_pids)
+            kill(producer_pid, SIGKILL);
+        return 2;
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        for (pid_t producer_pid : producer_pids)
+            kill(producer_pid, SIGKILL);
+        db.Close();
+        return 3;
+    }
+    fflush(stdout);
+    bool producers_ok = run_producers(producer_pids, producers, start_fd[1]);
+    if (producers_ok && producers > 0) {
+        producers_ok = run_local_producers(mbdir, producers, false)
+            && run_local_producers(mbdir, producers, true);
+    }
+    int64_t count = db.Count();
+    db.Close();
+    if (!producers_ok)
+        return 3;
+    int64_t expected = rounds + BURST + static_cast<int64_t>(producers) * PRODUCER_UPDATES * 3;
+    if (count != expected) {
+        std::cerr << "expected " << expected << " keys, found " << count << "\n";
+        return 4;
+    }
+    return 0;
+}
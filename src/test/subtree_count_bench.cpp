@@ -0,0 +1,199 @@
+/**
+ * Benchmark and consistency check for CountPrefix, Rank and Select.
+ * Usage: ./subtree_count_bench <n> [tenants] [mbdir]
+ *   n: number of entries, spread evenly over the tenants
+ *   tenants: number of key prefixes (default: 100)
+ *   mbdir: database directory (default: /var/tmp/mabain_test/)
+ * Per-tenant counts from a prefix iterator walk are timed against
+ * CountPrefix, and Select(Rank(key)) must give back key. A writer thread
+ * then adds and removes keys under a separate prefix while a reader checks
+ * that the tenant counts and ranks stay exact.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+
+using namespace mabain;
+
+static std::string tenant_prefix(size_t t)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "t%04zu/", t);
+    return buf;
+}
+
+static std::string make_key(const char* prefix, size_t tenants, size_t i)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s%04zu/%010zu", prefix, i % tenants, i / tenants);
+    return buf;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [tenants] [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    size_t tenants = (argc >= 3) ? static_cast<size_t>(std::strtoull(argv[2], nullptr, 10)) : 100;
+    std::string mbdir = (argc >= 4) ? argv[3] : std::string("/var/tmp/mabain_test/");
+    if (n == 0 || tenants == 0 || tenants > 10000) {
+        std::cerr << "n must be positive and tenants in [1, 10000]\n";
+        return 1;
+    }
+
+    MBConfig config;
+    memset(&config, 0, sizeof(config));
+    config.mbdir = mbdir.c_str();
+    config.options = CONSTS::WriterOptions() | CONSTS::OPTION_SUBTREE_COUNT;
+    config.memcap_index = 1024ULL << 20;
+    config.memcap_data = 1024ULL << 20;
+    DB writer(config);
+    if (!writer.is_open()) {
+        std::cerr << "failed to open db: " << writer.StatusStr() << "\n";
+        return 2;
+    }
+    std::vector<int64_t> expect(tenants, 0);
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+        if (writer.Add(make_key("t", tenants, i), "value") != MBError::SUCCESS) {
+            std::cerr << "Add failed at i=" << i << "\n";
+            return 2;
+        }
+        expect[i % tenants]++;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double add_ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+
+    DB reader(mbdir.c_str(), CONSTS::ReaderOptions(), 1024ULL << 20, 1024ULL << 20);
+    if (!reader.is_open()) {
+        std::cerr << "failed to open reader\n";
+        return 2;
+    }
+
+    // Per-tenant counts: iterator walk versus CountPrefix
+    size_t errors = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < tenants; t++) {
+        int64_t count = 0;
+        for (DB::iterator iter = reader.begin(tenant_prefix(t)); iter != reader.end(); ++iter)
+            count++;
+        if (count != expect[t])
+            errors++;
+    }
+    t1 = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < tenants; t++) {
+        int64_t count = -1;
+        if (reader.CountPrefix(tenant_prefix(t), count) != MBError::SUCCESS || count != expect[t])
+            errors++;
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    double iter_us = std::chrono::duration<double, std::micro>(t1 - t0).count() / tenants;
+    double count_us = std::chrono::duration<double, std::micro>(t2 - t1).count() / tenants;
+
+    // Rank and Select round trips on random keys
+    const int num_probes = 10000;
+    std::mt19937_64 rng(0x5EED);
+    std::uniform_int_distribution<size_t> dist(0, n - 1);
+    MBData mbd;
+    std::string key;
+    double rank_ns = 0;
+    double select_ns = 0;
+    for (int i = 0; i < num_probes; i++) {
+        std::string probe = make_key("t", tenants, dist(rng));
+        int64_t rank = -1;
+        auto r0 = std::chrono::steady_clock::now();
+        int rval = reader.Rank(probe, rank);
+        auto r1 = std::chrono::steady_clock::now();
+        if (rval == MBError::SUCCESS)
+            rval = reader.Select(rank, mbd, &key);
+        auto r2 = std::chrono::steady_clock::now();
+        rank_ns += std::chrono::duration<double, std::nano>(r1 - r0).count();
+        select_ns += std::chrono::duration<double, std::nano>(r2 - r1).count();
+        if (rval != MBError::SUCCESS || key != probe)
+            errors++;
+    }
+
+    std::cout << "Entries:          " << n << " in " << tenants << " tenants\n"
+              << "Add:              " << add_ns << " ns/entry\n"
+              << "Iterator count:   " << iter_us << " us/tenant\n"
+              << "CountPrefix:      " << count_us << " us/tenant\n"
+              << "Speedup:          " << (count_us > 0 ? iter_us / count_us : 0.0) << "x\n"
+              << "Rank:             " << rank_ns / num_probes << " ns\n"
+              << "Select:           " << select_ns / num_probes << " ns\n";
+
+    // The churned prefix sorts after every tenant, so neither the tenant
+    // counts nor the ranks of tenant keys may change.
+    std::atomic<bool> stop { false };
+    std::thread churn([&]() {
+        std::mt19937_64 wrng(0xBEEF);
+        while (!stop.load(std::memory_order_relaxed)) {
+            std::string churn_key = make_key("u", tenants, dist(wrng));
+            if (writer.Add(churn_key, "value") == MBError::IN_DICT)
+                writer.Remove(churn_key);
+        }
+    });
+
+    size_t queries = 0;
+    size_t retries = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (std::chrono::steady_clock::now() < deadline) {
+        size_t t = dist(rng) % tenants;
+        int64_t count = -1;
+        int rval = reader.CountPrefix(tenant_prefix(t), count);
+        queries++;
+        if (rval == MBError::TRY_AGAIN) {
+            retries++;
+            continue;
+        }
+        if (rval != MBError::SUCCESS || count != expect[t]) {
+            if (errors++ < 10)
+                std::cerr << "bad count for tenant " << t << ": " << MBError::get_error_str(rval)
+                          << " " << count << "\n";
+        }
+
+        size_t i = dist(rng);
+        int64_t rank = -1;
+        rval = reader.Rank(make_key("t", tenants, i), rank);
+        queries++;
+        if (rval == MBError::TRY_AGAIN) {
+            retries++;
+            continue;
+        }
+        int64_t want = 0;
+        for (size_t s = 0; s < i % tenants; s++)
+            want += expect[s];
+        want += i / tenants;
+        if (rval != MBError::SUCCESS || rank != want) {
+            if (errors++ < 10)
+                std::cerr << "bad rank for key " << i << ": " << MBError::get_error_str(rval) << " "
+                          << rank << " expected " << want << "\n";
+        }
+    }
+    stop = true;
+    churn.join();
+
+    std::cout << "Concurrent:       " << queries << " queries, " << retries << " gave up\n";
+
+    reader.Close();
+    writer.Close();
+    if (errors != 0) {
+        std::cerr << errors << " errors\n";
+        return 4;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * Benchmark for batched writes.
+ * Usage: ./write_batch_bench <n> [mbdir]
+ *   n: number of keys
+ *   mbdir: parent directory of the databases (default: /var/tmp/mabain_test/)
+ * The same keys are loaded into a fresh DB once with a loop of Add calls and
+ * once with DB::Write for each batch size, first in random order and then in
+ * key order. Every DB is checked to hold all keys afterwards.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../db.h"
+#include "../error.h"
+#include "../mabain_consts.h"
+#include "../write_batch.h"
+
+using namespace mabain;
+
+static const size_t MEMCAP = 512ULL << 20;
+
+static DB* open_db(const std::string& dir)
+{
+    std::string cmd = "mkdir -p " + dir + " && rm -f " + dir + "_*";
+    if (system(cmd.c_str()) != 0)
+        return nullptr;
+    MBConfig config;
+    memset(&config, 0, sizeof(config));
+    config.mbdir = dir.c_str();
+    config.options = CONSTS::WriterOptions();
+    config.memcap_index = MEMCAP;
+    config.memcap_data = MEMCAP;
+    return new DB(config);
+}
+
+static size_t count_missing(DB& db, const std::vector<std::string>& keys)
+{
+    MBData mbd;
+    size_t missing = 0;
+    for (const std::string& key : keys) {
+        if (db.Find(key, mbd) != MBError::SUCCESS || mbd.data_len != (int)key.size())
+            missing++;
+    }
+    if (db.Count() != (int64_t)keys.size())
+        missing++;
+    return missing;
+}
+
+// Loads keys with Add and with each batch size; returns the number of
+// lookup errors.
+static size_t run(const char* feed, const std::vector<std::string>& keys, const std::string& mbdir)
+{
+    const size_t n = keys.size();
+    size_t errors = 0;
+    DB* db = open_db(mbdir + "add/");
+    if (db == nullptr || !db->is_open()) {
+        std::cerr << "failed to open db\n";
+        exit(2);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    for (const std::string& key : keys) {
+        if (db->Add(key, key) != MBError::SUCCESS) {
+            std::cerr << "Add failed\n";
+            exit(2);
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double base = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+    printf("%s keys, Add loop:  %8.1f ns/key\n", feed, base);
+    errors += count_missing(*db, keys);
+    db->Close();
+    delete db;
+
+    const size_t batch_sizes[] = { 16, 256, 4096, 65536 };
+    for (size_t batch_size : batch_sizes) {
+        db = open_db(mbdir + "batch" + std::to_string(batch_size) + "/");
+        if (db == nullptr || !db->is_open()) {
+            std::cerr << "failed to open db\n";
+            exit(2);
+        }
+        WriteBatch batch;
+        // Filling and sorting the batch are part of the cost.
+        t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i += batch_size) {
+            batch.Clear();
+            for (size_t j = i; j < n && j < i + batch_size; j++)
+                batch.Put(keys[j], keys[j]);
+            if (db->Write(batch) != MBError::SUCCESS) {
+                std::cerr << "Write failed\n";
+                exit(2);
+            }
+        }
+        t1 = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+        printf("%s keys, batch %-6zu %8.1f ns/key (%.2fx)\n", feed, batch_size, ns, base / ns);
+        errors += count_missing(*db, keys);
+        db->Close();
+        delete db;
+    }
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <n> [mbdir]\n";
+        return 1;
+    }
+    const size_t n = static_cast<size_t>(std::strtoull(argv[1], nullptr, 10));
+    std::string mbdir = (argc >= 3) ? argv[2] : std::string("/var/tmp/mabain_test/");
+    if (n == 0 || n > 0xFFFFFFFFULL) {
+        std::cerr << "n must be positive and fit in 32 bits\n";
+        return 1;
+    }
+
+    std::mt19937_64 rng(0xBA7C);
+    std::vector<std::string> keys(n);
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)rng());
+        keys[i] = buf;
+    }
+
+    size_t errors = 0;
+    errors += run("Random", keys, mbdir);
+    std::sort(keys.begin(), keys.end());
+    errors += run("Sorted", keys, mbdir);
+
+    if (errors != 0) {
+        std::cerr << errors << " lookup errors\n";
+        return 4;
+    }
+    return 0;
+}
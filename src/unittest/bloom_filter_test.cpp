@@ -0,0 +1,250 @@
+/**
+ * Negative-lookup Bloom filter tests
+ */
+
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../bloom_filter.h"
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class BloomFilterTest : public ::testing::Test {
+public:
+    BloomFilterTest()
+        : db(nullptr)
+    {
+    }
+    ~BloomFilterTest() override
+    {
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+
+        db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_BLOOM_FILTER);
+        ASSERT_TRUE(db->is_open());
+    }
+
+    void TearDown() override
+    {
+        if (db) {
+            db->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static DB* OpenDB(int options, uint32_t hot_key_cache_size = 0)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 64 * 1024 * 1024LL;
+        config.memcap_data = 64 * 1024 * 1024LL;
+        config.bloom_filter_size = 100000;
+        config.hot_key_cache_size = hot_key_cache_size;
+        return new DB(config);
+    }
+
+    static std::string Key(int i)
+    {
+        return "bloom-filter-test-" + std::to_string(i);
+    }
+
+    // Finds every key in [0, num) that is not removed and returns the
+    // number of lookups the filter answered for the others.
+    static uint64_t Check(DB* handle, int num, int removed_mod)
+    {
+        uint64_t skips = handle->GetBloomFilterSkipCount();
+        MBData mbd;
+        for (int i = 0; i < num; i++) {
+            if (removed_mod > 0 && i % removed_mod == 0) {
+                EXPECT_EQ(handle->Find(Key(i), mbd), MBError::NOT_EXIST) << i;
+            } else {
+                EXPECT_EQ(handle->Find(Key(i), mbd), MBError::SUCCESS) << i;
+                EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), Key(i));
+            }
+        }
+        return handle->GetBloomFilterSkipCount() - skips;
+    }
+
+    // Lookups for keys that were never added; returns the number the
+    // filter did not answer.
+    static uint64_t Misses(DB* handle, int num)
+    {
+        uint64_t false_positives = handle->GetBloomFilterFalsePositiveCount();
+        MBData mbd;
+        for (int i = 0; i < num; i++)
+            EXPECT_EQ(handle->Find("absent-" + std::to_string(i), mbd), MBError::NOT_EXIST);
+        return handle->GetBloomFilterFalsePositiveCount() - false_positives;
+    }
+
+    // Removes enough keys that the next rc rebuilds the filter.
+    void AddAndRemoveExtraKeys()
+    {
+        size_t capacity = BloomFilter::BlocksForKeys(100000) * BloomFilter::BLOCK_SIZE * 8
+            / BloomFilter::BITS_PER_KEY;
+        int extra = capacity / BloomFilter::REBUILD_DIVISOR;
+        for (int i = 0; i < extra; i++)
+            ASSERT_EQ(db->Add("extra-" + std::to_string(i), "v"), MBError::SUCCESS);
+        for (int i = 0; i < extra; i++)
+            ASSERT_EQ(db->Remove("extra-" + std::to_string(i)), MBError::SUCCESS);
+    }
+
+protected:
+    DB* db;
+};
+
+TEST_F(BloomFilterTest, NoFalseNegatives)
+{
+    const int num = 20000;
+    BloomFilter filter(std::string(MB_DIR) + "_standalone", BloomFilter::BlocksForKeys(num),
+        CONSTS::WriterOptions());
+    EXPECT_TRUE(filter.Created());
+    for (int i = 0; i < num; i++)
+        filter.Add((const uint8_t*)Key(i).data(), Key(i).size());
+    int passed = 0;
+    for (int i = 0; i < num; i++) {
+        ASSERT_TRUE(filter.MayContain((const uint8_t*)Key(i).data(), Key(i).size())) << i;
+        std::string absent = "absent-" + std::to_string(i);
+        if (filter.MayContain((const uint8_t*)absent.data(), absent.size()))
+            passed++;
+    }
+    EXPECT_LT(passed, num / 50);
+
+    filter.Clear();
+    for (int i = 0; i < num; i++)
+        EXPECT_FALSE(filter.MayContain((const uint8_t*)Key(i).data(), Key(i).size()));
+}
+
+TEST_F(BloomFilterTest, FindAndRebuild)
+{
+    const int num = 5000;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Key(i)), MBError::SUCCESS);
+
+    DB* reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_BLOOM_FILTER);
+    ASSERT_TRUE(reader->is_open());
+    EXPECT_EQ(Check(reader, num, 0), 0u);
+    EXPECT_LT(Misses(reader, num), (uint64_t)num / 50);
+    EXPECT_GT(reader->GetBloomFilterSkipCount(), (uint64_t)num * 9 / 10);
+
+    // Removed keys still pass the filter until resource collection.
+    for (int i = 0; i < num; i += 3)
+        ASSERT_EQ(db->Remove(Key(i)), MBError::SUCCESS);
+    EXPECT_EQ(Check(reader, num, 3), 0u);
+    EXPECT_GT(db->GetDictPtr()->GetHeaderPtr()->bloom_filter_removed, 0u);
+
+    // A few removed keys are not worth a rebuild.
+    db->CollectResource(1, 1);
+    EXPECT_GT(db->GetDictPtr()->GetHeaderPtr()->bloom_filter_removed, 0u);
+    EXPECT_EQ(Check(reader, num, 3), 0u);
+
+    // Once the removed keys pass 1/8 of the capacity, rc refills the filter.
+    AddAndRemoveExtraKeys();
+    EXPECT_TRUE(db->GetDictPtr()->BloomFilterWorn());
+    db->CollectResource(1, 1);
+    EXPECT_EQ(db->GetDictPtr()->GetHeaderPtr()->bloom_filter_removed, 0u);
+    EXPECT_GT(Check(reader, num, 3), (uint64_t)num / 3 * 9 / 10);
+
+    // Prefix lookups do not use the filter.
+    MBData mbd;
+    EXPECT_EQ(reader->FindLongestPrefix(Key(1) + "-suffix", mbd), MBError::SUCCESS);
+
+    ASSERT_EQ(db->RemoveAll(), MBError::SUCCESS);
+    EXPECT_EQ(Check(reader, num, 1), (uint64_t)num);
+    ASSERT_EQ(db->Add(Key(0), Key(0)), MBError::SUCCESS);
+    ASSERT_EQ(reader->Find(Key(0), mbd), MBError::SUCCESS);
+
+    reader->Close();
+    delete reader;
+}
+
+TEST_F(BloomFilterTest, WriterWithoutFilter)
+{
+    const int num = 1000;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Key(i)), MBError::SUCCESS);
+    db->Close();
+    delete db;
+
+    // Reopening with the option keeps the filter without a rebuild.
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_BLOOM_FILTER);
+    ASSERT_TRUE(db->is_open());
+    EXPECT_FALSE(db->GetDictPtr()->BloomFilterStale());
+    db->Close();
+    delete db;
+
+    // A writer that does not maintain the filter must disable it.
+    db = OpenDB(CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    for (int i = num; i < 2 * num; i++)
+        ASSERT_EQ(db->Add(Key(i), Key(i)), MBError::SUCCESS);
+    DB* reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_BLOOM_FILTER);
+    ASSERT_TRUE(reader->is_open());
+    EXPECT_EQ(Check(reader, 2 * num, 0), 0u);
+    EXPECT_EQ(Misses(reader, num), 0u);
+    EXPECT_EQ(reader->GetBloomFilterSkipCount(), 0u);
+    reader->Close();
+    delete reader;
+    db->Close();
+    delete db;
+
+    // Reopening with the option rebuilds the filter from the tree.
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_BLOOM_FILTER);
+    ASSERT_TRUE(db->is_open());
+    EXPECT_FALSE(db->GetDictPtr()->BloomFilterStale());
+    reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_BLOOM_FILTER);
+    ASSERT_TRUE(reader->is_open());
+    EXPECT_EQ(Check(reader, 2 * num, 0), 0u);
+    EXPECT_LT(Misses(reader, num), (uint64_t)num / 50);
+    EXPECT_GT(reader->GetBloomFilterSkipCount(), (uint64_t)num * 9 / 10);
+    reader->Close();
+    delete reader;
+}
+
+TEST_F(BloomFilterTest, HotKeyCache)
+{
+    const int num = 5000;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Key(i)), MBError::SUCCESS);
+
+    // Lookups that miss the cache still consult the filter first.
+    DB* reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_BLOOM_FILTER, 1024);
+    ASSERT_TRUE(reader->is_open());
+    EXPECT_EQ(Check(reader, num, 0), 0u);
+    EXPECT_EQ(Check(reader, num, 0), 0u);
+    EXPECT_LT(Misses(reader, num), (uint64_t)num / 50);
+    EXPECT_GT(reader->GetBloomFilterSkipCount(), (uint64_t)num * 9 / 10);
+
+    for (int i = 0; i < num; i += 3)
+        ASSERT_EQ(db->Remove(Key(i)), MBError::SUCCESS);
+    AddAndRemoveExtraKeys();
+    db->CollectResource(1, 1);
+    EXPECT_GT(Check(reader, num, 3), (uint64_t)num / 3 * 9 / 10);
+    reader->Close();
+    delete reader;
+}
+
+} // namespace
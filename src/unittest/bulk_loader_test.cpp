@@ -0,0 +1,365 @@
+/**
+ * Bulk loader tests
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../bulk_loader.h"
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+#define MB_ADD_DIR "/var/tmp/mabain_test/bulk_add/"
+
+class BulkLoaderTest : public ::testing::Test {
+public:
+    BulkLoaderTest()
+        : db(nullptr)
+        , ref(nullptr)
+        , block_size(4 * 1024 * 1024)
+    {
+    }
+    ~BulkLoaderTest() override
+    {
+        for (DB* handle : { db, ref }) {
+            if (handle) {
+                handle->Close();
+                delete handle;
+            }
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_ADD_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_* " + MB_ADD_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        for (DB* handle : { db, ref }) {
+            if (handle)
+                handle->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    DB* OpenDB(const char* dir, int options, int64_t memcap = 64 * 1024 * 1024LL) const
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = dir;
+        config.options = options;
+        config.memcap_index = memcap;
+        config.memcap_data = memcap;
+        config.block_size_index = block_size;
+        config.block_size_data = block_size;
+        config.bloom_filter_size = 100000;
+        return new DB(config);
+    }
+
+    // Sorted keys with shared prefixes, keys that are prefixes of others,
+    // long labels, binary bytes and a node with all 256 first characters.
+    static std::vector<std::string> Keys(int num)
+    {
+        std::mt19937 rng(1234);
+        std::vector<std::string> keys;
+        for (int c = 0; c < 256; c++)
+            keys.push_back(std::string("fan-") + static_cast<char>(c));
+        std::string chain = "chain";
+        for (int i = 0; i < 40; i++) {
+            keys.push_back(chain);
+            chain += static_cast<char>('a' + i % 26);
+        }
+        keys.push_back(std::string(200, 'L'));
+        keys.push_back(std::string(200, 'L') + "x");
+        keys.push_back(std::string(100, 'L') + "y");
+        for (int i = 0; i < num; i++) {
+            std::string key = "key-" + std::to_string(rng() % 100000);
+            if (i % 7 == 0)
+                key += std::string(rng() % 20, static_cast<char>(rng() % 256));
+            keys.push_back(key);
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        return keys;
+    }
+
+    static std::string Value(const std::string& key)
+    {
+        return "v" + std::to_string(key.size()) + key.substr(0, 10);
+    }
+
+    // Feeds the keys starting with first_char
+    static int Feed(const std::vector<std::string>& keys, int first_char, BulkLoader& loader)
+    {
+        auto it = std::lower_bound(keys.begin(), keys.end(), std::string(1, static_cast<char>(first_char)));
+        for (; it != keys.end() && static_cast<uint8_t>((*it)[0]) == first_char; ++it) {
+            int rval = loader.Add(*it, Value(*it));
+            if (rval != MBError::SUCCESS)
+                return rval;
+        }
+        return MBError::SUCCESS;
+    }
+
+    // Loads keys with BulkLoader, or with ParallelBulkLoader if num_threads
+    // is not 0, and the same keys into ref with Add.
+    void Load(int options, const std::vector<std::string>& keys, int num_threads = 0,
+        int64_t memcap = 64 * 1024 * 1024LL)
+    {
+        db = OpenDB(MB_DIR, CONSTS::WriterOptions() | options, memcap);
+        ASSERT_TRUE(db->is_open());
+        if (num_threads == 0) {
+            BulkLoader loader(*db);
+            for (const std::string& key : keys)
+                ASSERT_EQ(loader.Add(key, Value(key)), MBError::SUCCESS);
+            ASSERT_EQ(loader.Finish(), MBError::SUCCESS);
+            EXPECT_EQ(loader.Count(), (int64_t)keys.size());
+        } else {
+            ParallelBulkLoader loader(*db, num_threads);
+            ASSERT_EQ(loader.Load([&keys](int c, BulkLoader& partition) { return Feed(keys, c, partition); }),
+                MBError::SUCCESS);
+            EXPECT_EQ(loader.Count(), (int64_t)keys.size());
+        }
+
+        ref = OpenDB(MB_ADD_DIR, CONSTS::WriterOptions() | options);
+        ASSERT_TRUE(ref->is_open());
+        std::vector<std::string> shuffled = keys;
+        std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(5678));
+        for (const std::string& key : shuffled)
+            ASSERT_EQ(ref->Add(key, Value(key)), MBError::SUCCESS);
+    }
+
+    static std::map<std::string, std::string> Contents(DB* handle)
+    {
+        std::map<std::string, std::string> kvs;
+        for (DB::iterator iter = handle->begin(); iter != handle->end(); ++iter)
+            kvs[iter.key] = std::string((const char*)iter.value.buff, iter.value.data_len);
+        return kvs;
+    }
+
+    // Every lookup on the loaded DB matches the one on the DB built by Add.
+    void Compare(DB* handle, const std::vector<std::string>& keys)
+    {
+        EXPECT_EQ(handle->Count(), (int64_t)keys.size());
+        EXPECT_EQ(Contents(handle), Contents(ref));
+        MBData mbd;
+        MBData ref_mbd;
+        for (const std::string& key : keys) {
+            ASSERT_EQ(handle->Find(key, mbd), MBError::SUCCESS) << key;
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), Value(key));
+            EXPECT_EQ(handle->Find(key + "-absent", mbd), MBError::NOT_EXIST);
+
+            std::string probe = key.substr(0, key.size() / 2) + "~";
+            ASSERT_EQ(handle->FindLongestPrefix(probe, mbd), ref->FindLongestPrefix(probe, ref_mbd));
+            EXPECT_EQ(mbd.match_len, ref_mbd.match_len) << probe;
+            std::string bound, ref_bound;
+            ASSERT_EQ(handle->FindLowerBound(probe, mbd, &bound), ref->FindLowerBound(probe, ref_mbd, &ref_bound));
+            EXPECT_EQ(bound, ref_bound) << probe;
+        }
+    }
+
+protected:
+    DB* db;
+    DB* ref;
+    uint32_t block_size;
+};
+
+TEST_F(BulkLoaderTest, MatchesAdd)
+{
+    std::vector<std::string> keys = Keys(3000);
+    Load(0, keys);
+    Compare(db, keys);
+
+    // The tree has the same shape; only node growth and splits are saved.
+    IndexHeader* header = db->GetDictPtr()->GetHeaderPtr();
+    IndexHeader* ref_header = ref->GetDictPtr()->GetHeaderPtr();
+    EXPECT_EQ(header->n_edges, ref_header->n_edges);
+    EXPECT_LT(header->m_index_offset, ref_header->m_index_offset);
+    EXPECT_EQ(header->num_update, ref_header->num_update);
+
+    DB* reader = OpenDB(MB_DIR, CONSTS::ReaderOptions());
+    ASSERT_TRUE(reader->is_open());
+    Compare(reader, keys);
+    reader->Close();
+    delete reader;
+
+    // The loaded DB takes normal updates.
+    for (size_t i = 0; i < keys.size(); i += 3) {
+        ASSERT_EQ(db->Remove(keys[i]), MBError::SUCCESS);
+        ASSERT_EQ(ref->Remove(keys[i]), MBError::SUCCESS);
+    }
+    ASSERT_EQ(db->Add("key-", "new"), MBError::SUCCESS);
+    ASSERT_EQ(ref->Add("key-", "new"), MBError::SUCCESS);
+    db->CollectResource(1, 1);
+    EXPECT_EQ(Contents(db), Contents(ref));
+}
+
+TEST_F(BulkLoaderTest, WithIndexes)
+{
+    const int options = CONSTS::OPTION_SUBTREE_COUNT | CONSTS::OPTION_DENSE_NODE_INDEX
+        | CONSTS::OPTION_HASH_INDEX | CONSTS::OPTION_BLOOM_FILTER;
+    std::vector<std::string> keys = Keys(3000);
+    Load(options, keys);
+
+    DB* reader = OpenDB(MB_DIR, CONSTS::ReaderOptions() | options);
+    ASSERT_TRUE(reader->is_open());
+    Compare(reader, keys);
+    for (const char* prefix : { "", "k", "key-1", "chain", "chainabc", "fan-", "L" }) {
+        int64_t count = -1;
+        int64_t ref_count = -2;
+        ASSERT_EQ(reader->CountPrefix(prefix, count), MBError::SUCCESS);
+        ASSERT_EQ(ref->CountPrefix(prefix, ref_count), MBError::SUCCESS);
+        EXPECT_EQ(count, ref_count) << prefix;
+    }
+    EXPECT_FALSE(db->GetDictPtr()->SubtreeCountStale());
+    EXPECT_FALSE(db->GetDictPtr()->BloomFilterStale());
+    EXPECT_GT(reader->GetBloomFilterSkipCount(), keys.size() / 2);
+    reader->Close();
+    delete reader;
+
+    db->CollectResource(1, 1);
+    Compare(db, keys);
+}
+
+TEST_F(BulkLoaderTest, InvalidInput)
+{
+    db = OpenDB(MB_DIR, CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    {
+        DB* reader = OpenDB(MB_DIR, CONSTS::ReaderOptions());
+        BulkLoader loader(*reader);
+        EXPECT_EQ(loader.Status(), MBError::NOT_ALLOWED);
+        EXPECT_EQ(loader.Add("a", "1"), MBError::NOT_ALLOWED);
+        reader->Close();
+        delete reader;
+    }
+    {
+        BulkLoader loader(*db);
+        EXPECT_EQ(loader.Add("b", "1"), MBError::SUCCESS);
+        EXPECT_EQ(loader.Add("b", "2"), MBError::INVALID_ARG);
+        EXPECT_EQ(loader.Add("a", "2"), MBError::INVALID_ARG);
+        EXPECT_EQ(loader.Add("", "2"), MBError::OUT_OF_BOUND);
+        EXPECT_EQ(loader.Add("ba", "2"), MBError::SUCCESS);
+        EXPECT_EQ(loader.Add("c", "3"), MBError::SUCCESS);
+        // The destructor finishes the load.
+    }
+    EXPECT_EQ(db->Count(), 3);
+    MBData mbd;
+    ASSERT_EQ(db->Find("ba", mbd), MBError::SUCCESS);
+    EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), "2");
+
+    BulkLoader loader(*db);
+    EXPECT_EQ(loader.Status(), MBError::NOT_ALLOWED);
+}
+
+TEST_F(BulkLoaderTest, ParallelMatchesAdd)
+{
+    const int options = CONSTS::OPTION_SUBTREE_COUNT | CONSTS::OPTION_DENSE_NODE_INDEX
+        | CONSTS::OPTION_HASH_INDEX | CONSTS::OPTION_BLOOM_FILTER;
+    std::vector<std::string> keys = Keys(3000);
+    Load(options, keys, 4);
+    Compare(db, keys);
+
+    IndexHeader* header = db->GetDictPtr()->GetHeaderPtr();
+    IndexHeader* ref_header = ref->GetDictPtr()->GetHeaderPtr();
+    EXPECT_EQ(header->n_edges, ref_header->n_edges);
+    EXPECT_EQ(header->num_update, ref_header->num_update);
+    EXPECT_FALSE(db->GetDictPtr()->SubtreeCountStale());
+    EXPECT_FALSE(db->GetDictPtr()->BloomFilterStale());
+
+    DB* reader = OpenDB(MB_DIR, CONSTS::ReaderOptions() | options);
+    ASSERT_TRUE(reader->is_open());
+    Compare(reader, keys);
+    int64_t count = -1;
+    int64_t ref_count = -2;
+    ASSERT_EQ(reader->CountPrefix("key-1", count), MBError::SUCCESS);
+    ASSERT_EQ(ref->CountPrefix("key-1", ref_count), MBError::SUCCESS);
+    EXPECT_EQ(count, ref_count);
+    reader->Close();
+    delete reader;
+
+    // Space left between the chunks of the workers is reused.
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        ASSERT_EQ(db->Remove(keys[i]), MBError::SUCCESS);
+        ASSERT_EQ(ref->Remove(keys[i]), MBError::SUCCESS);
+    }
+    for (int i = 0; i < 2000; i++) {
+        std::string key = "added-" + std::to_string(i);
+        ASSERT_EQ(db->Add(key, Value(key)), MBError::SUCCESS);
+        ASSERT_EQ(ref->Add(key, Value(key)), MBError::SUCCESS);
+    }
+    db->CollectResource(1, 1);
+    EXPECT_EQ(Contents(db), Contents(ref));
+}
+
+TEST_F(BulkLoaderTest, ParallelUnmapped)
+{
+    // Blocks past the memory cap are written with file writes.
+    block_size = 256 * 1024;
+    std::vector<std::string> keys = Keys(20000);
+    Load(0, keys, 3, 1);
+    IndexHeader* header = db->GetDictPtr()->GetHeaderPtr();
+    EXPECT_GT(header->m_index_offset, block_size);
+    EXPECT_GT(header->m_data_offset, block_size);
+    Compare(db, keys);
+}
+
+TEST_F(BulkLoaderTest, ParallelFailure)
+{
+    std::vector<std::string> keys = Keys(3000);
+    db = OpenDB(MB_DIR, CONSTS::WriterOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(db->is_open());
+    IndexHeader* header = db->GetDictPtr()->GetHeaderPtr();
+    size_t index_offset = header->m_index_offset;
+    size_t data_offset = header->m_data_offset;
+    {
+        ParallelBulkLoader loader(*db, 2);
+        int rval = loader.Load([&keys](int c, BulkLoader& partition) {
+            if (c == 'k')
+                return static_cast<int>(MBError::WRITE_ERROR);
+            // Keys of another first byte are refused.
+            if (partition.Add(std::string(1, static_cast<char>(c + 1)), "x") != MBError::INVALID_ARG)
+                return static_cast<int>(MBError::INVALID_ARG);
+            return Feed(keys, c, partition);
+        });
+        EXPECT_EQ(rval, MBError::WRITE_ERROR);
+        EXPECT_EQ(loader.Count(), 0);
+        EXPECT_EQ(loader.Load([](int, BulkLoader&) { return static_cast<int>(MBError::SUCCESS); }),
+            MBError::WRITE_ERROR);
+    }
+    // Nothing is linked and the file space is given back.
+    EXPECT_EQ(db->Count(), 0);
+    EXPECT_EQ(header->m_index_offset, index_offset);
+    EXPECT_EQ(header->m_data_offset, data_offset);
+    MBData mbd;
+    EXPECT_EQ(db->Find(keys[0], mbd), MBError::NOT_EXIST);
+
+    ParallelBulkLoader loader(*db, 2);
+    ASSERT_EQ(loader.Load([&keys](int c, BulkLoader& partition) { return Feed(keys, c, partition); }),
+        MBError::SUCCESS);
+    EXPECT_EQ(db->Count(), (int64_t)keys.size());
+    ASSERT_EQ(db->Find(keys[0], mbd), MBError::SUCCESS);
+
+    ParallelBulkLoader not_empty(*db, 2);
+    EXPECT_EQ(not_empty.Load([](int, BulkLoader&) { return static_cast<int>(MBError::SUCCESS); }),
+        MBError::NOT_ALLOWED);
+}
+
+} // namespace
@@ -0,0 +1,235 @@
+/**
+ * Dense node index tests
+ */
+
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../dict_mem.h"
+#include "../integer_4b_5b.h"
+#include "../mb_rc.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+// Keys under each root character fan out into this many second characters.
+const struct {
+    char root;
+    int fanout;
+} kFanouts[] = { { 'a', 20 }, { 'b', DENSE_NODE_MIN_EDGES }, { 'c', 200 }, { 'd', 256 } };
+
+class DenseNodeTest : public ::testing::Test {
+public:
+    DenseNodeTest()
+        : db(nullptr)
+    {
+    }
+    ~DenseNodeTest() override
+    {
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        if (db) {
+            db->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static DB* OpenDB(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 64 * 1024 * 1024LL;
+        config.memcap_data = 64 * 1024 * 1024LL;
+        return new DB(config);
+    }
+
+    static std::string MakeKey(char root, int c, int i)
+    {
+        std::string key(1, root);
+        key.push_back(static_cast<char>(c));
+        if (i > 0)
+            key += "tail" + std::to_string(i);
+        return key;
+    }
+
+    void Populate()
+    {
+        for (const auto& f : kFanouts) {
+            // The dense node itself holds a value too.
+            Add(std::string(1, f.root));
+            for (int c = 0; c < f.fanout; c++) {
+                Add(MakeKey(f.root, c, 0));
+                Add(MakeKey(f.root, c, c % 3 + 1));
+            }
+        }
+    }
+
+    void Add(const std::string& key)
+    {
+        ASSERT_EQ(db->Add(key, "v:" + key, true), MBError::SUCCESS);
+        expected[key] = "v:" + key;
+    }
+
+    void Remove(const std::string& key)
+    {
+        ASSERT_EQ(db->Remove(key), MBError::SUCCESS);
+        expected.erase(key);
+    }
+
+    // Flags of the node below the root edge for root
+    uint8_t ChildFlags(DB* handle, char root)
+    {
+        DictMem* mm = handle->GetDictPtr()->GetMM();
+        EdgePtrs edge_ptrs;
+        EXPECT_EQ(mm->GetRootEdge(0, static_cast<uint8_t>(root), edge_ptrs), MBError::SUCCESS);
+        EXPECT_EQ(edge_ptrs.len_ptr[0], 1);
+        uint8_t node_hdr[NODE_EDGE_KEY_FIRST];
+        EXPECT_EQ(mm->ReadData(node_hdr, NODE_EDGE_KEY_FIRST, Get6BInteger(edge_ptrs.offset_ptr)),
+            NODE_EDGE_KEY_FIRST);
+        return node_hdr[0];
+    }
+
+    void Verify(DB* handle)
+    {
+        MBData mbd;
+        for (const auto& entry : expected) {
+            ASSERT_EQ(handle->Find(entry.first, mbd), MBError::SUCCESS) << entry.first;
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), entry.second);
+            if (entry.first.size() < 2)
+                continue;
+            ASSERT_EQ(handle->FindLongestPrefix(entry.first + "~", mbd), MBError::SUCCESS);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), entry.second);
+        }
+        // Absent first characters in every node, and removed keys
+        for (const auto& f : kFanouts) {
+            for (int c = 0; c < 256; c++) {
+                std::string key = MakeKey(f.root, c, 0);
+                if (expected.count(key) == 0) {
+                    EXPECT_EQ(handle->Find(key, mbd), MBError::NOT_EXIST) << f.root << c;
+                }
+            }
+        }
+
+        int64_t count = 0;
+        for (DB::iterator iter = handle->begin(); iter != handle->end(); ++iter)
+            count++;
+        EXPECT_EQ(count, (int64_t)expected.size());
+
+        EXPECT_EQ(handle->FindLowerBound(std::string("c\x80zz"), mbd), MBError::SUCCESS);
+    }
+
+protected:
+    DB* db;
+    std::map<std::string, std::string> expected;
+};
+
+TEST_F(DenseNodeTest, AddFindRemove)
+{
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_DENSE_NODE_INDEX | CONSTS::OPTION_SUBTREE_COUNT);
+    ASSERT_TRUE(db->is_open());
+    Populate();
+    EXPECT_FALSE(ChildFlags(db, 'a') & FLAG_NODE_INDEXED);
+    for (char root : { 'b', 'c', 'd' })
+        EXPECT_TRUE(ChildFlags(db, root) & FLAG_NODE_INDEXED) << root;
+    Verify(db);
+
+    DB* reader = OpenDB(CONSTS::ReaderOptions());
+    ASSERT_TRUE(reader->is_open());
+    Verify(reader);
+    int64_t count = -1;
+    ASSERT_EQ(reader->CountPrefix("d", count), MBError::SUCCESS);
+    EXPECT_EQ(count, 1 + 2 * 256);
+
+    // Shrink the densest node below the threshold and grow it back.
+    for (int c = 255; c >= 10; c--) {
+        Remove(MakeKey('d', c, 0));
+        Remove(MakeKey('d', c, c % 3 + 1));
+        if (c % 61 == 0)
+            Verify(reader);
+    }
+    EXPECT_FALSE(ChildFlags(db, 'd') & FLAG_NODE_INDEXED);
+    Verify(reader);
+    for (int c = 10; c < 256; c++)
+        Add(MakeKey('d', c, 0));
+    EXPECT_TRUE(ChildFlags(db, 'd') & FLAG_NODE_INDEXED);
+    Verify(reader);
+    ASSERT_EQ(reader->CountPrefix("d", count), MBError::SUCCESS);
+    EXPECT_EQ(count, 1 + 256 + 10);
+
+    // Defragmentation moves indexed nodes with their size.
+    db->CollectResource(1, 1);
+    Verify(reader);
+    reader->Close();
+    delete reader;
+}
+
+TEST_F(DenseNodeTest, MigrateThroughResourceCollection)
+{
+    db = OpenDB(CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    Populate();
+    for (const auto& f : kFanouts)
+        EXPECT_FALSE(ChildFlags(db, f.root) & FLAG_NODE_INDEXED) << f.root;
+    db->Close();
+    delete db;
+
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_DENSE_NODE_INDEX);
+    ASSERT_TRUE(db->is_open());
+    DB* reader = OpenDB(CONSTS::ReaderOptions());
+    ASSERT_TRUE(reader->is_open());
+    Verify(reader);
+
+    db->CollectResource(1, 1);
+    EXPECT_FALSE(ChildFlags(db, 'a') & FLAG_NODE_INDEXED);
+    for (char root : { 'b', 'c', 'd' })
+        EXPECT_TRUE(ChildFlags(db, root) & FLAG_NODE_INDEXED) << root;
+    Verify(reader);
+
+    int64_t converted = -1;
+    ASSERT_EQ(db->GetDictPtr()->GetMM()->IndexDenseNodes(converted), MBError::SUCCESS);
+    EXPECT_EQ(converted, 0);
+
+    // Writers without the option keep existing indexes readable and drop
+    // them from nodes they rewrite.
+    reader->Close();
+    delete reader;
+    db->Close();
+    delete db;
+    db = OpenDB(CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    Remove(MakeKey('c', 7, 7 % 3 + 1));
+    Remove(MakeKey('c', 7, 0));
+    EXPECT_FALSE(ChildFlags(db, 'c') & FLAG_NODE_INDEXED);
+    EXPECT_TRUE(ChildFlags(db, 'd') & FLAG_NODE_INDEXED);
+    Verify(db);
+}
+
+} // namespace
@@ -0,0 +1,228 @@
+/**
+ * Group commit (SYNC_GROUP_COMMIT) tests
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class GroupSyncTest : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static MBConfig Config(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 16 * 1024 * 1024LL;
+        config.memcap_data = 16 * 1024 * 1024LL;
+        config.block_size_index = 8 * 1024 * 1024;
+        config.block_size_data = 8 * 1024 * 1024;
+        return config;
+    }
+
+    static std::string Value(int i)
+    {
+        return "value" + std::to_string(i) + std::string(i % 100, 'v');
+    }
+};
+
+TEST_F(GroupSyncTest, WaitDurable)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::SYNC_GROUP_COMMIT);
+    config.sync_interval_ms = 5;
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+
+    for (int i = 0; i < 1000; i++)
+        ASSERT_EQ(db.Add("key" + std::to_string(i), Value(i)), MBError::SUCCESS) << i;
+    uint64_t seq = 0;
+    ASSERT_EQ(db.WriteSeq(seq), MBError::SUCCESS);
+    EXPECT_GT(seq, 1000u);
+    EXPECT_EQ(db.WaitDurable(seq), MBError::SUCCESS);
+    EXPECT_GE(db.GetDictPtr()->GetGroupSync()->DurableSeq(), seq);
+    EXPECT_EQ(db.WaitDurable(seq + 1000), MBError::INVALID_ARG);
+
+    // Later writes get later sequence numbers.
+    ASSERT_EQ(db.Remove("key0"), MBError::SUCCESS);
+    uint64_t next_seq = 0;
+    ASSERT_EQ(db.WriteSeq(next_seq), MBError::SUCCESS);
+    EXPECT_GT(next_seq, seq);
+    EXPECT_EQ(db.WaitDurable(next_seq), MBError::SUCCESS);
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.WriteSeq(seq), MBError::NOT_ALLOWED);
+    EXPECT_EQ(reader.WaitDurable(1), MBError::NOT_ALLOWED);
+    EXPECT_EQ(reader.Count(), 999);
+    reader.Close();
+    db.Close();
+
+    MBConfig plain_config = Config(CONSTS::WriterOptions());
+    DB plain(plain_config);
+    ASSERT_TRUE(plain.is_open());
+    EXPECT_EQ(plain.WriteSeq(seq), MBError::NOT_ALLOWED);
+    plain.Close();
+}
+
+TEST_F(GroupSyncTest, ByteThreshold)
+{
+    // The interval is never reached; groups are written once enough bytes
+    // are pending.
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::SYNC_GROUP_COMMIT);
+    config.sync_interval_ms = 600000;
+    config.sync_bytes = 64 * 1024;
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+    GroupSync* group_sync = db.GetDictPtr()->GetGroupSync();
+    ASSERT_TRUE(group_sync != NULL);
+
+    std::string value(1000, 'x');
+    for (int i = 0; i < 1000; i++)
+        ASSERT_EQ(db.Add("key" + std::to_string(i), value), MBError::SUCCESS) << i;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (group_sync->DurableSeq() == 0 && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_GT(group_sync->DurableSeq(), 0u);
+
+    // Close writes back the rest without waiting for the interval.
+    auto start = std::chrono::steady_clock::now();
+    db.Close();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.Count(), 1000);
+    MBData mbd;
+    ASSERT_EQ(reader.Find("key999", mbd), MBError::SUCCESS);
+    EXPECT_EQ(std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len), value);
+    reader.Close();
+}
+
+TEST_F(GroupSyncTest, ResourceCollection)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::SYNC_GROUP_COMMIT | CONSTS::SYNC_ON_WRITE);
+    config.sync_interval_ms = 5;
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+
+    for (int i = 0; i < 2000; i++)
+        ASSERT_EQ(db.Add("key" + std::to_string(i), Value(i)), MBError::SUCCESS) << i;
+    for (int i = 0; i < 2000; i += 2)
+        ASSERT_EQ(db.Remove("key" + std::to_string(i)), MBError::SUCCESS) << i;
+    db.CollectResource(1, 1);
+
+    uint64_t seq = 0;
+    ASSERT_EQ(db.WriteSeq(seq), MBError::SUCCESS);
+    EXPECT_EQ(db.WaitDurable(seq), MBError::SUCCESS);
+    EXPECT_EQ(db.Count(), 1000);
+    for (int i = 1; i < 2000; i += 2) {
+        MBData mbd;
+        ASSERT_EQ(db.Find("key" + std::to_string(i), mbd), MBError::SUCCESS) << i;
+        EXPECT_EQ(std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len), Value(i)) << i;
+    }
+    db.Close();
+}
+
+TEST_F(GroupSyncTest, HeaderWaitsForUpdate)
+{
+    std::string header_path = std::string(MB_DIR) + "_group_sync_test_h";
+    FILE* fp = fopen(header_path.c_str(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fclose(fp);
+    GroupSync group_sync(header_path, 1, 0);
+
+    // A group is not durable while the writer is in the middle of an update.
+    group_sync.BeginUpdate();
+    uint64_t seq = group_sync.Mark();
+    std::atomic<bool> durable(false);
+    std::thread waiter([&]() {
+        EXPECT_EQ(group_sync.Wait(seq), MBError::SUCCESS);
+        durable = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(durable);
+    EXPECT_LT(group_sync.DurableSeq(), seq);
+    group_sync.EndUpdate();
+    waiter.join();
+    EXPECT_GE(group_sync.DurableSeq(), seq);
+}
+
+TEST_F(GroupSyncTest, ConcurrentWriter)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::SYNC_GROUP_COMMIT);
+    config.sync_interval_ms = 1;
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+
+    const int num_keys = 5000;
+    std::atomic<bool> done(false);
+    std::thread writer([&]() {
+        for (int i = 0; i < num_keys; i++)
+            EXPECT_EQ(db.Add("key" + std::to_string(i), Value(i)), MBError::SUCCESS) << i;
+        done = true;
+    });
+
+    // Groups keep becoming durable while the writer is busy.
+    uint64_t last_seq = 0;
+    int groups = 0;
+    while (!done) {
+        uint64_t seq = 0;
+        ASSERT_EQ(db.WriteSeq(seq), MBError::SUCCESS);
+        EXPECT_GT(seq, last_seq);
+        EXPECT_EQ(db.WaitDurable(seq), MBError::SUCCESS);
+        last_seq = seq;
+        groups++;
+    }
+    writer.join();
+    EXPECT_GT(groups, 0);
+    uint64_t seq = 0;
+    ASSERT_EQ(db.WriteSeq(seq), MBError::SUCCESS);
+    EXPECT_EQ(db.WaitDurable(seq), MBError::SUCCESS);
+    db.Close();
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.Count(), num_keys);
+    for (int i = 0; i < num_keys; i += 100) {
+        MBData mbd;
+        ASSERT_EQ(reader.Find("key" + std::to_string(i), mbd), MBError::SUCCESS) << i;
+        EXPECT_EQ(std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len), Value(i)) << i;
+    }
+    reader.Close();
+}
+
+}
@@ -0,0 +1,276 @@
+/**
+ * Exact-match hash index tests
+ */
+
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class HashIndexTest : public ::testing::Test {
+public:
+    HashIndexTest()
+        : db(nullptr)
+    {
+    }
+    ~HashIndexTest() override
+    {
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+
+        db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_HASH_INDEX);
+        ASSERT_TRUE(db->is_open());
+    }
+
+    void TearDown() override
+    {
+        if (db) {
+            db->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static DB* OpenDB(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 64 * 1024 * 1024LL;
+        config.memcap_data = 64 * 1024 * 1024LL;
+        config.hash_index_size = 4096;
+        return new DB(config);
+    }
+
+    static std::string Key(int i)
+    {
+        // Short enough to be indexed
+        return "hash-index-" + std::to_string(i);
+    }
+
+    // Points key at the value of another key in the index only; Find returns
+    // that value for as long as it uses this entry.
+    static void PlantEntry(DB* handle, const std::string& key, const std::string& target)
+    {
+        MBData mbd;
+        ASSERT_EQ(handle->Find(target, mbd), MBError::SUCCESS);
+        Dict* dict = handle->GetDictPtr();
+        dict->BeginHashIndexUpdate();
+        dict->PutHashIndex((const uint8_t*)key.data(), key.size(), mbd.data_offset);
+        dict->EndHashIndexUpdate();
+    }
+
+    static std::string FindValue(DB* handle, const std::string& key)
+    {
+        MBData mbd;
+        if (handle->Find(key, mbd) != MBError::SUCCESS)
+            return "<missing>";
+        return std::string((const char*)mbd.buff, mbd.data_len);
+    }
+
+    static std::string Value(int i, int version)
+    {
+        return "value-" + std::to_string(i) + "-" + std::to_string(version);
+    }
+
+    static void CheckValue(DB* handle, int i, int version)
+    {
+        MBData mbd;
+        ASSERT_EQ(handle->Find(Key(i), mbd), MBError::SUCCESS);
+        EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), Value(i, version));
+    }
+
+protected:
+    DB* db;
+};
+
+TEST_F(HashIndexTest, FindOverwriteRemove)
+{
+    const int num = 1000;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Value(i, 0)), MBError::SUCCESS);
+
+    DB* reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(reader->is_open());
+    EXPECT_TRUE(db->GetDictPtr()->HashIndexEnabled());
+    for (int i = 0; i < num; i++)
+        CheckValue(reader, i, 0);
+
+    for (int i = 0; i < num; i += 2)
+        ASSERT_EQ(db->Add(Key(i), Value(i, 1), true), MBError::SUCCESS);
+    for (int i = 1; i < num; i += 4)
+        ASSERT_EQ(db->Remove(Key(i)), MBError::SUCCESS);
+
+    MBData mbd;
+    for (int i = 0; i < num; i++) {
+        if (i % 4 == 1) {
+            EXPECT_EQ(reader->Find(Key(i), mbd), MBError::NOT_EXIST);
+        } else {
+            CheckValue(reader, i, (i % 2 == 0) ? 1 : 0);
+        }
+    }
+
+    // Keys sharing the inline prefix but not present must miss.
+    EXPECT_EQ(reader->Find(Key(num), mbd), MBError::NOT_EXIST);
+    // Prefix lookups still go through the tree.
+    EXPECT_EQ(reader->FindLongestPrefix(Key(3) + "-suffix", mbd), MBError::SUCCESS);
+
+    ASSERT_EQ(db->RemoveAll(), MBError::SUCCESS);
+    for (int i = 0; i < num; i++)
+        EXPECT_EQ(reader->Find(Key(i), mbd), MBError::NOT_EXIST);
+
+    reader->Close();
+    delete reader;
+}
+
+TEST_F(HashIndexTest, ResourceCollection)
+{
+    const int num = 2000;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Value(i, 0)), MBError::SUCCESS);
+    for (int i = 0; i < num; i += 2)
+        ASSERT_EQ(db->Remove(Key(i)), MBError::SUCCESS);
+
+    // Data buffers move; the index must not point at old locations.
+    db->CollectResource(1, 1);
+    DB* reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(reader->is_open());
+    MBData mbd;
+    for (int i = 0; i < num; i++) {
+        if (i % 2 == 0) {
+            EXPECT_EQ(reader->Find(Key(i), mbd), MBError::NOT_EXIST);
+        } else {
+            CheckValue(reader, i, 0);
+        }
+    }
+    reader->Close();
+    delete reader;
+}
+
+TEST_F(HashIndexTest, WriterWithoutIndex)
+{
+    const int num = 500;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Value(i, 0)), MBError::SUCCESS);
+    db->Close();
+    delete db;
+
+    // A writer that does not maintain the index must disable it.
+    db = OpenDB(CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Value(i, 1), true), MBError::SUCCESS);
+
+    DB* reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(reader->is_open());
+    for (int i = 0; i < num; i++)
+        CheckValue(reader, i, 1);
+    reader->Close();
+    delete reader;
+    db->Close();
+    delete db;
+
+    // Reopening with the option rebuilds the index from the tree.
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(db->is_open());
+    EXPECT_TRUE(db->GetDictPtr()->HashIndexEnabled());
+    reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(reader->is_open());
+    for (int i = 0; i < num; i++)
+        CheckValue(reader, i, 1);
+    reader->Close();
+    delete reader;
+}
+
+TEST_F(HashIndexTest, LongKeys)
+{
+    // Keys longer than the inline part share it and differ past it.
+    const std::string prefix = "hash-index-test-common-prefix-";
+    const int num = 200;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(prefix + std::to_string(i), Value(i, 0)), MBError::SUCCESS);
+    for (int i = 0; i < num; i++)
+        EXPECT_EQ(FindValue(db, prefix + std::to_string(i)), Value(i, 0));
+
+    // Long keys are not indexed, so an entry for one is never used.
+    PlantEntry(db, prefix + "missing", prefix + "1");
+    EXPECT_EQ(FindValue(db, prefix + "missing"), "<missing>");
+    PlantEntry(db, "short-missing", prefix + "1");
+    EXPECT_EQ(FindValue(db, "short-missing"), Value(1, 0));
+}
+
+TEST_F(HashIndexTest, KeptAcrossOpens)
+{
+    const int num = 500;
+    for (int i = 0; i < num; i++)
+        ASSERT_EQ(db->Add(Key(i), Value(i, 0)), MBError::SUCCESS);
+    PlantEntry(db, "planted", Key(7));
+    db->Close();
+    delete db;
+
+    // The next writer keeps the index instead of rebuilding it.
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(db->is_open());
+    EXPECT_FALSE(db->GetDictPtr()->HashIndexStale());
+    EXPECT_EQ(FindValue(db, "planted"), Value(7, 0));
+    DB* reader = OpenDB(CONSTS::ReaderOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(reader->is_open());
+    EXPECT_EQ(FindValue(reader, "planted"), Value(7, 0));
+
+    // Index rc does not move values and keeps it too.
+    db->CollectResource(1, 0x7FFFFFFFFFFFFFFF);
+    EXPECT_EQ(FindValue(reader, "planted"), Value(7, 0));
+
+    // Data rc moves the values and the index entries follow them; the
+    // index is not rebuilt, so the planted entry follows its value.
+    for (int i = 0; i < num; i += 2)
+        ASSERT_EQ(db->Remove(Key(i)), MBError::SUCCESS);
+    MBData mbd;
+    ASSERT_EQ(db->Find(Key(7), mbd), MBError::SUCCESS);
+    size_t old_offset = mbd.data_offset;
+    db->CollectResource(1, 1);
+    EXPECT_FALSE(db->GetDictPtr()->HashIndexStale());
+    ASSERT_EQ(db->Find(Key(7), mbd), MBError::SUCCESS);
+    EXPECT_NE(mbd.data_offset, old_offset);
+    EXPECT_EQ(FindValue(reader, "planted"), Value(7, 0));
+    for (int i = 1; i < num; i += 2)
+        CheckValue(reader, i, 0);
+    reader->Close();
+    delete reader;
+
+    // A writer that stopped in the middle of an update leaves it stale.
+    PlantEntry(db, "planted", Key(9));
+    db->GetDictPtr()->BeginHashIndexUpdate();
+    db->Close();
+    delete db;
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_HASH_INDEX);
+    ASSERT_TRUE(db->is_open());
+    EXPECT_FALSE(db->GetDictPtr()->HashIndexStale());
+    EXPECT_EQ(FindValue(db, "planted"), "<missing>");
+    CheckValue(db, 9, 0);
+}
+
+}
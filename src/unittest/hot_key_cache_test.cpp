@@ -0,0 +1,178 @@
+/**
+ * Per-handle hot key cache tests
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class HotKeyCacheTest : public ::testing::Test {
+public:
+    HotKeyCacheTest()
+        : db(nullptr)
+        , reader(nullptr)
+    {
+    }
+    ~HotKeyCacheTest() override
+    {
+        if (reader) {
+            reader->Close();
+            delete reader;
+            reader = nullptr;
+        }
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+
+        db = new DB(MB_DIR, CONSTS::WriterOptions());
+        ASSERT_TRUE(db->is_open());
+        for (int i = 0; i < num_keys; i++)
+            ASSERT_EQ(db->Add(Key(i), Value(i, 0)), MBError::SUCCESS);
+
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = CONSTS::ReaderOptions();
+        config.hot_key_cache_size = 64;
+        reader = new DB(config);
+        ASSERT_TRUE(reader->is_open());
+    }
+
+    void TearDown() override
+    {
+        if (reader)
+            reader->Close();
+        if (db)
+            db->Close();
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    // Fixed width so that no key is a prefix of another; values stored in
+    // an internal node are not cached.
+    static std::string Key(int i)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "hot-key-cache-test-%04d", i);
+        return buf;
+    }
+
+    static std::string Value(int i, int version)
+    {
+        return "value-" + std::to_string(i) + "-" + std::to_string(version);
+    }
+
+    // Hit count from the reader's stats output.
+    uint64_t Hits() const
+    {
+        std::ostringstream out;
+        reader->PrintStats(out);
+        std::string stats = out.str();
+        size_t pos = stats.find("Hits: ");
+        if (pos == std::string::npos)
+            return 0;
+        return std::stoull(stats.substr(pos + 6));
+    }
+
+    // Finds the hot keys and checks each value belongs to its key.
+    void FindHotKeys()
+    {
+        MBData mbd;
+        for (int i = 0; i < num_hot; i++) {
+            ASSERT_EQ(reader->Find(Key(i), mbd), MBError::SUCCESS) << i;
+            std::string value((const char*)mbd.buff, mbd.data_len);
+            std::string prefix = "value-" + std::to_string(i) + "-";
+            EXPECT_EQ(value.compare(0, prefix.size(), prefix), 0) << value;
+        }
+    }
+
+protected:
+    static const int num_keys = 1000;
+    static const int num_hot = 16;
+    DB* db;
+    DB* reader;
+};
+
+TEST_F(HotKeyCacheTest, HitsAfterUnrelatedWrites)
+{
+    // Hot keys sharing a slot evict each other; count those that stay.
+    FindHotKeys();
+    uint64_t hits = Hits();
+    FindHotKeys();
+    uint64_t cached = Hits() - hits;
+    EXPECT_GT(cached, (uint64_t)num_hot / 2);
+
+    // Overwriting other keys moves the lock-free counter well past the
+    // offset cache window but leaves the hot leaf edges in place.
+    for (int i = num_hot; i < num_keys; i++)
+        ASSERT_EQ(db->Add(Key(i), Value(i, 1), true), MBError::SUCCESS);
+    hits = Hits();
+    FindHotKeys();
+    EXPECT_EQ(Hits() - hits, cached);
+
+    // A new edge in a node on the hot keys' paths releases that node; the
+    // entries are checked against the writer counter again and dropped as
+    // that is too far behind.
+    ASSERT_EQ(db->Add("hot-key-cache-test-00x", "new-value"), MBError::SUCCESS);
+    hits = Hits();
+    FindHotKeys();
+    EXPECT_EQ(Hits(), hits);
+    FindHotKeys();
+    EXPECT_EQ(Hits() - hits, cached);
+}
+
+TEST_F(HotKeyCacheTest, ConcurrentWrites)
+{
+    FindHotKeys();
+    uint64_t hits = Hits();
+
+    std::atomic<bool> done(false);
+    std::thread writer([&]() {
+        for (int version = 1; version <= 20; version++) {
+            for (int i = 0; i < num_keys; i++)
+                EXPECT_EQ(db->Add(Key(i), Value(i, version), true), MBError::SUCCESS);
+            std::this_thread::yield();
+        }
+        done = true;
+    });
+    int rounds = 0;
+    while (!done || rounds == 0) {
+        FindHotKeys();
+        rounds++;
+    }
+    writer.join();
+    EXPECT_GT(Hits() - hits, (uint64_t)rounds * num_hot / 2);
+
+    MBData mbd;
+    for (int i = 0; i < num_keys; i++) {
+        ASSERT_EQ(reader->Find(Key(i), mbd), MBError::SUCCESS);
+        EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), Value(i, 20));
+    }
+}
+
+} // namespace
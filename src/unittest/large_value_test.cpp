@@ -0,0 +1,341 @@
+/**
+ * Large value (extent list) tests
+ */
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class LargeValueTest : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static MBConfig Config(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 16 * 1024 * 1024LL;
+        config.memcap_data = 16 * 1024 * 1024LL;
+        config.block_size_index = 8 * 1024 * 1024;
+        config.block_size_data = 8 * 1024 * 1024;
+        return config;
+    }
+
+    static std::string Value(int len, int seed)
+    {
+        std::string value(len, '\0');
+        for (int i = 0; i < len; i++)
+            value[i] = static_cast<char>((i * 31 + seed) % 251);
+        return value;
+    }
+
+    static std::string Find(const DB& db, const std::string& key)
+    {
+        MBData mbd;
+        if (db.Find(key, mbd) != MBError::SUCCESS)
+            return "<missing>";
+        return std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len);
+    }
+
+    // Read the value in pieces of piece_len bytes with ReadValueRange.
+    static std::string Stream(const DB& db, const std::string& key, int piece_len)
+    {
+        std::string value;
+        std::vector<char> buf(piece_len);
+        int read_len = piece_len;
+        while (read_len == piece_len) {
+            if (db.ReadValueRange(key, value.size(), piece_len, buf.data(), read_len)
+                != MBError::SUCCESS)
+                return "<missing>";
+            value.append(buf.data(), read_len);
+        }
+        return value;
+    }
+};
+
+TEST_F(LargeValueTest, AddFindRemove)
+{
+    MBConfig config = Config(CONSTS::WriterOptions());
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+
+    const int sizes[] = { CONSTS::MAX_DATA_SIZE, CONSTS::MAX_DATA_SIZE + 1,
+        3 * CONSTS::MAX_DATA_SIZE, 3 * CONSTS::MAX_DATA_SIZE + 5, 1024 * 1024 };
+    for (int i = 0; i < 5; i++) {
+        std::string key = "large" + std::to_string(i);
+        EXPECT_EQ(db.Add(key, Value(sizes[i], i)), MBError::SUCCESS) << i;
+    }
+    for (int i = 0; i < 5; i++) {
+        std::string key = "large" + std::to_string(i);
+        EXPECT_EQ(Find(db, key), Value(sizes[i], i)) << i;
+        EXPECT_EQ(Stream(db, key, 10000), Value(sizes[i], i)) << i;
+    }
+    EXPECT_EQ(db.Count(), 5);
+
+    // Ranges of a large value, including ones across extents and past the end
+    std::string value = Value(3 * CONSTS::MAX_DATA_SIZE + 5, 3);
+    char buf[100];
+    int read_len;
+    EXPECT_EQ(db.ReadValueRange("large3", CONSTS::MAX_DATA_SIZE - 50, 100, buf, read_len),
+        MBError::SUCCESS);
+    EXPECT_EQ(read_len, 100);
+    EXPECT_EQ(std::string(buf, read_len), value.substr(CONSTS::MAX_DATA_SIZE - 50, 100));
+    EXPECT_EQ(db.ReadValueRange("large3", value.size() - 30, 100, buf, read_len), MBError::SUCCESS);
+    EXPECT_EQ(std::string(buf, read_len), value.substr(value.size() - 30));
+    EXPECT_EQ(db.ReadValueRange("large3", value.size() + 30, 100, buf, read_len), MBError::SUCCESS);
+    EXPECT_EQ(read_len, 0);
+    EXPECT_EQ(db.ReadValueRange("missing", 0, 100, buf, read_len), MBError::NOT_EXIST);
+
+    // Ranges of a small value
+    EXPECT_EQ(db.Add("small", "0123456789"), MBError::SUCCESS);
+    EXPECT_EQ(db.ReadValueRange("small", 3, 4, buf, read_len), MBError::SUCCESS);
+    EXPECT_EQ(std::string(buf, read_len), "3456");
+    EXPECT_EQ(db.ReadValueRange("small", 8, 4, buf, read_len), MBError::SUCCESS);
+    EXPECT_EQ(std::string(buf, read_len), "89");
+
+    // Views of large values are copies.
+    MBDataView view;
+    ASSERT_EQ(db.FindView("large4", view), MBError::SUCCESS);
+    EXPECT_FALSE(view.IsPinned());
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view.data), view.data_len), Value(1024 * 1024, 4));
+    view.Release();
+
+    // Overwrite large with small and small with large
+    EXPECT_EQ(db.Add("large2", "short", true), MBError::SUCCESS);
+    EXPECT_EQ(db.Add("small", Value(2 * CONSTS::MAX_DATA_SIZE + 1, 7), true), MBError::SUCCESS);
+    EXPECT_EQ(db.Add("large4", Value(200000, 8), true), MBError::SUCCESS);
+    EXPECT_EQ(Find(db, "large2"), "short");
+    EXPECT_EQ(Find(db, "small"), Value(2 * CONSTS::MAX_DATA_SIZE + 1, 7));
+    EXPECT_EQ(Find(db, "large4"), Value(200000, 8));
+
+    int count = 0;
+    for (DB::iterator iter = db.begin(); iter != db.end(); ++iter) {
+        if (iter.key == "large4") {
+            EXPECT_EQ(std::string(reinterpret_cast<char*>(iter.value.buff), iter.value.data_len),
+                Value(200000, 8));
+        }
+        count++;
+    }
+    EXPECT_EQ(count, 6);
+
+    // The extents are released with the value and reused.
+    EXPECT_EQ(db.Remove("large4"), MBError::SUCCESS);
+    EXPECT_EQ(Find(db, "large4"), "<missing>");
+    size_t data_end = db.GetDictPtr()->GetHeaderPtr()->m_data_offset;
+    EXPECT_EQ(db.Add("large5", Value(200000, 9)), MBError::SUCCESS);
+    EXPECT_EQ(db.GetDictPtr()->GetHeaderPtr()->m_data_offset, data_end);
+    EXPECT_EQ(Find(db, "large5"), Value(200000, 9));
+
+    // Reader handles see the same values.
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(Find(reader, "large5"), Value(200000, 9));
+    EXPECT_EQ(Stream(reader, "large3", 4096), value);
+    reader.Close();
+    db.Close();
+}
+
+TEST_F(LargeValueTest, ViewValidity)
+{
+    MBConfig config = Config(CONSTS::WriterOptions());
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+
+    EXPECT_EQ(db.Add("view", Value(1000, 1)), MBError::SUCCESS);
+    MBDataView view;
+    ASSERT_EQ(db.FindView("view", view), MBError::SUCCESS);
+    ASSERT_TRUE(view.IsPinned());
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view.data), view.data_len), Value(1000, 1));
+    EXPECT_TRUE(view.Valid());
+
+    // New keys do not touch the pinned value.
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(db.Add("other" + std::to_string(i), Value(500, i)), MBError::SUCCESS);
+    EXPECT_TRUE(view.Valid());
+
+    // Overwriting and removing the key keep the buffer the view points at
+    // until the view is released.
+    int64_t pending = db.GetPendingDataBufferSize();
+    EXPECT_EQ(db.Add("view", Value(1000, 2), true), MBError::SUCCESS);
+    EXPECT_TRUE(view.Valid());
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view.data), view.data_len), Value(1000, 1));
+    MBDataView view2;
+    ASSERT_EQ(db.FindView("view", view2), MBError::SUCCESS);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view2.data), view2.data_len), Value(1000, 2));
+    EXPECT_EQ(db.Remove("view"), MBError::SUCCESS);
+    EXPECT_TRUE(view.Valid());
+    EXPECT_TRUE(view2.Valid());
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view2.data), view2.data_len), Value(1000, 2));
+    EXPECT_EQ(db.GetPendingDataBufferSize(), pending);
+    view.Release();
+    EXPECT_FALSE(view.Valid());
+    view2.Release();
+    // The next release frees the buffers kept for the views as well.
+    EXPECT_EQ(db.Remove("other0"), MBError::SUCCESS);
+    EXPECT_GT(db.GetPendingDataBufferSize(), pending + 2000);
+
+    // An in-place rewrite moves the value to a new buffer while views are
+    // pinned.
+    db.Close();
+    config.options |= CONSTS::OPTION_OVERWRITE_IN_PLACE;
+    config.view_rc_max_wait = 2;
+    DB db2(config);
+    ASSERT_TRUE(db2.is_open());
+    EXPECT_EQ(db2.Add("view", Value(1000, 3)), MBError::SUCCESS);
+    ASSERT_EQ(db2.FindView("view", view), MBError::SUCCESS);
+    ASSERT_TRUE(view.IsPinned());
+    size_t data_offset = view.data_offset;
+    EXPECT_EQ(db2.Add("view", Value(1000, 4), true), MBError::SUCCESS);
+    EXPECT_TRUE(view.Valid());
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view.data), view.data_len), Value(1000, 3));
+    view.Release();
+    ASSERT_EQ(db2.FindView("view", view), MBError::SUCCESS);
+    EXPECT_NE(view.data_offset, data_offset);
+    data_offset = view.data_offset;
+    view.Release();
+    EXPECT_EQ(db2.Add("view", Value(1000, 5), true), MBError::SUCCESS);
+    ASSERT_EQ(db2.FindView("view", view), MBError::SUCCESS);
+    EXPECT_EQ(view.data_offset, data_offset);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view.data), view.data_len), Value(1000, 5));
+    EXPECT_TRUE(view.Valid());
+    view.Release();
+
+    // Data rc waits for the pinned view, but not for longer than
+    // view_rc_max_wait seconds.
+    for (int i = 1; i < 100; i++)
+        EXPECT_EQ(db2.Remove("other" + std::to_string(i)), MBError::SUCCESS);
+    ASSERT_EQ(db2.FindView("view", view), MBError::SUCCESS);
+    pending = db2.GetPendingDataBufferSize();
+    EXPECT_EQ(db2.CollectResource(1, 1), MBError::SUCCESS);
+    EXPECT_EQ(db2.GetPendingDataBufferSize(), pending);
+    EXPECT_TRUE(view.Valid());
+    IndexHeader* header = db2.GetDictPtr()->GetHeaderPtr();
+    ASSERT_NE(header->view_rc_wait_since, 0);
+    header->view_rc_wait_since -= config.view_rc_max_wait;
+    EXPECT_EQ(db2.CollectResource(1, 1), MBError::SUCCESS);
+    EXPECT_LT(db2.GetPendingDataBufferSize(), pending);
+    EXPECT_EQ(header->view_rc_wait_since, 0);
+    EXPECT_FALSE(view.Valid());
+    view.Release();
+
+    ASSERT_EQ(db2.FindView("view", view), MBError::SUCCESS);
+    EXPECT_EQ(std::string(reinterpret_cast<const char*>(view.data), view.data_len), Value(1000, 5));
+    EXPECT_TRUE(view.Valid());
+    view.Release();
+    db2.Close();
+}
+
+TEST_F(LargeValueTest, ResourceCollection)
+{
+    MBConfig config = Config(CONSTS::WriterOptions());
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+
+    const int num_keys = 40;
+    for (int i = 0; i < num_keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        int len = (i % 2) ? 100 + i : CONSTS::MAX_DATA_SIZE + 1000 * i;
+        ASSERT_EQ(db.Add(key, Value(len, i)), MBError::SUCCESS) << i;
+    }
+    for (int i = 0; i < num_keys; i += 3)
+        ASSERT_EQ(db.Remove("key" + std::to_string(i)), MBError::SUCCESS) << i;
+
+    size_t data_end = db.GetDictPtr()->GetHeaderPtr()->m_data_offset;
+    db.CollectResource(1, 1);
+    EXPECT_LT(db.GetDictPtr()->GetHeaderPtr()->m_data_offset, data_end);
+
+    for (int i = 0; i < num_keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        int len = (i % 2) ? 100 + i : CONSTS::MAX_DATA_SIZE + 1000 * i;
+        if (i % 3 == 0)
+            EXPECT_EQ(Find(db, key), "<missing>") << i;
+        else
+            EXPECT_EQ(Find(db, key), Value(len, i)) << i;
+    }
+    db.Close();
+}
+
+TEST_F(LargeValueTest, AsyncQueue)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    Dict* dict = writer.GetDictPtr();
+
+    // Values larger than a queue slot are queued in parts by several threads.
+    const int num_threads = 3;
+    const int num_values = 5;
+    std::vector<int> results(num_threads, MBError::SUCCESS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([t, &results, dict]() {
+            for (int i = 0; i < num_values; i++) {
+                std::string key = "async" + std::to_string(t * num_values + i);
+                std::string value = Value(100000 + i, t);
+                int rval;
+                while ((rval = dict->SHMQ_Add(key.data(), key.size(), value.data(), value.size(), true))
+                    == MBError::TRY_AGAIN)
+                    usleep(10);
+                if (rval != MBError::SUCCESS) {
+                    results[t] = rval;
+                    break;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    for (int t = 0; t < num_threads; t++)
+        EXPECT_EQ(results[t], MBError::SUCCESS) << t;
+
+    // In-process readers pass large values to the writer directly.
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.Add("direct", Value(70000, 5)), MBError::SUCCESS);
+    while (writer.AsyncWriterBusy())
+        usleep(100);
+
+    for (int t = 0; t < num_threads; t++) {
+        for (int i = 0; i < num_values; i++) {
+            std::string key = "async" + std::to_string(t * num_values + i);
+            EXPECT_EQ(Find(reader, key), Value(100000 + i, t)) << key;
+        }
+    }
+    EXPECT_EQ(Find(reader, "direct"), Value(70000, 5));
+    EXPECT_EQ(reader.Count(), num_threads * num_values + 1);
+    reader.Close();
+    writer.Close();
+}
+
+}
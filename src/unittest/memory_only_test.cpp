@@ -18,6 +18,7 @@
 
 #include <gtest/gtest.h>
 
+#include "../async_writer.h"
 #include "../db.h"
 #include "../resource_pool.h"
 
@@ -101,4 +102,21 @@ TEST_F(MemoryOnlyTest, MemoryOnlyTest_test_async)
     db_r.Close();
 }
 
+TEST_F(MemoryOnlyTest, MemoryOnlyTest_test_async_two_dbs)
+{
+    int options = CONSTS::WriterOptions() | CONSTS::MEMORY_ONLY_MODE;
+    db = new DB("test_async_a", options | CONSTS::ASYNC_WRITER_MODE);
+    ASSERT_EQ(MBError::SUCCESS, db->Status());
+    DB db_b = DB("test_async_b", options);
+    ASSERT_EQ(MBError::SUCCESS, db_b.Status());
+
+    // Updates of the second DB must not go to the async writer of the first.
+    EXPECT_NE(AsyncWriter::GetInstance(db->GetDBDir()), nullptr);
+    EXPECT_EQ(AsyncWriter::GetInstance(db_b.GetDBDir()), nullptr);
+    db_b.Close();
+
+    db->Close();
+    EXPECT_EQ(AsyncWriter::GetInstance(db->GetDBDir()), nullptr);
+}
+
 }
@@ -0,0 +1,142 @@
+/**
+ * Batched exact-match lookup (DB::MultiFind) tests
+ */
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class MultiFindTest : public ::testing::Test {
+public:
+    MultiFindTest()
+        : db(nullptr)
+    {
+    }
+    ~MultiFindTest() override
+    {
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+
+        db = new DB(MB_DIR, CONSTS::WriterOptions());
+        ASSERT_TRUE(db->is_open());
+        for (int i = 0; i < num_keys; i++)
+            ASSERT_EQ(db->Add(Key(i), Value(i)), MBError::SUCCESS);
+    }
+
+    void TearDown() override
+    {
+        if (db) {
+            db->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static std::string Key(int i)
+    {
+        return "multi_find_key_" + std::to_string(i);
+    }
+
+    static std::string Value(int i)
+    {
+        return "value_" + std::to_string(i);
+    }
+
+protected:
+    static const int num_keys = 100;
+    DB* db;
+};
+
+TEST_F(MultiFindTest, Results)
+{
+    // More keys than one lockstep window, with a miss among them.
+    std::vector<std::string> key_strs;
+    for (int i = 0; i < 40; i++)
+        key_strs.push_back(i == 33 ? std::string("missing") : Key(i));
+    std::vector<std::string_view> keys(key_strs.begin(), key_strs.end());
+    std::vector<MBData> out;
+    std::vector<int> results;
+    EXPECT_EQ(db->MultiFind(keys, out, &results), MBError::SUCCESS);
+    ASSERT_EQ(results.size(), keys.size());
+    for (int i = 0; i < 40; i++) {
+        if (i == 33) {
+            EXPECT_EQ(results[i], MBError::NOT_EXIST);
+            continue;
+        }
+        ASSERT_EQ(results[i], MBError::SUCCESS) << i;
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(out[i].buff), out[i].data_len), Value(i));
+    }
+
+    std::vector<const char*> key_ptrs;
+    std::vector<int> lens;
+    for (const std::string& key : key_strs) {
+        key_ptrs.push_back(key.data());
+        lens.push_back(key.size());
+    }
+    std::vector<MBData> raw_out(keys.size());
+    std::vector<int> raw_results(keys.size());
+    EXPECT_EQ(db->MultiFind(key_ptrs.data(), lens.data(), keys.size(), raw_out.data(), raw_results.data()),
+        MBError::SUCCESS);
+    EXPECT_EQ(raw_results, results);
+}
+
+TEST_F(MultiFindTest, NullResults)
+{
+    // Without results both overloads return the aggregate status.
+    std::vector<std::string> key_strs;
+    for (int i = 0; i < 40; i++)
+        key_strs.push_back(Key(i));
+    std::vector<std::string_view> keys(key_strs.begin(), key_strs.end());
+    std::vector<const char*> key_ptrs;
+    std::vector<int> lens;
+    for (const std::string& key : key_strs) {
+        key_ptrs.push_back(key.data());
+        lens.push_back(key.size());
+    }
+    std::vector<MBData> out;
+    std::vector<MBData> raw_out(keys.size());
+    EXPECT_EQ(db->MultiFind(keys, out), MBError::SUCCESS);
+    EXPECT_EQ(db->MultiFind(key_ptrs.data(), lens.data(), keys.size(), raw_out.data(), nullptr),
+        MBError::SUCCESS);
+    for (int i = 0; i < 40; i++) {
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(out[i].buff), out[i].data_len), Value(i));
+        EXPECT_EQ(std::string(reinterpret_cast<const char*>(raw_out[i].buff), raw_out[i].data_len), Value(i));
+    }
+
+    // A miss in a later window is reported.
+    key_strs[35] = "missing";
+    keys[35] = key_strs[35];
+    key_ptrs[35] = key_strs[35].data();
+    lens[35] = key_strs[35].size();
+    EXPECT_EQ(db->MultiFind(keys, out), MBError::NOT_EXIST);
+    EXPECT_EQ(db->MultiFind(key_ptrs.data(), lens.data(), keys.size(), raw_out.data(), nullptr),
+        MBError::NOT_EXIST);
+    EXPECT_EQ(db->MultiFind(nullptr, lens.data(), keys.size(), raw_out.data(), nullptr),
+        MBError::INVALID_ARG);
+}
+
+} // namespace
@@ -0,0 +1,218 @@
+/**
+ * Read-modify-write update tests
+ */
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class ReadModifyWriteTest : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static MBConfig Config(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 16 * 1024 * 1024LL;
+        config.memcap_data = 16 * 1024 * 1024LL;
+        config.block_size_index = 8 * 1024 * 1024;
+        config.block_size_data = 8 * 1024 * 1024;
+        return config;
+    }
+
+    static std::string Value(const DB& db, const std::string& key)
+    {
+        MBData mbd;
+        if (db.Find(key, mbd) != MBError::SUCCESS)
+            return "<missing>";
+        return std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len);
+    }
+
+    static int64_t Number(const DB& db, const std::string& key)
+    {
+        MBData mbd;
+        int64_t number = -1;
+        if (db.Find(key, mbd) == MBError::SUCCESS && mbd.data_len == sizeof(number))
+            memcpy(&number, mbd.buff, sizeof(number));
+        return number;
+    }
+
+    // Keep the larger of the value and the operand.
+    static bool Max(const uint8_t* value, int value_len, const uint8_t* operand, int operand_len,
+        std::string& result)
+    {
+        if (operand_len == 0)
+            return false;
+        std::string old_value(reinterpret_cast<const char*>(value), value_len);
+        std::string new_value(reinterpret_cast<const char*>(operand), operand_len);
+        result = (value != NULL && old_value > new_value) ? old_value : new_value;
+        return true;
+    }
+};
+
+TEST_F(ReadModifyWriteTest, WriterUpdates)
+{
+    MBConfig config = Config(CONSTS::WriterOptions());
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+
+    EXPECT_EQ(db.Increment("counter", 5), MBError::SUCCESS);
+    EXPECT_EQ(db.Increment("counter", -2), MBError::SUCCESS);
+    EXPECT_EQ(Number(db, "counter"), 3);
+    EXPECT_EQ(db.Add("text", "abc"), MBError::SUCCESS);
+    EXPECT_EQ(db.Increment("text", 1), MBError::INVALID_SIZE);
+    EXPECT_EQ(Value(db, "text"), "abc");
+
+    EXPECT_EQ(db.Append("text", "def"), MBError::SUCCESS);
+    EXPECT_EQ(db.Append("new", "xyz"), MBError::SUCCESS);
+    EXPECT_EQ(Value(db, "text"), "abcdef");
+    EXPECT_EQ(Value(db, "new"), "xyz");
+    EXPECT_EQ(db.Append("long", std::string(CONSTS::MAX_DATA_SIZE, 'x')), MBError::SUCCESS);
+    EXPECT_EQ(db.Append("long", "abc"), MBError::SUCCESS);
+    EXPECT_EQ(Value(db, "long"), std::string(CONSTS::MAX_DATA_SIZE, 'x') + "abc");
+
+    EXPECT_EQ(db.CompareAndSwap("text", "abc", "123"), MBError::COMPARE_FAILED);
+    EXPECT_EQ(db.CompareAndSwap("text", "abcdef", "123"), MBError::SUCCESS);
+    EXPECT_EQ(Value(db, "text"), "123");
+    EXPECT_EQ(db.CompareAndSwap("text", "", "456"), MBError::COMPARE_FAILED);
+    EXPECT_EQ(db.CompareAndSwap("cas", "", "456"), MBError::SUCCESS);
+    EXPECT_EQ(db.CompareAndSwap("missing", "456", "789"), MBError::COMPARE_FAILED);
+    EXPECT_EQ(Value(db, "cas"), "456");
+    EXPECT_EQ(Value(db, "missing"), "<missing>");
+
+    EXPECT_EQ(db.Merge("max", "m"), MBError::NOT_ALLOWED);
+    EXPECT_EQ(db.SetMergeOperator(Max), MBError::SUCCESS);
+    EXPECT_EQ(db.Merge("max", "m"), MBError::SUCCESS);
+    EXPECT_EQ(db.Merge("max", "c"), MBError::SUCCESS);
+    EXPECT_EQ(db.Merge("max", "q"), MBError::SUCCESS);
+    EXPECT_EQ(db.Merge("max", ""), MBError::INVALID_ARG);
+    EXPECT_EQ(Value(db, "max"), "q");
+    EXPECT_EQ(db.Count(), 6);
+    db.Close();
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.SetMergeOperator(Max), MBError::NOT_ALLOWED);
+}
+
+TEST_F(ReadModifyWriteTest, AsyncWriterUpdates)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    ASSERT_EQ(writer.SetMergeOperator(Max), MBError::SUCCESS);
+    Dict* dict = writer.GetDictPtr();
+
+    // Each thread bumps the same counter through the writer lock and through
+    // the shared memory queue; no increment may be lost.
+    const int num_threads = 4;
+    const int num_updates = 500;
+    std::vector<int> results(num_threads, MBError::SUCCESS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([t, &results, dict]() {
+            MBConfig reader_config = Config(CONSTS::ReaderOptions());
+            DB db(reader_config);
+            if (!db.is_open()) {
+                results[t] = db.Status();
+                return;
+            }
+            int64_t one = 1;
+            for (int i = 0; i < num_updates; i++) {
+                int rval;
+                while ((rval = db.Increment("counter", 1)) == MBError::TRY_AGAIN)
+                    usleep(10);
+                if (rval == MBError::SUCCESS) {
+                    while ((rval = dict->SHMQ_Update("counter", 7, MABAIN_ASYNC_TYPE_INCREMENT,
+                                reinterpret_cast<const char*>(&one), sizeof(one)))
+                        == MBError::TRY_AGAIN)
+                        usleep(10);
+                }
+                if (rval != MBError::SUCCESS) {
+                    results[t] = rval;
+                    break;
+                }
+            }
+            db.Close();
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    for (int t = 0; t < num_threads; t++)
+        EXPECT_EQ(results[t], MBError::SUCCESS) << t;
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    const char* value = "zz";
+    ASSERT_EQ(dict->SHMQ_Update("max", 3, MABAIN_ASYNC_TYPE_MERGE, value, 2), MBError::SUCCESS);
+    ASSERT_EQ(dict->SHMQ_Update("max", 3, MABAIN_ASYNC_TYPE_MERGE, value, 1), MBError::SUCCESS);
+    ASSERT_EQ(dict->SHMQ_Update("text", 4, MABAIN_ASYNC_TYPE_APPEND, value, 1), MBError::SUCCESS);
+    ASSERT_EQ(dict->SHMQ_Update("text", 4, MABAIN_ASYNC_TYPE_APPEND, value, 2), MBError::SUCCESS);
+    while (writer.AsyncWriterBusy())
+        usleep(100);
+
+    EXPECT_EQ(Number(reader, "counter"), 2 * num_threads * num_updates);
+    EXPECT_EQ(Value(reader, "max"), "zz");
+    EXPECT_EQ(Value(reader, "text"), "zzz");
+    EXPECT_EQ(reader.CompareAndSwap("text", "zzz", "done"), MBError::SUCCESS);
+    EXPECT_EQ(Value(reader, "text"), "done");
+    reader.Close();
+    writer.Close();
+}
+
+TEST_F(ReadModifyWriteTest, QueuedUpdates)
+{
+    // Without an async writer in this process a reader queues its updates.
+    MBConfig config = Config(CONSTS::WriterOptions());
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    ASSERT_EQ(writer.Add("text", "abc"), MBError::SUCCESS);
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+
+    EXPECT_EQ(reader.Increment("counter", 1), MBError::SUCCESS);
+    EXPECT_EQ(reader.Append("text", "def"), MBError::SUCCESS);
+    // The result of a queued swap would be lost.
+    EXPECT_EQ(reader.CompareAndSwap("text", "abc", "123"), MBError::NOT_ALLOWED);
+    EXPECT_EQ(Value(reader, "text"), "abc");
+    // The queue takes no swaps at all.
+    EXPECT_EQ(reader.GetDictPtr()->SHMQ_Update("text", 4, MABAIN_UPDATE_TYPE_CAS, "\0\0\0\0", 4),
+        MBError::INVALID_ARG);
+    reader.Close();
+    writer.Close();
+}
+
+}
@@ -0,0 +1,468 @@
+/**
+ * Range scan tests
+ */
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class ScanTest : public ::testing::Test {
+public:
+    ScanTest()
+        : db(nullptr)
+    {
+    }
+    ~ScanTest() override
+    {
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+
+        db = new DB(MB_DIR, CONSTS::WriterOptions());
+        ASSERT_TRUE(db->is_open());
+    }
+
+    void TearDown() override
+    {
+        if (db) {
+            db->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    void Populate(int num, std::mt19937& rng)
+    {
+        // Short alphabet and mixed lengths so that keys share prefixes, end
+        // inside edge labels and sit on internal nodes.
+        std::uniform_int_distribution<int> len_dist(1, 12);
+        std::uniform_int_distribution<int> char_dist(0, 3);
+        const char alphabet[] = { 'a', 'b', 'c', '\xf0' };
+        while ((int)expected.size() < num) {
+            std::string key;
+            int len = len_dist(rng);
+            for (int i = 0; i < len; i++)
+                key.push_back(alphabet[char_dist(rng)]);
+            std::string value = "v:" + key;
+            ASSERT_EQ(db->Add(key, value, true), MBError::SUCCESS);
+            expected[key] = value;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> Scan(DB* handle, const std::string& start,
+        const std::string& end, int64_t limit)
+    {
+        std::vector<std::pair<std::string, std::string>> result;
+        int rval = handle->Scan(start, end, limit,
+            [&](const char* key, int key_len, const uint8_t* value, int value_len) {
+                result.emplace_back(std::string(key, key_len),
+                    std::string(reinterpret_cast<const char*>(value), value_len));
+                return true;
+            });
+        EXPECT_EQ(rval, MBError::SUCCESS);
+        return result;
+    }
+
+    std::vector<std::pair<std::string, std::string>> Expected(const std::string& start,
+        const std::string& end, int64_t limit) const
+    {
+        std::vector<std::pair<std::string, std::string>> result;
+        for (auto it = expected.lower_bound(start); it != expected.end(); ++it) {
+            if (!end.empty() && it->first >= end)
+                break;
+            if (limit > 0 && (int64_t)result.size() == limit)
+                break;
+            result.emplace_back(it->first, it->second);
+        }
+        return result;
+    }
+
+protected:
+    DB* db;
+    std::map<std::string, std::string> expected;
+};
+
+TEST_F(ScanTest, FullScanIsOrdered)
+{
+    std::mt19937 rng(7);
+    Populate(3000, rng);
+    EXPECT_EQ(Scan(db, "", "", 0), Expected("", "", 0));
+}
+
+TEST_F(ScanTest, RandomRanges)
+{
+    std::mt19937 rng(11);
+    Populate(3000, rng);
+
+    DB reader(MB_DIR, CONSTS::ReaderOptions());
+    ASSERT_TRUE(reader.is_open());
+    std::vector<std::string> probes;
+    for (const auto& kv : expected)
+        probes.push_back(kv.first);
+    // Probes that fall between keys and inside edge labels
+    probes.push_back("");
+    probes.push_back("ab");
+    probes.push_back("abz");
+    probes.push_back("b\xff");
+    probes.push_back("\xf0\xf0\xf0\xf0\xf0\xf0\xf0\xf0\xf0\xf0\xf0\xf0\xf0");
+
+    std::uniform_int_distribution<size_t> probe_dist(0, probes.size() - 1);
+    std::uniform_int_distribution<int> limit_dist(0, 50);
+    for (int i = 0; i < 500; i++) {
+        std::string start = probes[probe_dist(rng)];
+        std::string end = (i % 5 == 0) ? std::string() : probes[probe_dist(rng)];
+        if (!end.empty() && end < start)
+            std::swap(start, end);
+        int64_t limit = (i % 3 == 0) ? 0 : limit_dist(rng);
+        // Drop the last byte to seek into the middle of edge labels
+        if (i % 4 == 0 && start.size() > 1)
+            start.pop_back();
+        ASSERT_EQ(Scan(&reader, start, end, limit), Expected(start, end, limit))
+            << "start=" << start << " end=" << end << " limit=" << limit;
+    }
+}
+
+TEST_F(ScanTest, WideNodes)
+{
+    // Random bytes give unsorted nodes with many edges.
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int> len_dist(1, 4);
+    std::uniform_int_distribution<int> byte_dist(0, 255);
+    while (expected.size() < 5000) {
+        std::string key;
+        int len = len_dist(rng);
+        for (int i = 0; i < len; i++)
+            key.push_back(static_cast<char>(byte_dist(rng)));
+        ASSERT_EQ(db->Add(key, key, true), MBError::SUCCESS);
+        expected[key] = key;
+    }
+    EXPECT_EQ(Scan(db, "", "", 0), Expected("", "", 0));
+    EXPECT_EQ(Scan(db, "\x80", "\x90", 0), Expected("\x80", "\x90", 0));
+}
+
+TEST_F(ScanTest, VisitorStopsScan)
+{
+    std::mt19937 rng(3);
+    Populate(500, rng);
+    int visited = 0;
+    int rval = db->Scan("", "", 0, [&](const char*, int, const uint8_t*, int) {
+        return ++visited < 10;
+    });
+    EXPECT_EQ(rval, MBError::SUCCESS);
+    EXPECT_EQ(visited, 10);
+}
+
+TEST_F(ScanTest, NeighborQueries)
+{
+    std::mt19937 rng(13);
+    Populate(2000, rng);
+    DB reader(MB_DIR, CONSTS::ReaderOptions());
+    ASSERT_TRUE(reader.is_open());
+
+    std::vector<std::string> probes;
+    for (const auto& kv : expected) {
+        probes.push_back(kv.first);
+        probes.push_back(kv.first + "a");
+        probes.push_back(kv.first.substr(0, kv.first.size() - 1));
+    }
+    probes.push_back("\xff");
+    std::uniform_int_distribution<size_t> probe_dist(0, probes.size() - 1);
+
+    MBData mbd;
+    std::string key;
+    for (int i = 0; i < 1000; i++) {
+        const std::string& probe = probes[probe_dist(rng)];
+        auto upper = expected.lower_bound(probe);
+        auto next = expected.upper_bound(probe);
+        auto prev = expected.lower_bound(probe);
+
+        key.clear();
+        int rval = reader.FindUpperBound(probe, mbd, &key);
+        if (upper == expected.end()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, upper->first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), upper->second);
+        }
+
+        key.clear();
+        rval = reader.Next(probe, mbd, &key);
+        if (next == expected.end()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, next->first);
+        }
+
+        key.clear();
+        rval = reader.Prev(probe, mbd, &key);
+        if (prev == expected.begin()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            --prev;
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, prev->first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), prev->second);
+        }
+    }
+}
+
+TEST_F(ScanTest, LowerBoundProbes)
+{
+    // A lone leaf root edge that is a prefix of the probe
+    ASSERT_EQ(db->Add("d", "v:d"), MBError::SUCCESS);
+    MBData mbd;
+    std::string key;
+    EXPECT_EQ(db->FindLowerBound("db", mbd, &key), MBError::SUCCESS);
+    EXPECT_EQ(key, "d");
+    ASSERT_EQ(db->Remove("d"), MBError::SUCCESS);
+
+    std::mt19937 rng(17);
+    Populate(2000, rng);
+
+    // Probes that end inside edge labels or leave them on either side
+    std::vector<std::string> probes;
+    for (const auto& kv : expected) {
+        probes.push_back(kv.first);
+        probes.push_back(kv.first + "\xff");
+        probes.push_back(kv.first.substr(0, kv.first.size() - 1) + "\x7f");
+        probes.push_back(kv.first.substr(0, 1) + "\xff");
+        probes.push_back(kv.first.substr(0, 1) + "\x01");
+    }
+    for (const std::string& probe : probes) {
+        auto next = expected.upper_bound(probe);
+        key.clear();
+        int rval = db->FindLowerBound(probe, mbd, &key);
+        if (next == expected.begin()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            --next;
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, next->first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), next->second);
+        }
+    }
+}
+
+TEST_F(ScanTest, Cursors)
+{
+    std::mt19937 rng(17);
+    Populate(2000, rng);
+
+    DB::Cursor forward(*db);
+    std::vector<std::string> keys;
+    for (int rval = forward.SeekToFirst(); rval == MBError::SUCCESS; rval = forward.Next()) {
+        EXPECT_EQ(std::string((const char*)forward.value().buff, forward.value().data_len),
+            "v:" + forward.key());
+        keys.push_back(forward.key());
+    }
+    EXPECT_FALSE(forward.Valid());
+    EXPECT_EQ(forward.Next(), MBError::NOT_EXIST);
+    ASSERT_EQ(keys.size(), expected.size());
+    EXPECT_TRUE(std::equal(keys.begin(), keys.end(), expected.begin(),
+        [](const std::string& k, const std::pair<const std::string, std::string>& kv) {
+            return k == kv.first;
+        }));
+
+    DB::Cursor reverse(*db, true);
+    keys.clear();
+    for (int rval = reverse.SeekToFirst(); rval == MBError::SUCCESS; rval = reverse.Next())
+        keys.push_back(reverse.key());
+    ASSERT_EQ(keys.size(), expected.size());
+    EXPECT_TRUE(std::equal(keys.begin(), keys.end(), expected.rbegin(),
+        [](const std::string& k, const std::pair<const std::string, std::string>& kv) {
+            return k == kv.first;
+        }));
+
+    // Seek into the middle and walk a few steps in both directions.
+    std::uniform_int_distribution<int> len_dist(1, 6);
+    std::uniform_int_distribution<int> char_dist('a', 'd');
+    for (int i = 0; i < 200; i++) {
+        std::string probe;
+        int len = len_dist(rng);
+        for (int j = 0; j < len; j++)
+            probe.push_back(static_cast<char>(char_dist(rng)));
+
+        auto it = expected.lower_bound(probe);
+        int rval = forward.Seek(probe);
+        for (int j = 0; j < 5; j++, ++it) {
+            if (it == expected.end()) {
+                EXPECT_EQ(rval, MBError::NOT_EXIST);
+                break;
+            }
+            ASSERT_EQ(rval, MBError::SUCCESS);
+            EXPECT_EQ(forward.key(), it->first);
+            rval = forward.Next();
+        }
+
+        auto rit = std::map<std::string, std::string>::reverse_iterator(expected.upper_bound(probe));
+        rval = reverse.Seek(probe);
+        for (int j = 0; j < 5; j++, ++rit) {
+            if (rit == expected.rend()) {
+                EXPECT_EQ(rval, MBError::NOT_EXIST);
+                break;
+            }
+            ASSERT_EQ(rval, MBError::SUCCESS);
+            EXPECT_EQ(reverse.key(), rit->first);
+            rval = reverse.Next();
+        }
+    }
+}
+
+TEST_F(ScanTest, DuringResourceCollection)
+{
+    std::mt19937 rng(19);
+    Populate(1000, rng);
+
+    // Start an rc tree as rc does and add to it as the async writer does
+    // while rc runs: new keys and newer values of existing keys.
+    Dict* dict = db->GetDictPtr();
+    IndexHeader* header = dict->GetHeaderPtr();
+    header->rc_root_offset.store(dict->GetMM()->InitRootNode_RC(), MEMORY_ORDER_WRITER);
+    std::map<std::string, std::string> main_entries = expected;
+    std::vector<std::string> keys;
+    for (const auto& kv : expected)
+        keys.push_back(kv.first);
+    std::uniform_int_distribution<size_t> key_dist(0, keys.size() - 1);
+    std::uniform_int_distribution<int> char_dist(0, 3);
+    const char alphabet[] = { 'a', 'b', 'c', '\xf0' };
+    MBData mbd;
+    for (int i = 0; i < 300; i++) {
+        std::string key = keys[key_dist(rng)];
+        if (i % 2 == 0)
+            key.push_back(alphabet[char_dist(rng)]);
+        std::string value = "rc:" + key;
+        mbd.options = CONSTS::OPTION_RC_MODE;
+        mbd.buff = reinterpret_cast<uint8_t*>(&value[0]);
+        mbd.data_len = value.size();
+        ASSERT_EQ(dict->Add(reinterpret_cast<const uint8_t*>(key.data()), key.size(), mbd, true),
+            MBError::SUCCESS);
+        mbd.buff = NULL;
+        expected[key] = value;
+    }
+    mbd.options = 0;
+
+    EXPECT_EQ(Scan(db, "", "", 0), Expected("", "", 0));
+    for (int i = 0; i < 50; i++) {
+        const std::string& start = keys[key_dist(rng)];
+        const std::string& end = keys[key_dist(rng)];
+        EXPECT_EQ(Scan(db, start, end, 20), Expected(start, end, 20));
+    }
+
+    // Neighbor queries agree with Find and FindLowerBound.
+    std::string key;
+    for (int i = 0; i < 300; i++) {
+        std::string probe = keys[key_dist(rng)];
+        if (i % 3 == 1)
+            probe.push_back(alphabet[char_dist(rng)]);
+        auto upper = expected.lower_bound(probe);
+        key.clear();
+        int rval = db->FindUpperBound(probe, mbd, &key);
+        if (upper == expected.end()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, upper->first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), upper->second);
+        }
+
+        auto next = expected.upper_bound(probe);
+        key.clear();
+        rval = db->Next(probe, mbd, &key);
+        if (next == expected.end()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, next->first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), next->second);
+        }
+
+        auto prev = expected.lower_bound(probe);
+        key.clear();
+        rval = db->Prev(probe, mbd, &key);
+        if (prev == expected.begin()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            --prev;
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, prev->first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), prev->second);
+        }
+
+        auto lower = expected.upper_bound(probe);
+        key.clear();
+        rval = db->FindLowerBound(probe, mbd, &key);
+        if (lower == expected.begin()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST) << probe;
+        } else {
+            --lower;
+            ASSERT_EQ(rval, MBError::SUCCESS) << probe;
+            EXPECT_EQ(key, lower->first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), lower->second);
+        }
+    }
+
+    DB::Cursor reverse(*db, true);
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (int rval = reverse.SeekToFirst(); rval == MBError::SUCCESS; rval = reverse.Next()) {
+        entries.emplace_back(reverse.key(),
+            std::string((const char*)reverse.value().buff, reverse.value().data_len));
+    }
+    std::reverse(entries.begin(), entries.end());
+    EXPECT_EQ(entries, Expected("", "", 0));
+
+    // A cursor that outlives rc continues in the main tree after the last
+    // merged entry.
+    DB::Cursor forward(*db);
+    int rval = forward.SeekToFirst();
+    for (size_t i = 1; i < expected.size() / 2 && rval == MBError::SUCCESS; i++)
+        rval = forward.Next();
+    ASSERT_EQ(rval, MBError::SUCCESS);
+    std::string last = forward.key();
+    header->rc_root_offset.store(0, MEMORY_ORDER_WRITER);
+    std::vector<std::string> rest;
+    for (rval = forward.Next(); rval == MBError::SUCCESS; rval = forward.Next())
+        rest.push_back(forward.key());
+    std::vector<std::string> main_rest;
+    for (auto it = main_entries.upper_bound(last); it != main_entries.end(); ++it)
+        main_rest.push_back(it->first);
+    EXPECT_EQ(rest, main_rest);
+}
+
+TEST_F(ScanTest, EmptyAndInvalidRanges)
+{
+    std::vector<std::pair<std::string, std::string>> none;
+    EXPECT_EQ(Scan(db, "", "", 0), none);
+    ASSERT_EQ(db->Add("key", "value"), MBError::SUCCESS);
+    EXPECT_EQ(Scan(db, "key", "key", 0), none);
+    EXPECT_EQ(Scan(db, "z", "a", 0), none);
+    EXPECT_EQ(db->Scan("", "", 0, DB::ScanVisitor()), MBError::INVALID_ARG);
+}
+
+}
@@ -0,0 +1,278 @@
+/**
+ * Sharded multi-writer DB tests
+ */
+
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../resource_pool.h"
+#include "../sharded_db.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/sharded/"
+
+class ShardedDBTest : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        std::string cmd = std::string("rm -rf ") + MB_DIR + " && mkdir -p " + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static MBConfig Config(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 16 * 1024 * 1024LL;
+        config.memcap_data = 16 * 1024 * 1024LL;
+        config.block_size_index = 8 * 1024 * 1024;
+        config.block_size_data = 8 * 1024 * 1024;
+        return config;
+    }
+
+    // Keys spread over every first byte
+    static std::string Key(int i)
+    {
+        return std::string(1, static_cast<char>(i * 37 % 256)) + "sharded-" + std::to_string(i);
+    }
+
+    static std::string Value(int i)
+    {
+        return "value-" + std::to_string(i);
+    }
+
+    static void CheckNeighbor(const ShardedDB& sdb, const std::map<std::string, std::string>& keys,
+        const std::string& probe)
+    {
+        MBData mbd;
+        std::string found;
+        auto upper = keys.lower_bound(probe);
+        auto next = keys.upper_bound(probe);
+
+        int rval = sdb.FindUpperBound(probe, mbd, &found);
+        if (upper == keys.end()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST);
+        } else {
+            EXPECT_EQ(rval, MBError::SUCCESS);
+            EXPECT_EQ(found, upper->first);
+        }
+        rval = sdb.Next(probe, mbd, &found);
+        if (next == keys.end()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST);
+        } else {
+            EXPECT_EQ(rval, MBError::SUCCESS);
+            EXPECT_EQ(found, next->first);
+        }
+        rval = sdb.FindLowerBound(probe, mbd, &found);
+        if (next == keys.begin()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST);
+        } else {
+            EXPECT_EQ(rval, MBError::SUCCESS);
+            EXPECT_EQ(found, std::prev(next)->first);
+        }
+        rval = sdb.Prev(probe, mbd, &found);
+        if (upper == keys.begin()) {
+            EXPECT_EQ(rval, MBError::NOT_EXIST);
+        } else {
+            EXPECT_EQ(rval, MBError::SUCCESS);
+            EXPECT_EQ(found, std::prev(upper)->first);
+        }
+    }
+};
+
+TEST_F(ShardedDBTest, ShardRanges)
+{
+    for (int n : { 1, 3, 4, 7, 256 }) {
+        int expected_first = 0;
+        for (int shard = 0; shard < n; shard++) {
+            int first, end;
+            ShardedDB::ShardRange(shard, n, first, end);
+            EXPECT_EQ(first, expected_first);
+            EXPECT_LT(first, end);
+            for (int c = first; c < end; c++) {
+                char key = static_cast<char>(c);
+                EXPECT_EQ(ShardedDB::ShardOf(&key, 1, n), shard);
+            }
+            expected_first = end;
+        }
+        EXPECT_EQ(expected_first, 256);
+    }
+}
+
+TEST_F(ShardedDBTest, ThreadsWriteOwnShards)
+{
+    const int num_shards = 4;
+    const int num_keys = 20000;
+    std::vector<int> results(num_shards, MBError::NOT_INITIALIZED);
+    std::vector<std::thread> threads;
+    for (int shard = 0; shard < num_shards; shard++) {
+        threads.emplace_back([shard, &results]() {
+            MBConfig config = Config(CONSTS::WriterOptions());
+            ShardedDB sdb(config, num_shards, { shard });
+            if (!sdb.is_open()) {
+                results[shard] = sdb.Status();
+                return;
+            }
+            int rval = MBError::SUCCESS;
+            for (int i = 0; i < num_keys && rval == MBError::SUCCESS; i++) {
+                std::string key = Key(i);
+                if (ShardedDB::ShardOf(key.data(), key.size(), num_shards) == shard) {
+                    rval = sdb.Add(key, Value(i));
+                } else if (sdb.Add(key, Value(i)) != MBError::NOT_ALLOWED) {
+                    rval = MBError::UNKNOWN_ERROR;
+                }
+            }
+            results[shard] = rval;
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    for (int shard = 0; shard < num_shards; shard++)
+        EXPECT_EQ(results[shard], MBError::SUCCESS) << shard;
+
+    MBConfig config = Config(CONSTS::ReaderOptions());
+    ShardedDB sdb(config, 0);
+    ASSERT_TRUE(sdb.is_open());
+    EXPECT_EQ(sdb.NumShards(), num_shards);
+    EXPECT_EQ(sdb.Count(), num_keys);
+
+    std::map<std::string, std::string> keys;
+    MBData mbd;
+    for (int i = 0; i < num_keys; i++) {
+        keys[Key(i)] = Value(i);
+        ASSERT_EQ(sdb.Find(Key(i), mbd), MBError::SUCCESS) << i;
+        EXPECT_EQ(std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len), Value(i));
+    }
+    EXPECT_EQ(sdb.Find(std::string("\x40no-such-key"), mbd), MBError::NOT_EXIST);
+    EXPECT_EQ(sdb.FindLongestPrefix(Key(5) + "-suffix", mbd), MBError::SUCCESS);
+    EXPECT_EQ(std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len), Value(5));
+
+    for (int c = 0; c < 256; c++) {
+        CheckNeighbor(sdb, keys, std::string(1, static_cast<char>(c)));
+        CheckNeighbor(sdb, keys, std::string(1, static_cast<char>(c)) + "\xff");
+    }
+    for (int i = 0; i < 100; i++)
+        CheckNeighbor(sdb, keys, Key(i));
+
+    // A full scan visits every shard in key order.
+    std::vector<std::string> scanned;
+    auto collect = [&scanned](const char* key, int key_len, const uint8_t*, int) {
+        scanned.emplace_back(key, key_len);
+        return true;
+    };
+    EXPECT_EQ(sdb.Scan("", "", 0, collect), MBError::SUCCESS);
+    ASSERT_EQ(scanned.size(), keys.size());
+    EXPECT_TRUE(std::equal(scanned.begin(), scanned.end(), keys.begin(),
+        [](const std::string& key, const std::pair<const std::string, std::string>& entry) {
+            return key == entry.first;
+        }));
+
+    // A bounded scan across shard boundaries stops at the limit.
+    std::string start("\x30");
+    std::string end("\xd0");
+    scanned.clear();
+    EXPECT_EQ(sdb.Scan(start, end, 5000, collect), MBError::SUCCESS);
+    ASSERT_EQ(scanned.size(), 5000u);
+    auto it = keys.lower_bound(start);
+    for (const std::string& key : scanned)
+        EXPECT_EQ(key, (it++)->first);
+
+    int visits = 0;
+    EXPECT_EQ(sdb.Scan(start, end, 0, [&visits](const char*, int, const uint8_t*, int) {
+        return ++visits < 3;
+    }),
+        MBError::SUCCESS);
+    EXPECT_EQ(visits, 3);
+}
+
+TEST_F(ShardedDBTest, WriteBatchSplitsByShard)
+{
+    MBConfig config = Config(CONSTS::WriterOptions());
+    ShardedDB sdb(config, 3, { 0, 2 });
+    ASSERT_TRUE(sdb.is_open());
+    EXPECT_TRUE(sdb.IsWriter(0));
+    EXPECT_FALSE(sdb.IsWriter(1));
+    EXPECT_EQ(sdb.GetShard(1), nullptr);
+
+    WriteBatch batch;
+    ASSERT_EQ(batch.Put(std::string("\x01") + "a", "1"), MBError::SUCCESS);
+    ASSERT_EQ(batch.Put(std::string("\xf0") + "b", "2"), MBError::SUCCESS);
+    ASSERT_EQ(batch.Put(std::string("\x02") + "c", "3"), MBError::SUCCESS);
+    ASSERT_EQ(batch.Remove(std::string("\xf1") + "missing"), MBError::SUCCESS);
+    EXPECT_EQ(sdb.Write(batch), MBError::SUCCESS);
+    EXPECT_EQ(batch.Skipped(), 1u);
+    EXPECT_EQ(sdb.Count(), 3);
+    EXPECT_EQ(sdb.GetShard(0)->Count(), 2);
+    EXPECT_EQ(sdb.GetShard(2)->Count(), 1);
+
+    batch.Clear();
+    ASSERT_EQ(batch.Put(std::string("\x80") + "d", "4"), MBError::SUCCESS);
+    EXPECT_EQ(sdb.Write(batch), MBError::NOT_ALLOWED);
+    EXPECT_EQ(sdb.Remove(std::string("\x80") + "d"), MBError::NOT_ALLOWED);
+
+    // The reader handle sees the missing shard as empty until it exists.
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    ShardedDB reader(reader_config, 3);
+    ASSERT_TRUE(reader.is_open());
+    MBData mbd;
+    std::string key;
+    EXPECT_EQ(reader.Count(), 3);
+    EXPECT_EQ(reader.FindUpperBound(std::string("\x03"), mbd, &key), MBError::SUCCESS);
+    EXPECT_EQ(key, std::string("\xf0") + "b");
+
+    ShardedDB middle(config, 0, { 1 });
+    ASSERT_TRUE(middle.is_open());
+    EXPECT_EQ(middle.Add(std::string("\x80") + "d", "4"), MBError::SUCCESS);
+    EXPECT_EQ(reader.Count(), 4);
+    EXPECT_EQ(reader.FindUpperBound(std::string("\x03"), mbd, &key), MBError::SUCCESS);
+    EXPECT_EQ(key, std::string("\x80") + "d");
+    EXPECT_EQ(middle.Count(), 4);
+}
+
+TEST_F(ShardedDBTest, ShardCountChecks)
+{
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    ShardedDB no_db(reader_config, 0);
+    EXPECT_EQ(no_db.Status(), MBError::NO_DB);
+
+    MBConfig config = Config(CONSTS::WriterOptions());
+    ShardedDB no_shards(config, 4);
+    EXPECT_EQ(no_shards.Status(), MBError::INVALID_ARG);
+    ShardedDB bad_shard(config, 4, { 4 });
+    EXPECT_EQ(bad_shard.Status(), MBError::INVALID_ARG);
+    ShardedDB too_many(config, 257, { 0 });
+    EXPECT_EQ(too_many.Status(), MBError::INVALID_ARG);
+
+    ShardedDB writer(config, 4, { 0 });
+    ASSERT_TRUE(writer.is_open());
+    ShardedDB other_count(reader_config, 8);
+    EXPECT_EQ(other_count.Status(), MBError::INVALID_ARG);
+    ShardedDB same_shard(config, 4, { 0 });
+    EXPECT_EQ(same_shard.Status(), MBError::WRITER_EXIST);
+    ShardedDB reader(reader_config, 4);
+    EXPECT_TRUE(reader.is_open());
+
+    EXPECT_EQ(writer.Close(), MBError::SUCCESS);
+    EXPECT_FALSE(writer.is_open());
+    EXPECT_EQ(writer.Add("a", 1, "b", 1), MBError::NOT_INITIALIZED);
+}
+
+}
@@ -0,0 +1,522 @@
+/**
+ * Shared memory async queue (variable-length record ring) tests
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../async_writer.h"
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+#include "../shm_queue_mgr.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class ShmQueueTest : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static MBConfig Config(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 16 * 1024 * 1024LL;
+        config.memcap_data = 16 * 1024 * 1024LL;
+        config.block_size_index = 8 * 1024 * 1024;
+        config.block_size_data = 8 * 1024 * 1024;
+        return config;
+    }
+
+    static std::string Key(int i)
+    {
+        return "key" + std::to_string(i);
+    }
+
+    static std::string Value(int i)
+    {
+        return "value" + std::to_string(i) + std::string(i % 300, 'v');
+    }
+
+    static std::string Find(const DB& db, const std::string& key)
+    {
+        MBData mbd;
+        if (db.Find(key, mbd) != MBError::SUCCESS)
+            return "<missing>";
+        return std::string(reinterpret_cast<char*>(mbd.buff), mbd.data_len);
+    }
+};
+
+TEST_F(ShmQueueTest, SmallRecords)
+{
+    // Without an async writer nothing takes records off the queue.
+    MBConfig config = Config(CONSTS::WriterOptions());
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+    Dict* dict = db.GetDictPtr();
+    shm_lock_and_queue* slaq = dict->GetAsyncQueuePtr();
+    // The lanes share the space of queue_size updates of the largest size,
+    // plus one slot each.
+    EXPECT_EQ(slaq->num_lanes, (uint32_t)MB_NUM_SHM_QUEUE_LANES);
+    EXPECT_EQ(slaq->num_lanes * (slaq->ring_size - MB_ASYNC_SHM_SLOT_SIZE),
+        MB_MAX_NUM_SHM_QUEUE_NODE * MB_ASYNC_SHM_SLOT_SIZE);
+    AsyncLane& lane = slaq->lanes[dict->SHMQ_Lane()];
+
+    int count = 0;
+    int rval;
+    while ((rval = dict->SHMQ_Add(Key(count).data(), Key(count).size(), "v", 1, true))
+        == MBError::SUCCESS)
+        count++;
+    EXPECT_EQ(rval, MBError::TRY_AGAIN);
+    // A thousand small updates fit in the two slots of a lane.
+    EXPECT_GT(count, 1000);
+    EXPECT_LE(lane.tail - lane.head, slaq->ring_size);
+    EXPECT_TRUE(dict->SHMQ_Busy());
+
+    std::string long_key(CONSTS::MAX_KEY_LENGHTH + 1, 'k');
+    EXPECT_EQ(dict->SHMQ_Add(long_key.data(), long_key.size(), "v", 1, true),
+        MBError::OUT_OF_BOUND);
+    db.Close();
+
+    // An async writer takes over the queued records.
+    config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    while (writer.AsyncWriterBusy())
+        usleep(100);
+    EXPECT_EQ(writer.Count(), count);
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(Find(reader, Key(0)), "v");
+    EXPECT_EQ(Find(reader, Key(count - 1)), "v");
+    reader.Close();
+    writer.Close();
+}
+
+TEST_F(ShmQueueTest, BatchedWriter)
+{
+    // Queue the updates first so that the async writer finds them all ready.
+    // They all fit in a single lane.
+    MBConfig config = Config(CONSTS::WriterOptions());
+    config.queue_lanes = 1;
+    DB db(config);
+    ASSERT_TRUE(db.is_open());
+    Dict* dict = db.GetDictPtr();
+    const int num_keys = 1000;
+    for (int i = 0; i < num_keys; i++)
+        ASSERT_EQ(dict->SHMQ_Add(Key(i).data(), Key(i).size(), "old", 3, false), MBError::SUCCESS);
+    for (int i = 0; i < num_keys; i += 2) {
+        // Without overwrite the first value stays; with it the last wins.
+        ASSERT_EQ(dict->SHMQ_Add(Key(i).data(), Key(i).size(), "new", 3, i % 4 == 0), MBError::SUCCESS);
+    }
+    for (int i = 0; i < num_keys; i += 5)
+        ASSERT_EQ(dict->SHMQ_Remove(Key(i).data(), Key(i).size()), MBError::SUCCESS);
+    for (int i = 0; i < num_keys; i += 10)
+        ASSERT_EQ(dict->SHMQ_Add(Key(i).data(), Key(i).size(), "back", 4, false), MBError::SUCCESS);
+    ASSERT_EQ(dict->SHMQ_Update("counter", 7, MABAIN_ASYNC_TYPE_INCREMENT, "\x01\0\0\0\0\0\0\0", 8),
+        MBError::SUCCESS);
+    ASSERT_EQ(dict->SHMQ_Add("counter", 7, "x", 1, true), MBError::SUCCESS);
+    db.Close();
+
+    config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    config.queue_lanes = 1;
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    while (writer.AsyncWriterBusy())
+        usleep(100);
+
+    // The queue was drained in batches of more than one record.
+    shm_lock_and_queue* slaq = writer.GetDictPtr()->GetAsyncQueuePtr();
+    uint64_t batches = 0;
+    for (int i = 0; i < MB_ASYNC_SHM_HIST_BUCKETS; i++)
+        batches += slaq->batch_hist[i];
+    EXPECT_GT(slaq->batch_hist[8], 0u);
+    EXPECT_LT(batches, 100u);
+    EXPECT_EQ(writer.GetDictPtr()->GetHeaderPtr()->writer_index,
+        writer.GetDictPtr()->GetHeaderPtr()->queue_index.load());
+    std::ostringstream stats;
+    writer.GetDictPtr()->PrintStats(stats);
+    EXPECT_NE(stats.str().find("batch size histogram: "), std::string::npos);
+    EXPECT_NE(stats.str().find("queue depth histogram: "), std::string::npos);
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    for (int i = 0; i < num_keys; i++) {
+        std::string expected = "old";
+        if (i % 4 == 0)
+            expected = "new";
+        if (i % 5 == 0)
+            expected = "<missing>";
+        if (i % 10 == 0)
+            expected = "back";
+        EXPECT_EQ(Find(reader, Key(i)), expected) << i;
+    }
+    EXPECT_EQ(Find(reader, "counter"), "x");
+    reader.Close();
+    writer.Close();
+}
+
+TEST_F(ShmQueueTest, ParkedWriterWakes)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    Dict* dict = writer.GetDictPtr();
+    shm_lock_and_queue* slaq = dict->GetAsyncQueuePtr();
+
+    for (int i = 0; i < 20; i++) {
+        // An idle writer parks; an update wakes it well before the writer
+        // would wake up by itself.
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (slaq->writer_parked.load() == 0 && std::chrono::steady_clock::now() < deadline)
+            usleep(100);
+        ASSERT_EQ(slaq->writer_parked.load(), 1u);
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_EQ(dict->SHMQ_Add(Key(i).data(), Key(i).size(), "v", 1, true), MBError::SUCCESS);
+        while (writer.AsyncWriterBusy())
+            usleep(100);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(500));
+    }
+    EXPECT_EQ(writer.Count(), 20);
+    writer.Close();
+}
+
+TEST_F(ShmQueueTest, WaitApplied)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    Dict* dict = writer.GetDictPtr();
+    MBConfig reader_config = Config(CONSTS::ReaderOptions() | CONSTS::OPTION_ASYNC_HANDOFF);
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+
+    // The async writer of this process adds the entry right away.
+    uint64_t seq = UINT64_MAX;
+    ASSERT_EQ(reader.AddAsync("direct", 6, "v", 1, true, seq), MBError::SUCCESS);
+    EXPECT_EQ(seq, 0u);
+    EXPECT_EQ(reader.WaitApplied(seq, 0), MBError::SUCCESS);
+    EXPECT_EQ(Find(reader, "direct"), "v");
+
+    // Updates through the queue are visible once applied.
+    const int num_keys = 2000;
+    uint64_t last_seq = dict->SHMQ_LastSeq();
+    for (int i = 0; i < num_keys; i++) {
+        int rval;
+        while ((rval = dict->SHMQ_Add(Key(i).data(), Key(i).size(), Value(i).data(), Value(i).size(), true))
+            == MBError::TRY_AGAIN)
+            usleep(10);
+        ASSERT_EQ(rval, MBError::SUCCESS);
+        EXPECT_GT(dict->SHMQ_LastSeq(), last_seq);
+        last_seq = dict->SHMQ_LastSeq();
+    }
+    EXPECT_EQ(reader.WaitApplied(last_seq, 10000), MBError::SUCCESS);
+    for (int i = 0; i < num_keys; i += 100)
+        EXPECT_EQ(Find(reader, Key(i)), Value(i)) << i;
+
+    // Removals of handles with OPTION_ASYNC_HANDOFF go to the writer thread
+    // directly.
+    ASSERT_EQ(reader.RemoveAsync(Key(0).data(), Key(0).size(), seq), MBError::SUCCESS);
+    EXPECT_EQ(MB_ASYNC_SHM_SEQ_LANE(seq), (uint64_t)MB_ASYNC_LOCAL_LANE);
+    DB::AppliedFuture applied(reader, seq);
+    EXPECT_EQ(applied.Seq(), seq);
+    EXPECT_EQ(applied.Wait(10000), MBError::SUCCESS);
+    EXPECT_TRUE(applied.Ready());
+    EXPECT_EQ(Find(reader, Key(0)), "<missing>");
+
+    // Nothing is queued up to this sequence number.
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(reader.WaitApplied(seq + (1ULL << 40), 50), MBError::TIMEOUT);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    EXPECT_FALSE(DB::AppliedFuture(reader, seq + (1ULL << 40)).Ready());
+    std::string qfile = "/dev/shm/_mabain_q" + std::to_string(dict->GetHeaderPtr()->shm_queue_id);
+    reader.Close();
+    writer.Close();
+
+    // A new queue, e.g. after a reboot cleared /dev/shm, continues the
+    // sequence numbers.
+    ResourcePool::getInstance().RemoveAll();
+    ASSERT_EQ(unlink(qfile.c_str()), 0);
+    DB writer2(config);
+    ASSERT_TRUE(writer2.is_open());
+    shm_lock_and_queue* slaq = writer2.GetDictPtr()->GetAsyncQueuePtr();
+    EXPECT_EQ(slaq->lanes[MB_ASYNC_SHM_SEQ_LANE(last_seq)].head.load(), MB_ASYNC_SHM_SEQ_POS(last_seq));
+    ASSERT_EQ(writer2.GetDictPtr()->SHMQ_Remove(Key(1).data(), Key(1).size()), MBError::SUCCESS);
+    EXPECT_GT(writer2.GetDictPtr()->SHMQ_LastSeq(), last_seq);
+    writer2.Close();
+}
+
+TEST_F(ShmQueueTest, Lanes)
+{
+    // A handle queues in the lane of its connect id.
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    config.connect_id = 11;
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    Dict* dict = writer.GetDictPtr();
+    shm_lock_and_queue* slaq = dict->GetAsyncQueuePtr();
+    ASSERT_EQ(slaq->num_lanes, (uint32_t)MB_NUM_SHM_QUEUE_LANES);
+    EXPECT_EQ(dict->SHMQ_Lane(), 11u % slaq->num_lanes);
+    ASSERT_EQ(dict->SHMQ_Remove(Key(0).data(), Key(0).size()), MBError::SUCCESS);
+    EXPECT_EQ(MB_ASYNC_SHM_SEQ_LANE(dict->SHMQ_LastSeq()), dict->SHMQ_Lane());
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.WaitApplied(dict->SHMQ_LastSeq(), 10000), MBError::SUCCESS);
+
+    // A producer in another lane dies after reserving a record; the removal
+    // it queued after that record waits, the lane of the writer handle does
+    // not.
+    uint32_t other_lane = (dict->SHMQ_Lane() + 1) % slaq->num_lanes;
+    AsyncLane& lane = slaq->lanes[other_lane];
+    uint64_t stalled_pos = lane.tail.fetch_add(MB_ASYNC_SHM_RECORD_ALIGN);
+    uint64_t size = MB_ASYNC_SHM_RECORD_SIZE(Key(1).size());
+    uint64_t pos = lane.tail.fetch_add(size);
+    AsyncNode* node_ptr = slaq->node(other_lane, pos);
+    node_ptr->pos = pos;
+    node_ptr->size = size;
+    node_ptr->key_len = Key(1).size();
+    node_ptr->data_len = 0;
+    node_ptr->type = MABAIN_ASYNC_TYPE_REMOVE;
+    memcpy(node_ptr->key, Key(1).data(), Key(1).size());
+    node_ptr->ready.store(pos + 1);
+    uint64_t seq = MB_ASYNC_SHM_SEQ(other_lane, pos + size);
+
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(dict->SHMQ_Add(Key(i).data(), Key(i).size(), "v", 1, true), MBError::SUCCESS);
+    EXPECT_EQ(reader.WaitApplied(dict->SHMQ_LastSeq(), 10000), MBError::SUCCESS);
+    EXPECT_EQ(Find(reader, Key(99)), "v");
+    EXPECT_EQ(reader.WaitApplied(seq, 100), MBError::TIMEOUT);
+    EXPECT_EQ(Find(reader, Key(1)), "v");
+
+    // The stalled record is finished.
+    node_ptr = slaq->node(other_lane, stalled_pos);
+    node_ptr->pos = stalled_pos;
+    node_ptr->size = MB_ASYNC_SHM_RECORD_ALIGN;
+    node_ptr->type = MABAIN_ASYNC_TYPE_NONE;
+    node_ptr->ready.store(stalled_pos + 1);
+    dict->SHMQ_Signal();
+    EXPECT_EQ(reader.WaitApplied(seq, 10000), MBError::SUCCESS);
+    EXPECT_EQ(Find(reader, Key(1)), "<missing>");
+
+    std::ostringstream stats;
+    dict->PrintStats(stats);
+    EXPECT_NE(stats.str().find("lanes: " + std::to_string(MB_NUM_SHM_QUEUE_LANES)), std::string::npos);
+    reader.Close();
+    writer.Close();
+}
+
+TEST_F(ShmQueueTest, LocalSubmit)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    IndexHeader* header = writer.GetDictPtr()->GetHeaderPtr();
+    uint32_t queue_index = header->queue_index.load();
+
+    // Threads of the writer process with OPTION_ASYNC_HANDOFF hand their
+    // updates to the writer thread without the queue file; each thread's
+    // updates are applied in order.
+    const int num_threads = 4;
+    const int num_keys = 2000;
+    std::vector<uint64_t> last_seq(num_threads, 0);
+    std::vector<int> results(num_threads, MBError::SUCCESS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([t, &results, &last_seq]() {
+            MBConfig reader_config = Config(CONSTS::ReaderOptions() | CONSTS::OPTION_ASYNC_HANDOFF);
+            DB reader(reader_config);
+            uint64_t seq = 0;
+            for (int i = t; i < num_keys && results[t] == MBError::SUCCESS; i += num_threads) {
+                results[t] = reader.AddAsync(Key(i), "old", false, seq);
+                if (results[t] == MBError::SUCCESS)
+                    results[t] = reader.AddAsync(Key(i), Value(i), true, seq);
+                if (results[t] == MBError::SUCCESS && i % 10 == 0)
+                    results[t] = reader.RemoveAsync(Key(i).data(), Key(i).size(), seq);
+                if (results[t] == MBError::SUCCESS && seq <= last_seq[t])
+                    results[t] = MBError::INVALID_ARG;
+                last_seq[t] = seq;
+            }
+            reader.Close();
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions() | CONSTS::OPTION_ASYNC_HANDOFF);
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    for (int t = 0; t < num_threads; t++) {
+        EXPECT_EQ(results[t], MBError::SUCCESS) << t;
+        EXPECT_EQ(MB_ASYNC_SHM_SEQ_LANE(last_seq[t]), (uint64_t)MB_ASYNC_LOCAL_LANE);
+        EXPECT_EQ(reader.WaitApplied(last_seq[t], 10000), MBError::SUCCESS);
+    }
+    EXPECT_EQ(reader.Count(), num_keys - num_keys / 10);
+    for (int i = 0; i < num_keys; i++)
+        EXPECT_EQ(Find(reader, Key(i)), i % 10 == 0 ? "<missing>" : Value(i)) << i;
+    EXPECT_EQ(header->queue_index.load(), queue_index);
+
+    // Keys and values that do not fit are refused, and so are empty keys.
+    std::string long_key(CONSTS::MAX_KEY_LENGHTH + 1, 'k');
+    EXPECT_EQ(reader.AddAsync(long_key, "v"), MBError::OUT_OF_BOUND);
+    EXPECT_EQ(reader.AddAsync("", "v"), MBError::INVALID_ARG);
+    uint64_t seq = 0;
+    EXPECT_EQ(reader.RemoveAsync("", 0, seq), MBError::INVALID_ARG);
+
+    // Handles without the option do not use the handoff.
+    MBConfig plain_config = Config(CONSTS::ReaderOptions());
+    DB plain(plain_config);
+    ASSERT_TRUE(plain.is_open());
+    EXPECT_EQ(plain.AddAsync("", "v"), MBError::INVALID_ARG);
+    ASSERT_EQ(plain.RemoveAsync(Key(1).data(), Key(1).size(), seq), MBError::SUCCESS);
+    EXPECT_NE(MB_ASYNC_SHM_SEQ_LANE(seq), (uint64_t)MB_ASYNC_LOCAL_LANE);
+    EXPECT_EQ(plain.WaitApplied(seq, 10000), MBError::SUCCESS);
+    EXPECT_EQ(Find(plain, Key(1)), "<missing>");
+    plain.Close();
+
+    // Updates submitted before the writer stops are applied, including the
+    // ones accepted while it stops; later ones are refused instead of being
+    // dropped.
+    ASSERT_EQ(reader.AddAsync("last", "v", true, seq), MBError::SUCCESS);
+    std::vector<uint64_t> accepted(2, 0);
+    std::vector<int> refused(2, MBError::SUCCESS);
+    threads.clear();
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([t, &accepted, &refused]() {
+            MBConfig handoff_config = Config(CONSTS::ReaderOptions() | CONSTS::OPTION_ASYNC_HANDOFF);
+            DB handoff(handoff_config);
+            for (int i = 0; refused[t] == MBError::SUCCESS; i++) {
+                uint64_t next_seq = 0;
+                refused[t] = handoff.AddAsync("stop" + std::to_string(t), std::to_string(i), true, next_seq);
+                if (refused[t] == MBError::SUCCESS)
+                    accepted[t] = next_seq;
+            }
+            handoff.Close();
+        });
+    }
+    usleep(10000);
+    AsyncWriter* awr = AsyncWriter::GetInstance(MB_DIR);
+    ASSERT_NE(awr, nullptr);
+    EXPECT_EQ(awr->StopAsyncThread(), MBError::SUCCESS);
+    for (std::thread& thread : threads)
+        thread.join();
+    EXPECT_EQ(reader.WaitApplied(seq, 0), MBError::SUCCESS);
+    for (int t = 0; t < 2; t++) {
+        EXPECT_EQ(refused[t], MBError::NOT_ALLOWED) << t;
+        EXPECT_EQ(reader.WaitApplied(accepted[t], 0), MBError::SUCCESS) << t;
+    }
+    EXPECT_EQ(reader.AddAsync("late", "v"), MBError::NOT_ALLOWED);
+    seq = std::max(seq, std::max(accepted[0], accepted[1]));
+
+    // The sequence numbers continue with the next writer.
+    reader.Close();
+    writer.Close();
+    DB writer2(config);
+    ASSERT_TRUE(writer2.is_open());
+    DB reader2(reader_config);
+    ASSERT_TRUE(reader2.is_open());
+    EXPECT_EQ(reader2.WaitApplied(seq, 0), MBError::SUCCESS);
+    EXPECT_EQ(Find(reader2, "last"), "v");
+    uint64_t next_seq = 0;
+    ASSERT_EQ(reader2.RemoveAsync("last", 4, next_seq), MBError::SUCCESS);
+    EXPECT_GT(next_seq, seq);
+    EXPECT_EQ(reader2.WaitApplied(next_seq, 10000), MBError::SUCCESS);
+    EXPECT_EQ(Find(reader2, "last"), "<missing>");
+    reader2.Close();
+    writer2.Close();
+}
+
+TEST_F(ShmQueueTest, WrapAround)
+{
+    MBConfig config = Config(CONSTS::WriterOptions() | CONSTS::ASYNC_WRITER_MODE);
+    config.queue_size = 1;
+    DB writer(config);
+    ASSERT_TRUE(writer.is_open());
+    Dict* dict = writer.GetDictPtr();
+    shm_lock_and_queue* slaq = dict->GetAsyncQueuePtr();
+
+    // Records of all sizes from several threads go around the ring many
+    // times, including long keys with values filling a record.
+    const int num_threads = 4;
+    const int num_keys = 2000;
+    std::vector<int> results(num_threads, MBError::SUCCESS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([t, &results, dict]() {
+            for (int i = t; i < num_keys; i += num_threads) {
+                std::string key = Key(i);
+                std::string value = Value(i);
+                if (i % 100 == 0) {
+                    key = std::string(CONSTS::MAX_KEY_LENGHTH - 1 - key.size(), 'k') + key;
+                    value = std::string(MB_ASYNC_SHM_DATA_SIZE, 'x');
+                }
+                int rval;
+                while ((rval = dict->SHMQ_Add(key.data(), key.size(), value.data(), value.size(), true))
+                    == MBError::TRY_AGAIN)
+                    usleep(10);
+                if (rval != MBError::SUCCESS) {
+                    results[t] = rval;
+                    break;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    for (int t = 0; t < num_threads; t++)
+        EXPECT_EQ(results[t], MBError::SUCCESS) << t;
+    while (writer.AsyncWriterBusy())
+        usleep(100);
+    // The threads of one process share a lane.
+    AsyncLane& lane = slaq->lanes[dict->SHMQ_Lane()];
+    EXPECT_GT(lane.head, 10 * slaq->ring_size);
+    EXPECT_EQ(lane.head, lane.tail);
+
+    MBConfig reader_config = Config(CONSTS::ReaderOptions());
+    reader_config.queue_size = 1;
+    DB reader(reader_config);
+    ASSERT_TRUE(reader.is_open());
+    EXPECT_EQ(reader.Count(), num_keys);
+    for (int i = 0; i < num_keys; i++) {
+        if (i % 100 == 0) {
+            std::string key = std::string(CONSTS::MAX_KEY_LENGHTH - 1 - Key(i).size(), 'k') + Key(i);
+            EXPECT_EQ(Find(reader, key), std::string(MB_ASYNC_SHM_DATA_SIZE, 'x')) << i;
+        } else {
+            EXPECT_EQ(Find(reader, Key(i)), Value(i)) << i;
+        }
+    }
+    reader.Close();
+    writer.Close();
+}
+
+}
@@ -0,0 +1,260 @@
+/**
+ * Subtree count tests: CountPrefix, Rank and Select
+ */
+
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class SubtreeCountTest : public ::testing::Test {
+public:
+    SubtreeCountTest()
+        : db(nullptr)
+    {
+    }
+    ~SubtreeCountTest() override
+    {
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+
+        db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_SUBTREE_COUNT);
+        ASSERT_TRUE(db->is_open());
+    }
+
+    void TearDown() override
+    {
+        if (db) {
+            db->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static DB* OpenDB(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 64 * 1024 * 1024LL;
+        config.memcap_data = 64 * 1024 * 1024LL;
+        return new DB(config);
+    }
+
+    std::string RandomKey(std::mt19937& rng)
+    {
+        // Short alphabet and mixed lengths so that keys share prefixes, end
+        // inside edge labels and sit on internal nodes.
+        std::uniform_int_distribution<int> len_dist(1, 12);
+        std::uniform_int_distribution<int> char_dist(0, 3);
+        const char alphabet[] = { 'a', 'b', 'c', '\xf0' };
+        std::string key;
+        int len = len_dist(rng);
+        for (int i = 0; i < len; i++)
+            key.push_back(alphabet[char_dist(rng)]);
+        return key;
+    }
+
+    void Populate(int num, std::mt19937& rng)
+    {
+        while ((int)expected.size() < num) {
+            std::string key = RandomKey(rng);
+            ASSERT_EQ(db->Add(key, "v:" + key, true), MBError::SUCCESS);
+            expected[key] = "v:" + key;
+        }
+    }
+
+    int64_t ExpectedPrefixCount(const std::string& prefix) const
+    {
+        int64_t count = 0;
+        for (auto it = expected.lower_bound(prefix);
+             it != expected.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+            count++;
+        return count;
+    }
+
+    void Verify(DB* handle, std::mt19937& rng)
+    {
+        int64_t count = -1;
+        ASSERT_EQ(handle->CountPrefix("", count), MBError::SUCCESS);
+        EXPECT_EQ(count, (int64_t)expected.size());
+
+        // Every key in order, and the prefixes of a sample of them
+        int64_t n = 0;
+        MBData mbd;
+        std::string key;
+        for (const auto& entry : expected) {
+            int64_t rank = -1;
+            ASSERT_EQ(handle->Rank(entry.first, rank), MBError::SUCCESS);
+            EXPECT_EQ(rank, n) << entry.first;
+            ASSERT_EQ(handle->Select(n, mbd, &key), MBError::SUCCESS);
+            EXPECT_EQ(key, entry.first);
+            EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), entry.second);
+            if (n % 7 == 0) {
+                for (size_t len = 1; len <= entry.first.size(); len++) {
+                    std::string prefix = entry.first.substr(0, len);
+                    ASSERT_EQ(handle->CountPrefix(prefix, count), MBError::SUCCESS);
+                    EXPECT_EQ(count, ExpectedPrefixCount(prefix)) << prefix;
+                }
+            }
+            n++;
+        }
+        EXPECT_EQ(handle->Select(n, mbd, &key), MBError::NOT_EXIST);
+        EXPECT_EQ(handle->Select(-1, mbd, &key), MBError::NOT_EXIST);
+
+        // Keys and prefixes that may not be in the DB
+        for (int i = 0; i < 300; i++) {
+            std::string probe = RandomKey(rng);
+            int64_t rank = -1;
+            ASSERT_EQ(handle->Rank(probe, rank), MBError::SUCCESS);
+            EXPECT_EQ(rank, (int64_t)std::distance(expected.begin(), expected.lower_bound(probe)))
+                << probe;
+            ASSERT_EQ(handle->CountPrefix(probe, count), MBError::SUCCESS);
+            EXPECT_EQ(count, ExpectedPrefixCount(probe)) << probe;
+        }
+    }
+
+protected:
+    DB* db;
+    std::map<std::string, std::string> expected;
+};
+
+TEST_F(SubtreeCountTest, AddOverwriteRemove)
+{
+    std::mt19937 rng(9);
+    Populate(2000, rng);
+    Verify(db, rng);
+
+    DB* reader = OpenDB(CONSTS::ReaderOptions());
+    ASSERT_TRUE(reader->is_open());
+    Verify(reader, rng);
+
+    // Overwrites do not change the counts; removals shrink nodes and
+    // collapse single-edge nodes.
+    int i = 0;
+    for (auto it = expected.begin(); it != expected.end(); i++) {
+        if (i % 3 == 0) {
+            ASSERT_EQ(db->Add(it->first, "w:" + it->first, true), MBError::SUCCESS);
+            it->second = "w:" + it->first;
+            ++it;
+        } else if (i % 3 == 1) {
+            ASSERT_EQ(db->Remove(it->first), MBError::SUCCESS);
+            it = expected.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    EXPECT_EQ(db->Remove("not-in-db"), MBError::NOT_EXIST);
+    Verify(reader, rng);
+
+    ASSERT_EQ(db->RemoveAll(), MBError::SUCCESS);
+    expected.clear();
+    int64_t count = -1;
+    ASSERT_EQ(reader->CountPrefix("", count), MBError::SUCCESS);
+    EXPECT_EQ(count, 0);
+    Populate(500, rng);
+    Verify(reader, rng);
+    reader->Close();
+    delete reader;
+}
+
+TEST_F(SubtreeCountTest, ResourceCollection)
+{
+    std::mt19937 rng(17);
+    Populate(3000, rng);
+    int i = 0;
+    for (auto it = expected.begin(); it != expected.end(); i++) {
+        if (i % 2 == 0) {
+            ASSERT_EQ(db->Remove(it->first), MBError::SUCCESS);
+            it = expected.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Nodes move with their counts.
+    db->CollectResource(1, 1);
+    Verify(db, rng);
+    Populate(3000, rng);
+    Verify(db, rng);
+}
+
+TEST_F(SubtreeCountTest, StaleCountsRebuiltOnOpen)
+{
+    std::mt19937 rng(23);
+    Populate(1000, rng);
+
+    // A writer that stops mid-update leaves the sequence odd; readers wait
+    // for the next writer to recount.
+    IndexHeader* header = db->GetDictPtr()->GetHeaderPtr();
+    header->subtree_count_seq.fetch_add(1);
+    DB* reader = OpenDB(CONSTS::ReaderOptions());
+    ASSERT_TRUE(reader->is_open());
+    int64_t count = -1;
+    EXPECT_EQ(reader->CountPrefix("", count), MBError::TRY_AGAIN);
+    reader->Close();
+    delete reader;
+    db->Close();
+    delete db;
+
+    // Reopening without the option keeps the layout the DB was created with.
+    db = OpenDB(CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    Verify(db, rng);
+    Populate(1500, rng);
+    Verify(db, rng);
+}
+
+TEST_F(SubtreeCountTest, NotEnabled)
+{
+    db->Close();
+    delete db;
+    ResourcePool::getInstance().RemoveAll();
+    std::string cmd = std::string("rm -f ") + MB_DIR + "_*";
+    if (system(cmd.c_str()) != 0) {
+    }
+    db = OpenDB(CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    ASSERT_EQ(db->Add("key", "value"), MBError::SUCCESS);
+
+    int64_t count;
+    MBData mbd;
+    EXPECT_EQ(db->CountPrefix("k", count), MBError::NOT_ALLOWED);
+    EXPECT_EQ(db->Rank("key", count), MBError::NOT_ALLOWED);
+    EXPECT_EQ(db->Select(0, mbd), MBError::NOT_ALLOWED);
+    // Existing DBs keep their layout.
+    db->Close();
+    delete db;
+    ResourcePool::getInstance().RemoveAll();
+    db = OpenDB(CONSTS::WriterOptions() | CONSTS::OPTION_SUBTREE_COUNT);
+    ASSERT_TRUE(db->is_open());
+    EXPECT_EQ(db->CountPrefix("k", count), MBError::NOT_ALLOWED);
+}
+
+} // namespace
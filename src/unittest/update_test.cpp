@@ -1,11 +1,14 @@
+#include <atomic>
 #include <cstdlib>
 #include <list>
 #include <stdlib.h>
+#include <thread>
 #include <unistd.h>
 
 #include <gtest/gtest.h>
 
 #include "../db.h"
+#include "../dict.h"
 #include "../mb_data.h"
 #include "../resource_pool.h"
 #include "./test_key.h"
@@ -165,4 +168,112 @@ TEST_F(UpdateTest, Update_random)
     delete[] added;
 }
 
+TEST_F(UpdateTest, Update_in_place)
+{
+    db->Close();
+    delete db;
+    db = new DB(MB_DIR, CONSTS::WriterOptions() | CONSTS::OPTION_OVERWRITE_IN_PLACE);
+    IndexHeader* header = db->GetDictPtr()->GetHeaderPtr();
+    // "abc" ends at a node below "abcd" and "abce"; the other keys end at leaf edges.
+    const char* keys[] = { "abc", "abcd", "abce", "xyz" };
+    size_t offsets[4];
+    MBData mbd;
+    int rval;
+    for (int i = 0; i < 4; i++) {
+        rval = db->Add(keys[i], std::string(16, 'a'));
+        EXPECT_EQ(rval, MBError::SUCCESS);
+        rval = db->Find(keys[i], mbd);
+        EXPECT_EQ(rval, MBError::SUCCESS);
+        offsets[i] = mbd.data_offset;
+    }
+
+    // Values of the same size are written into the existing buffers.
+    int64_t pending = header->pending_data_buff_size;
+    for (int i = 0; i < 4; i++) {
+        rval = db->Add(keys[i], std::string(16, 'b' + i), true);
+        EXPECT_EQ(rval, MBError::SUCCESS);
+    }
+    EXPECT_EQ(header->pending_data_buff_size, pending);
+    for (int i = 0; i < 4; i++) {
+        rval = db->Find(keys[i], mbd);
+        EXPECT_EQ(rval, MBError::SUCCESS);
+        EXPECT_EQ(mbd.data_offset, offsets[i]);
+        EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), std::string(16, 'b' + i));
+    }
+
+    // A smaller value releases the rest of the buffer.
+    rval = db->Add(keys[0], std::string(10, 'c'), true);
+    EXPECT_EQ(rval, MBError::SUCCESS);
+    EXPECT_EQ(header->pending_data_buff_size, pending + 6);
+    rval = db->Find(keys[0], mbd);
+    EXPECT_EQ(rval, MBError::SUCCESS);
+    EXPECT_EQ(mbd.data_offset, offsets[0]);
+    EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), std::string(10, 'c'));
+
+    // A larger value needs a new buffer.
+    rval = db->Add(keys[3], std::string(32, 'd'), true);
+    EXPECT_EQ(rval, MBError::SUCCESS);
+    rval = db->Find(keys[3], mbd);
+    EXPECT_EQ(rval, MBError::SUCCESS);
+    EXPECT_NE(mbd.data_offset, offsets[3]);
+    EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), std::string(32, 'd'));
+}
+
+// Overwrite keys with values of value_len bytes while a reader thread looks
+// them up. The reader must never see a mix of two values. "in-place" is a
+// whole root edge; the other two keys end at leaf edges below it.
+static int FindTornValues(DB* db, int value_len)
+{
+    const std::string keys[] = { "in-place", "in-place-1", "in-place-2" };
+    const int num_updates = 3000;
+    for (const std::string& key : keys)
+        EXPECT_EQ(db->Add(key, std::string(value_len, 'a'), true), MBError::SUCCESS);
+
+    std::atomic<bool> done(false);
+    int torn = 0;
+    std::thread reader([&]() {
+        DB db_r(MB_DIR, CONSTS::ReaderOptions());
+        MBData mbd;
+        for (int n = 0; !done.load(); n++) {
+            if (db_r.Find(keys[n % 3], mbd) != MBError::SUCCESS || mbd.data_len != value_len) {
+                torn++;
+                continue;
+            }
+            for (int i = 1; i < value_len; i++) {
+                if (mbd.buff[i] != mbd.buff[0]) {
+                    torn++;
+                    break;
+                }
+            }
+        }
+        db_r.Close();
+    });
+    for (int i = 0; i < num_updates; i++) {
+        EXPECT_EQ(db->Add(keys[i % 3], std::string(value_len, 'a' + i % 26), true), MBError::SUCCESS);
+        // Give the reader time to copy values of the same buffer.
+        if (i % 16 == 0)
+            usleep(1);
+    }
+    done = true;
+    reader.join();
+    return torn;
+}
+
+TEST_F(UpdateTest, Update_reader)
+{
+    for (int value_len : { 200, 8192, 30000 }) {
+        EXPECT_EQ(FindTornValues(db, value_len), 0) << value_len;
+    }
+}
+
+TEST_F(UpdateTest, Update_in_place_reader)
+{
+    db->Close();
+    delete db;
+    db = new DB(MB_DIR, CONSTS::WriterOptions() | CONSTS::OPTION_OVERWRITE_IN_PLACE);
+    for (int value_len : { 200, 8192, 30000 }) {
+        EXPECT_EQ(FindTornValues(db, value_len), 0) << value_len;
+    }
+}
+
 }
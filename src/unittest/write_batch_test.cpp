@@ -0,0 +1,195 @@
+/**
+ * Batched write tests
+ */
+
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../db.h"
+#include "../dict.h"
+#include "../resource_pool.h"
+#include "../write_batch.h"
+
+using namespace mabain;
+
+namespace {
+
+#define MB_DIR "/var/tmp/mabain_test/"
+
+class WriteBatchTest : public ::testing::Test {
+public:
+    WriteBatchTest()
+        : db(nullptr)
+    {
+    }
+    ~WriteBatchTest() override
+    {
+        if (db) {
+            db->Close();
+            delete db;
+            db = nullptr;
+        }
+    }
+
+    void SetUp() override
+    {
+        std::string cmd = std::string("mkdir -p ") + MB_DIR;
+        if (system(cmd.c_str()) != 0) {
+        }
+        cmd = std::string("rm -f ") + MB_DIR + "_*";
+        if (system(cmd.c_str()) != 0) {
+        }
+    }
+
+    void TearDown() override
+    {
+        if (db) {
+            db->Close();
+        }
+        ResourcePool::getInstance().RemoveAll();
+    }
+
+    static DB* OpenDB(int options)
+    {
+        MBConfig config;
+        memset(&config, 0, sizeof(config));
+        config.mbdir = MB_DIR;
+        config.options = options;
+        config.memcap_index = 64 * 1024 * 1024LL;
+        config.memcap_data = 64 * 1024 * 1024LL;
+        config.bloom_filter_size = 100000;
+        return new DB(config);
+    }
+
+    static std::string Key(int i)
+    {
+        return "write-batch-test-" + std::to_string(i * 7919 % 10007);
+    }
+
+    // Every key of expected is found with its value and no other key in
+    // [0, num) is.
+    static void Check(DB* handle, const std::map<std::string, std::string>& expected, int num)
+    {
+        MBData mbd;
+        for (int i = 0; i < num; i++) {
+            auto it = expected.find(Key(i));
+            if (it == expected.end()) {
+                EXPECT_EQ(handle->Find(Key(i), mbd), MBError::NOT_EXIST) << i;
+            } else {
+                ASSERT_EQ(handle->Find(Key(i), mbd), MBError::SUCCESS) << i;
+                EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), it->second);
+            }
+        }
+        EXPECT_EQ(handle->Count(), (int64_t)expected.size());
+    }
+
+    void PutsAndRemoves(int options)
+    {
+        const int num = 3000;
+        db = OpenDB(CONSTS::WriterOptions() | options);
+        ASSERT_TRUE(db->is_open());
+        std::map<std::string, std::string> expected;
+        WriteBatch batch;
+        for (int i = 0; i < num; i += 2) {
+            ASSERT_EQ(batch.Put(Key(i), "v" + Key(i)), MBError::SUCCESS);
+            expected[Key(i)] = "v" + Key(i);
+        }
+        ASSERT_EQ(db->Write(batch), MBError::SUCCESS);
+        EXPECT_EQ(batch.Skipped(), 0u);
+
+        DB* reader = OpenDB(CONSTS::ReaderOptions() | options);
+        ASSERT_TRUE(reader->is_open());
+        Check(reader, expected, num);
+
+        // Overwrite some keys, add the odd ones and remove every third.
+        batch.Clear();
+        for (int i = 0; i < num; i++) {
+            if (i % 3 == 0) {
+                ASSERT_EQ(batch.Remove(Key(i)), MBError::SUCCESS);
+                expected.erase(Key(i));
+            } else if (i % 2 == 1 || i % 5 == 0) {
+                std::string value(1 + i % 200, 'a' + i % 26);
+                ASSERT_EQ(batch.Put(Key(i), value), MBError::SUCCESS);
+                expected[Key(i)] = value;
+            }
+        }
+        ASSERT_EQ(db->Write(batch, true), MBError::SUCCESS);
+        // Removals of the odd multiples of three find nothing.
+        EXPECT_EQ(batch.Skipped(), (size_t)num / 6);
+        Check(reader, expected, num);
+
+        db->CollectResource(1, 1);
+        Check(reader, expected, num);
+        reader->Close();
+        delete reader;
+    }
+
+protected:
+    DB* db;
+};
+
+TEST_F(WriteBatchTest, InvalidEntries)
+{
+    WriteBatch batch;
+    EXPECT_EQ(batch.Put(nullptr, 1, "v", 1), MBError::INVALID_ARG);
+    EXPECT_EQ(batch.Put("", ""), MBError::OUT_OF_BOUND);
+    EXPECT_EQ(batch.Put(std::string(CONSTS::MAX_KEY_LENGHTH + 1, 'k'), "v"), MBError::OUT_OF_BOUND);
+    EXPECT_EQ(batch.Remove(""), MBError::OUT_OF_BOUND);
+    EXPECT_EQ(batch.Size(), 0u);
+}
+
+TEST_F(WriteBatchTest, LastEntryWins)
+{
+    db = OpenDB(CONSTS::WriterOptions());
+    ASSERT_TRUE(db->is_open());
+    ASSERT_EQ(db->Add("b", "old"), MBError::SUCCESS);
+
+    WriteBatch batch;
+    batch.Put("c", "1");
+    batch.Put("a", "1");
+    batch.Remove("c");
+    batch.Put("b", "new");
+    batch.Put("a", "2");
+    batch.Put("ab", "3");
+    EXPECT_EQ(batch.Size(), 6u);
+    ASSERT_EQ(db->Write(batch), MBError::SUCCESS);
+    EXPECT_EQ(batch.Size(), 4u);
+    // "b" exists and "c" was never added.
+    EXPECT_EQ(batch.Skipped(), 2u);
+
+    std::map<std::string, std::string> expected = { { "a", "2" }, { "ab", "3" }, { "b", "old" } };
+    MBData mbd;
+    for (auto& kv : expected) {
+        ASSERT_EQ(db->Find(kv.first, mbd), MBError::SUCCESS) << kv.first;
+        EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), kv.second);
+    }
+    EXPECT_EQ(db->Find("c", mbd), MBError::NOT_EXIST);
+    EXPECT_EQ(db->Count(), 3);
+
+    batch.Clear();
+    batch.Put("b", "new");
+    ASSERT_EQ(db->Write(batch, true), MBError::SUCCESS);
+    EXPECT_EQ(batch.Skipped(), 0u);
+    ASSERT_EQ(db->Find("b", mbd), MBError::SUCCESS);
+    EXPECT_EQ(std::string((const char*)mbd.buff, mbd.data_len), "new");
+    EXPECT_EQ(db->Count(), 3);
+}
+
+TEST_F(WriteBatchTest, PutsAndRemoves)
+{
+    PutsAndRemoves(0);
+}
+
+TEST_F(WriteBatchTest, PutsAndRemovesWithIndexes)
+{
+    PutsAndRemoves(CONSTS::OPTION_HASH_INDEX | CONSTS::OPTION_SUBTREE_COUNT | CONSTS::OPTION_BLOOM_FILTER);
+    int64_t count = 0;
+    ASSERT_EQ(db->CountPrefix("write-batch-test-", count), MBError::SUCCESS);
+    EXPECT_EQ(count, db->Count());
+    EXPECT_FALSE(db->GetDictPtr()->SubtreeCountStale());
+}
+
+} // namespace
@@ -20,6 +20,11 @@
 #include "../error.h"
 #include "../logger.h"
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
 
 namespace mabain {
 
@@ -81,4 +86,21 @@ int InitShmMutex(pthread_mutex_t* mutex)
     return MBError::SUCCESS;
 }
 
+#ifdef __linux__
+// Not FUTEX_PRIVATE_FLAG: the word is mapped by other processes.
+void ShmFutexWait(std::atomic<uint32_t>* word, uint32_t val, int timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    // Returns early with EAGAIN if the word changed, EINTR or ETIMEDOUT.
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+void ShmFutexWake(std::atomic<uint32_t>* word, int num)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, num, NULL, NULL, 0);
+}
+#endif
+
 }
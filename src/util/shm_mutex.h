@@ -19,6 +19,8 @@
 #ifndef __SHM_MUTEX_H__
 #define __SHM_MUTEX_H__
 
+#include <atomic>
+#include <cstdint>
 #include <pthread.h>
 
 namespace mabain {
@@ -28,6 +30,14 @@ int InitShmRWLock(pthread_rwlock_t* lock);
 int InitShmCond(pthread_cond_t* cond);
 int ShmMutexLock(pthread_mutex_t& mutex);
 
+#ifdef __linux__
+// Futex on a word in shared memory, usable across processes. ShmFutexWait
+// sleeps while the word holds val, for at most timeout milliseconds.
+// ShmFutexWake wakes up to num waiters.
+void ShmFutexWait(std::atomic<uint32_t>* word, uint32_t val, int timeout);
+void ShmFutexWake(std::atomic<uint32_t>* word, int num);
+#endif
+
 #ifdef __APPLE__
 int pthread_mutex_timedlock(pthread_mutex_t* mutex, const struct timespec* abs_timeout);
 #endif
@@ -0,0 +1,102 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string.h>
+
+#include "error.h"
+#include "mabain_consts.h"
+#include "write_batch.h"
+
+namespace mabain {
+
+WriteBatch::WriteBatch()
+    : skipped(0)
+{
+}
+
+int WriteBatch::Put(const char* key, int len, const char* value, int value_len)
+{
+    if (key == NULL || value == NULL)
+        return MBError::INVALID_ARG;
+    if (len <= 0 || len > CONSTS::MAX_KEY_LENGHTH || value_len <= 0 || value_len > CONSTS::MAX_DATA_SIZE)
+        return MBError::OUT_OF_BOUND;
+
+    AddEntry(key, len, value_len);
+    buffer.insert(buffer.end(), value, value + value_len);
+    return MBError::SUCCESS;
+}
+
+int WriteBatch::Put(const std::string& key, const std::string& value)
+{
+    return Put(key.data(), key.size(), value.data(), value.size());
+}
+
+int WriteBatch::Remove(const char* key, int len)
+{
+    if (key == NULL)
+        return MBError::INVALID_ARG;
+    if (len <= 0 || len > CONSTS::MAX_KEY_LENGHTH)
+        return MBError::OUT_OF_BOUND;
+
+    AddEntry(key, len, -1);
+    return MBError::SUCCESS;
+}
+
+int WriteBatch::Remove(const std::string& key)
+{
+    return Remove(key.data(), key.size());
+}
+
+void WriteBatch::AddEntry(const char* key, int len, int value_len)
+{
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8; i++)
+        prefix = (prefix << 8) | (i < len ? static_cast<uint8_t>(key[i]) : 0);
+    entries.push_back({ prefix, buffer.size(), len, value_len });
+    buffer.insert(buffer.end(), key, key + len);
+}
+
+void WriteBatch::Clear()
+{
+    buffer.clear();
+    entries.clear();
+    skipped = 0;
+}
+
+void WriteBatch::Sort()
+{
+    auto less = [this](const Entry& a, const Entry& b) {
+        if (a.prefix != b.prefix)
+            return a.prefix < b.prefix;
+        int cmp = memcmp(Key(a), Key(b), std::min(a.key_len, b.key_len));
+        return cmp < 0 || (cmp == 0 && a.key_len < b.key_len);
+    };
+    // Feeds are often already in key order.
+    if (!std::is_sorted(entries.begin(), entries.end(), less))
+        std::stable_sort(entries.begin(), entries.end(), less);
+
+    // Stable order puts the last entry of a key at the end of its run.
+    size_t out = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (i + 1 < entries.size() && !less(entries[i], entries[i + 1]))
+            continue;
+        entries[out++] = entries[i];
+    }
+    entries.resize(out);
+}
+
+}
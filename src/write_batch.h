@@ -0,0 +1,70 @@
+/**
+ * Copyright (C) 2025 Cisco Inc.
+ *
+ * This program is free software: you can redistribute it and/or  modify
+ * it under the terms of the GNU General Public License, version 2,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WRITE_BATCH_H__
+#define __WRITE_BATCH_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace mabain {
+
+// Puts and removals applied together by DB::Write. Keys and values are
+// copied into one buffer owned by the batch; the batch can be reused after
+// Clear.
+class WriteBatch {
+public:
+    WriteBatch();
+
+    // Return MBError::OUT_OF_BOUND for empty or oversized keys and values.
+    int Put(const char* key, int len, const char* value, int value_len);
+    int Put(const std::string& key, const std::string& value);
+    int Remove(const char* key, int len);
+    int Remove(const std::string& key);
+    void Clear();
+
+    size_t Size() const { return entries.size(); }
+    // Entries of the last DB::Write that were left as they were: puts of
+    // existing keys without overwrite and removals of missing keys.
+    size_t Skipped() const { return skipped; }
+
+private:
+    friend class Dict;
+    friend class DB;
+    friend class ShardedDB;
+
+    struct Entry {
+        uint64_t prefix; // first eight key bytes, big-endian, for sorting
+        size_t offset; // of the key in buffer; the value follows the key
+        int key_len;
+        int value_len; // -1 for a removal
+    };
+
+    const uint8_t* Key(const Entry& entry) const { return buffer.data() + entry.offset; }
+    const uint8_t* Value(const Entry& entry) const { return buffer.data() + entry.offset + entry.key_len; }
+    void AddEntry(const char* key, int len, int value_len);
+    // Order the entries by key, keeping only the last entry of each key.
+    void Sort();
+
+    std::vector<uint8_t> buffer;
+    std::vector<Entry> entries;
+    size_t skipped;
+};
+
+}
+
+#endif